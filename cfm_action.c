@@ -0,0 +1,443 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_bridge.h>
+#include <linux/rtnetlink.h>
+
+#include "libnetlink.h"
+#include "cfm_hist.h"
+#include "cfm_state.h"
+#include "cfm_action.h"
+
+/* Netlink requests run when a peer MEP goes into or out of CCM defect.
+ * Every request is built when the action file is read, and is sent as is
+ * on a socket of its own, so running the actions of a transition is one
+ * sendmsg() and the wait for the ACKs. Actions are sorted by bridge and
+ * instance, and then by their line in the file, which is the order they
+ * run in.
+ */
+
+#define ACTION_LINE_ARGS	32
+
+struct action_msg {
+	struct nlmsghdr n;
+	union {
+		struct ifinfomsg ifm;
+		struct rtmsg rtm;
+	};
+	char buf[256];
+};
+
+struct cfm_action {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t peer;		/* MEPID or CFM_ACTION_ANY_PEER */
+	bool defect;		/* Run on defect, else on defect clear */
+	int line;
+	char desc[64];
+	uint64_t runs;
+	uint64_t errors;
+	struct action_msg msg;
+};
+
+static struct cfm_action *actions;
+static uint32_t action_count;
+static struct rtnl_handle action_rth = { .fd = -1 };
+
+static struct cfm_hist action_latency;
+static uint64_t action_batches;
+static uint64_t action_dropped;	/* Over CFM_ACTION_BATCH_MAX in one transition */
+
+static const char *const port_states[] = {
+	[BR_STATE_DISABLED] = "disabled",
+	[BR_STATE_LISTENING] = "listening",
+	[BR_STATE_LEARNING] = "learning",
+	[BR_STATE_FORWARDING] = "forwarding",
+	[BR_STATE_BLOCKING] = "blocking",
+};
+
+static void action_port_fill(struct action_msg *m, uint32_t ifindex, int attr, uint8_t state)
+{
+	struct rtattr *protinfo;
+
+	m->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	m->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	m->n.nlmsg_type = RTM_SETLINK;
+	m->ifm.ifi_family = PF_BRIDGE;
+	m->ifm.ifi_index = ifindex;
+
+	protinfo = addattr_nest(&m->n, sizeof(*m), IFLA_PROTINFO | NLA_F_NESTED);
+	if (attr == IFLA_BRPORT_STATE)
+		addattr8(&m->n, sizeof(*m), IFLA_BRPORT_STATE, state);
+	else
+		addattr_l(&m->n, sizeof(*m), IFLA_BRPORT_FLUSH, NULL, 0);
+	addattr_nest_end(&m->n, protinfo);
+}
+
+/* route-add|route-del <prefix>[/<len>] [via <gw>] dev <dev> metric <n> [table <id>] */
+static int action_route_fill(struct action_msg *m, bool add, int argc, char **argv, int line)
+{
+	unsigned char dst[16], gw[16];
+	char prefix[INET6_ADDRSTRLEN + 4], *slash;
+	bool has_gw = false;
+	uint32_t table = RT_TABLE_MAIN;
+	int family, bits, a;
+
+	if (argc < 1) {
+		fprintf(stderr, "Action line %d: route without prefix\n", line);
+		return -1;
+	}
+
+	strncpy(prefix, argv[0], sizeof(prefix) - 1);
+	prefix[sizeof(prefix) - 1] = '\0';
+	if (!strcmp(prefix, "default"))
+		strcpy(prefix, "0.0.0.0/0");
+	family = strchr(prefix, ':') ? AF_INET6 : AF_INET;
+	bits = family == AF_INET6 ? 128 : 32;
+	slash = strchr(prefix, '/');
+	if (slash) {
+		*slash = '\0';
+		if (atoi(slash + 1) < 0 || atoi(slash + 1) > bits)
+			goto bad;
+		bits = atoi(slash + 1);
+	}
+	if (inet_pton(family, prefix, dst) != 1)
+		goto bad;
+
+	m->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	m->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (add)
+		m->n.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+	m->n.nlmsg_type = add ? RTM_NEWROUTE : RTM_DELROUTE;
+	m->rtm.rtm_family = family;
+	m->rtm.rtm_dst_len = bits;
+	m->rtm.rtm_protocol = RTPROT_STATIC;
+	m->rtm.rtm_type = RTN_UNICAST;
+	addattr_l(&m->n, sizeof(*m), RTA_DST, dst, family == AF_INET6 ? 16 : 4);
+
+	for (a = 1; a + 1 < argc; a += 2) {
+		if (!strcmp(argv[a], "via")) {
+			if (inet_pton(family, argv[a + 1], gw) != 1)
+				goto bad;
+			addattr_l(&m->n, sizeof(*m), RTA_GATEWAY, gw, family == AF_INET6 ? 16 : 4);
+			has_gw = true;
+		} else if (!strcmp(argv[a], "dev")) {
+			if (!if_nametoindex(argv[a + 1]))
+				goto bad;
+			addattr32(&m->n, sizeof(*m), RTA_OIF, if_nametoindex(argv[a + 1]));
+		} else if (!strcmp(argv[a], "metric")) {
+			addattr32(&m->n, sizeof(*m), RTA_PRIORITY, strtoul(argv[a + 1], NULL, 0));
+		} else if (!strcmp(argv[a], "table")) {
+			table = strtoul(argv[a + 1], NULL, 0);
+		} else {
+			goto bad;
+		}
+	}
+	if (a != argc)
+		goto bad;
+
+	if (table < 256) {
+		m->rtm.rtm_table = table;
+	} else {
+		m->rtm.rtm_table = RT_TABLE_UNSPEC;
+		addattr32(&m->n, sizeof(*m), RTA_TABLE, table);
+	}
+	if (!add)
+		m->rtm.rtm_scope = RT_SCOPE_NOWHERE;
+	else
+		m->rtm.rtm_scope = has_gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+
+	return 0;
+
+bad:
+	fprintf(stderr, "Action line %d: invalid route\n", line);
+	return -1;
+}
+
+/* <bridge> <instance> <peer-mepid|any> defect|clear <action> [args]
+ *   port-state <port> disabled|listening|learning|forwarding|blocking
+ *   flush <port>
+ *   route-add|route-del <prefix>[/<len>] [via <gw>] dev <dev> metric <n> [table <id>]
+ */
+static int action_parse(struct cfm_action *a, int argc, char **argv, int line)
+{
+	uint32_t ifindex;
+	int i, len;
+
+	memset(a, 0, sizeof(*a));
+	a->line = line;
+
+	if (argc < 6) {
+		fprintf(stderr, "Action line %d: too few arguments\n", line);
+		return -1;
+	}
+
+	a->br_ifindex = if_nametoindex(argv[0]);
+	if (!a->br_ifindex) {
+		fprintf(stderr, "Action line %d: unknown bridge %s\n", line, argv[0]);
+		return -1;
+	}
+	a->instance = atoi(argv[1]);
+	a->peer = strcmp(argv[2], "any") ? (uint32_t)atoi(argv[2]) : CFM_ACTION_ANY_PEER;
+	if (strcmp(argv[3], "defect") && strcmp(argv[3], "clear")) {
+		fprintf(stderr, "Action line %d: expected defect or clear\n", line);
+		return -1;
+	}
+	a->defect = !strcmp(argv[3], "defect");
+
+	for (i = 4, len = 0; i < argc && len < (int)sizeof(a->desc); ++i)
+		len += snprintf(a->desc + len, sizeof(a->desc) - len, "%s%s",
+				i > 4 ? " " : "", argv[i]);
+
+	if (!strcmp(argv[4], "route-add") || !strcmp(argv[4], "route-del"))
+		return action_route_fill(&a->msg, !strcmp(argv[4], "route-add"),
+					 argc - 5, argv + 5, line);
+
+	ifindex = if_nametoindex(argv[5]);
+	if (!ifindex) {
+		fprintf(stderr, "Action line %d: unknown port %s\n", line, argv[5]);
+		return -1;
+	}
+
+	if (!strcmp(argv[4], "flush") && argc == 6) {
+		action_port_fill(&a->msg, ifindex, IFLA_BRPORT_FLUSH, 0);
+		return 0;
+	}
+
+	if (!strcmp(argv[4], "port-state") && argc == 7) {
+		for (i = 0; i <= BR_STATE_BLOCKING; ++i) {
+			if (strcmp(argv[6], port_states[i]))
+				continue;
+			action_port_fill(&a->msg, ifindex, IFLA_BRPORT_STATE, i);
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "Action line %d: invalid action %s\n", line, a->desc);
+	return -1;
+}
+
+static int action_cmp(const void *pa, const void *pb)
+{
+	const struct cfm_action *a = pa, *b = pb;
+
+	if (a->br_ifindex != b->br_ifindex)
+		return a->br_ifindex < b->br_ifindex ? -1 : 1;
+	if (a->instance != b->instance)
+		return a->instance < b->instance ? -1 : 1;
+	return a->line - b->line;
+}
+
+static int action_file_read(const char *file)
+{
+	char buf[1024], *argv[ACTION_LINE_ARGS], *tok, *save;
+	struct cfm_action *tmp;
+	uint32_t size = 0;
+	int argc, line = 0, err = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	while (!err && fgets(buf, sizeof(buf), fp)) {
+		line++;
+		if (strchr(buf, '#'))
+			*strchr(buf, '#') = '\0';
+
+		argc = 0;
+		for (tok = strtok_r(buf, " \t\r\n", &save); tok && argc < ACTION_LINE_ARGS;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			argv[argc++] = tok;
+		if (!argc)
+			continue;
+
+		if (action_count == size) {
+			tmp = realloc(actions, (size ? 2 * size : 16) * sizeof(*actions));
+			if (!tmp) {
+				err = -1;
+				break;
+			}
+			actions = tmp;
+			size = size ? 2 * size : 16;
+		}
+		err = action_parse(&actions[action_count], argc, argv, line);
+		if (!err)
+			action_count++;
+	}
+	fclose(fp);
+
+	if (!err)
+		qsort(actions, action_count, sizeof(*actions), action_cmp);
+
+	return err;
+}
+
+static void action_alarm(const struct cfm_action *a, uint32_t mepid, int err)
+{
+	printf("EVENT CFM action:\n");
+	printf("Bridge %u instance %u peer %u\n", a->br_ifindex, a->instance, mepid);
+	printf("    line %d %s failed: %s\n", a->line, a->desc, strerror(-err));
+	printf("\n");
+	fflush(stdout);
+}
+
+/* First action of the MEP, or action_count */
+static uint32_t action_first(uint32_t br_ifindex, uint32_t instance)
+{
+	uint32_t lo = 0, hi = action_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (actions[mid].br_ifindex < br_ifindex ||
+		    (actions[mid].br_ifindex == br_ifindex && actions[mid].instance < instance))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void cfm_action_peer(uint32_t br_ifindex, uint32_t instance, uint32_t mepid, bool defect,
+		     uint64_t event_ts)
+{
+	struct cfm_action *run[CFM_ACTION_BATCH_MAX];
+	bool done[CFM_ACTION_BATCH_MAX] = { false };
+	struct iovec iov[CFM_ACTION_BATCH_MAX];
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+	};
+	unsigned int count = 0, acked = 0, i;
+	struct nlmsgerr *nlerr;
+	struct nlmsghdr *h;
+	struct cfm_action *a;
+	char buf[8192];
+	uint32_t first;
+	int len, err = 0;
+
+	first = action_rth.seq + 1;
+	for (i = action_first(br_ifindex, instance); i < action_count; ++i) {
+		a = &actions[i];
+		if (a->br_ifindex != br_ifindex || a->instance != instance)
+			break;
+		if (a->defect != defect || (a->peer != CFM_ACTION_ANY_PEER && a->peer != mepid))
+			continue;
+		if (count == CFM_ACTION_BATCH_MAX) {
+			action_dropped++;
+			continue;
+		}
+		a->msg.n.nlmsg_seq = ++action_rth.seq;
+		iov[count].iov_base = &a->msg.n;
+		iov[count].iov_len = a->msg.n.nlmsg_len;
+		run[count++] = a;
+	}
+	if (!count)
+		return;
+
+	msg.msg_iovlen = count;
+	if (sendmsg(action_rth.fd, &msg, 0) < 0) {
+		for (i = 0; i < count; ++i) {
+			run[i]->errors++;
+			action_alarm(run[i], mepid, -errno);
+		}
+		return;
+	}
+
+	while (acked < count) {
+		len = recv(action_rth.fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			if (h->nlmsg_type != NLMSG_ERROR || h->nlmsg_seq - first >= count ||
+			    h->nlmsg_len < NLMSG_LENGTH(sizeof(*nlerr)) ||
+			    done[h->nlmsg_seq - first])
+				continue;
+
+			nlerr = NLMSG_DATA(h);
+			a = run[h->nlmsg_seq - first];
+			done[h->nlmsg_seq - first] = true;
+			a->runs++;
+			if (nlerr->error) {
+				a->errors++;
+				action_alarm(a, mepid, nlerr->error);
+			}
+			acked++;
+		}
+	}
+
+	/* The ACKs of the rest are lost with the socket error */
+	for (i = 0; err && i < count; ++i) {
+		if (done[i])
+			continue;
+		run[i]->errors++;
+		action_alarm(run[i], mepid, err);
+	}
+
+	action_batches++;
+	cfm_hist_add(&action_latency, cfm_state_now() - event_ts);
+}
+
+int cfm_action_init(const char *file)
+{
+	if (action_file_read(file))
+		return -1;
+
+	if (rtnl_open(&action_rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink for actions\n");
+		return -1;
+	}
+
+	cfm_hist_init(&action_latency);
+
+	return 0;
+}
+
+void cfm_action_uninit(void)
+{
+	if (action_rth.fd >= 0)
+		rtnl_close(&action_rth);
+	action_rth.fd = -1;
+	free(actions);
+	actions = NULL;
+	action_count = 0;
+}
+
+void cfm_action_stats_print(FILE *fp)
+{
+	const struct cfm_action *a;
+	uint32_t i;
+
+	fprintf(fp, "Defect actions\n");
+	cfm_hist_print(fp, "Event to action ACK", &action_latency);
+	fprintf(fp, "    Transitions %" PRIu64 ", dropped actions %" PRIu64 "\n",
+		action_batches, action_dropped);
+	for (i = 0; i < action_count; ++i) {
+		a = &actions[i];
+		fprintf(fp, "    Line %d bridge %u instance %u peer ", a->line, a->br_ifindex,
+			a->instance);
+		if (a->peer == CFM_ACTION_ANY_PEER)
+			fprintf(fp, "any");
+		else
+			fprintf(fp, "%u", a->peer);
+		fprintf(fp, " %s %s: runs %" PRIu64 " errors %" PRIu64 "\n",
+			a->defect ? "defect" : "clear", a->desc, a->runs, a->errors);
+	}
+	fprintf(fp, "\n");
+}
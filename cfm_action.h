@@ -0,0 +1,23 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_ACTION_H
+#define CFM_ACTION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Actions run by one peer transition, more are dropped */
+#define CFM_ACTION_BATCH_MAX	32
+
+/* Peer MEPID of rules matching any peer of the MEP */
+#define CFM_ACTION_ANY_PEER	0xFFFFFFFF
+
+int cfm_action_init(const char *file);
+void cfm_action_uninit(void);
+void cfm_action_peer(uint32_t br_ifindex, uint32_t instance, uint32_t mepid, bool defect,
+		     uint64_t event_ts);
+void cfm_action_stats_print(FILE *fp);
+
+#endif
@@ -0,0 +1,232 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <net/if.h>
+
+#include "cfm_ctl.h"
+#include "cfm_state.h"
+#include "cfm_avail.h"
+
+/* The defect state only changes on events, so the seconds between two
+ * events are all of one kind and are accounted together when the next
+ * event, or a query, comes. Nothing runs per second.
+ *
+ * The seconds of a run towards the other state are only accounted when
+ * the run ends, to the state they turn out to belong to.
+ */
+
+#define AVAIL_NSEC	1000000000ULL
+
+static uint32_t window;
+static uint64_t updates;
+
+static void avail_account(struct cfm_avail *a, bool bad, uint64_t secs)
+{
+	uint64_t take;
+
+	if (!secs)
+		return;
+
+	if (bad != a->unavailable) {
+		take = secs < window - a->run ? secs : window - a->run;
+		a->run += take;
+		secs -= take;
+		if (a->run < window)
+			return;
+
+		a->unavailable = bad;
+		a->periods += bad;
+	}
+
+	/* A run that ends here belongs to the state it ends in */
+	secs += a->run;
+	a->run = 0;
+	if (a->unavailable)
+		a->unavailable_secs += secs;
+	else
+		a->available_secs += secs;
+}
+
+/* Account the seconds before 'now', all in state 'defect' since the last */
+static void avail_advance(struct cfm_avail *a, bool defect, uint64_t now)
+{
+	uint64_t second = now / AVAIL_NSEC;
+
+	if (!a->start) {
+		a->start = now;
+		a->second = second;
+		a->bad = defect;
+		return;
+	}
+	if (second <= a->second)
+		return;
+
+	avail_account(a, a->bad, 1);
+	avail_account(a, defect, second - a->second - 1);
+	a->second = second;
+	a->bad = defect;
+}
+
+static void avail_update(struct cfm_avail *a, bool before, bool after, uint64_t now)
+{
+	avail_advance(a, before, now);
+	a->bad |= after;
+}
+
+/* Called after the defect of the peer changed */
+void cfm_avail_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	bool mep_before = mep->defect_count + (peer->defect ? -1 : 1) > 0;
+
+	avail_update(&peer->avail, !peer->defect, peer->defect, now);
+	avail_update(&mep->avail, mep_before, mep->defect_count > 0, now);
+	updates++;
+}
+
+/* 'a' brought up to 'now' without changing the state kept */
+static struct cfm_avail avail_view(const struct cfm_avail *a, bool defect, uint64_t now)
+{
+	struct cfm_avail v = *a;
+
+	avail_advance(&v, defect, now);
+	return v;
+}
+
+static void avail_print(struct cfm_ctl_client *client, const struct cfm_avail *a, uint64_t now)
+{
+	uint64_t total = a->available_secs + a->unavailable_secs;
+	uint64_t tracked = (now - a->start) / AVAIL_NSEC;
+
+	cfm_ctl_printf(client, "\"available\":%s,\"available_s\":%" PRIu64 ",\"unavailable_s\":%"
+		       PRIu64 ",\"pending_s\":%u,\"periods\":%" PRIu64 ",\"tracked_s\":%" PRIu64
+		       ",\"availability\":%.4f",
+		       a->unavailable ? "false" : "true", a->available_secs, a->unavailable_secs,
+		       a->run, a->periods, tracked,
+		       total ? 100.0 * a->available_secs / total : 100.0);
+}
+
+/* availability [netns <nsid>] bridge <bridge> instance <instance> [peer <mepid>] */
+static void avail_cmd(struct cfm_ctl_client *client, int argc, char **argv)
+{
+	uint32_t br_ifindex = 0, instance = 0, mepid = 0, i;
+	uint64_t now = cfm_state_now();
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	struct cfm_avail v;
+	bool sep = false;
+	int a, nsid = -1;
+
+	for (a = 1; a + 1 < argc; a += 2) {
+		if (!strcmp(argv[a], "netns")) {
+			nsid = atoi(argv[a + 1]);
+		} else if (!strcmp(argv[a], "bridge")) {
+			br_ifindex = if_nametoindex(argv[a + 1]);
+			if (!br_ifindex)
+				br_ifindex = strtoul(argv[a + 1], NULL, 10);
+		} else if (!strcmp(argv[a], "instance")) {
+			instance = strtoul(argv[a + 1], NULL, 10);
+		} else if (!strcmp(argv[a], "peer")) {
+			mepid = strtoul(argv[a + 1], NULL, 10);
+		} else {
+			break;
+		}
+	}
+	if (a != argc || !br_ifindex) {
+		cfm_ctl_error(client, "invalid arguments");
+		return;
+	}
+
+	mep = cfm_state_mep_find(nsid, br_ifindex, instance);
+	if (!mep || (mepid && !cfm_state_peer_find(mep, mepid))) {
+		cfm_ctl_error(client, "no such MEP or peer");
+		return;
+	}
+
+	cfm_ctl_printf(client, "{\"netns\":%d,\"bridge\":%u,\"instance\":%u,\"window_s\":%u,",
+		       nsid, br_ifindex, instance, window);
+	v = avail_view(&mep->avail, mep->defect_count > 0, now);
+	avail_print(client, &v, now);
+	cfm_ctl_printf(client, ",\"peers\":[");
+	for (i = 0; i < mep->peer_count; ++i) {
+		peer = &mep->peers[i];
+		if (mepid && peer->mepid != mepid)
+			continue;
+		cfm_ctl_printf(client, "%s{\"peer\":%u,", sep ? "," : "", peer->mepid);
+		v = avail_view(&peer->avail, peer->defect, now);
+		avail_print(client, &v, now);
+		cfm_ctl_printf(client, "}");
+		sep = true;
+	}
+	cfm_ctl_printf(client, "]}");
+}
+
+static void avail_mep_start(struct cfm_mep_state *mep, void *arg)
+{
+	uint64_t now = *(uint64_t *)arg;
+	uint32_t i;
+
+	avail_advance(&mep->avail, mep->defect_count > 0, now);
+	for (i = 0; i < mep->peer_count; ++i)
+		avail_advance(&mep->peers[i].avail, mep->peers[i].defect, now);
+}
+
+int cfm_avail_init(uint32_t win)
+{
+	uint64_t now = cfm_state_now();
+
+	window = win ? win : CFM_AVAIL_WINDOW;
+
+	/* Peers known from the start are tracked from now, later ones from
+	 * their first change
+	 */
+	cfm_state_for_each(avail_mep_start, &now);
+
+	return cfm_ctl_register("availability", avail_cmd);
+}
+
+void cfm_avail_uninit(void)
+{
+	window = 0;
+	updates = 0;
+}
+
+struct avail_stats {
+	uint64_t now;
+	uint32_t meps;
+	uint32_t meps_unavailable;
+	uint32_t peers;
+	uint32_t peers_unavailable;
+	uint64_t periods;
+};
+
+static void avail_mep_stats(struct cfm_mep_state *mep, void *arg)
+{
+	struct avail_stats *s = arg;
+	struct cfm_avail v;
+	uint32_t i;
+
+	v = avail_view(&mep->avail, mep->defect_count > 0, s->now);
+	s->meps++;
+	s->meps_unavailable += v.unavailable;
+	for (i = 0; i < mep->peer_count; ++i) {
+		v = avail_view(&mep->peers[i].avail, mep->peers[i].defect, s->now);
+		s->peers++;
+		s->peers_unavailable += v.unavailable;
+		s->periods += v.periods;
+	}
+}
+
+void cfm_avail_stats_print(FILE *fp)
+{
+	struct avail_stats s = { .now = cfm_state_now() };
+
+	cfm_state_for_each(avail_mep_stats, &s);
+	fprintf(fp, "Availability, window %u s\n", window);
+	fprintf(fp, "    MEPs unavailable %u of %u, peers unavailable %u of %u\n",
+		s.meps_unavailable, s.meps, s.peers_unavailable, s.peers);
+	fprintf(fp, "    Peer unavailable periods %" PRIu64 " updates %" PRIu64 "\n\n",
+		s.periods, updates);
+}
@@ -0,0 +1,38 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_AVAIL_H
+#define CFM_AVAIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Availability of every peer MEP, and of every MEP, in the style of
+ * Y.1563 and G.826. A second is unavailable-like if the peer was in CCM
+ * defect at any time in it; a MEP if any of its peers was. The entity
+ * becomes unavailable at the start of 'window' such seconds in a row, and
+ * available again at the start of 'window' other seconds in a row.
+ */
+#define CFM_AVAIL_WINDOW	10	/* Seconds, default */
+
+struct cfm_avail {
+	uint64_t start;		/* ns, CLOCK_MONOTONIC, 0 - not tracked */
+	uint64_t second;	/* First second not yet accounted */
+	bool bad;		/* In defect at some time in 'second' */
+	bool unavailable;
+	uint32_t run;		/* Seconds in a row that count for the other state */
+	uint64_t available_secs;
+	uint64_t unavailable_secs;
+	uint64_t periods;	/* Of unavailability */
+};
+
+struct cfm_mep_state;
+struct cfm_peer_state;
+
+int cfm_avail_init(uint32_t window);
+void cfm_avail_uninit(void);
+void cfm_avail_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now);
+void cfm_avail_stats_print(FILE *fp);
+
+#endif
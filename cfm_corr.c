@@ -0,0 +1,310 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <ev.h>
+#include <net/if.h>
+
+#include "cfm_ctl.h"
+#include "cfm_state.h"
+#include "cfm_corr.h"
+
+/* Open alarms are hashed by (namespace, bridge, port). A peer remembers the
+ * alarm it joined and its member index, so a defect or a clear is one hash
+ * lookup. All alarms collect for the same window, so the collecting ones
+ * are a FIFO and one timer ends the window of its head.
+ */
+
+#define CORR_BUCKETS	4096
+
+static uint32_t window;
+static cfm_corr_alarm_fn_t alarm_fn;
+static ev_timer window_watcher;
+static struct cfm_corr_alarm *buckets[CORR_BUCKETS];
+static struct cfm_corr_alarm *pending_head;
+static struct cfm_corr_alarm *pending_tail;
+static uint32_t alarm_id;
+static uint32_t open_count;
+static uint64_t raised;
+static uint64_t cleared;
+static uint64_t glitches;	/* Cleared before the window ended */
+static uint64_t defects;
+static uint32_t members_max;
+
+static uint64_t corr_window_ns(void)
+{
+	return window * 1000000ULL;
+}
+
+static uint32_t corr_hash(int nsid, uint32_t br_ifindex, uint32_t port_ifindex)
+{
+	uint64_t key = ((uint64_t)br_ifindex << 32 | port_ifindex) ^ (uint32_t)nsid;
+
+	return ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (CORR_BUCKETS - 1);
+}
+
+static struct cfm_corr_alarm *corr_find(int nsid, uint32_t br_ifindex, uint32_t port_ifindex)
+{
+	struct cfm_corr_alarm *a;
+
+	for (a = buckets[corr_hash(nsid, br_ifindex, port_ifindex)]; a; a = a->next)
+		if (a->port_ifindex == port_ifindex && a->br_ifindex == br_ifindex &&
+		    a->nsid == nsid)
+			return a;
+
+	return NULL;
+}
+
+static void corr_free(struct cfm_corr_alarm *alarm)
+{
+	struct cfm_corr_alarm **p;
+
+	p = &buckets[corr_hash(alarm->nsid, alarm->br_ifindex, alarm->port_ifindex)];
+	while (*p != alarm)
+		p = &(*p)->next;
+	*p = alarm->next;
+
+	open_count--;
+	free(alarm->members);
+	free(alarm);
+}
+
+static void corr_timer_arm(uint64_t now)
+{
+	uint64_t end;
+
+	ev_timer_stop(EV_DEFAULT, &window_watcher);
+	if (!pending_head)
+		return;
+
+	end = pending_head->first + corr_window_ns();
+	ev_timer_set(&window_watcher, end > now ? (end - now) / 1e9 : 0, 0);
+	ev_timer_start(EV_DEFAULT, &window_watcher);
+}
+
+static void corr_window_end(EV_P_ ev_timer *w, int revents)
+{
+	uint64_t now = cfm_state_now();
+	struct cfm_corr_alarm *alarm;
+
+	while (pending_head && pending_head->first + corr_window_ns() <= now) {
+		alarm = pending_head;
+		pending_head = alarm->pending;
+		if (!pending_head)
+			pending_tail = NULL;
+
+		if (!alarm->active) {
+			glitches++;
+			corr_free(alarm);
+			continue;
+		}
+		alarm->raised = now;
+		raised++;
+		alarm_fn(alarm, now);
+	}
+
+	corr_timer_arm(now);
+}
+
+static struct cfm_corr_alarm *corr_open(struct cfm_mep_state *mep, uint64_t now)
+{
+	struct cfm_corr_alarm *alarm, **bucket;
+
+	alarm = calloc(1, sizeof(*alarm));
+	if (!alarm)
+		return NULL;
+
+	alarm->id = ++alarm_id;
+	alarm->nsid = mep->nsid;
+	alarm->br_ifindex = mep->br_ifindex;
+	alarm->port_ifindex = mep->port_ifindex;
+	alarm->level = mep->level;
+	alarm->first = now;
+
+	bucket = &buckets[corr_hash(alarm->nsid, alarm->br_ifindex, alarm->port_ifindex)];
+	alarm->next = *bucket;
+	*bucket = alarm;
+	open_count++;
+
+	if (pending_tail) {
+		pending_tail->pending = alarm;
+	} else {
+		pending_head = alarm;
+		corr_timer_arm(now);
+	}
+	pending_tail = alarm;
+
+	return alarm;
+}
+
+static void corr_defect(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	struct cfm_corr_alarm *alarm;
+	struct cfm_corr_member *m;
+	uint32_t size;
+
+	alarm = corr_find(mep->nsid, mep->br_ifindex, mep->port_ifindex);
+	if (!alarm) {
+		alarm = corr_open(mep, now);
+		if (!alarm)
+			return;
+	}
+
+	/* A peer that comes back into defect is the same member */
+	if (peer->corr_id == alarm->id) {
+		m = &alarm->members[peer->corr_member];
+	} else {
+		if (alarm->member_count == alarm->member_size) {
+			size = alarm->member_size ? 2 * alarm->member_size : 8;
+			m = realloc(alarm->members, size * sizeof(*m));
+			if (!m)
+				return;
+			alarm->members = m;
+			alarm->member_size = size;
+		}
+		peer->corr_id = alarm->id;
+		peer->corr_member = alarm->member_count;
+		m = &alarm->members[alarm->member_count++];
+		m->instance = mep->instance;
+		m->mepid = peer->mepid;
+		m->level = mep->level;
+		m->defect = false;
+		if (alarm->member_count > members_max)
+			members_max = alarm->member_count;
+	}
+
+	if (!m->defect) {
+		m->defect = true;
+		alarm->active++;
+	}
+	if (mep->level < alarm->level)
+		alarm->level = mep->level;
+	defects++;
+}
+
+static void corr_clear(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	struct cfm_corr_alarm *alarm;
+	struct cfm_corr_member *m;
+
+	if (!peer->corr_id)
+		return;
+	alarm = corr_find(mep->nsid, mep->br_ifindex, mep->port_ifindex);
+	if (!alarm || alarm->id != peer->corr_id)
+		return;
+
+	m = &alarm->members[peer->corr_member];
+	if (!m->defect)
+		return;
+	m->defect = false;
+	alarm->active--;
+
+	/* A collecting alarm ends with its window */
+	if (!alarm->active && alarm->raised) {
+		cleared++;
+		alarm_fn(alarm, now);
+		corr_free(alarm);
+	}
+}
+
+/* Called after the defect of the peer changed */
+void cfm_corr_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	if (peer->defect)
+		corr_defect(mep, peer, now);
+	else
+		corr_clear(mep, peer, now);
+}
+
+static void corr_alarm_print(struct cfm_ctl_client *client, const struct cfm_corr_alarm *alarm,
+			     bool sep)
+{
+	char port[IF_NAMESIZE];
+	uint32_t i;
+
+	/* Names are only known in our own namespace */
+	if (alarm->nsid >= 0 || !if_indextoname(alarm->port_ifindex, port))
+		snprintf(port, sizeof(port), "%u", alarm->port_ifindex);
+
+	cfm_ctl_printf(client, "%s{\"id\":%u,\"netns\":%d,\"bridge\":%u,\"port\":\"%s\","
+		       "\"level\":%u,\"first\":%" PRIu64 ",\"raised\":%" PRIu64 ",\"active\":%u,"
+		       "\"fields\":[\"instance\",\"peer\",\"level\",\"defect\"],\"members\":[",
+		       sep ? "," : "", alarm->id, alarm->nsid, alarm->br_ifindex, port, alarm->level,
+		       alarm->first, alarm->raised, alarm->active);
+	for (i = 0; i < alarm->member_count; ++i)
+		cfm_ctl_printf(client, "%s[%u,%u,%u,%u]", i ? "," : "", alarm->members[i].instance,
+			       alarm->members[i].mepid, alarm->members[i].level,
+			       alarm->members[i].defect);
+	cfm_ctl_printf(client, "]}");
+}
+
+/* alarms [netns <nsid>] [bridge <bridge>] */
+static void corr_cmd(struct cfm_ctl_client *client, int argc, char **argv)
+{
+	const struct cfm_corr_alarm *alarm;
+	uint32_t br_ifindex = 0, b;
+	bool all_netns = true, sep = false;
+	int i, nsid = -1;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "netns")) {
+			nsid = atoi(argv[i + 1]);
+			all_netns = false;
+		} else if (!strcmp(argv[i], "bridge")) {
+			br_ifindex = if_nametoindex(argv[i + 1]);
+			if (!br_ifindex)
+				br_ifindex = strtoul(argv[i + 1], NULL, 10);
+			all_netns = false;
+		} else {
+			break;
+		}
+	}
+	if (i != argc) {
+		cfm_ctl_error(client, "invalid arguments");
+		return;
+	}
+
+	cfm_ctl_printf(client, "{\"window_ms\":%u,\"alarms\":[", window);
+	for (b = 0; b < CORR_BUCKETS; ++b) {
+		for (alarm = buckets[b]; alarm; alarm = alarm->next) {
+			if (br_ifindex && alarm->br_ifindex != br_ifindex)
+				continue;
+			if (!all_netns && alarm->nsid != nsid)
+				continue;
+			corr_alarm_print(client, alarm, sep);
+			sep = true;
+		}
+	}
+	cfm_ctl_printf(client, "]}");
+}
+
+int cfm_corr_init(uint32_t win, cfm_corr_alarm_fn_t fn)
+{
+	window = win ? win : CFM_CORR_WINDOW;
+	alarm_fn = fn;
+	ev_timer_init(&window_watcher, corr_window_end, 0, 0);
+
+	return cfm_ctl_register("alarms", corr_cmd);
+}
+
+void cfm_corr_uninit(void)
+{
+	uint32_t b;
+
+	ev_timer_stop(EV_DEFAULT, &window_watcher);
+	for (b = 0; b < CORR_BUCKETS; ++b)
+		while (buckets[b])
+			corr_free(buckets[b]);
+	pending_head = NULL;
+	pending_tail = NULL;
+}
+
+void cfm_corr_stats_print(FILE *fp)
+{
+	fprintf(fp, "Correlation, window %u ms\n", window);
+	fprintf(fp, "    Alarms raised %" PRIu64 " cleared %" PRIu64 " open %u, cleared in the window %"
+		PRIu64 "\n", raised, cleared, open_count, glitches);
+	fprintf(fp, "    Defects %" PRIu64 ", largest alarm %u members\n\n", defects, members_max);
+}
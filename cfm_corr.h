@@ -0,0 +1,55 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_CORR_H
+#define CFM_CORR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Correlation of CCM defects into alarms. MEPs on the same port of the same
+ * bridge share a fault below them, so the first defect on a port opens an
+ * alarm that collects the defects of all MEPs on the port during the
+ * window. Then it is raised once, with the lowest MD level among its
+ * members, and cleared once when none of its members is in defect anymore.
+ * Defects on the port while it is raised join it.
+ */
+#define CFM_CORR_WINDOW		50	/* ms, default */
+
+struct cfm_corr_member {
+	uint32_t instance;
+	uint32_t mepid;		/* Peer MEP */
+	uint8_t level;
+	bool defect;
+};
+
+struct cfm_corr_alarm {
+	uint32_t id;
+	int nsid;
+	uint32_t br_ifindex;
+	uint32_t port_ifindex;	/* 0 - the MEP configuration is unknown */
+	uint8_t level;		/* Lowest MD level of the members */
+	uint64_t first;		/* ns, CLOCK_MONOTONIC, of the first defect */
+	uint64_t raised;	/* ns, 0 - still collecting */
+	struct cfm_corr_member *members;
+	uint32_t member_count;
+	uint32_t member_size;
+	uint32_t active;	/* Members in defect, 0 - cleared */
+
+	struct cfm_corr_alarm *next;	/* Port hash chain */
+	struct cfm_corr_alarm *pending;	/* Collecting, in order of 'first' */
+};
+
+struct cfm_mep_state;
+struct cfm_peer_state;
+
+/* Called when an alarm is raised, and when it is cleared */
+typedef void (*cfm_corr_alarm_fn_t)(const struct cfm_corr_alarm *alarm, uint64_t now);
+
+int cfm_corr_init(uint32_t window, cfm_corr_alarm_fn_t fn);
+void cfm_corr_uninit(void);
+void cfm_corr_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now);
+void cfm_corr_stats_print(FILE *fp);
+
+#endif
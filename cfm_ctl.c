@@ -0,0 +1,295 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ev.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cfm_ctl.h"
+
+/* Commands are answered from the event loop, from the state the server
+ * already holds. The answer is buffered and written when the socket is
+ * writable, so a client that does not read only stalls itself.
+ */
+
+#define CTL_LINE_MAX	256
+
+struct cfm_ctl_client {
+	int fd;
+	ev_io read_watcher;
+	ev_io write_watcher;
+	char in[CTL_LINE_MAX];
+	uint32_t in_len;
+	char *out;
+	size_t out_size;
+	size_t out_len;
+	size_t out_off;
+	size_t resp_start;	/* Start of the response being built */
+	bool overflow;
+};
+
+struct ctl_command {
+	const char *name;
+	cfm_ctl_cmd_fn_t fn;
+};
+
+static const char *sock_path;
+static int listen_fd = -1;
+static ev_io listen_watcher;
+static struct cfm_ctl_client *clients[CFM_CTL_CLIENTS_MAX];
+static struct ctl_command commands[CFM_CTL_COMMANDS_MAX];
+static int command_count;
+
+int cfm_ctl_register(const char *name, cfm_ctl_cmd_fn_t fn)
+{
+	if (command_count == CFM_CTL_COMMANDS_MAX)
+		return -1;
+
+	commands[command_count].name = name;
+	commands[command_count].fn = fn;
+	command_count++;
+
+	return 0;
+}
+
+void cfm_ctl_printf(struct cfm_ctl_client *client, const char *fmt, ...)
+{
+	size_t size;
+	va_list ap;
+	char *out;
+	int n;
+
+	if (client->overflow)
+		return;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(client->out + client->out_len, client->out_size - client->out_len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if (client->out_len + n < client->out_size) {
+			client->out_len += n;
+			return;
+		}
+
+		size = client->out_size ? 2 * client->out_size : 4096;
+		while (size <= client->out_len + n)
+			size *= 2;
+		if (size > CFM_CTL_OUT_MAX) {
+			client->overflow = true;
+			return;
+		}
+		out = realloc(client->out, size);
+		if (!out) {
+			client->overflow = true;
+			return;
+		}
+		client->out = out;
+		client->out_size = size;
+	}
+}
+
+void cfm_ctl_error(struct cfm_ctl_client *client, const char *msg)
+{
+	cfm_ctl_printf(client, "{\"error\":\"%s\"}", msg);
+}
+
+static void client_close(struct cfm_ctl_client *client)
+{
+	int i;
+
+	for (i = 0; i < CFM_CTL_CLIENTS_MAX; ++i)
+		if (clients[i] == client)
+			clients[i] = NULL;
+
+	ev_io_stop(EV_DEFAULT, &client->read_watcher);
+	ev_io_stop(EV_DEFAULT, &client->write_watcher);
+	close(client->fd);
+	free(client->out);
+	free(client);
+}
+
+static void client_flush(struct cfm_ctl_client *client)
+{
+	ssize_t n;
+
+	while (client->out_off < client->out_len) {
+		n = send(client->fd, client->out + client->out_off, client->out_len - client->out_off,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ev_io_start(EV_DEFAULT, &client->write_watcher);
+				return;
+			}
+			if (errno == EINTR)
+				continue;
+			client_close(client);
+			return;
+		}
+		client->out_off += n;
+	}
+
+	client->out_off = client->out_len = 0;
+	ev_io_stop(EV_DEFAULT, &client->write_watcher);
+}
+
+static void client_write(EV_P_ ev_io *w, int revents)
+{
+	client_flush(w->data);
+}
+
+static void client_command(struct cfm_ctl_client *client, char *line)
+{
+	char *argv[CFM_CTL_ARGS_MAX], *save;
+	int argc = 0, i;
+
+	for (argv[0] = strtok_r(line, " \t\r", &save); argv[argc] && argc < CFM_CTL_ARGS_MAX - 1;
+	     argv[argc] = strtok_r(NULL, " \t\r", &save))
+		argc++;
+	if (!argc)
+		return;
+
+	client->resp_start = client->out_len;
+	client->overflow = false;
+
+	for (i = 0; i < command_count; ++i)
+		if (!strcmp(commands[i].name, argv[0]))
+			break;
+	if (i == command_count)
+		cfm_ctl_error(client, "unknown command");
+	else
+		commands[i].fn(client, argc, argv);
+
+	if (client->overflow) {
+		client->out_len = client->resp_start;
+		client->overflow = false;
+		cfm_ctl_error(client, "response too large");
+	}
+	cfm_ctl_printf(client, "\n");
+}
+
+static void client_read(EV_P_ ev_io *w, int revents)
+{
+	struct cfm_ctl_client *client = w->data;
+	char *nl;
+	ssize_t n;
+
+	n = recv(client->fd, client->in + client->in_len, sizeof(client->in) - 1 - client->in_len,
+		 MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n <= 0) {
+		client_close(client);
+		return;
+	}
+	client->in_len += n;
+	client->in[client->in_len] = '\0';
+
+	while ((nl = strchr(client->in, '\n'))) {
+		*nl = '\0';
+		client_command(client, client->in);
+		client->in_len -= nl + 1 - client->in;
+		memmove(client->in, nl + 1, client->in_len + 1);
+	}
+
+	if (client->in_len == sizeof(client->in) - 1) {
+		fprintf(stderr, "Control client %d: command too long, disconnected\n", client->fd);
+		client_close(client);
+		return;
+	}
+
+	if (client->out_len && !ev_is_active(&client->write_watcher))
+		client_flush(client);
+}
+
+static void listen_accept(EV_P_ ev_io *w, int revents)
+{
+	struct cfm_ctl_client *client;
+	int fd, i;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < CFM_CTL_CLIENTS_MAX; ++i)
+		if (!clients[i])
+			break;
+	if (i == CFM_CTL_CLIENTS_MAX) {
+		close(fd);
+		return;
+	}
+
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		close(fd);
+		return;
+	}
+	client->fd = fd;
+
+	ev_io_init(&client->read_watcher, client_read, fd, EV_READ);
+	client->read_watcher.data = client;
+	ev_io_init(&client->write_watcher, client_write, fd, EV_WRITE);
+	client->write_watcher.data = client;
+	ev_io_start(EV_DEFAULT, &client->read_watcher);
+
+	clients[i] = client;
+}
+
+int cfm_ctl_init(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listen_fd, CFM_CTL_CLIENTS_MAX)) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+	sock_path = path;
+
+	ev_io_init(&listen_watcher, listen_accept, listen_fd, EV_READ);
+	ev_io_start(EV_DEFAULT, &listen_watcher);
+
+	return 0;
+}
+
+void cfm_ctl_uninit(void)
+{
+	int i;
+
+	if (listen_fd < 0)
+		return;
+
+	for (i = 0; i < CFM_CTL_CLIENTS_MAX; ++i)
+		if (clients[i])
+			client_close(clients[i]);
+
+	ev_io_stop(EV_DEFAULT, &listen_watcher);
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(sock_path);
+}
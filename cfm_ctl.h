@@ -0,0 +1,27 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_CTL_H
+#define CFM_CTL_H
+
+/* Control socket of cfm_server. A client sends one command per line, and
+ * gets one JSON object per line back, in order.
+ */
+
+#define CFM_CTL_CLIENTS_MAX	16
+#define CFM_CTL_COMMANDS_MAX	16
+#define CFM_CTL_ARGS_MAX	32
+#define CFM_CTL_OUT_MAX		(1 << 20)	/* Output pending per client */
+
+struct cfm_ctl_client;
+
+typedef void (*cfm_ctl_cmd_fn_t)(struct cfm_ctl_client *client, int argc, char **argv);
+
+int cfm_ctl_init(const char *path);
+void cfm_ctl_uninit(void);
+int cfm_ctl_register(const char *name, cfm_ctl_cmd_fn_t fn);
+void cfm_ctl_printf(struct cfm_ctl_client *client, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void cfm_ctl_error(struct cfm_ctl_client *client, const char *msg);
+
+#endif
@@ -0,0 +1,293 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <ev.h>
+#include <net/if.h>
+
+#include "cfm_ctl.h"
+#include "cfm_state.h"
+#include "cfm_damp.h"
+
+/* The penalty is only decayed when it is looked at, so a change costs the
+ * same whatever the number of peers. Only suppressed peers and peers with
+ * a clear held are kept in the pending list and checked every tick, and
+ * the tick only runs while the list is not empty.
+ */
+
+struct damp_pending {
+	struct cfm_mep_state *mep;	/* Peers move when others are added */
+	uint32_t mepid;
+};
+
+static struct cfm_damp_config config;
+static cfm_damp_fn_t damp_fn;
+static double half_life_ns;
+static double ceiling;		/* Decays to CFM_DAMP_REUSE in the max suppress time */
+static ev_timer tick_watcher;
+static struct damp_pending *pending;
+static uint32_t pending_count;
+static uint32_t pending_size;
+
+static uint64_t changes;
+static uint64_t damped_changes;
+static uint64_t suppressed_changes;
+static uint64_t suppressions;
+static uint64_t reuses;
+
+static double damp_penalty(const struct cfm_damp *d, uint64_t now)
+{
+	if (now <= d->updated || d->penalty == 0)
+		return d->penalty;
+
+	return d->penalty * exp2(-(double)(now - d->updated) / half_life_ns);
+}
+
+static void damp_decay(struct cfm_damp *d, uint64_t now)
+{
+	d->penalty = damp_penalty(d, now);
+	d->updated = now;
+}
+
+static void damp_set(struct cfm_mep_state *mep, struct cfm_peer_state *peer, bool defect,
+		     uint64_t now)
+{
+	if (peer->damp.defect == defect)
+		return;
+
+	peer->damp.defect = defect;
+	damped_changes++;
+	damp_fn(mep, peer, now);
+}
+
+static void damp_pending_add(struct cfm_mep_state *mep, struct cfm_peer_state *peer)
+{
+	struct damp_pending *p;
+	uint32_t size;
+
+	if (peer->damp.pending)
+		return;
+
+	if (pending_count == pending_size) {
+		size = pending_size ? 2 * pending_size : 64;
+		p = realloc(pending, size * sizeof(*p));
+		if (!p)
+			return;
+		pending = p;
+		pending_size = size;
+	}
+	pending[pending_count].mep = mep;
+	pending[pending_count].mepid = peer->mepid;
+	pending_count++;
+	peer->damp.pending = true;
+
+	if (!ev_is_active(&tick_watcher))
+		ev_timer_start(EV_DEFAULT, &tick_watcher);
+}
+
+/* Pass the clear on once the peer stayed clear for the hold time */
+static void damp_clear(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	uint64_t until = peer->last_change + config.hold * 1000000ULL;
+
+	if (until > now) {
+		peer->damp.hold_until = until;
+		damp_pending_add(mep, peer);
+	} else {
+		peer->damp.hold_until = 0;
+		damp_set(mep, peer, false, now);
+	}
+}
+
+/* Called after the defect of the peer changed */
+void cfm_damp_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	struct cfm_damp *d = &peer->damp;
+	bool defect = d->defect;
+
+	changes++;
+	damp_decay(d, now);
+	if (peer->defect) {
+		d->penalty += CFM_DAMP_PENALTY;
+		if (d->penalty > ceiling)
+			d->penalty = ceiling;
+		if (!d->suppressed && d->penalty >= CFM_DAMP_SUPPRESS) {
+			d->suppressed = true;
+			suppressions++;
+			damp_pending_add(mep, peer);
+		}
+	}
+
+	if (d->suppressed || peer->defect) {
+		d->hold_until = 0;
+		damp_set(mep, peer, true, now);
+	} else {
+		damp_clear(mep, peer, now);
+	}
+
+	if (d->defect == defect) {
+		d->suppressed_changes++;
+		suppressed_changes++;
+	}
+}
+
+static void damp_tick(EV_P_ ev_timer *w, int revents)
+{
+	uint64_t now = cfm_state_now();
+	struct cfm_peer_state *peer;
+	struct cfm_mep_state *mep;
+	struct cfm_damp *d;
+	uint32_t i = 0;
+
+	while (i < pending_count) {
+		mep = pending[i].mep;
+		peer = cfm_state_peer_find(mep, pending[i].mepid);
+		d = &peer->damp;
+
+		if (d->suppressed) {
+			damp_decay(d, now);
+			if (d->penalty < CFM_DAMP_REUSE) {
+				d->suppressed = false;
+				reuses++;
+				if (!peer->defect)
+					damp_clear(mep, peer, now);
+			}
+		} else if (d->hold_until && d->hold_until <= now) {
+			d->hold_until = 0;
+			damp_set(mep, peer, false, now);
+		}
+
+		if (d->suppressed || d->hold_until) {
+			i++;
+			continue;
+		}
+		d->pending = false;
+		pending[i] = pending[--pending_count];
+	}
+
+	if (!pending_count)
+		ev_timer_stop(EV_DEFAULT, &tick_watcher);
+}
+
+static void damp_peer_print(struct cfm_ctl_client *client, const struct cfm_peer_state *peer,
+			    uint64_t now, bool sep)
+{
+	const struct cfm_damp *d = &peer->damp;
+
+	cfm_ctl_printf(client, "%s{\"peer\":%u,\"defect\":%u,\"damped\":%u,\"suppressed\":%s,"
+		       "\"penalty\":%.0f,\"hold_ms\":%" PRIu64 ",\"suppressed_changes\":%" PRIu64 "}",
+		       sep ? "," : "", peer->mepid, peer->defect, d->defect,
+		       d->suppressed ? "true" : "false", damp_penalty(d, now),
+		       d->hold_until > now ? (d->hold_until - now) / 1000000 : 0,
+		       d->suppressed_changes);
+}
+
+/* damping [netns <nsid>] bridge <bridge> instance <instance> [peer <mepid>] */
+static void damp_cmd(struct cfm_ctl_client *client, int argc, char **argv)
+{
+	uint32_t br_ifindex = 0, instance = 0, mepid = 0, i;
+	uint64_t now = cfm_state_now();
+	struct cfm_mep_state *mep;
+	bool sep = false;
+	int a, nsid = -1;
+
+	for (a = 1; a + 1 < argc; a += 2) {
+		if (!strcmp(argv[a], "netns")) {
+			nsid = atoi(argv[a + 1]);
+		} else if (!strcmp(argv[a], "bridge")) {
+			br_ifindex = if_nametoindex(argv[a + 1]);
+			if (!br_ifindex)
+				br_ifindex = strtoul(argv[a + 1], NULL, 10);
+		} else if (!strcmp(argv[a], "instance")) {
+			instance = strtoul(argv[a + 1], NULL, 10);
+		} else if (!strcmp(argv[a], "peer")) {
+			mepid = strtoul(argv[a + 1], NULL, 10);
+		} else {
+			break;
+		}
+	}
+	if (a != argc || !br_ifindex) {
+		cfm_ctl_error(client, "invalid arguments");
+		return;
+	}
+
+	mep = cfm_state_mep_find(nsid, br_ifindex, instance);
+	if (!mep || (mepid && !cfm_state_peer_find(mep, mepid))) {
+		cfm_ctl_error(client, "no such MEP or peer");
+		return;
+	}
+
+	cfm_ctl_printf(client, "{\"netns\":%d,\"bridge\":%u,\"instance\":%u,\"half_life_ms\":%u,"
+		       "\"hold_ms\":%u,\"peers\":[", nsid, br_ifindex, instance, config.half_life,
+		       config.hold);
+	for (i = 0; i < mep->peer_count; ++i) {
+		if (mepid && mep->peers[i].mepid != mepid)
+			continue;
+		damp_peer_print(client, &mep->peers[i], now, sep);
+		sep = true;
+	}
+	cfm_ctl_printf(client, "]}");
+}
+
+/* Peers whose state as loaded differs from the one last passed on changed
+ * while the server was down, and are damped as any other change
+ */
+static void damp_mep_start(struct cfm_mep_state *mep, void *arg)
+{
+	uint64_t now = *(uint64_t *)arg;
+	uint32_t i;
+
+	for (i = 0; i < mep->peer_count; ++i) {
+		if (mep->peers[i].damp.defect != mep->peers[i].defect)
+			cfm_damp_peer(mep, &mep->peers[i], now);
+	}
+}
+
+int cfm_damp_init(const struct cfm_damp_config *cfg, cfm_damp_fn_t fn)
+{
+	double interval = CFM_DAMP_TICK / 1000.0;
+	uint64_t now = cfm_state_now();
+
+	if (!cfg->half_life) {
+		fprintf(stderr, "Damping half life must be at least 1 ms\n");
+		return -1;
+	}
+
+	config = *cfg;
+	half_life_ns = config.half_life * 1000000.0;
+	ceiling = CFM_DAMP_REUSE * exp2(CFM_DAMP_MAX_SUPPRESS);
+
+	damp_fn = fn;
+	ev_timer_init(&tick_watcher, damp_tick, interval, interval);
+
+	cfm_state_for_each(damp_mep_start, &now);
+
+	return cfm_ctl_register("damping", damp_cmd);
+}
+
+void cfm_damp_uninit(void)
+{
+	ev_timer_stop(EV_DEFAULT, &tick_watcher);
+	free(pending);
+	pending = NULL;
+	pending_count = 0;
+	pending_size = 0;
+	damp_fn = NULL;
+}
+
+void cfm_damp_stats_print(FILE *fp)
+{
+	uint32_t i, suppressed = 0;
+
+	for (i = 0; i < pending_count; ++i)
+		suppressed += cfm_state_peer_find(pending[i].mep, pending[i].mepid)->damp.suppressed;
+
+	fprintf(fp, "Flap damping, half life %u ms, hold %u ms\n", config.half_life, config.hold);
+	fprintf(fp, "    Changes %" PRIu64 " passed on %" PRIu64 " suppressed %" PRIu64 "\n",
+		changes, damped_changes, suppressed_changes);
+	fprintf(fp, "    Suppressions %" PRIu64 " reuses %" PRIu64 ", peers suppressed %u held %u\n\n",
+		suppressions, reuses, suppressed, pending_count - suppressed);
+}
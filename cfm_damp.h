@@ -0,0 +1,53 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_DAMP_H
+#define CFM_DAMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Flap damping of the CCM defect of every peer MEP, as route flap damping
+ * in RFC 2439. Every change into defect adds CFM_DAMP_PENALTY to a penalty
+ * that halves every 'half_life'. Above CFM_DAMP_SUPPRESS the peer is
+ * suppressed: its damped state stays in defect whatever the raw state
+ * does, until the penalty decays below CFM_DAMP_REUSE. The penalty is
+ * capped so no peer stays suppressed longer than CFM_DAMP_MAX_SUPPRESS
+ * half lives after its last change. Outside of suppression, a clear is
+ * only passed on after the peer stayed clear for 'hold'.
+ */
+#define CFM_DAMP_PENALTY	1000
+#define CFM_DAMP_SUPPRESS	2000
+#define CFM_DAMP_REUSE		750
+#define CFM_DAMP_MAX_SUPPRESS	4	/* Half lives */
+#define CFM_DAMP_TICK		100	/* ms, suppressed and held peers are checked */
+
+struct cfm_damp_config {
+	uint32_t half_life;	/* ms */
+	uint32_t hold;		/* ms, 0 - clears are passed on at once */
+};
+
+struct cfm_damp {
+	double penalty;
+	uint64_t updated;	/* ns, CLOCK_MONOTONIC, 'penalty' was decayed to */
+	uint64_t hold_until;	/* ns, a clear is held until, 0 - none */
+	bool defect;		/* Damped state */
+	bool suppressed;
+	bool pending;		/* Checked every tick */
+	uint64_t suppressed_changes;
+};
+
+struct cfm_mep_state;
+struct cfm_peer_state;
+
+/* Called when the damped state of a peer changes */
+typedef void (*cfm_damp_fn_t)(struct cfm_mep_state *mep, struct cfm_peer_state *peer,
+			      uint64_t now);
+
+int cfm_damp_init(const struct cfm_damp_config *cfg, cfm_damp_fn_t fn);
+void cfm_damp_uninit(void);
+void cfm_damp_peer(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now);
+void cfm_damp_stats_print(FILE *fp);
+
+#endif
@@ -0,0 +1,385 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if_ether.h>
+
+#include "cfm_pdu.h"
+#include "cfm_hist.h"
+#include "cfm_oam.h"
+#include "cfm_dm.h"
+
+/* Transmitted DMMs remembered for matching their kernel timestamp */
+#define CFM_DM_TX_RING		8
+
+/* Time to wait for the last DMRs after the final DMM */
+#define CFM_DM_LINGER_NS	1000000000ULL
+
+struct cfm_dm_tx {
+	uint64_t txf;		/* TxTimestampf written in the DMM */
+	uint64_t ts;		/* Kernel transmit timestamp, 0 - not known */
+};
+
+struct cfm_dm_session {
+	struct cfm_oam_timer timer;	/* First, the timer leads to the session */
+	struct mac_addr peer;
+	bool initiator;
+	uint32_t sent;
+	uint32_t received;
+	uint32_t negative;	/* Delays below zero, clock offset with 1DM */
+	uint32_t tx_head;
+	struct cfm_dm_tx tx[CFM_DM_TX_RING];
+	struct cfm_hist delay;
+};
+
+struct cfm_dm {
+	struct cfm_oam oam;
+	const struct cfm_dm_config *cfg;
+	uint64_t interval;	/* ns */
+
+	/* Sessions by peer MAC, open addressing with linear probing */
+	struct cfm_dm_session **sessions;
+	uint32_t count;
+	uint32_t capacity;
+	struct cfm_dm_session **hash;
+	uint32_t hash_mask;
+
+	uint32_t initiators;
+	uint32_t done;
+	uint64_t dmm_answered;
+	struct cfm_oam_timer stop;
+};
+
+static uint64_t cfm_dm_mac_key(const uint8_t *mac)
+{
+	uint64_t key = 0;
+
+	memcpy(&key, mac, ETH_ALEN);
+	return key;
+}
+
+static uint32_t cfm_dm_hash(const uint8_t *mac, uint32_t mask)
+{
+	return (uint32_t)((cfm_dm_mac_key(mac) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static struct cfm_dm_session *cfm_dm_lookup(struct cfm_dm *dm, const uint8_t *mac)
+{
+	uint32_t h = cfm_dm_hash(mac, dm->hash_mask);
+
+	while (dm->hash[h]) {
+		if (!memcmp(dm->hash[h]->peer.addr, mac, ETH_ALEN))
+			return dm->hash[h];
+		h = (h + 1) & dm->hash_mask;
+	}
+
+	return NULL;
+}
+
+static int cfm_dm_hash_resize(struct cfm_dm *dm, uint32_t size)
+{
+	struct cfm_dm_session **hash;
+	uint32_t i, h;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	for (i = 0; i < dm->count; ++i) {
+		h = cfm_dm_hash(dm->sessions[i]->peer.addr, size - 1);
+		while (hash[h])
+			h = (h + 1) & (size - 1);
+		hash[h] = dm->sessions[i];
+	}
+
+	free(dm->hash);
+	dm->hash = hash;
+	dm->hash_mask = size - 1;
+
+	return 0;
+}
+
+static struct cfm_dm_session *cfm_dm_session_add(struct cfm_dm *dm, const uint8_t *mac)
+{
+	struct cfm_dm_session *s, **sessions;
+	uint32_t h;
+
+	s = cfm_dm_lookup(dm, mac);
+	if (s)
+		return s;
+
+	/* The hash has twice the capacity, keeping the load factor at 50% */
+	if (dm->count == dm->capacity) {
+		sessions = realloc(dm->sessions, 2 * dm->capacity * sizeof(*sessions));
+		if (!sessions)
+			return NULL;
+		dm->sessions = sessions;
+		if (cfm_dm_hash_resize(dm, 4 * dm->capacity))
+			return NULL;
+		dm->capacity *= 2;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	memcpy(s->peer.addr, mac, ETH_ALEN);
+	cfm_hist_init(&s->delay);
+
+	dm->sessions[dm->count++] = s;
+	h = cfm_dm_hash(mac, dm->hash_mask);
+	while (dm->hash[h])
+		h = (h + 1) & dm->hash_mask;
+	dm->hash[h] = s;
+
+	return s;
+}
+
+static void cfm_dm_stop(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	oam->quit = 1;
+}
+
+static void cfm_dm_tx(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_dm_session *s = (struct cfm_dm_session *)timer;
+	struct cfm_dm *dm = (struct cfm_dm *)oam;
+	uint8_t frame[ETH_HLEN + CFM_DMM_TLV_OFFSET + 5];
+	uint8_t *pdu;
+	uint32_t len;
+
+	memset(frame, 0, sizeof(frame));
+	pdu = cfm_oam_frame_init(oam, frame, &s->peer);
+
+	if (dm->cfg->type == CFM_DM_TYPE_DMM) {
+		cfm_pdu_hdr_put(pdu, oam->mep.level, CFM_OPCODE_DMM, 0, CFM_DMM_TLV_OFFSET);
+		len = 4 + CFM_DMM_TLV_OFFSET + 1;
+	} else {
+		cfm_pdu_hdr_put(pdu, oam->mep.level, CFM_OPCODE_1DM, 0, CFM_1DM_TLV_OFFSET);
+		len = 4 + CFM_1DM_TLV_OFFSET + 1;
+	}
+
+	now = cfm_oam_now();
+	cfm_pdu_put_ts(pdu + CFM_DM_TXF_OFFSET, now);
+	s->tx[s->tx_head].txf = now;
+	s->tx[s->tx_head].ts = 0;
+	s->tx_head = (s->tx_head + 1) % CFM_DM_TX_RING;
+
+	if (cfm_oam_send(oam, frame, len) == 0)
+		s->sent++;
+
+	/* Rearm from the previous expiry so the rate does not drift */
+	if (!dm->cfg->count || s->sent < dm->cfg->count) {
+		cfm_oam_timer_start(oam, timer, timer->expires + dm->interval);
+		return;
+	}
+
+	if (++dm->done == dm->initiators)
+		cfm_oam_timer_start(oam, &dm->stop, now + CFM_DM_LINGER_NS);
+}
+
+/* The kernel transmit timestamp replaces the one written by userspace */
+static void cfm_dm_tx_ts(struct cfm_oam *oam, const uint8_t *frame, uint32_t len,
+			 uint64_t ts, void *arg)
+{
+	struct cfm_dm *dm = arg;
+	struct cfm_dm_session *s;
+	uint64_t txf;
+	int i;
+
+	if (len < ETH_HLEN + CFM_DM_TXF_OFFSET + 8)
+		return;
+
+	s = cfm_dm_lookup(dm, frame);
+	if (!s)
+		return;
+
+	txf = cfm_pdu_get_ts(frame + ETH_HLEN + CFM_DM_TXF_OFFSET);
+	for (i = 0; i < CFM_DM_TX_RING; ++i) {
+		if (s->tx[i].txf == txf) {
+			s->tx[i].ts = ts;
+			break;
+		}
+	}
+}
+
+static void cfm_dm_delay_add(struct cfm_dm_session *s, uint64_t end, uint64_t start,
+			     uint64_t residence)
+{
+	if (end < start || end - start < residence) {
+		s->negative++;
+		return;
+	}
+
+	cfm_hist_add(&s->delay, end - start - residence);
+}
+
+static void cfm_dm_dmr_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_dm *dm = arg;
+	struct cfm_dm_session *s;
+	uint64_t t1, t2, t3, residence = 0;
+	int i;
+
+	if (frame->len < CFM_DM_RXB_OFFSET)
+		return;
+
+	s = cfm_dm_lookup(dm, frame->mac + ETH_ALEN);
+	if (!s || !s->initiator)
+		return;
+
+	t1 = cfm_pdu_get_ts(frame->pdu + CFM_DM_TXF_OFFSET);
+	t2 = cfm_pdu_get_ts(frame->pdu + CFM_DM_RXF_OFFSET);
+	t3 = cfm_pdu_get_ts(frame->pdu + CFM_DM_TXB_OFFSET);
+
+	for (i = 0; i < CFM_DM_TX_RING; ++i) {
+		if (s->tx[i].txf == t1 && s->tx[i].ts) {
+			t1 = s->tx[i].ts;
+			break;
+		}
+	}
+
+	/* The responder time is left out when the responder reports it */
+	if (t2 && t3 >= t2)
+		residence = t3 - t2;
+
+	s->received++;
+	cfm_dm_delay_add(s, frame->ts, t1, residence);
+}
+
+static void cfm_dm_dmm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_dm *dm = arg;
+	uint8_t reply[CFM_OAM_FRAME_MAX];
+	struct mac_addr peer;
+	uint32_t len = frame->len;
+	uint8_t *pdu;
+
+	if (len < CFM_DM_RXB_OFFSET + 8)
+		return;
+	if (len > CFM_OAM_FRAME_MAX - ETH_HLEN)
+		len = CFM_OAM_FRAME_MAX - ETH_HLEN;
+
+	memcpy(peer.addr, frame->mac + ETH_ALEN, ETH_ALEN);
+	pdu = cfm_oam_frame_init(oam, reply, &peer);
+	memcpy(pdu, frame->pdu, len);
+	pdu[1] = CFM_OPCODE_DMR;
+	cfm_pdu_put_ts(pdu + CFM_DM_RXF_OFFSET, frame->ts);
+	cfm_pdu_put_ts(pdu + CFM_DM_TXB_OFFSET, cfm_oam_now());
+
+	if (cfm_oam_send(oam, reply, len) == 0)
+		dm->dmm_answered++;
+}
+
+static void cfm_dm_1dm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_dm *dm = arg;
+	struct cfm_dm_session *s;
+
+	if (frame->len < CFM_DM_TXF_OFFSET + 8)
+		return;
+
+	s = cfm_dm_session_add(dm, frame->mac + ETH_ALEN);
+	if (!s)
+		return;
+
+	s->received++;
+	cfm_dm_delay_add(s, frame->ts, cfm_pdu_get_ts(frame->pdu + CFM_DM_TXF_OFFSET), 0);
+}
+
+static void cfm_dm_report(struct cfm_dm *dm)
+{
+	struct cfm_dm_session *s;
+	uint32_t i;
+
+	for (i = 0; i < dm->count; ++i) {
+		s = dm->sessions[i];
+		printf("Peer %02X-%02X-%02X-%02X-%02X-%02X\n",
+		       s->peer.addr[0], s->peer.addr[1], s->peer.addr[2],
+		       s->peer.addr[3], s->peer.addr[4], s->peer.addr[5]);
+		if (s->initiator)
+			printf("    Sent %u\n", s->sent);
+		printf("    Received %u\n", s->received);
+		if (s->negative)
+			printf("    Negative %u\n", s->negative);
+		if (s->initiator && dm->cfg->type == CFM_DM_TYPE_1DM)
+			continue;
+		cfm_hist_print(stdout, s->initiator ? "Two-way delay" : "One-way delay", &s->delay);
+	}
+
+	if (dm->cfg->responder)
+		printf("DMM answered %llu\n", (unsigned long long)dm->dmm_answered);
+	if (dm->oam.tx_errors)
+		printf("TX errors %llu\n", (unsigned long long)dm->oam.tx_errors);
+}
+
+int cfm_dm_run(const struct cfm_dm_config *cfg)
+{
+	const uint8_t opcodes[] = { CFM_OPCODE_DMM, CFM_OPCODE_DMR, CFM_OPCODE_1DM };
+	struct cfm_dm_session *s;
+	struct cfm_dm *dm;
+	uint64_t now;
+	uint32_t i;
+	int err = -1;
+
+	if (!cfg->dmac_count && !cfg->responder) {
+		fprintf(stderr, "No destination and not a responder\n");
+		return -1;
+	}
+
+	dm = calloc(1, sizeof(*dm));
+	if (!dm)
+		return -1;
+	dm->oam.tx_fd = -1;
+	dm->oam.rx.fd = -1;
+	dm->cfg = cfg;
+	dm->interval = (uint64_t)(cfg->interval ? cfg->interval : 100) * 1000000ULL;
+
+	dm->capacity = 32;
+	dm->sessions = calloc(dm->capacity, sizeof(*dm->sessions));
+	if (!dm->sessions || cfm_dm_hash_resize(dm, 2 * dm->capacity))
+		goto out;
+
+	if (cfm_oam_open(&dm->oam, cfg->br_ifindex, cfg->instance, opcodes, sizeof(opcodes)))
+		goto out;
+
+	/* A 1DM is gone before its transmit time is known, only DMMs use it */
+	if (cfg->type == CFM_DM_TYPE_DMM && cfg->dmac_count && cfm_oam_tx_ts_enable(&dm->oam))
+		goto out;
+
+	cfm_oam_handler_set(&dm->oam, CFM_OPCODE_DMR, cfm_dm_dmr_rx, NULL, dm);
+	cfm_oam_handler_set(&dm->oam, CFM_OPCODE_DMM, cfg->responder ? cfm_dm_dmm_rx : NULL,
+			    cfm_dm_tx_ts, dm);
+	cfm_oam_handler_set(&dm->oam, CFM_OPCODE_1DM, cfg->responder ? cfm_dm_1dm_rx : NULL,
+			    NULL, dm);
+	dm->stop.fn = cfm_dm_stop;
+
+	/* Spread the sessions over the interval so they don't send in bursts */
+	now = cfm_oam_now();
+	for (i = 0; i < cfg->dmac_count; ++i) {
+		s = cfm_dm_session_add(dm, cfg->dmacs[i].addr);
+		if (!s)
+			goto out;
+		if (s->initiator)
+			continue;
+		s->initiator = true;
+		s->timer.fn = cfm_dm_tx;
+		if (cfm_oam_timer_start(&dm->oam, &s->timer, now + dm->interval * i / cfg->dmac_count))
+			goto out;
+		dm->initiators++;
+	}
+
+	err = cfm_oam_run(&dm->oam);
+	cfm_dm_report(dm);
+
+out:
+	cfm_oam_close(&dm->oam);
+	for (i = 0; i < dm->count; ++i)
+		free(dm->sessions[i]);
+	free(dm->sessions);
+	free(dm->hash);
+	free(dm);
+
+	return err;
+}
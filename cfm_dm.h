@@ -0,0 +1,30 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_DM_H
+#define CFM_DM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cfm_netlink.h"
+
+enum cfm_dm_type {
+	CFM_DM_TYPE_DMM,	/* Two-way, DMM answered by DMR */
+	CFM_DM_TYPE_1DM,	/* One-way, needs synchronized clocks */
+};
+
+struct cfm_dm_config {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	enum cfm_dm_type type;
+	uint32_t interval;	/* ms between PDUs of a session */
+	uint32_t count;		/* PDUs per session, 0 - until interrupted */
+	bool responder;		/* Answer DMM and measure received 1DM */
+	uint32_t dmac_count;	/* One session per destination */
+	struct mac_addr *dmacs;
+};
+
+int cfm_dm_run(const struct cfm_dm_config *cfg);
+
+#endif
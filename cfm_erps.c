@@ -0,0 +1,822 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ev.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+
+#include "cfm_pdu.h"
+#include "cfm_hist.h"
+#include "cfm_erps.h"
+
+/* G.8032 Ethernet ring protection. Each ring has two ports on one bridge.
+ * Signal fail of a ring port is the CCM defect state of the MEP that
+ * monitors the link, R-APS messages from the other ring nodes are reported
+ * by the MIP on the ring port. The state machine follows G.8032 (Table
+ * 10-2) without the manual and forced switch commands. Ports are blocked
+ * and unblocked by setting their STP state, so the bridge must not run STP.
+ *
+ * The kernel does not send R-APS, the messages of this node are sent on a
+ * raw socket per ring port: three in a row 3.3 ms apart, then every 5 s.
+ */
+
+#define ERPS_TX_FAST_COUNT	3
+#define ERPS_TX_FAST_INTERVAL	0.0033
+#define ERPS_TX_INTERVAL	5.0
+#define ERPS_FRAME_LEN		64
+#define ERPS_LINE_ARGS		64
+
+enum erps_state {
+	ERPS_STATE_INIT,
+	ERPS_STATE_IDLE,
+	ERPS_STATE_PROTECTION,
+	ERPS_STATE_PENDING,
+};
+
+enum erps_role {
+	ERPS_ROLE_NONE,
+	ERPS_ROLE_OWNER,
+	ERPS_ROLE_NEIGHBOUR,
+};
+
+static const char *const erps_state_names[] = {
+	[ERPS_STATE_INIT] = "INIT",
+	[ERPS_STATE_IDLE] = "IDLE",
+	[ERPS_STATE_PROTECTION] = "PROTECTION",
+	[ERPS_STATE_PENDING] = "PENDING",
+};
+
+static const char *const erps_role_names[] = {
+	[ERPS_ROLE_NONE] = "none",
+	[ERPS_ROLE_OWNER] = "owner",
+	[ERPS_ROLE_NEIGHBOUR] = "neighbour",
+};
+
+struct erps_ring;
+
+struct erps_port {
+	struct erps_ring *ring;
+	int idx;
+	char name[IF_NAMESIZE];
+	uint32_t ifindex;
+	bool has_mep;
+	uint32_t mep;		/* MEP instance giving signal fail */
+	bool has_mip;
+	uint32_t mip;		/* MIP instance reporting R-APS */
+	int fd;
+
+	bool defect;		/* CCM defect of the MEP */
+	bool sf;		/* Signal fail, the defect after the hold-off time */
+	uint64_t sf_ts;		/* ns, when the defect was read */
+	ev_timer holdoff_timer;
+	bool blocked;
+
+	/* Node ID and BPR of the last R-APS(SF) or R-APS(NR, RB), -1 - none */
+	struct mac_addr last_node;
+	int last_bpr;
+};
+
+struct erps_ring {
+	uint32_t id;
+	uint32_t br_ifindex;
+	char br_name[IF_NAMESIZE];
+	uint8_t level;
+	uint16_t vlan;		/* R-APS VLAN, 0 - untagged */
+	enum erps_role role;
+	int rpl;		/* Index of the RPL port, -1 - none */
+	bool revertive;
+	uint32_t wtr;		/* ms */
+	uint32_t guard;		/* ms */
+	uint32_t holdoff;	/* ms */
+	struct mac_addr node_id;
+	struct erps_port port[2];
+
+	enum erps_state state;
+	bool tx_active;
+	uint8_t tx_request;
+	uint8_t tx_status;
+	int tx_fast;		/* Messages left at the fast interval */
+	ev_timer tx_timer;
+	ev_timer wtr_timer;
+	uint64_t guard_end;	/* ns, R-APS are ignored until then */
+
+	uint64_t switches;
+	uint64_t late;		/* Switches over CFM_ERPS_SWITCH_BUDGET_NS */
+	uint64_t reverts;
+	uint64_t raps_rx;
+	uint64_t raps_ignored;
+	uint64_t raps_tx;
+	uint64_t tx_errors;
+	uint64_t flushes;
+	uint64_t errors;
+	struct cfm_hist switch_time;
+};
+
+static struct erps_ring rings[CFM_ERPS_RINGS_MAX];
+static int ring_count;
+
+static void erps_event(const struct erps_ring *r, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("EVENT CFM ERPS:\n");
+	printf("Ring %u\n    ", r->id);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n\n");
+	fflush(stdout);
+}
+
+static void erps_state_set(struct erps_ring *r, enum erps_state state)
+{
+	if (r->state == state)
+		return;
+
+	erps_event(r, "%s -> %s", erps_state_names[r->state], erps_state_names[state]);
+	r->state = state;
+}
+
+/* Time from reading the event until the ports are switched */
+static void erps_switch_done(struct erps_ring *r, uint64_t event_ts)
+{
+	uint64_t t = cfm_state_now() - event_ts;
+
+	cfm_hist_add(&r->switch_time, t);
+	r->switches++;
+	if (t > CFM_ERPS_SWITCH_BUDGET_NS)
+		r->late++;
+}
+
+static void erps_port_set(struct erps_ring *r, int p, bool block)
+{
+	struct erps_port *port = &r->port[p];
+	int err;
+
+	if (port->blocked == block)
+		return;
+
+	err = cfm_offload_port_state(port->ifindex, block ? BR_STATE_BLOCKING : BR_STATE_FORWARDING);
+	if (err) {
+		r->errors++;
+		erps_event(r, "%s %s failed: %s", block ? "blocking" : "unblocking",
+			   port->name, strerror(-err));
+		return;
+	}
+	port->blocked = block;
+}
+
+static void erps_unblock_non_failed(struct erps_ring *r)
+{
+	int p;
+
+	for (p = 0; p < 2; ++p)
+		if (!r->port[p].sf)
+			erps_port_set(r, p, false);
+}
+
+static void erps_unblock_non_rpl(struct erps_ring *r)
+{
+	int p;
+
+	for (p = 0; p < 2; ++p)
+		if (p != r->rpl)
+			erps_port_set(r, p, false);
+}
+
+static void erps_flush(struct erps_ring *r)
+{
+	int p;
+
+	for (p = 0; p < 2; ++p)
+		if (cfm_offload_port_flush(r->port[p].ifindex))
+			r->errors++;
+	r->flushes++;
+}
+
+static int erps_frame_build(const struct erps_ring *r, uint8_t *frame)
+{
+	static const uint8_t dmac[ETH_ALEN] = { 0x01, 0x19, 0xA7, 0x00, 0x00, 0x00 };
+	uint8_t *pdu;
+	int len;
+
+	memset(frame, 0, ERPS_FRAME_LEN);
+	memcpy(frame, dmac, ETH_ALEN);
+	frame[ETH_ALEN - 1] = r->id;
+	memcpy(frame + ETH_ALEN, r->node_id.addr, ETH_ALEN);
+	len = 2 * ETH_ALEN;
+	if (r->vlan) {
+		cfm_pdu_put_u16(frame + len, ETH_P_8021Q);
+		cfm_pdu_put_u16(frame + len + 2, (7 << 13) | r->vlan);
+		len += 4;
+	}
+	cfm_pdu_put_u16(frame + len, ETH_P_CFM);
+	len += 2;
+
+	pdu = frame + len;
+	cfm_pdu_hdr_put(pdu, r->level, BR_CFM_OPCODE_RAPS, 0, CFM_RAPS_TLV_OFFSET);
+	pdu[0] |= CFM_RAPS_VERSION;
+	pdu[4] = r->tx_request << 4;
+	pdu[5] = r->tx_status;
+	memcpy(pdu + CFM_RAPS_NODE_ID_OFFSET, r->node_id.addr, ETH_ALEN);
+	pdu[4 + CFM_RAPS_TLV_OFFSET] = CFM_ENDE_TLV_TYPE;
+	len += 4 + CFM_RAPS_TLV_OFFSET + 1;
+
+	return len < ETH_ZLEN ? ETH_ZLEN : len;
+}
+
+static void erps_tx_send(struct erps_ring *r)
+{
+	uint8_t frame[ERPS_FRAME_LEN];
+	int len = erps_frame_build(r, frame);
+	int p;
+
+	for (p = 0; p < 2; ++p) {
+		if (send(r->port[p].fd, frame, len, 0) < 0)
+			r->tx_errors++;
+		else
+			r->raps_tx++;
+	}
+}
+
+static void erps_tx_timeout(EV_P_ ev_timer *w, int revents)
+{
+	struct erps_ring *r = w->data;
+
+	erps_tx_send(r);
+	if (r->tx_fast && !--r->tx_fast) {
+		w->repeat = ERPS_TX_INTERVAL;
+		ev_timer_again(EV_A_ w);
+	}
+}
+
+/* Start sending a new R-APS message, BPR is set from the blocked port */
+static void erps_tx(struct erps_ring *r, uint8_t request, uint8_t status)
+{
+	if (r->port[1].blocked && !r->port[0].blocked)
+		status |= CFM_RAPS_STATUS_BPR;
+
+	if (r->tx_active && r->tx_request == request && r->tx_status == status)
+		return;
+
+	r->tx_active = true;
+	r->tx_request = request;
+	r->tx_status = status;
+	r->tx_fast = ERPS_TX_FAST_COUNT - 1;
+	erps_tx_send(r);
+
+	ev_timer_stop(EV_DEFAULT, &r->tx_timer);
+	ev_timer_set(&r->tx_timer, ERPS_TX_FAST_INTERVAL, ERPS_TX_FAST_INTERVAL);
+	ev_timer_start(EV_DEFAULT, &r->tx_timer);
+}
+
+static void erps_tx_stop(struct erps_ring *r)
+{
+	r->tx_active = false;
+	ev_timer_stop(EV_DEFAULT, &r->tx_timer);
+}
+
+static void erps_wtr_start(struct erps_ring *r)
+{
+	if (ev_is_active(&r->wtr_timer))
+		return;
+
+	ev_timer_set(&r->wtr_timer, r->wtr / 1e3, 0);
+	ev_timer_start(EV_DEFAULT, &r->wtr_timer);
+}
+
+static void erps_local_sf(struct erps_ring *r, int p, uint64_t event_ts)
+{
+	bool was_blocked = r->port[p].blocked;
+
+	ev_timer_stop(EV_DEFAULT, &r->wtr_timer);
+	erps_port_set(r, p, true);
+	if (!r->port[!p].sf)
+		erps_port_set(r, !p, false);
+	erps_tx(r, CFM_RAPS_REQ_SF, was_blocked ? CFM_RAPS_STATUS_DNF : 0);
+	if (!was_blocked)
+		erps_flush(r);
+	erps_switch_done(r, event_ts);
+	erps_state_set(r, ERPS_STATE_PROTECTION);
+}
+
+static void erps_local_clear_sf(struct erps_ring *r)
+{
+	if (r->state != ERPS_STATE_PROTECTION || r->port[0].sf || r->port[1].sf)
+		return;
+
+	/* The recovered port stays blocked until the RPL is blocked again */
+	r->guard_end = cfm_state_now() + r->guard * 1000000ULL;
+	erps_tx(r, CFM_RAPS_REQ_NR, 0);
+	if (r->role == ERPS_ROLE_OWNER && r->revertive)
+		erps_wtr_start(r);
+	erps_state_set(r, ERPS_STATE_PENDING);
+}
+
+/* Returns true if the message asks for an FDB flush, G.8032 10.1.10 */
+static bool erps_raps_flush(struct erps_ring *r, int p, uint8_t status,
+			    const struct mac_addr *node_id)
+{
+	struct erps_port *port = &r->port[p];
+	int bpr = !!(status & CFM_RAPS_STATUS_BPR);
+
+	if (port->last_bpr == bpr && !memcmp(&port->last_node, node_id, sizeof(*node_id)))
+		return false;
+
+	port->last_node = *node_id;
+	port->last_bpr = bpr;
+	r->port[!p].last_bpr = -1;
+
+	return !(status & CFM_RAPS_STATUS_DNF);
+}
+
+static void erps_raps_sf(struct erps_ring *r, bool flush, uint64_t event_ts)
+{
+	if (r->state != ERPS_STATE_PROTECTION) {
+		ev_timer_stop(EV_DEFAULT, &r->wtr_timer);
+		erps_unblock_non_failed(r);
+		erps_tx_stop(r);
+	}
+	if (flush)
+		erps_flush(r);
+	if (r->state != ERPS_STATE_PROTECTION)
+		erps_switch_done(r, event_ts);
+	erps_state_set(r, ERPS_STATE_PROTECTION);
+}
+
+static void erps_raps_nr_rb(struct erps_ring *r, bool flush)
+{
+	if (r->role == ERPS_ROLE_OWNER || r->port[0].sf || r->port[1].sf) {
+		if (flush)
+			erps_flush(r);
+		return;
+	}
+
+	if (r->role == ERPS_ROLE_NEIGHBOUR)
+		erps_port_set(r, r->rpl, true);
+	erps_unblock_non_rpl(r);
+	erps_tx_stop(r);
+	if (flush)
+		erps_flush(r);
+	if (r->state != ERPS_STATE_IDLE)
+		r->reverts++;
+	erps_state_set(r, ERPS_STATE_IDLE);
+}
+
+static void erps_raps_nr(struct erps_ring *r, const struct mac_addr *node_id)
+{
+	int p;
+
+	switch (r->state) {
+	case ERPS_STATE_PROTECTION:
+		if (r->port[0].sf || r->port[1].sf)
+			break;
+		if (r->role == ERPS_ROLE_OWNER && r->revertive)
+			erps_wtr_start(r);
+		erps_state_set(r, ERPS_STATE_PENDING);
+		break;
+	case ERPS_STATE_PENDING:
+		if (r->role == ERPS_ROLE_OWNER && r->revertive)
+			erps_wtr_start(r);
+		/* Of the nodes that recovered, only the highest Node ID keeps blocking */
+		if (memcmp(node_id, &r->node_id, sizeof(*node_id)) > 0) {
+			for (p = 0; p < 2; ++p)
+				if (!r->port[p].sf && p != r->rpl)
+					erps_port_set(r, p, false);
+			erps_tx_stop(r);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void cfm_erps_raps_event(uint32_t br_ifindex, uint32_t mip_instance, uint8_t request_subcode,
+			 uint8_t status, const struct mac_addr *node_id, uint64_t now)
+{
+	struct erps_ring *r;
+	bool flush;
+	int i, p;
+
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		if (r->br_ifindex != br_ifindex)
+			continue;
+		for (p = 0; p < 2; ++p)
+			if (r->port[p].has_mip && r->port[p].mip == mip_instance)
+				break;
+		if (p == 2)
+			continue;
+
+		r->raps_rx++;
+		if (!memcmp(node_id, &r->node_id, sizeof(*node_id)) ||
+		    now < r->guard_end) {
+			r->raps_ignored++;
+			continue;
+		}
+
+		switch (request_subcode >> 4) {
+		case CFM_RAPS_REQ_SF:
+			flush = erps_raps_flush(r, p, status, node_id);
+			erps_raps_sf(r, flush, now);
+			break;
+		case CFM_RAPS_REQ_NR:
+			if (status & CFM_RAPS_STATUS_RB) {
+				flush = erps_raps_flush(r, p, status, node_id);
+				erps_raps_nr_rb(r, flush);
+			} else {
+				erps_raps_nr(r, node_id);
+			}
+			break;
+		default:
+			r->raps_ignored++;
+			break;
+		}
+	}
+}
+
+void cfm_erps_mep_changed(const struct cfm_mep_state *mep, uint64_t now)
+{
+	struct erps_port *port;
+	struct erps_ring *r;
+	int i, p;
+
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		if (r->br_ifindex != mep->br_ifindex)
+			continue;
+		for (p = 0; p < 2; ++p) {
+			port = &r->port[p];
+			if (!port->has_mep || port->mep != mep->instance ||
+			    port->defect == (mep->defect_count > 0))
+				continue;
+
+			port->defect = mep->defect_count > 0;
+			if (port->defect) {
+				port->sf_ts = now;
+				if (r->holdoff) {
+					ev_timer_set(&port->holdoff_timer, r->holdoff / 1e3, 0);
+					ev_timer_start(EV_DEFAULT, &port->holdoff_timer);
+				} else {
+					port->sf = true;
+					erps_local_sf(r, p, now);
+				}
+			} else if (ev_is_active(&port->holdoff_timer)) {
+				ev_timer_stop(EV_DEFAULT, &port->holdoff_timer);
+			} else {
+				port->sf = false;
+				erps_local_clear_sf(r);
+			}
+		}
+	}
+}
+
+static void erps_holdoff_timeout(EV_P_ ev_timer *w, int revents)
+{
+	struct erps_port *port = w->data;
+
+	if (!port->defect || port->sf)
+		return;
+
+	port->sf = true;
+	erps_local_sf(port->ring, port->idx, port->sf_ts);
+}
+
+static void erps_wtr_timeout(EV_P_ ev_timer *w, int revents)
+{
+	struct erps_ring *r = w->data;
+	bool was_blocked = r->port[r->rpl].blocked;
+
+	if (r->state != ERPS_STATE_PENDING)
+		return;
+
+	erps_port_set(r, r->rpl, true);
+	erps_unblock_non_rpl(r);
+	erps_tx(r, CFM_RAPS_REQ_NR, CFM_RAPS_STATUS_RB |
+		(was_blocked ? CFM_RAPS_STATUS_DNF : 0));
+	if (!was_blocked)
+		erps_flush(r);
+	r->reverts++;
+	erps_state_set(r, ERPS_STATE_IDLE);
+}
+
+/* G.8032 initialization: block the RPL (or any ring port), tell the ring
+ * and wait for the RPL owner to take over.
+ */
+static void erps_ring_start(struct erps_ring *r)
+{
+	int block = r->rpl >= 0 ? r->rpl : 0;
+	int p;
+
+	for (p = 0; p < 2; ++p) {
+		r->port[p].blocked = p != block;
+		erps_port_set(r, p, p == block);
+	}
+	erps_tx(r, CFM_RAPS_REQ_NR, 0);
+	if (r->role == ERPS_ROLE_OWNER && r->revertive)
+		erps_wtr_start(r);
+	erps_state_set(r, ERPS_STATE_PENDING);
+}
+
+static int erps_mac_parse(const char *s, struct mac_addr *mac)
+{
+	unsigned int b[ETH_ALEN];
+	int i;
+
+	if (sscanf(s, "%x%*[-:]%x%*[-:]%x%*[-:]%x%*[-:]%x%*[-:]%x",
+		   &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETH_ALEN)
+		return -1;
+
+	for (i = 0; i < ETH_ALEN; ++i) {
+		if (b[i] > 0xFF)
+			return -1;
+		mac->addr[i] = b[i];
+	}
+
+	return 0;
+}
+
+static int erps_ifmac_get(const char *name, struct mac_addr *mac)
+{
+	struct ifreq ifr = { 0 };
+	int fd, err;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	strncpy(ifr.ifr_name, name, IF_NAMESIZE - 1);
+	err = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	close(fd);
+	if (err)
+		return -errno;
+
+	memcpy(mac->addr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	return 0;
+}
+
+static int erps_port_open(struct erps_port *port)
+{
+	struct sockaddr_ll sll = { 0 };
+
+	port->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (port->fd < 0) {
+		fprintf(stderr, "ERPS: cannot open socket on %s: %s\n", port->name, strerror(errno));
+		return -1;
+	}
+
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = port->ifindex;
+	if (bind(port->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+		fprintf(stderr, "ERPS: cannot bind to %s: %s\n", port->name, strerror(errno));
+		close(port->fd);
+		port->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int erps_ifname(char *dst, const char *name, uint32_t *ifindex, int line)
+{
+	*ifindex = if_nametoindex(name);
+	if (!*ifindex) {
+		fprintf(stderr, "ERPS line %d: unknown interface %s\n", line, name);
+		return -1;
+	}
+	strncpy(dst, name, IF_NAMESIZE - 1);
+
+	return 0;
+}
+
+/* ring <id> bridge <br> port0 <port> port1 <port> [mep0 <instance>]
+ * [mep1 <instance>] [mip0 <instance>] [mip1 <instance>] [rpl port0|port1]
+ * [role owner|neighbour|none] [level <level>] [vlan <vid>] [node-id <mac>]
+ * [revertive yes|no] [wtr <ms>] [guard <ms>] [hold-off <ms>]
+ */
+static int erps_ring_parse(struct erps_ring *r, int argc, char **argv, int line)
+{
+	bool node_id = false;
+	int a, p, n;
+
+	r->level = 7;
+	r->rpl = -1;
+	r->revertive = true;
+	r->wtr = 300000;
+	r->guard = 500;
+	for (p = 0; p < 2; ++p) {
+		r->port[p].ring = r;
+		r->port[p].idx = p;
+		r->port[p].fd = -1;
+		r->port[p].last_bpr = -1;
+	}
+
+	for (a = 0; a + 1 < argc; a += 2) {
+		const char *key = argv[a], *val = argv[a + 1];
+
+		p = key[strlen(key) - 1] == '1';
+		if (!strcmp(key, "ring")) {
+			r->id = atoi(val);
+		} else if (!strcmp(key, "bridge")) {
+			if (erps_ifname(r->br_name, val, &r->br_ifindex, line))
+				return -1;
+		} else if (!strcmp(key, "port0") || !strcmp(key, "port1")) {
+			if (erps_ifname(r->port[p].name, val, &r->port[p].ifindex, line))
+				return -1;
+		} else if (!strcmp(key, "mep0") || !strcmp(key, "mep1")) {
+			r->port[p].has_mep = true;
+			r->port[p].mep = atoi(val);
+		} else if (!strcmp(key, "mip0") || !strcmp(key, "mip1")) {
+			r->port[p].has_mip = true;
+			r->port[p].mip = atoi(val);
+		} else if (!strcmp(key, "rpl")) {
+			if (strcmp(val, "port0") && strcmp(val, "port1"))
+				goto bad;
+			r->rpl = val[4] == '1';
+		} else if (!strcmp(key, "role")) {
+			if (!strcmp(val, "owner"))
+				r->role = ERPS_ROLE_OWNER;
+			else if (!strcmp(val, "neighbour"))
+				r->role = ERPS_ROLE_NEIGHBOUR;
+			else if (!strcmp(val, "none"))
+				r->role = ERPS_ROLE_NONE;
+			else
+				goto bad;
+		} else if (!strcmp(key, "level")) {
+			n = atoi(val);
+			if (n < 0 || n > 7)
+				goto bad;
+			r->level = n;
+		} else if (!strcmp(key, "vlan")) {
+			n = atoi(val);
+			if (n < 0 || n > 4094)
+				goto bad;
+			r->vlan = n;
+		} else if (!strcmp(key, "node-id")) {
+			if (erps_mac_parse(val, &r->node_id))
+				goto bad;
+			node_id = true;
+		} else if (!strcmp(key, "revertive")) {
+			r->revertive = !strcmp(val, "yes");
+		} else if (!strcmp(key, "wtr")) {
+			r->wtr = atoi(val);
+		} else if (!strcmp(key, "guard")) {
+			r->guard = atoi(val);
+		} else if (!strcmp(key, "hold-off")) {
+			r->holdoff = atoi(val);
+		} else {
+			fprintf(stderr, "ERPS line %d: unknown keyword %s\n", line, key);
+			return -1;
+		}
+		continue;
+bad:
+		fprintf(stderr, "ERPS line %d: invalid %s %s\n", line, key, val);
+		return -1;
+	}
+
+	if (a != argc) {
+		fprintf(stderr, "ERPS line %d: %s without value\n", line, argv[a]);
+		return -1;
+	}
+	if (r->id < 1 || r->id > 239 || !r->br_ifindex || !r->port[0].ifindex ||
+	    !r->port[1].ifindex) {
+		fprintf(stderr, "ERPS line %d: ring 1-239, bridge, port0 and port1 are needed\n", line);
+		return -1;
+	}
+	if (r->role != ERPS_ROLE_NONE && r->rpl < 0) {
+		fprintf(stderr, "ERPS line %d: the %s needs the rpl port\n", line,
+			erps_role_names[r->role]);
+		return -1;
+	}
+	if (!node_id && erps_ifmac_get(r->br_name, &r->node_id)) {
+		fprintf(stderr, "ERPS line %d: cannot read the MAC of %s\n", line, r->br_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int erps_file_read(const char *file)
+{
+	char buf[1024], *argv[ERPS_LINE_ARGS], *tok, *save;
+	int argc, line = 0, err = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "ERPS: cannot open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	while (!err && fgets(buf, sizeof(buf), fp)) {
+		line++;
+		if (strchr(buf, '#'))
+			*strchr(buf, '#') = '\0';
+
+		argc = 0;
+		for (tok = strtok_r(buf, " \t\r\n", &save); tok && argc < ERPS_LINE_ARGS;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			argv[argc++] = tok;
+		if (!argc)
+			continue;
+
+		if (ring_count == CFM_ERPS_RINGS_MAX) {
+			fprintf(stderr, "ERPS line %d: more than %d rings\n", line, CFM_ERPS_RINGS_MAX);
+			err = -1;
+			break;
+		}
+		err = erps_ring_parse(&rings[ring_count], argc, argv, line);
+		if (!err)
+			ring_count++;
+	}
+	fclose(fp);
+
+	return err;
+}
+
+int cfm_erps_init(const char *file)
+{
+	struct erps_ring *r;
+	int i, p;
+
+	if (erps_file_read(file))
+		return -1;
+
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		for (p = 0; p < 2; ++p)
+			if (erps_port_open(&r->port[p]))
+				return -1;
+	}
+
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		cfm_hist_init(&r->switch_time);
+		ev_timer_init(&r->tx_timer, erps_tx_timeout, 0, 0);
+		ev_timer_init(&r->wtr_timer, erps_wtr_timeout, 0, 0);
+		r->tx_timer.data = r;
+		r->wtr_timer.data = r;
+		for (p = 0; p < 2; ++p) {
+			ev_timer_init(&r->port[p].holdoff_timer, erps_holdoff_timeout, 0, 0);
+			r->port[p].holdoff_timer.data = &r->port[p];
+		}
+		erps_ring_start(r);
+	}
+
+	return 0;
+}
+
+void cfm_erps_uninit(void)
+{
+	struct erps_ring *r;
+	int i, p;
+
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		ev_timer_stop(EV_DEFAULT, &r->tx_timer);
+		ev_timer_stop(EV_DEFAULT, &r->wtr_timer);
+		for (p = 0; p < 2; ++p) {
+			ev_timer_stop(EV_DEFAULT, &r->port[p].holdoff_timer);
+			if (r->port[p].fd >= 0)
+				close(r->port[p].fd);
+		}
+	}
+	memset(rings, 0, sizeof(rings));
+	ring_count = 0;
+}
+
+void cfm_erps_stats_print(FILE *fp)
+{
+	const struct erps_ring *r;
+	int i, p;
+
+	fprintf(fp, "ERPS\n");
+	for (i = 0; i < ring_count; ++i) {
+		r = &rings[i];
+		fprintf(fp, "    Ring %u on %s: %s, %s\n", r->id, r->br_name,
+			erps_state_names[r->state], erps_role_names[r->role]);
+		for (p = 0; p < 2; ++p)
+			fprintf(fp, "    Port %s%s: %s%s\n", r->port[p].name,
+				p == r->rpl ? " (RPL)" : "",
+				r->port[p].blocked ? "blocked" : "forwarding",
+				r->port[p].sf ? ", signal fail" : "");
+		fprintf(fp, "    Switches %" PRIu64 " (over %llu ms %" PRIu64 "), reverts %" PRIu64 "\n",
+			r->switches, CFM_ERPS_SWITCH_BUDGET_NS / 1000000, r->late, r->reverts);
+		fprintf(fp, "    R-APS rx %" PRIu64 " (ignored %" PRIu64 "), tx %" PRIu64 " (errors %" PRIu64 ")\n",
+			r->raps_rx, r->raps_ignored, r->raps_tx, r->tx_errors);
+		fprintf(fp, "    Flushes %" PRIu64 ", errors %" PRIu64 "\n", r->flushes, r->errors);
+		cfm_hist_print(fp, "Event to switch", &r->switch_time);
+	}
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_ERPS_H
+#define CFM_ERPS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cfm_netlink.h"
+#include "cfm_state.h"
+
+#define CFM_ERPS_RINGS_MAX	16
+
+/* Protection switching must complete within 50 ms of the failure */
+#define CFM_ERPS_SWITCH_BUDGET_NS	50000000ULL
+
+int cfm_erps_init(const char *file);
+void cfm_erps_uninit(void);
+void cfm_erps_mep_changed(const struct cfm_mep_state *mep, uint64_t now);
+void cfm_erps_raps_event(uint32_t br_ifindex, uint32_t mip_instance, uint8_t request_subcode,
+			 uint8_t status, const struct mac_addr *node_id, uint64_t now);
+void cfm_erps_stats_print(FILE *fp);
+
+#endif
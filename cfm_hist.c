@@ -0,0 +1,119 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "cfm_hist.h"
+
+#define CFM_HIST_SUB		(1U << CFM_HIST_SUB_BITS)
+
+/* Values below 2 * CFM_HIST_SUB map one to one. Above that the top
+ * CFM_HIST_SUB_BITS + 1 bits select the bucket within the power of two.
+ */
+static uint32_t cfm_hist_index(uint64_t v)
+{
+	uint32_t shift;
+
+	if (v < 2 * CFM_HIST_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzll(v) - CFM_HIST_SUB_BITS;
+	if (shift >= CFM_HIST_MAX_BITS - CFM_HIST_SUB_BITS - 1)
+		return CFM_HIST_BUCKETS - 1;
+
+	return (shift << CFM_HIST_SUB_BITS) + (v >> shift);
+}
+
+/* Middle of the value range of a bucket */
+static uint64_t cfm_hist_value(uint32_t idx)
+{
+	uint32_t shift;
+	uint64_t top;
+
+	if (idx < 2 * CFM_HIST_SUB)
+		return idx;
+
+	shift = (idx - CFM_HIST_SUB) >> CFM_HIST_SUB_BITS;
+	top = idx - (shift << CFM_HIST_SUB_BITS);
+
+	return (top << shift) + ((1ULL << shift) >> 1);
+}
+
+void cfm_hist_init(struct cfm_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void cfm_hist_add(struct cfm_hist *h, uint64_t v)
+{
+	uint64_t jitter;
+
+	if (h->count) {
+		jitter = v > h->last ? v - h->last : h->last - v;
+		h->jitter_sum += jitter;
+		if (jitter > h->jitter_max)
+			h->jitter_max = jitter;
+	}
+
+	h->buckets[cfm_hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	h->last = v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+uint64_t cfm_hist_percentile(const struct cfm_hist *h, double percentile)
+{
+	uint64_t rank, seen = 0;
+	uint32_t i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < CFM_HIST_BUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	/* The exact extremes are known, don't report a bucket middle beyond them */
+	if (i == CFM_HIST_BUCKETS || cfm_hist_value(i) > h->max)
+		return h->max;
+	if (cfm_hist_value(i) < h->min)
+		return h->min;
+
+	return cfm_hist_value(i);
+}
+
+uint64_t cfm_hist_mean(const struct cfm_hist *h)
+{
+	return h->count ? h->sum / h->count : 0;
+}
+
+uint64_t cfm_hist_jitter(const struct cfm_hist *h)
+{
+	return h->count > 1 ? h->jitter_sum / (h->count - 1) : 0;
+}
+
+void cfm_hist_print(FILE *fp, const char *name, const struct cfm_hist *h)
+{
+	if (!h->count) {
+		fprintf(fp, "    %s: no samples\n", name);
+		return;
+	}
+
+	fprintf(fp, "    %s (us): samples %" PRIu64 " min %.3f mean %.3f p50 %.3f p99 %.3f p99.9 %.3f max %.3f jitter %.3f\n",
+		name, h->count, h->min / 1000.0, cfm_hist_mean(h) / 1000.0,
+		cfm_hist_percentile(h, 50) / 1000.0, cfm_hist_percentile(h, 99) / 1000.0,
+		cfm_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0,
+		cfm_hist_jitter(h) / 1000.0);
+}
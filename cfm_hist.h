@@ -0,0 +1,37 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_HIST_H
+#define CFM_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Log-linear histogram in the style of HdrHistogram. Every power of two
+ * range is split in 2^CFM_HIST_SUB_BITS linear buckets, so a recorded value
+ * is off by at most 1/32 (3%) of itself. Values below 2^(CFM_HIST_MAX_BITS - 1)
+ * ns (9 minutes) are kept apart, larger ones land in the last bucket.
+ */
+#define CFM_HIST_SUB_BITS	5
+#define CFM_HIST_MAX_BITS	40
+#define CFM_HIST_BUCKETS	((CFM_HIST_MAX_BITS - CFM_HIST_SUB_BITS) << CFM_HIST_SUB_BITS)
+
+struct cfm_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t last;
+	uint64_t jitter_sum;	/* Sum of |v(n) - v(n-1)| */
+	uint64_t jitter_max;
+	uint32_t buckets[CFM_HIST_BUCKETS];
+};
+
+void cfm_hist_init(struct cfm_hist *h);
+void cfm_hist_add(struct cfm_hist *h, uint64_t v);
+uint64_t cfm_hist_percentile(const struct cfm_hist *h, double percentile);
+uint64_t cfm_hist_mean(const struct cfm_hist *h);
+uint64_t cfm_hist_jitter(const struct cfm_hist *h);
+void cfm_hist_print(FILE *fp, const char *name, const struct cfm_hist *h);
+
+#endif
@@ -0,0 +1,354 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <ev.h>
+#include <net/if.h>
+
+#include "cfm_ctl.h"
+#include "cfm_state.h"
+#include "cfm_history.h"
+#include "cfm_journal.h"
+
+/* All peers are sampled at the same ticks, so sample m of a tier is at
+ * m % CFM_HISTORY_SAMPLES in every ring and the rings need no head. A peer
+ * gets its rings when it is first sampled, from chunks allocated as
+ * needed, until the memory limit is reached. Peers are never removed.
+ *
+ * Reading the peer status clears its 'seen' flags in the kernel, so a
+ * sample tells whether a CCM was seen since the one before.
+ */
+
+#define HISTORY_CHUNK	1024	/* Peers per allocation */
+
+/* Counts of the base samples summed into one sample */
+struct history_sample {
+	uint8_t samples;	/* 0 - the peer was not sampled */
+	uint8_t seen;
+	uint8_t seq_unexp;
+	uint8_t defect;
+	uint8_t rdi;
+};
+
+_Static_assert(CFM_HISTORY_FACTOR * CFM_HISTORY_FACTOR <= UINT8_MAX,
+	       "Sample counts of the last tier must fit");
+
+#define HISTORY_PEER_SIZE	(CFM_HISTORY_TIERS * CFM_HISTORY_SAMPLES * \
+				 sizeof(struct history_sample))
+
+static struct cfm_history_config config;
+static ev_timer tick_watcher;
+static uint64_t tick;		/* Base samples taken */
+static uint64_t tick_ts[CFM_HISTORY_TIERS][CFM_HISTORY_SAMPLES];
+static struct history_sample **chunks;
+static uint32_t slot_count;
+static uint32_t slots_max;
+static uint64_t memory;		/* Allocated for rings */
+static uint32_t untracked;	/* Peers without rings in the last tick */
+static uint64_t tick_ns_max;
+static struct cfm_mep_state **new_meps;	/* Configuration read after the dump */
+static uint32_t new_mep_count;
+static uint32_t new_mep_size;
+
+static struct history_sample *history_ring(uint32_t slot, int tier)
+{
+	return chunks[slot / HISTORY_CHUNK] +
+	       ((slot % HISTORY_CHUNK) * CFM_HISTORY_TIERS + tier) * CFM_HISTORY_SAMPLES;
+}
+
+static int history_slot_alloc(struct cfm_peer_state *peer)
+{
+	uint32_t chunk = slot_count / HISTORY_CHUNK;
+	uint32_t peers;
+
+	if (slot_count == slots_max)
+		return -1;
+
+	if (!chunks[chunk]) {
+		peers = slots_max - chunk * HISTORY_CHUNK;
+		if (peers > HISTORY_CHUNK)
+			peers = HISTORY_CHUNK;
+		chunks[chunk] = calloc(peers, HISTORY_PEER_SIZE);
+		if (!chunks[chunk])
+			return -1;
+		memory += peers * HISTORY_PEER_SIZE;
+	}
+
+	peer->history_slot = ++slot_count;
+
+	return 0;
+}
+
+static uint64_t history_period(int tier)
+{
+	uint64_t period = 1;
+
+	while (tier--)
+		period *= CFM_HISTORY_FACTOR;
+
+	return period;
+}
+
+static void history_mep_new(struct cfm_mep_state *mep)
+{
+	struct cfm_mep_state **meps;
+
+	if (new_mep_count == new_mep_size) {
+		meps = realloc(new_meps, (new_mep_size ? 2 * new_mep_size : 16) * sizeof(*meps));
+		if (!meps)
+			return;
+		new_meps = meps;
+		new_mep_size = new_mep_size ? 2 * new_mep_size : 16;
+	}
+	new_meps[new_mep_count++] = mep;
+}
+
+struct history_tick_ctx {
+	uint32_t idx;
+	uint64_t now;
+};
+
+static void history_sample(int nsid, const struct cfm_mep_snapshot *snap, void *arg)
+{
+	const struct history_tick_ctx *ctx = arg;
+	uint32_t w, mepid;
+	struct cfm_peer_state *peer;
+	struct history_sample *s;
+	struct cfm_mep_state *mep;
+	uint64_t peers, bit;
+	uint8_t flags;
+
+	mep = cfm_state_mep_find(nsid, snap->info.br_ifindex, snap->info.instance);
+	if (!mep) {
+		mep = cfm_state_mep_add(nsid, snap->info.br_ifindex, snap->info.instance);
+		if (!mep)
+			return;
+		history_mep_new(mep);
+	}
+
+	for (w = 0; w < CFM_MEPID_WORDS; ++w) {
+		for (peers = snap->status[w]; peers; peers &= peers - 1) {
+			bit = peers & -peers;
+			mepid = w * 64 + __builtin_ctzll(peers);
+
+			peer = cfm_state_peer_get(mep, mepid);
+			if (!peer)
+				return;
+
+			if (config.journal) {
+				flags = (snap->seen[w] & bit ? CFM_JOURNAL_SAMPLE_SEEN : 0) |
+					(snap->seq_unexp[w] & bit ? CFM_JOURNAL_SAMPLE_SEQ_UNEXP : 0) |
+					(snap->defects[w] & bit ? CFM_JOURNAL_SAMPLE_DEFECT : 0) |
+					(snap->rdi[w] & bit ? CFM_JOURNAL_SAMPLE_RDI : 0);
+				cfm_journal_sample(nsid, mep->br_ifindex, mep->instance, mepid,
+						   flags, ctx->now);
+			}
+
+			if (!peer->history_slot && history_slot_alloc(peer)) {
+				untracked++;
+				continue;
+			}
+
+			s = &history_ring(peer->history_slot - 1, 0)[ctx->idx];
+			s->samples = 1;
+			s->seen = !!(snap->seen[w] & bit);
+			s->seq_unexp = !!(snap->seq_unexp[w] & bit);
+			s->defect = !!(snap->defects[w] & bit);
+			s->rdi = !!(snap->rdi[w] & bit);
+		}
+	}
+}
+
+/* Sample m of 'tier' sums the last CFM_HISTORY_FACTOR samples of the tier
+ * below
+ */
+static void history_aggregate(int tier, uint64_t m)
+{
+	uint32_t idx = m % CFM_HISTORY_SAMPLES, slot, j;
+	struct history_sample *src, *dst;
+	uint64_t from = m * CFM_HISTORY_FACTOR;
+
+	for (slot = 0; slot < slot_count; ++slot) {
+		src = history_ring(slot, tier - 1);
+		dst = &history_ring(slot, tier)[idx];
+		memset(dst, 0, sizeof(*dst));
+		for (j = 0; j < CFM_HISTORY_FACTOR; ++j) {
+			dst->samples += src[(from - j) % CFM_HISTORY_SAMPLES].samples;
+			dst->seen += src[(from - j) % CFM_HISTORY_SAMPLES].seen;
+			dst->seq_unexp += src[(from - j) % CFM_HISTORY_SAMPLES].seq_unexp;
+			dst->defect += src[(from - j) % CFM_HISTORY_SAMPLES].defect;
+			dst->rdi += src[(from - j) % CFM_HISTORY_SAMPLES].rdi;
+		}
+	}
+	tick_ts[tier][idx] = tick_ts[tier - 1][from % CFM_HISTORY_SAMPLES];
+}
+
+static void history_tick(EV_P_ ev_timer *w, int revents)
+{
+	uint64_t start = cfm_state_now(), period;
+	struct history_tick_ctx ctx = { .now = start };
+	uint32_t idx, slot, i;
+	int tier;
+
+	tick++;
+	idx = tick % CFM_HISTORY_SAMPLES;
+	ctx.idx = idx;
+
+	/* Peers missing from this dump get no sample */
+	for (slot = 0; slot < slot_count; ++slot)
+		memset(&history_ring(slot, 0)[idx], 0, sizeof(struct history_sample));
+
+	untracked = 0;
+	new_mep_count = 0;
+	cfm_state_snapshot(false, history_sample, &ctx);
+	for (i = 0; i < new_mep_count; ++i)
+		cfm_state_mep_info_load(new_meps[i]);
+	tick_ts[0][idx] = start;
+
+	for (tier = 1; tier < CFM_HISTORY_TIERS; ++tier) {
+		period = history_period(tier);
+		if (tick % period)
+			break;
+		history_aggregate(tier, tick / period);
+	}
+
+	if (cfm_state_now() - start > tick_ns_max)
+		tick_ns_max = cfm_state_now() - start;
+}
+
+/* history [netns <nsid>] bridge <bridge> instance <instance> peer <mepid>
+ *         [tier <tier>] [count <samples>]
+ */
+static void history_cmd(struct cfm_ctl_client *client, int argc, char **argv)
+{
+	uint32_t br_ifindex = 0, instance = 0, mepid = 0, count = CFM_HISTORY_SAMPLES;
+	const struct history_sample *ring, *s;
+	struct cfm_peer_state *peer;
+	struct cfm_mep_state *mep;
+	uint64_t period, last, first, m;
+	bool found = false, sep = false;
+	int i, nsid = -1, tier = 0;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "netns")) {
+			nsid = atoi(argv[i + 1]);
+		} else if (!strcmp(argv[i], "bridge")) {
+			br_ifindex = if_nametoindex(argv[i + 1]);
+			if (!br_ifindex)
+				br_ifindex = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "instance")) {
+			instance = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "peer")) {
+			mepid = strtoul(argv[i + 1], NULL, 10);
+			found = true;
+		} else if (!strcmp(argv[i], "tier")) {
+			tier = atoi(argv[i + 1]);
+		} else if (!strcmp(argv[i], "count")) {
+			count = strtoul(argv[i + 1], NULL, 10);
+		} else {
+			break;
+		}
+	}
+	if (i != argc || !br_ifindex || !found || tier < 0 || tier >= CFM_HISTORY_TIERS) {
+		cfm_ctl_error(client, "invalid arguments");
+		return;
+	}
+
+	mep = cfm_state_mep_find(nsid, br_ifindex, instance);
+	peer = mep ? cfm_state_peer_find(mep, mepid) : NULL;
+	if (!peer || !peer->history_slot) {
+		cfm_ctl_error(client, "no history of this peer");
+		return;
+	}
+
+	period = history_period(tier);
+	last = tick / period;
+	first = last >= CFM_HISTORY_SAMPLES ? last - CFM_HISTORY_SAMPLES + 1 : 1;
+	if (count < last - first + 1)
+		first = last - count + 1;
+	ring = history_ring(peer->history_slot - 1, tier);
+
+	cfm_ctl_printf(client, "{\"netns\":%d,\"bridge\":%u,\"instance\":%u,\"peer\":%u,"
+		       "\"tier\":%d,\"interval_ms\":%" PRIu64 ",",
+		       nsid, br_ifindex, instance, mepid, tier, config.resolution * period);
+	cfm_ctl_printf(client, "\"fields\":[\"ts\",\"samples\",\"seen\",\"seq_unexp\",\"defect\",\"rdi\"],"
+		       "\"samples\":[");
+	for (m = first; m <= last; ++m) {
+		s = &ring[m % CFM_HISTORY_SAMPLES];
+		if (!s->samples)
+			continue;
+		cfm_ctl_printf(client, "%s[%" PRIu64 ",%u,%u,%u,%u,%u]", sep ? "," : "",
+			       tick_ts[tier][m % CFM_HISTORY_SAMPLES], s->samples, s->seen,
+			       s->seq_unexp, s->defect, s->rdi);
+		sep = true;
+	}
+	cfm_ctl_printf(client, "]}");
+}
+
+static void history_info_cmd(struct cfm_ctl_client *client, int argc, char **argv)
+{
+	cfm_ctl_printf(client, "{\"resolution_ms\":%u,\"tiers\":%d,\"factor\":%d,\"samples\":%d,"
+		       "\"ticks\":%" PRIu64 ",\"peers\":%u,\"peers_max\":%u,\"untracked\":%u,"
+		       "\"memory\":%" PRIu64 ",\"memory_max\":%" PRIu64 ",\"tick_us_max\":%" PRIu64 "}",
+		       config.resolution, CFM_HISTORY_TIERS, CFM_HISTORY_FACTOR, CFM_HISTORY_SAMPLES,
+		       tick, slot_count, slots_max, untracked, memory,
+		       (uint64_t)config.memory << 20, tick_ns_max / 1000);
+}
+
+int cfm_history_init(const struct cfm_history_config *cfg)
+{
+	double interval;
+
+	if (!cfg->resolution) {
+		fprintf(stderr, "History resolution must be at least 1 ms\n");
+		return -1;
+	}
+
+	config = *cfg;
+	slots_max = ((uint64_t)config.memory << 20) / HISTORY_PEER_SIZE;
+	chunks = calloc(slots_max / HISTORY_CHUNK + 1, sizeof(*chunks));
+	if (!chunks)
+		return -1;
+
+	cfm_ctl_register("history", history_cmd);
+	cfm_ctl_register("history-info", history_info_cmd);
+
+	interval = config.resolution / 1000.0;
+	ev_timer_init(&tick_watcher, history_tick, interval, interval);
+	ev_timer_start(EV_DEFAULT, &tick_watcher);
+
+	return 0;
+}
+
+void cfm_history_uninit(void)
+{
+	uint32_t i;
+
+	if (!chunks)
+		return;
+
+	ev_timer_stop(EV_DEFAULT, &tick_watcher);
+	for (i = 0; i <= slots_max / HISTORY_CHUNK; ++i)
+		free(chunks[i]);
+	free(chunks);
+	chunks = NULL;
+	free(new_meps);
+	new_meps = NULL;
+	new_mep_size = 0;
+	slot_count = 0;
+	memory = 0;
+	tick = 0;
+	tick_ns_max = 0;
+}
+
+void cfm_history_stats_print(FILE *fp)
+{
+	fprintf(fp, "History every %u ms, %d tiers of %d samples, factor %d\n",
+		config.resolution, CFM_HISTORY_TIERS, CFM_HISTORY_SAMPLES, CFM_HISTORY_FACTOR);
+	fprintf(fp, "    Peers %u/%u untracked %u, memory %" PRIu64 "/%" PRIu64
+		" bytes, ticks %" PRIu64 " longest %" PRIu64 " us\n\n",
+		slot_count, slots_max, untracked, memory,
+		(uint64_t)config.memory << 20, tick, tick_ns_max / 1000);
+}
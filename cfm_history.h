@@ -0,0 +1,30 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_HISTORY_H
+#define CFM_HISTORY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Recent CCM history of every peer MEP, sampled from the kernel peer status
+ * every 'resolution' ms. Each tier keeps CFM_HISTORY_SAMPLES samples, and a
+ * sample of the next tier sums CFM_HISTORY_FACTOR of the one before.
+ */
+#define CFM_HISTORY_TIERS	3
+#define CFM_HISTORY_FACTOR	10
+#define CFM_HISTORY_SAMPLES	120
+#define CFM_HISTORY_MEMORY	64	/* MB, default */
+
+struct cfm_history_config {
+	uint32_t resolution;	/* ms */
+	uint32_t memory;	/* MB for the samples of all peers */
+	bool journal;		/* Also write the samples to the journal */
+};
+
+int cfm_history_init(const struct cfm_history_config *cfg);
+void cfm_history_uninit(void);
+void cfm_history_stats_print(FILE *fp);
+
+#endif
@@ -0,0 +1,477 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <ev.h>
+
+#include "cfm_journal.h"
+
+/* Records are collected in a buffer that is written when full, and written
+ * and fsync'ed together every flush interval. A crash loses at most that
+ * interval, and the disk sees one sync for all records of it.
+ */
+
+struct journal_key {
+	bool used;
+	int32_t nsid;
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t mepid;
+	uint32_t id;
+	uint8_t sample;		/* Last sample written */
+	uint64_t defect_events;	/* Last defect count written */
+	uint32_t records;
+	uint64_t first_off;
+	uint64_t last_off;
+};
+
+static const char *journal_dir;
+static uint32_t flush_ms;
+static ev_timer flush_watcher;
+static int seg_fd = -1;
+static char seg_path[PATH_MAX];
+static uint64_t seg_off;	/* Written and buffered */
+static uint64_t seg_first;
+static uint64_t seg_records;
+static uint64_t last_time;	/* us, of the record before */
+static uint64_t sync_off;	/* Of the last SYNC */
+static int64_t rt_offset;	/* ns, CLOCK_REALTIME - CLOCK_MONOTONIC */
+static uint8_t buf[CFM_JOURNAL_SYNC_BYTES];
+static uint32_t buf_len;
+
+/* Keys of the open segment, open addressing */
+static struct journal_key *keys;
+static uint32_t key_mask;
+static uint32_t key_count;
+
+static struct cfm_journal_sync *syncs;
+static uint32_t sync_count;
+static uint32_t sync_size;
+
+static uint64_t records;
+static uint64_t bytes;
+static uint64_t segments;
+static uint64_t fsyncs;
+static uint64_t fsync_ns_max;
+static uint64_t errors;
+
+static uint64_t journal_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void journal_write(void)
+{
+	uint32_t off = 0;
+	ssize_t n;
+
+	while (off < buf_len) {
+		n = write(seg_fd, buf + off, buf_len - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			errors++;
+			break;
+		}
+		off += n;
+	}
+	bytes += buf_len;
+	buf_len = 0;
+}
+
+static void journal_sync(void)
+{
+	uint64_t start;
+
+	if (seg_fd < 0)
+		return;
+
+	journal_write();
+	start = journal_clock(CLOCK_MONOTONIC);
+	if (fdatasync(seg_fd))
+		errors++;
+	fsyncs++;
+	if (journal_clock(CLOCK_MONOTONIC) - start > fsync_ns_max)
+		fsync_ns_max = journal_clock(CLOCK_MONOTONIC) - start;
+}
+
+static void journal_append(const uint8_t *rec, int len)
+{
+	if (buf_len + len > sizeof(buf))
+		journal_write();
+	memcpy(buf + buf_len, rec, len);
+	buf_len += len;
+	seg_off += len;
+}
+
+static void journal_sync_record(uint64_t time)
+{
+	struct cfm_journal_sync *s;
+	uint8_t rec[CFM_JOURNAL_RECORD_MAX];
+	int n = 2;
+
+	if (sync_count == sync_size) {
+		s = realloc(syncs, (sync_size ? 2 * sync_size : 64) * sizeof(*s));
+		if (s) {
+			syncs = s;
+			sync_size = sync_size ? 2 * sync_size : 64;
+		}
+	}
+	if (sync_count < sync_size) {
+		syncs[sync_count].time = time;
+		syncs[sync_count].off = seg_off;
+		sync_count++;
+	}
+
+	sync_off = seg_off;
+	last_time = time;
+	n += cfm_journal_varint_put(rec + n, time);
+	rec[0] = CFM_JOURNAL_SYNC;
+	rec[1] = n - 2;
+	journal_append(rec, n);
+}
+
+static int journal_key_cmp(const void *a, const void *b)
+{
+	const struct journal_key *x = a, *y = b;
+
+	if (x->nsid != y->nsid)
+		return x->nsid < y->nsid ? -1 : 1;
+	if (x->br_ifindex != y->br_ifindex)
+		return x->br_ifindex < y->br_ifindex ? -1 : 1;
+	if (x->instance != y->instance)
+		return x->instance < y->instance ? -1 : 1;
+	if (x->mepid != y->mepid)
+		return x->mepid < y->mepid ? -1 : 1;
+	return 0;
+}
+
+/* Written next to the index path and renamed, a reader sees all or nothing */
+static void journal_index_write(void)
+{
+	struct cfm_journal_index idx = {
+		.magic = CFM_JOURNAL_INDEX_MAGIC,
+		.version = CFM_JOURNAL_VERSION,
+		.key_count = key_count,
+		.sync_count = sync_count,
+		.first = seg_first,
+		.last = last_time,
+		.size = seg_off,
+		.records = seg_records,
+	};
+	struct cfm_journal_key k;
+	char path[PATH_MAX + 8], tmp[PATH_MAX + 16];
+	struct journal_key *sorted;
+	uint32_t i, n = 0;
+	FILE *fp;
+
+	sorted = malloc((key_count + 1) * sizeof(*sorted));
+	if (!sorted) {
+		errors++;
+		return;
+	}
+	for (i = 0; keys && i <= key_mask; ++i)
+		if (keys[i].used)
+			sorted[n++] = keys[i];
+	qsort(sorted, n, sizeof(*sorted), journal_key_cmp);
+
+	snprintf(path, sizeof(path), "%s.idx", seg_path);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		errors++;
+		free(sorted);
+		return;
+	}
+
+	fwrite(&idx, sizeof(idx), 1, fp);
+	for (i = 0; i < n; ++i) {
+		memset(&k, 0, sizeof(k));
+		k.nsid = sorted[i].nsid;
+		k.br_ifindex = sorted[i].br_ifindex;
+		k.instance = sorted[i].instance;
+		k.mepid = sorted[i].mepid;
+		k.id = sorted[i].id;
+		k.records = sorted[i].records;
+		k.first_off = sorted[i].first_off;
+		k.last_off = sorted[i].last_off;
+		fwrite(&k, sizeof(k), 1, fp);
+	}
+	fwrite(syncs, sizeof(*syncs), sync_count, fp);
+	free(sorted);
+
+	if (fflush(fp) || ferror(fp) || fsync(fileno(fp)) || fclose(fp) || rename(tmp, path)) {
+		errors++;
+		unlink(tmp);
+	}
+}
+
+static void journal_close(void)
+{
+	if (seg_fd < 0)
+		return;
+
+	journal_sync();
+	journal_index_write();
+	close(seg_fd);
+	seg_fd = -1;
+}
+
+static int journal_open(uint64_t time)
+{
+	struct cfm_journal_segment hdr = {
+		.magic = CFM_JOURNAL_MAGIC,
+		.version = CFM_JOURNAL_VERSION,
+		.header_size = sizeof(hdr),
+		.start = time,
+	};
+
+	/* Named by the start time, so names sort in time order */
+	snprintf(seg_path, sizeof(seg_path), "%s/%016" PRIx64 ".seg", journal_dir, time);
+	seg_fd = open(seg_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (seg_fd < 0) {
+		fprintf(stderr, "Cannot create %s: %s\n", seg_path, strerror(errno));
+		errors++;
+		return -1;
+	}
+
+	if (keys)
+		memset(keys, 0, (key_mask + 1) * sizeof(*keys));
+	key_count = 0;
+	sync_count = 0;
+	seg_off = 0;
+	seg_first = time;
+	seg_records = 0;
+	segments++;
+
+	journal_append((const uint8_t *)&hdr, sizeof(hdr));
+	journal_sync_record(time);
+
+	return 0;
+}
+
+/* Make room for a record and the KEY record before it */
+static int journal_prepare(uint64_t time)
+{
+	if (seg_fd >= 0 && seg_off + 2 * CFM_JOURNAL_RECORD_MAX > CFM_JOURNAL_SEGMENT_SIZE)
+		journal_close();
+	if (seg_fd < 0 && journal_open(time))
+		return -1;
+
+	if (seg_off - sync_off >= CFM_JOURNAL_SYNC_BYTES)
+		journal_sync_record(time);
+
+	return 0;
+}
+
+static uint64_t journal_time(uint64_t ts)
+{
+	uint64_t time = (ts + rt_offset) / 1000;
+
+	/* Differences are unsigned */
+	return time < last_time ? last_time : time;
+}
+
+static uint32_t journal_key_hash(int nsid, uint32_t br_ifindex, uint32_t instance, uint32_t mepid)
+{
+	uint64_t key = ((uint64_t)br_ifindex << 32 | instance) ^ ((uint64_t)mepid << 16) ^ (uint32_t)nsid;
+
+	return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static int journal_keys_grow(void)
+{
+	struct journal_key *old = keys;
+	uint32_t old_size = old ? key_mask + 1 : 0;
+	uint32_t size = old_size ? 2 * old_size : 1024;
+	uint32_t i, h;
+
+	keys = calloc(size, sizeof(*keys));
+	if (!keys) {
+		keys = old;
+		return -1;
+	}
+	key_mask = size - 1;
+
+	for (i = 0; i < old_size; ++i) {
+		if (!old[i].used)
+			continue;
+		h = journal_key_hash(old[i].nsid, old[i].br_ifindex, old[i].instance,
+				     old[i].mepid) & key_mask;
+		while (keys[h].used)
+			h = (h + 1) & key_mask;
+		keys[h] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+static struct journal_key *journal_key(int nsid, uint32_t br_ifindex, uint32_t instance,
+				       uint32_t mepid)
+{
+	uint8_t rec[CFM_JOURNAL_RECORD_MAX];
+	struct journal_key *k;
+	uint32_t h;
+	int n = 2;
+
+	if ((!keys || 2 * (key_count + 1) > key_mask + 1) && journal_keys_grow())
+		return NULL;
+
+	h = journal_key_hash(nsid, br_ifindex, instance, mepid) & key_mask;
+	for (; keys[h].used; h = (h + 1) & key_mask) {
+		k = &keys[h];
+		if (k->br_ifindex == br_ifindex && k->instance == instance && k->mepid == mepid &&
+		    k->nsid == nsid)
+			return k;
+	}
+
+	k = &keys[h];
+	k->used = true;
+	k->nsid = nsid;
+	k->br_ifindex = br_ifindex;
+	k->instance = instance;
+	k->mepid = mepid;
+	k->id = key_count++;
+	k->sample = CFM_JOURNAL_SAMPLE_CLEAN;
+
+	n += cfm_journal_varint_put(rec + n, k->id);
+	n += cfm_journal_varint_put(rec + n, nsid + 1);
+	n += cfm_journal_varint_put(rec + n, br_ifindex);
+	n += cfm_journal_varint_put(rec + n, instance);
+	n += cfm_journal_varint_put(rec + n, mepid);
+	rec[0] = CFM_JOURNAL_KEY;
+	rec[1] = n - 2;
+	journal_append(rec, n);
+
+	return k;
+}
+
+static void journal_keyed_append(struct journal_key *k, uint8_t *rec, int n, uint64_t time)
+{
+	if (!k->records)
+		k->first_off = seg_off;
+	k->records++;
+	journal_append(rec, n);
+	k->last_off = seg_off;
+	last_time = time;
+	seg_records++;
+	records++;
+}
+
+void cfm_journal_peer(int nsid, uint32_t br_ifindex, uint32_t instance, uint32_t mepid,
+		      bool defect, uint64_t defect_events, uint64_t ts)
+{
+	uint8_t rec[CFM_JOURNAL_RECORD_MAX];
+	uint64_t time = journal_time(ts);
+	struct journal_key *k;
+	int n = 2;
+
+	if (!journal_dir || journal_prepare(time))
+		return;
+	k = journal_key(nsid, br_ifindex, instance, mepid);
+	if (!k)
+		return;
+
+	n += cfm_journal_varint_put(rec + n, time - last_time);
+	n += cfm_journal_varint_put(rec + n, k->id);
+	rec[n++] = defect;
+	n += cfm_journal_varint_put(rec + n, defect_events - k->defect_events);
+	k->defect_events = defect_events;
+	rec[0] = CFM_JOURNAL_PEER;
+	rec[1] = n - 2;
+	journal_keyed_append(k, rec, n, time);
+}
+
+void cfm_journal_sample(int nsid, uint32_t br_ifindex, uint32_t instance, uint32_t mepid,
+			uint8_t flags, uint64_t ts)
+{
+	uint8_t rec[CFM_JOURNAL_RECORD_MAX];
+	uint64_t time = journal_time(ts);
+	struct journal_key *k;
+	int n = 2;
+
+	if (!journal_dir || journal_prepare(time))
+		return;
+	k = journal_key(nsid, br_ifindex, instance, mepid);
+	if (!k || k->sample == flags)
+		return;
+	k->sample = flags;
+
+	n += cfm_journal_varint_put(rec + n, time - last_time);
+	n += cfm_journal_varint_put(rec + n, k->id);
+	rec[n++] = flags;
+	rec[0] = CFM_JOURNAL_SAMPLE;
+	rec[1] = n - 2;
+	journal_keyed_append(k, rec, n, time);
+}
+
+static void journal_flush(EV_P_ ev_timer *w, int revents)
+{
+	rt_offset = journal_clock(CLOCK_REALTIME) - journal_clock(CLOCK_MONOTONIC);
+	if (buf_len)
+		journal_sync();
+}
+
+int cfm_journal_init(const char *dir, uint32_t flush)
+{
+	uint8_t rec[CFM_JOURNAL_RECORD_MAX];
+	uint64_t time;
+	int n = 2;
+
+	journal_dir = dir;
+	flush_ms = flush ? flush : CFM_JOURNAL_FLUSH_MS;
+	rt_offset = journal_clock(CLOCK_REALTIME) - journal_clock(CLOCK_MONOTONIC);
+
+	/* A new segment for every run, the last one may lack its index */
+	time = journal_time(journal_clock(CLOCK_MONOTONIC));
+	if (journal_open(time)) {
+		journal_dir = NULL;
+		return -1;
+	}
+	n += cfm_journal_varint_put(rec + n, 0);
+	rec[0] = CFM_JOURNAL_START;
+	rec[1] = n - 2;
+	journal_append(rec, n);
+	journal_sync();
+
+	ev_timer_init(&flush_watcher, journal_flush, flush_ms / 1000.0, flush_ms / 1000.0);
+	ev_timer_start(EV_DEFAULT, &flush_watcher);
+
+	return 0;
+}
+
+void cfm_journal_uninit(void)
+{
+	if (!journal_dir)
+		return;
+
+	ev_timer_stop(EV_DEFAULT, &flush_watcher);
+	journal_close();
+	free(keys);
+	keys = NULL;
+	free(syncs);
+	syncs = NULL;
+	sync_size = 0;
+	journal_dir = NULL;
+}
+
+void cfm_journal_stats_print(FILE *fp)
+{
+	fprintf(fp, "Journal in %s, fsync every %u ms\n", journal_dir, flush_ms);
+	fprintf(fp, "    Records %" PRIu64 " bytes %" PRIu64 " segments %" PRIu64
+		" fsyncs %" PRIu64 " longest %" PRIu64 " us errors %" PRIu64 "\n",
+		records, bytes + buf_len, segments, fsyncs, fsync_ns_max / 1000, errors);
+	fprintf(fp, "    Segment %s: %" PRIu64 " bytes, %" PRIu64 " records, %u peers\n\n",
+		seg_path, seg_off, seg_records, key_count);
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_JOURNAL_H
+#define CFM_JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Append-only journal of peer MEP defect changes and CCM samples written
+ * by cfm_server into a directory of segment files.
+ *
+ * A segment is a struct cfm_journal_segment followed by records. Every
+ * record is a struct cfm_journal_record and 'len' bytes of varints.
+ * Timestamps are us of CLOCK_REALTIME, stored as the difference to the
+ * record before. A SYNC record holds the full time and restarts the
+ * differences, one is written every CFM_JOURNAL_SYNC_BYTES so a reader can
+ * start there. Peers are written as key IDs, defined by a KEY record
+ * before their first use in the segment.
+ *
+ * When a segment is closed, an index '<segment>.idx' is written: a struct
+ * cfm_journal_index, the keys sorted by (netns, bridge, instance, peer)
+ * and the SYNC records. Segments without an index are scanned.
+ */
+
+#define CFM_JOURNAL_MAGIC		0x4a4d4643	/* "CFMJ" */
+#define CFM_JOURNAL_INDEX_MAGIC		0x494d4643	/* "CFMI" */
+#define CFM_JOURNAL_VERSION		1
+#define CFM_JOURNAL_SEGMENT_SIZE	(64 << 20)
+#define CFM_JOURNAL_SYNC_BYTES		(64 << 10)
+#define CFM_JOURNAL_FLUSH_MS		1000	/* Default time between fsyncs */
+#define CFM_JOURNAL_RECORD_MAX		64
+
+enum cfm_journal_type {
+	CFM_JOURNAL_SYNC = 1,	/* time */
+	CFM_JOURNAL_START,	/* time, the server started */
+	CFM_JOURNAL_KEY,	/* id, netns + 1, bridge, instance, peer MEPID */
+	CFM_JOURNAL_PEER,	/* time, id, defect, defect count change since the last one */
+	CFM_JOURNAL_SAMPLE,	/* time, id, CFM_JOURNAL_SAMPLE_* */
+};
+
+/* Samples are only written when they differ from the one before of the
+ * same peer. Before the first one, a peer is taken to have seen CCMs and
+ * nothing else.
+ */
+#define CFM_JOURNAL_SAMPLE_SEEN		0x01
+#define CFM_JOURNAL_SAMPLE_SEQ_UNEXP	0x02
+#define CFM_JOURNAL_SAMPLE_DEFECT	0x04
+#define CFM_JOURNAL_SAMPLE_RDI		0x08
+#define CFM_JOURNAL_SAMPLE_CLEAN	CFM_JOURNAL_SAMPLE_SEEN
+
+struct cfm_journal_segment {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t reserved;
+	uint64_t start;		/* us, CLOCK_REALTIME */
+	uint64_t reserved2[5];
+};
+
+struct cfm_journal_record {
+	uint8_t type;
+	uint8_t len;
+};
+
+struct cfm_journal_index {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t key_count;
+	uint32_t sync_count;
+	uint64_t first;		/* us, CLOCK_REALTIME, of the first and last record */
+	uint64_t last;
+	uint64_t size;		/* Of the segment it indexes */
+	uint64_t records;
+};
+
+struct cfm_journal_key {
+	int32_t nsid;
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t mepid;
+	uint32_t id;
+	uint32_t records;
+	uint64_t first_off;	/* Of its first record */
+	uint64_t last_off;	/* Past its last record */
+};
+
+struct cfm_journal_sync {
+	uint64_t time;
+	uint64_t off;
+};
+
+static inline int cfm_journal_varint_put(uint8_t *p, uint64_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+/* Returns the bytes used, 0 if it runs past 'end' */
+static inline int cfm_journal_varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	int n = 0, shift = 0;
+
+	*v = 0;
+	while (p + n < end && shift < 64) {
+		*v |= (uint64_t)(p[n] & 0x7f) << shift;
+		if (!(p[n++] & 0x80))
+			return n;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+/* Writer, in cfm_server */
+int cfm_journal_init(const char *dir, uint32_t flush_ms);
+void cfm_journal_uninit(void);
+void cfm_journal_peer(int nsid, uint32_t br_ifindex, uint32_t instance, uint32_t mepid,
+		      bool defect, uint64_t defect_events, uint64_t ts);
+void cfm_journal_sample(int nsid, uint32_t br_ifindex, uint32_t instance, uint32_t mepid,
+			uint8_t flags, uint64_t ts);
+void cfm_journal_stats_print(FILE *fp);
+
+/* Reader, in cfm */
+struct cfm_journal_query {
+	const char *dir;
+	int nsid;		/* -1 - the server's own namespace */
+	uint32_t br_ifindex;
+	uint32_t instance;	/* 0 - any */
+	uint32_t mepid;		/* 0 - any */
+	uint64_t from;		/* us, CLOCK_REALTIME */
+	uint64_t to;
+};
+
+int cfm_journal_show(const struct cfm_journal_query *q);
+
+#endif
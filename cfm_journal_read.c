@@ -0,0 +1,340 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cfm_journal.h"
+
+/* Segments are mapped and decoded in place. With an index, a segment
+ * without the wanted peers is skipped, and the scan of the others starts
+ * at the SYNC record before the first wanted record and ends after the last
+ * wanted record or at 'to'. PEER records carry the change of the defect
+ * count, so the scan sums them from the first one of the segment, also
+ * before 'from'.
+ */
+
+struct journal_scan_key {
+	struct cfm_journal_key key;
+	bool wanted;
+	uint64_t defect_events;	/* Sum of the PEER records so far */
+};
+
+struct journal_scan {
+	const struct cfm_journal_query *q;
+	struct journal_scan_key *keys;	/* By ID */
+	uint32_t key_size;
+	uint64_t records;		/* Decoded */
+	uint64_t shown;
+	uint32_t segments;
+	uint32_t indexed;
+	uint32_t skipped;
+};
+
+static uint64_t journal_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool journal_key_match(const struct cfm_journal_query *q, int nsid, uint32_t br_ifindex,
+			      uint32_t instance, uint32_t mepid)
+{
+	return nsid == q->nsid && br_ifindex == q->br_ifindex &&
+	       (!q->instance || instance == q->instance) && (!q->mepid || mepid == q->mepid);
+}
+
+static int journal_key_set(struct journal_scan *s, const struct cfm_journal_key *key)
+{
+	struct journal_scan_key *keys;
+	uint32_t size;
+
+	if (key->id >= s->key_size) {
+		size = s->key_size ? s->key_size : 1024;
+		while (size <= key->id)
+			size *= 2;
+		keys = realloc(s->keys, size * sizeof(*keys));
+		if (!keys)
+			return -1;
+		memset(keys + s->key_size, 0, (size - s->key_size) * sizeof(*keys));
+		s->keys = keys;
+		s->key_size = size;
+	}
+
+	s->keys[key->id].key = *key;
+	s->keys[key->id].wanted = journal_key_match(s->q, key->nsid, key->br_ifindex,
+						    key->instance, key->mepid);
+	s->keys[key->id].defect_events = 0;
+
+	return 0;
+}
+
+static void journal_time_print(uint64_t time)
+{
+	time_t sec = time / 1000000;
+	struct tm tm;
+	char buf[32];
+
+	localtime_r(&sec, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%06u ", buf, (unsigned)(time % 1000000));
+}
+
+static void journal_key_print(const struct cfm_journal_key *key)
+{
+	if (key->nsid >= 0)
+		printf("Netns %d ", key->nsid);
+	printf("Bridge %u instance %u peer-mep %u ", key->br_ifindex, key->instance, key->mepid);
+}
+
+/* Decode [off, end), returns -1 on a damaged record */
+static int journal_scan(struct journal_scan *s, const uint8_t *base, uint64_t off, uint64_t end)
+{
+	const uint8_t *p = base + off, *stop = base + end, *pl, *pe;
+	const struct cfm_journal_record *rec;
+	struct journal_scan_key *k;
+	struct cfm_journal_key key;
+	uint64_t time = 0, v[5];
+	int i, n, count;
+
+	while (p + sizeof(*rec) <= stop) {
+		rec = (const void *)p;
+		pl = p + sizeof(*rec);
+		pe = pl + rec->len;
+		if (pe > stop)
+			return -1;
+		p = pe;
+		s->records++;
+
+		/* Every record is time and ID, or only varints */
+		count = rec->type == CFM_JOURNAL_KEY ? 5 : rec->type == CFM_JOURNAL_PEER ||
+			rec->type == CFM_JOURNAL_SAMPLE ? 2 : 1;
+		for (i = 0; i < count; ++i) {
+			n = cfm_journal_varint_get(pl, pe, &v[i]);
+			if (!n)
+				return -1;
+			pl += n;
+		}
+
+		switch (rec->type) {
+		case CFM_JOURNAL_SYNC:
+			time = v[0];
+			break;
+		case CFM_JOURNAL_START:
+			time += v[0];
+			if (time > s->q->to)
+				return 0;
+			if (time >= s->q->from) {
+				journal_time_print(time);
+				printf("Server started\n");
+			}
+			break;
+		case CFM_JOURNAL_KEY:
+			memset(&key, 0, sizeof(key));
+			key.id = v[0];
+			key.nsid = (int)v[1] - 1;
+			key.br_ifindex = v[2];
+			key.instance = v[3];
+			key.mepid = v[4];
+			if (journal_key_set(s, &key))
+				return -1;
+			break;
+		case CFM_JOURNAL_PEER:
+		case CFM_JOURNAL_SAMPLE:
+			time += v[0];
+			if (time > s->q->to)
+				return 0;
+			if (v[1] >= s->key_size || !s->keys[v[1]].wanted)
+				break;
+			if (pl >= pe)
+				return -1;
+
+			k = &s->keys[v[1]];
+			if (rec->type == CFM_JOURNAL_PEER) {
+				if (!cfm_journal_varint_get(pl + 1, pe, &v[2]))
+					return -1;
+				k->defect_events += v[2];
+			}
+			if (time < s->q->from)
+				break;
+
+			journal_time_print(time);
+			journal_key_print(&k->key);
+			if (rec->type == CFM_JOURNAL_PEER) {
+				printf("CCM defect %u defects %" PRIu64 "\n", *pl, k->defect_events);
+			} else {
+				printf("seen %u seq-unexp %u defect %u rdi %u\n",
+				       !!(*pl & CFM_JOURNAL_SAMPLE_SEEN),
+				       !!(*pl & CFM_JOURNAL_SAMPLE_SEQ_UNEXP),
+				       !!(*pl & CFM_JOURNAL_SAMPLE_DEFECT),
+				       !!(*pl & CFM_JOURNAL_SAMPLE_RDI));
+			}
+			s->shown++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* The range of the segment to scan, from its index. Returns false if the
+ * segment holds nothing wanted.
+ */
+static bool journal_index_range(struct journal_scan *s, const struct cfm_journal_index *idx,
+				uint64_t *off, uint64_t *end)
+{
+	const struct cfm_journal_key *keys = (const void *)(idx + 1);
+	const struct cfm_journal_sync *syncs = (const void *)(keys + idx->key_count);
+	uint64_t first = UINT64_MAX, last = 0, start = 0;
+	uint32_t i;
+
+	if (idx->last < s->q->from || idx->first > s->q->to)
+		return false;
+
+	for (i = 0; i < idx->key_count; ++i) {
+		if (!journal_key_match(s->q, keys[i].nsid, keys[i].br_ifindex, keys[i].instance,
+				       keys[i].mepid))
+			continue;
+		if (journal_key_set(s, &keys[i]))
+			return false;
+		if (keys[i].first_off < first)
+			first = keys[i].first_off;
+		if (keys[i].last_off > last)
+			last = keys[i].last_off;
+	}
+	if (first == UINT64_MAX)
+		return false;
+
+	/* A scan must start at a SYNC, times are relative before the first */
+	for (i = 0; i < idx->sync_count; ++i) {
+		if (syncs[i].off > first)
+			break;
+		start = syncs[i].off;
+	}
+
+	*off = start;
+	*end = last;
+	return true;
+}
+
+static void journal_segment_show(struct journal_scan *s, const char *path)
+{
+	const struct cfm_journal_segment *hdr;
+	const struct cfm_journal_index *idx = NULL;
+	char idx_path[PATH_MAX + 8];
+	struct stat st, idx_st;
+	uint64_t off, end;
+	void *map, *idx_map = NULL;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	hdr = map;
+	if (hdr->magic != CFM_JOURNAL_MAGIC || hdr->version != CFM_JOURNAL_VERSION) {
+		fprintf(stderr, "%s is not a journal segment\n", path);
+		goto out;
+	}
+	s->segments++;
+
+	/* The index of a segment still written, or cut short, is missing */
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+	fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		if (!fstat(fd, &idx_st) && idx_st.st_size >= (off_t)sizeof(*idx)) {
+			idx_map = mmap(NULL, idx_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (idx_map == MAP_FAILED)
+				idx_map = NULL;
+		}
+		close(fd);
+	}
+	idx = idx_map;
+	if (idx && (idx->magic != CFM_JOURNAL_INDEX_MAGIC || idx->version != CFM_JOURNAL_VERSION ||
+		    idx->size != (uint64_t)st.st_size ||
+		    (uint64_t)idx_st.st_size != sizeof(*idx) +
+		    idx->key_count * sizeof(struct cfm_journal_key) +
+		    idx->sync_count * sizeof(struct cfm_journal_sync)))
+		idx = NULL;
+
+	if (s->keys)
+		memset(s->keys, 0, s->key_size * sizeof(*s->keys));
+
+	if (idx) {
+		s->indexed++;
+		if (!journal_index_range(s, idx, &off, &end)) {
+			s->skipped++;
+			goto out;
+		}
+	} else {
+		off = hdr->header_size;
+		end = st.st_size;
+	}
+
+	if (journal_scan(s, map, off, end))
+		fprintf(stderr, "%s: damaged record, rest of the segment skipped\n", path);
+
+out:
+	if (idx_map)
+		munmap(idx_map, idx_st.st_size);
+	munmap(map, st.st_size);
+}
+
+static int journal_segment_filter(const struct dirent *de)
+{
+	size_t len = strlen(de->d_name);
+
+	return len > 4 && !strcmp(de->d_name + len - 4, ".seg");
+}
+
+int cfm_journal_show(const struct cfm_journal_query *q)
+{
+	struct journal_scan s = { .q = q };
+	uint64_t start = journal_clock(), next;
+	struct dirent **names;
+	char path[PATH_MAX];
+	int i, count;
+
+	count = scandir(q->dir, &names, journal_segment_filter, alphasort);
+	if (count < 0) {
+		fprintf(stderr, "Cannot read %s\n", q->dir);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		/* A segment ends where the next one starts */
+		next = i + 1 < count ? strtoull(names[i + 1]->d_name, NULL, 16) : UINT64_MAX;
+		if (next >= q->from && strtoull(names[i]->d_name, NULL, 16) <= q->to) {
+			snprintf(path, sizeof(path), "%s/%s", q->dir, names[i]->d_name);
+			journal_segment_show(&s, path);
+		}
+		free(names[i]);
+	}
+	free(names);
+	free(s.keys);
+
+	printf("%" PRIu64 " records shown, %" PRIu64 " decoded in %u segments (%u indexed, %u skipped) in %.1f ms\n",
+	       s.shown, s.records, s.segments, s.indexed, s.skipped,
+	       (journal_clock() - start) / 1000000.0);
+
+	return 0;
+}
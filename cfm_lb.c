@@ -0,0 +1,299 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <linux/if_ether.h>
+
+#include "cfm_pdu.h"
+#include "cfm_hist.h"
+#include "cfm_oam.h"
+#include "cfm_lb.h"
+
+/* Transactions in flight are tracked in a ring indexed by the low bits of
+ * the transaction ID. An LBR arriving after its slot was reused is late.
+ */
+#define CFM_LB_RING_BITS	16
+#define CFM_LB_RING_SIZE	(1U << CFM_LB_RING_BITS)
+#define CFM_LB_RING_MASK	(CFM_LB_RING_SIZE - 1)
+
+/* Pacing granularity, and the most LBMs sent per tick before receiving */
+#define CFM_LB_TICK_NS		1000000ULL
+#define CFM_LB_TICK_MAX		4096
+
+/* Time to wait for the last LBRs after the final LBM */
+#define CFM_LB_LINGER_NS	1000000000ULL
+
+#define CFM_LB_PDU_MIN		(4 + 4 + 1)
+
+enum cfm_lb_state {
+	CFM_LB_FREE,
+	CFM_LB_PENDING,
+	CFM_LB_ANSWERED,
+};
+
+struct cfm_lb_trans {
+	uint64_t tx;		/* ns, userspace time just before sending */
+	uint32_t id;
+	uint32_t state;
+};
+
+struct cfm_lb {
+	struct cfm_oam oam;
+	const struct cfm_lb_config *cfg;
+
+	uint8_t frames[CFM_OAM_BATCH_MAX][CFM_OAM_FRAME_MAX];
+	uint32_t pdu_len;
+	uint32_t burst;
+	uint64_t tick;
+	uint64_t start;
+	uint64_t last_tx;
+
+	struct cfm_lb_trans *ring;
+	uint32_t next_id;
+	uint32_t highest_id;	/* Highest transaction ID answered */
+
+	uint64_t sent;
+	uint64_t received;
+	uint64_t out_of_order;
+	uint64_t duplicates;
+	uint64_t late;
+	uint64_t lbm_answered;
+	struct cfm_hist rtt;
+
+	struct cfm_oam_timer tx_timer;
+	struct cfm_oam_timer stop;
+};
+
+static void cfm_lb_stop(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	oam->quit = 1;
+}
+
+/* Build the LBM template, with a Data TLV when a frame size is given */
+static void cfm_lb_frame_init(struct cfm_lb *lb)
+{
+	uint32_t size = lb->cfg->size, data_len, i;
+	uint8_t *pdu;
+
+	lb->pdu_len = CFM_LB_PDU_MIN;
+	if (size > CFM_OAM_FRAME_MAX)
+		size = CFM_OAM_FRAME_MAX;
+	if (size > ETH_HLEN + CFM_LB_PDU_MIN + 3)
+		lb->pdu_len = size - ETH_HLEN;
+
+	for (i = 0; i < CFM_OAM_BATCH_MAX; ++i) {
+		memset(lb->frames[i], 0, sizeof(lb->frames[i]));
+		pdu = cfm_oam_frame_init(&lb->oam, lb->frames[i], &lb->cfg->dmac);
+		cfm_pdu_hdr_put(pdu, lb->oam.mep.level, CFM_OPCODE_LBM, 0, CFM_LBM_TLV_OFFSET);
+
+		if (lb->pdu_len > CFM_LB_PDU_MIN) {
+			data_len = lb->pdu_len - CFM_LB_PDU_MIN - 3;
+			pdu[8] = CFM_DATA_TLV_TYPE;
+			cfm_pdu_put_u16(pdu + 9, data_len);
+			memset(pdu + 11, 0xA5, data_len);
+		}
+	}
+}
+
+/* LBMs due since the start at the configured rate, without overflowing
+ * for long runs at high rates.
+ */
+static uint64_t cfm_lb_due(struct cfm_lb *lb, uint64_t now)
+{
+	uint64_t elapsed = now - lb->start;
+
+	return elapsed / 1000000000ULL * lb->cfg->rate +
+	       elapsed % 1000000000ULL * lb->cfg->rate / 1000000000ULL + 1;
+}
+
+static void cfm_lb_tx(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_lb *lb = (struct cfm_lb *)oam;
+	uint8_t *frames[CFM_OAM_BATCH_MAX];
+	uint32_t lens[CFM_OAM_BATCH_MAX];
+	uint64_t todo, left = UINT64_MAX;
+	struct cfm_lb_trans *t;
+	unsigned int i, n;
+	int sent;
+
+	todo = lb->cfg->rate ? cfm_lb_due(lb, now) - lb->sent : lb->burst;
+	if (todo > CFM_LB_TICK_MAX)
+		todo = CFM_LB_TICK_MAX;
+	if (lb->cfg->count)
+		left = lb->cfg->count - lb->sent;
+	if (todo > left)
+		todo = left;
+
+	while (todo) {
+		n = todo < lb->burst ? todo : lb->burst;
+		now = cfm_oam_now();
+		for (i = 0; i < n; ++i) {
+			frames[i] = lb->frames[i];
+			lens[i] = lb->pdu_len;
+			cfm_pdu_put_u32(frames[i] + ETH_HLEN + CFM_LB_TRANS_ID_OFFSET, lb->next_id + i);
+		}
+
+		sent = cfm_oam_send_many(oam, frames, lens, n);
+		for (i = 0; i < (unsigned int)sent; ++i) {
+			t = &lb->ring[(lb->next_id + i) & CFM_LB_RING_MASK];
+			t->id = lb->next_id + i;
+			t->tx = now;
+			t->state = CFM_LB_PENDING;
+		}
+		lb->next_id += sent;
+		lb->sent += sent;
+		lb->last_tx = now;
+		todo -= sent;
+
+		/* The socket is backed up, try again on the next tick */
+		if ((unsigned int)sent < n)
+			break;
+	}
+
+	if (lb->cfg->count && lb->sent >= lb->cfg->count) {
+		cfm_oam_timer_start(oam, &lb->stop, now + CFM_LB_LINGER_NS);
+		return;
+	}
+
+	cfm_oam_timer_start(oam, timer, lb->cfg->rate ? timer->expires + lb->tick : now);
+}
+
+static void cfm_lb_lbr_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_lb *lb = arg;
+	struct cfm_lb_trans *t;
+	uint32_t id;
+
+	if (frame->len < CFM_LB_TRANS_ID_OFFSET + 4)
+		return;
+
+	id = cfm_pdu_get_u32(frame->pdu + CFM_LB_TRANS_ID_OFFSET);
+	t = &lb->ring[id & CFM_LB_RING_MASK];
+
+	if (t->id != id || t->state == CFM_LB_FREE) {
+		lb->late++;
+		return;
+	}
+	if (t->state == CFM_LB_ANSWERED) {
+		lb->duplicates++;
+		return;
+	}
+
+	t->state = CFM_LB_ANSWERED;
+	if (lb->received && (int32_t)(id - lb->highest_id) < 0)
+		lb->out_of_order++;
+	else
+		lb->highest_id = id;
+	lb->received++;
+
+	if (frame->ts > t->tx)
+		cfm_hist_add(&lb->rtt, frame->ts - t->tx);
+}
+
+static void cfm_lb_lbm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_lb *lb = arg;
+	uint8_t reply[CFM_OAM_FRAME_MAX];
+	struct mac_addr peer;
+	uint32_t len = frame->len;
+	uint8_t *pdu;
+
+	if (len < CFM_LB_TRANS_ID_OFFSET + 4)
+		return;
+	if (len > CFM_OAM_FRAME_MAX - ETH_HLEN)
+		len = CFM_OAM_FRAME_MAX - ETH_HLEN;
+
+	memcpy(peer.addr, frame->mac + ETH_ALEN, ETH_ALEN);
+	pdu = cfm_oam_frame_init(oam, reply, &peer);
+	memcpy(pdu, frame->pdu, len);
+	pdu[1] = CFM_OPCODE_LBR;
+
+	if (cfm_oam_send(oam, reply, len) == 0)
+		lb->lbm_answered++;
+}
+
+static void cfm_lb_report(struct cfm_lb *lb)
+{
+	uint64_t duration = lb->last_tx > lb->start ? lb->last_tx - lb->start : 0;
+
+	if (lb->cfg->initiator) {
+		printf("Sent %" PRIu64 "\n", lb->sent);
+		if (duration)
+			printf("    Rate %.0f frames/s\n", lb->sent * 1e9 / duration);
+		printf("Received %" PRIu64 "\n", lb->received);
+		printf("    Lost %" PRIu64 " (%.3f%%)\n", lb->sent - lb->received,
+		       lb->sent ? 100.0 * (lb->sent - lb->received) / lb->sent : 0);
+		printf("    Out of order %" PRIu64 "\n", lb->out_of_order);
+		printf("    Duplicates %" PRIu64 "\n", lb->duplicates);
+		printf("    Late %" PRIu64 "\n", lb->late);
+		cfm_hist_print(stdout, "Round trip", &lb->rtt);
+	}
+
+	if (lb->cfg->responder)
+		printf("LBM answered %" PRIu64 "\n", lb->lbm_answered);
+	if (lb->oam.tx_errors)
+		printf("TX errors %" PRIu64 "\n", lb->oam.tx_errors);
+}
+
+int cfm_lb_run(const struct cfm_lb_config *cfg)
+{
+	const uint8_t opcodes[] = { CFM_OPCODE_LBM, CFM_OPCODE_LBR };
+	struct cfm_lb *lb;
+	int err = -1;
+
+	if (!cfg->initiator && !cfg->responder) {
+		fprintf(stderr, "No destination and not a responder\n");
+		return -1;
+	}
+
+	lb = calloc(1, sizeof(*lb));
+	if (!lb)
+		return -1;
+	lb->oam.tx_fd = -1;
+	lb->oam.rx.fd = -1;
+	lb->cfg = cfg;
+	cfm_hist_init(&lb->rtt);
+
+	lb->ring = calloc(CFM_LB_RING_SIZE, sizeof(*lb->ring));
+	if (!lb->ring)
+		goto out;
+
+	if (cfm_oam_open(&lb->oam, cfg->br_ifindex, cfg->instance, opcodes, sizeof(opcodes)))
+		goto out;
+
+	cfm_oam_handler_set(&lb->oam, CFM_OPCODE_LBR, cfm_lb_lbr_rx, NULL, lb);
+	if (cfg->responder)
+		cfm_oam_handler_set(&lb->oam, CFM_OPCODE_LBM, cfm_lb_lbm_rx, NULL, lb);
+	lb->stop.fn = cfm_lb_stop;
+
+	if (cfg->initiator) {
+		cfm_lb_frame_init(lb);
+
+		/* Slow rates get a tick per LBM, fast ones a batch per tick */
+		lb->tick = CFM_LB_TICK_NS;
+		if (cfg->rate && 1000000000ULL / cfg->rate > lb->tick)
+			lb->tick = 1000000000ULL / cfg->rate;
+
+		lb->burst = cfg->burst;
+		if (lb->burst < 1 || lb->burst > CFM_OAM_BATCH_MAX)
+			lb->burst = CFM_OAM_BATCH_MAX;
+
+		lb->start = cfm_oam_now();
+		lb->next_id = (uint32_t)lb->start;
+		lb->tx_timer.fn = cfm_lb_tx;
+		cfm_oam_timer_start(&lb->oam, &lb->tx_timer, lb->start);
+	}
+
+	err = cfm_oam_run(&lb->oam);
+	cfm_lb_report(lb);
+
+out:
+	cfm_oam_close(&lb->oam);
+	free(lb->ring);
+	free(lb);
+
+	return err;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_LB_H
+#define CFM_LB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cfm_netlink.h"
+
+struct cfm_lb_config {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	bool initiator;		/* Send LBMs to dmac */
+	struct mac_addr dmac;
+	uint32_t rate;		/* LBMs per second, 0 - as fast as possible */
+	uint32_t count;		/* LBMs to send, 0 - until interrupted */
+	uint32_t size;		/* Frame size without FCS, padded with a Data TLV */
+	uint32_t burst;		/* Most LBMs sent back to back */
+	bool responder;		/* Answer LBMs with LBRs */
+};
+
+int cfm_lb_run(const struct cfm_lb_config *cfg);
+
+#endif
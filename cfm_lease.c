@@ -0,0 +1,444 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <ev.h>
+
+#include "cfm_netlink.h"
+#include "cfm_state.h"
+#include "cfm_lease.h"
+
+/* The kernel stops sending CCMs 'period' seconds after the CCM TX
+ * configuration was last given. Every MEP found transmitting gets a lease
+ * that is renewed by giving the same configuration again.
+ *
+ * Each wakeup first dumps the CCM TX configuration of all bridges. MEPs
+ * that started transmitting get a lease, and leases of MEPs stopped before
+ * their expiry are released, so a stop is never undone by a renewal. A MEP
+ * found stopped after its lease expired has lapsed, and is restarted.
+ * Then all leases due before the end of the coalescing window are renewed,
+ * CFM_CCM_TX_BATCH_MAX requests per sendmsg().
+ */
+
+#define LEASE_RETRY_NS		1000000000ULL
+
+struct cfm_lease {
+	struct cfm_ccm_tx tx;
+	uint64_t next;		/* ns, CLOCK_MONOTONIC */
+	uint64_t expires;	/* ns, estimated end of transmission, 0 - unknown */
+	uint64_t interval;	/* ns between renewals */
+	uint32_t heap_idx;	/* Position in the renewal heap, 0 - not queued */
+	uint32_t generation;	/* Last scan that found the MEP transmitting */
+	uint32_t failures;	/* Consecutive failed renewals */
+};
+
+static struct cfm_lease_config config;
+static ev_timer lease_watcher;
+
+/* Leases by (bridge, instance), open addressing with linear probing */
+static struct cfm_lease **hash;
+static uint32_t hash_mask;
+static uint32_t lease_count;
+
+/* Min-heap on next renewal, index 0 unused */
+static struct cfm_lease **heap;
+static uint32_t heap_count;
+static uint32_t heap_size;
+
+static uint32_t generation;
+static uint64_t next_scan;
+
+static struct {
+	uint64_t scans;
+	uint64_t scan_errors;
+	uint64_t scan_ns_max;
+	uint64_t renewals;
+	uint64_t batches;
+	uint64_t failures;
+	uint64_t lapsed;
+	uint64_t released;
+	uint64_t margin_min;	/* Least time left on a lease when it was renewed */
+	uint32_t alarms;	/* Leases whose last renewal failed */
+} stats = { .margin_min = UINT64_MAX };
+
+static uint32_t lease_hash(uint32_t br_ifindex, uint32_t instance)
+{
+	uint64_t key = ((uint64_t)br_ifindex << 32) | instance;
+
+	key *= 0x9E3779B97F4A7C15ULL;
+	return key >> 32;
+}
+
+static struct cfm_lease *lease_find(uint32_t br_ifindex, uint32_t instance)
+{
+	uint32_t h = lease_hash(br_ifindex, instance) & hash_mask;
+
+	for (; hash[h]; h = (h + 1) & hash_mask)
+		if (hash[h]->tx.br_ifindex == br_ifindex && hash[h]->tx.instance == instance)
+			return hash[h];
+
+	return NULL;
+}
+
+static void lease_hash_insert(struct cfm_lease *l)
+{
+	uint32_t h = lease_hash(l->tx.br_ifindex, l->tx.instance) & hash_mask;
+
+	while (hash[h])
+		h = (h + 1) & hash_mask;
+	hash[h] = l;
+}
+
+static int lease_hash_grow(void)
+{
+	struct cfm_lease **old = hash;
+	uint32_t old_size = hash_mask + 1, i;
+
+	hash = calloc(2 * old_size, sizeof(*hash));
+	if (!hash) {
+		hash = old;
+		return -1;
+	}
+	hash_mask = 2 * old_size - 1;
+
+	for (i = 0; i < old_size; ++i)
+		if (old[i])
+			lease_hash_insert(old[i]);
+	free(old);
+
+	return 0;
+}
+
+/* Backward shift deletion keeps probe sequences intact without tombstones */
+static void lease_hash_remove(uint32_t slot)
+{
+	uint32_t i = slot, j = slot, k;
+
+	for (;;) {
+		j = (j + 1) & hash_mask;
+		if (!hash[j])
+			break;
+		k = lease_hash(hash[j]->tx.br_ifindex, hash[j]->tx.instance) & hash_mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			hash[i] = hash[j];
+			i = j;
+		}
+	}
+	hash[i] = NULL;
+}
+
+static void heap_swap(uint32_t a, uint32_t b)
+{
+	struct cfm_lease *t = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = t;
+	heap[a]->heap_idx = a;
+	heap[b]->heap_idx = b;
+}
+
+static void heap_fix(uint32_t idx)
+{
+	uint32_t child;
+
+	while (idx > 1 && heap[idx]->next < heap[idx / 2]->next) {
+		heap_swap(idx, idx / 2);
+		idx /= 2;
+	}
+
+	while ((child = idx * 2) <= heap_count) {
+		if (child < heap_count && heap[child + 1]->next < heap[child]->next)
+			child++;
+		if (heap[idx]->next <= heap[child]->next)
+			break;
+		heap_swap(idx, child);
+		idx = child;
+	}
+}
+
+static int heap_push(struct cfm_lease *l)
+{
+	struct cfm_lease **h;
+
+	if (heap_count + 1 >= heap_size) {
+		h = realloc(heap, 2 * heap_size * sizeof(*h));
+		if (!h)
+			return -1;
+		heap = h;
+		heap_size *= 2;
+	}
+
+	l->heap_idx = ++heap_count;
+	heap[l->heap_idx] = l;
+	heap_fix(l->heap_idx);
+
+	return 0;
+}
+
+static void heap_remove(struct cfm_lease *l)
+{
+	uint32_t idx = l->heap_idx;
+
+	if (!idx)
+		return;
+
+	if (idx != heap_count) {
+		heap_swap(idx, heap_count);
+		heap_count--;
+		heap_fix(idx);
+	} else {
+		heap_count--;
+	}
+	l->heap_idx = 0;
+}
+
+static void lease_schedule(struct cfm_lease *l, uint64_t next)
+{
+	l->next = next;
+	if (l->heap_idx)
+		heap_fix(l->heap_idx);
+	else
+		heap_push(l);
+}
+
+/* Renew after a quarter to half of the period. The fraction is fixed per
+ * MEP, so MEPs started together drift apart instead of coming due at the
+ * same time on every renewal.
+ */
+static uint64_t lease_interval(const struct cfm_ccm_tx *tx)
+{
+	uint64_t period = tx->period * 1000000000ULL;
+
+	return period / 4 + period / 4 * (lease_hash(tx->br_ifindex, tx->instance) & 0xFF) / 256;
+}
+
+static void lease_alarm(const struct cfm_lease *l, const char *what, int err)
+{
+	printf("EVENT CFM CCM TX lease:\n");
+	printf("Bridge %u instance %u\n", l->tx.br_ifindex, l->tx.instance);
+	if (err)
+		printf("    %s: %s\n", what, strerror(-err));
+	else
+		printf("    %s\n", what);
+	printf("\n");
+	fflush(stdout);
+}
+
+static bool lease_tx_equal(const struct cfm_ccm_tx *a, const struct cfm_ccm_tx *b)
+{
+	return !memcmp(a->dmac.addr, b->dmac.addr, sizeof(a->dmac.addr)) &&
+	       a->sequence == b->sequence && a->period == b->period &&
+	       a->iftlv == b->iftlv && a->iftlv_value == b->iftlv_value &&
+	       a->porttlv == b->porttlv && a->porttlv_value == b->porttlv_value;
+}
+
+static void lease_scan_one(const struct cfm_ccm_tx *tx, void *arg)
+{
+	uint64_t now = *(uint64_t *)arg;
+	struct cfm_lease *l;
+
+	if (!tx->period)
+		return;
+
+	l = lease_find(tx->br_ifindex, tx->instance);
+	if (!l) {
+		if (2 * (lease_count + 1) > hash_mask + 1 && lease_hash_grow())
+			return;
+		l = calloc(1, sizeof(*l));
+		if (!l)
+			return;
+		l->tx = *tx;
+		lease_hash_insert(l);
+		lease_count++;
+
+		/* Time left is unknown, renew right away */
+		l->interval = lease_interval(tx);
+		lease_schedule(l, now);
+	} else if (!lease_tx_equal(&l->tx, tx)) {
+		/* Reconfigured, later renewals give the new configuration */
+		l->tx = *tx;
+		l->interval = lease_interval(tx);
+		if (l->next > now + l->interval)
+			lease_schedule(l, now + l->interval);
+	}
+
+	l->generation = generation;
+}
+
+static void lease_scan(uint64_t now)
+{
+	struct cfm_lease *l;
+	uint64_t end;
+	uint32_t i;
+
+	generation++;
+	if (cfm_offload_ccm_tx_dump(lease_scan_one, &now) < 0) {
+		stats.scan_errors++;
+		return;
+	}
+	stats.scans++;
+	end = cfm_state_now();
+	if (end - now > stats.scan_ns_max)
+		stats.scan_ns_max = end - now;
+
+	for (i = 0; i <= hash_mask; ) {
+		l = hash[i];
+		if (!l || l->generation == generation) {
+			i++;
+			continue;
+		}
+
+		if (l->expires && now >= l->expires) {
+			/* The kernel stopped on its own, the lease was not renewed
+			 * in time. Restart once, it is released if that fails.
+			 */
+			stats.lapsed++;
+			l->generation = generation;
+			l->expires = 0;
+			lease_alarm(l, "lapsed, restarting", 0);
+			lease_schedule(l, now);
+			i++;
+			continue;
+		}
+
+		/* Stopped on purpose */
+		stats.released++;
+		if (l->failures)
+			stats.alarms--;
+		heap_remove(l);
+		lease_hash_remove(i);
+		lease_count--;
+		free(l);
+	}
+}
+
+static void lease_renew_batch(struct cfm_lease **batch, unsigned int count, uint64_t now)
+{
+	struct cfm_ccm_tx tx[CFM_CCM_TX_BATCH_MAX];
+	int errors[CFM_CCM_TX_BATCH_MAX];
+	struct cfm_lease *l;
+	unsigned int i;
+
+	for (i = 0; i < count; ++i)
+		tx[i] = batch[i]->tx;
+
+	cfm_offload_cc_ccm_tx_batch(tx, count, errors);
+	stats.batches++;
+
+	for (i = 0; i < count; ++i) {
+		l = batch[i];
+		if (errors[i]) {
+			stats.failures++;
+			if (!l->failures++) {
+				stats.alarms++;
+				lease_alarm(l, "renewal failed", errors[i]);
+			}
+			lease_schedule(l, now + LEASE_RETRY_NS);
+			continue;
+		}
+
+		stats.renewals++;
+		if (l->expires > now && l->expires - now < stats.margin_min)
+			stats.margin_min = l->expires - now;
+		if (l->failures) {
+			stats.alarms--;
+			l->failures = 0;
+			lease_alarm(l, "renewed again", 0);
+		}
+
+		/* The kernel counts from when it handled the request, a bit
+		 * after 'now', so this errs on the early side.
+		 */
+		l->expires = now + l->tx.period * 1000000000ULL;
+		lease_schedule(l, now + l->interval);
+	}
+}
+
+static void lease_timer_arm(uint64_t now)
+{
+	uint64_t next = next_scan;
+
+	if (heap_count && heap[1]->next < next)
+		next = heap[1]->next;
+
+	ev_timer_stop(EV_DEFAULT, &lease_watcher);
+	ev_timer_set(&lease_watcher, next > now ? (next - now) / 1e9 : 0, 0);
+	ev_timer_start(EV_DEFAULT, &lease_watcher);
+}
+
+static void lease_run(EV_P_ ev_timer *w, int revents)
+{
+	struct cfm_lease *batch[CFM_CCM_TX_BATCH_MAX];
+	uint64_t now = cfm_state_now(), horizon;
+	unsigned int n;
+
+	lease_scan(now);
+	next_scan = now + config.rescan * 1000000ULL;
+
+	now = cfm_state_now();
+	horizon = now + config.window * 1000000ULL;
+	while (heap_count && heap[1]->next <= horizon) {
+		for (n = 0; n < CFM_CCM_TX_BATCH_MAX && heap_count && heap[1]->next <= horizon; ++n) {
+			batch[n] = heap[1];
+			heap_remove(batch[n]);
+		}
+		lease_renew_batch(batch, n, now);
+	}
+
+	lease_timer_arm(cfm_state_now());
+}
+
+int cfm_lease_init(const struct cfm_lease_config *cfg)
+{
+	config = *cfg;
+	if (!config.rescan)
+		config.rescan = 1000;
+
+	hash = calloc(64, sizeof(*hash));
+	heap = calloc(64, sizeof(*heap));
+	if (!hash || !heap) {
+		cfm_lease_uninit();
+		return -1;
+	}
+	hash_mask = 63;
+	heap_size = 64;
+
+	ev_timer_init(&lease_watcher, lease_run, 0, 0);
+	ev_timer_start(EV_DEFAULT, &lease_watcher);
+
+	return 0;
+}
+
+void cfm_lease_uninit(void)
+{
+	uint32_t i;
+
+	ev_timer_stop(EV_DEFAULT, &lease_watcher);
+	for (i = 0; hash && i <= hash_mask; ++i)
+		free(hash[i]);
+	free(hash);
+	free(heap);
+	hash = NULL;
+	heap = NULL;
+	hash_mask = 0;
+	heap_count = 0;
+	lease_count = 0;
+}
+
+void cfm_lease_stats_print(FILE *fp)
+{
+	fprintf(fp, "CCM TX leases\n");
+	fprintf(fp, "    Leases %u (alarm %u)\n", lease_count, stats.alarms);
+	fprintf(fp, "    Renewals %" PRIu64 " in %" PRIu64 " batches\n", stats.renewals, stats.batches);
+	fprintf(fp, "    Renewal failures %" PRIu64 "\n", stats.failures);
+	fprintf(fp, "    Lapsed %" PRIu64 "\n", stats.lapsed);
+	fprintf(fp, "    Released %" PRIu64 "\n", stats.released);
+	if (stats.margin_min != UINT64_MAX)
+		fprintf(fp, "    Min time left at renewal %.3f ms\n", stats.margin_min / 1e6);
+	fprintf(fp, "    Scans %" PRIu64 " (errors %" PRIu64 ", max %.3f ms)\n", stats.scans,
+		stats.scan_errors, stats.scan_ns_max / 1e6);
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,19 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_LEASE_H
+#define CFM_LEASE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct cfm_lease_config {
+	uint32_t rescan;	/* ms between looks for started and stopped CCM TX */
+	uint32_t window;	/* ms, renewals due this close together share a batch */
+};
+
+int cfm_lease_init(const struct cfm_lease_config *cfg);
+void cfm_lease_uninit(void);
+void cfm_lease_stats_print(FILE *fp);
+
+#endif
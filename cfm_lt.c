@@ -0,0 +1,513 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if_ether.h>
+
+#include "cfm_pdu.h"
+#include "cfm_oam.h"
+#include "cfm_lt.h"
+
+/* Most LTRs kept per trace */
+#define CFM_LT_HOPS_MAX		32
+
+/* LTMs go out in batches, one batch per tick */
+#define CFM_LT_TICK_NS		1000000ULL
+
+/* Peer MACs are learned from CCMs for 3.5 CCM intervals, at most 35 s */
+#define CFM_LT_LEARN_MAX_NS	35000000000ULL
+
+/* LTM with an LTM Egress Identifier TLV and End TLV */
+#define CFM_LT_LTM_LEN		(4 + CFM_LTM_TLV_OFFSET + 3 + 8 + 1)
+
+enum cfm_lt_state {
+	CFM_LT_IDLE,
+	CFM_LT_PENDING,
+	CFM_LT_REACHED,
+	CFM_LT_TIMEOUT,
+};
+
+struct cfm_lt_hop {
+	struct mac_addr from;		/* Source of the LTR */
+	struct mac_addr ingress;
+	struct mac_addr egress;
+	uint8_t ttl;
+	uint8_t relay;
+	uint8_t flags;
+	uint8_t ingress_action;		/* 0 - no Reply Ingress TLV */
+	uint8_t egress_action;		/* 0 - no Reply Egress TLV */
+};
+
+struct cfm_lt_trace {
+	struct mac_addr target;
+	uint16_t mepid;			/* Peer MEP traced to, 0 - given target */
+	enum cfm_lt_state state;
+	uint64_t sent;
+	uint64_t done;
+
+	/* Reply TTLs seen, and the TTL of the reply from the target */
+	uint64_t ttl_seen[4];
+	bool terminal;
+	uint8_t terminal_ttl;
+
+	uint32_t hop_count;
+	uint32_t hops_dropped;
+	struct cfm_lt_hop hops[CFM_LT_HOPS_MAX];
+};
+
+struct cfm_lt {
+	struct cfm_oam oam;
+	const struct cfm_lt_config *cfg;
+
+	/* Trace i uses transaction ID base_id + i and is sent in index order.
+	 * All traces have the same timeout, so they also time out in index
+	 * order and one timer walking the sent traces covers all of them.
+	 */
+	struct cfm_lt_trace *traces;
+	uint32_t trace_count;
+	uint32_t tx_next;
+	uint32_t expire_next;
+	uint32_t pending;
+	uint32_t base_id;
+	uint64_t timeout;
+	uint64_t start;
+	uint64_t end;
+
+	uint64_t peers_missing[CFM_MEPID_WORDS];
+	uint32_t peers_learned;
+
+	uint64_t ltr_late;
+	uint64_t ltm_answered;
+
+	struct cfm_oam_timer learn;
+	struct cfm_oam_timer tx;
+	struct cfm_oam_timer expire;
+};
+
+static const char *cfm_lt_relay_str(uint8_t relay)
+{
+	switch (relay) {
+	case CFM_LTR_RELAY_HIT:
+		return "hit";
+	case CFM_LTR_RELAY_FDB:
+		return "fdb";
+	case CFM_LTR_RELAY_MPDB:
+		return "mpdb";
+	}
+	return "unknown";
+}
+
+/* Value of the first TLV of 'type' with at least 'min_len' bytes */
+static const uint8_t *cfm_lt_tlv_find(const uint8_t *pdu, uint32_t len, uint8_t type,
+				      uint16_t min_len)
+{
+	const uint8_t *p = pdu + 4 + pdu[3];
+	const uint8_t *end = pdu + len;
+	uint16_t tlv_len;
+
+	while (p + 3 <= end && p[0] != CFM_ENDE_TLV_TYPE) {
+		tlv_len = cfm_pdu_get_u16(p + 1);
+		if (p + 3 + tlv_len > end)
+			break;
+		if (p[0] == type && tlv_len >= min_len)
+			return p + 3;
+		p += 3 + tlv_len;
+	}
+
+	return NULL;
+}
+
+static void cfm_lt_finish(struct cfm_lt *lt, struct cfm_lt_trace *t, enum cfm_lt_state state,
+			  uint64_t now)
+{
+	t->state = state;
+	t->done = now;
+	lt->pending--;
+	lt->end = now;
+
+	if (lt->tx_next == lt->trace_count && !lt->pending)
+		lt->oam.quit = 1;
+}
+
+static void cfm_lt_expire(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_lt *lt = (struct cfm_lt *)oam;
+	struct cfm_lt_trace *t;
+
+	for (; lt->expire_next < lt->tx_next; lt->expire_next++) {
+		t = &lt->traces[lt->expire_next];
+		if (t->state != CFM_LT_PENDING)
+			continue;
+		if (t->sent + lt->timeout > now)
+			break;
+		cfm_lt_finish(lt, t, CFM_LT_TIMEOUT, now);
+	}
+
+	if (lt->expire_next < lt->tx_next)
+		cfm_oam_timer_start(oam, timer, lt->traces[lt->expire_next].sent + lt->timeout);
+}
+
+static void cfm_lt_tx(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_lt *lt = (struct cfm_lt *)oam;
+	uint8_t buf[CFM_OAM_BATCH_MAX][ETH_HLEN + CFM_LT_LTM_LEN];
+	uint8_t *frames[CFM_OAM_BATCH_MAX];
+	uint32_t lens[CFM_OAM_BATCH_MAX];
+	struct mac_addr dmac = { .addr = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x38 } };
+	struct cfm_lt_trace *t;
+	unsigned int i, n;
+	uint8_t *pdu;
+	int sent;
+
+	dmac.addr[5] |= oam->mep.level;
+	n = lt->trace_count - lt->tx_next;
+	if (n > CFM_OAM_BATCH_MAX)
+		n = CFM_OAM_BATCH_MAX;
+
+	for (i = 0; i < n; ++i) {
+		t = &lt->traces[lt->tx_next + i];
+		frames[i] = buf[i];
+		lens[i] = CFM_LT_LTM_LEN;
+
+		memset(buf[i], 0, sizeof(buf[i]));
+		pdu = cfm_oam_frame_init(oam, buf[i], &dmac);
+		cfm_pdu_hdr_put(pdu, oam->mep.level, CFM_OPCODE_LTM,
+				lt->cfg->fdb_only ? CFM_LT_FLAG_USE_FDB_ONLY : 0,
+				CFM_LTM_TLV_OFFSET);
+		cfm_pdu_put_u32(pdu + CFM_LT_TRANS_ID_OFFSET, lt->base_id + lt->tx_next + i);
+		pdu[CFM_LT_TTL_OFFSET] = lt->cfg->ttl;
+		memcpy(pdu + CFM_LTM_ORIG_MAC_OFFSET, oam->mep.mac.addr, ETH_ALEN);
+		memcpy(pdu + CFM_LTM_TARGET_MAC_OFFSET, t->target.addr, ETH_ALEN);
+
+		/* LTM Egress Identifier: zero followed by the MEP MAC */
+		pdu += 4 + CFM_LTM_TLV_OFFSET;
+		pdu[0] = CFM_LTM_EGRESS_ID_TLV_TYPE;
+		cfm_pdu_put_u16(pdu + 1, 8);
+		memcpy(pdu + 5, oam->mep.mac.addr, ETH_ALEN);
+		pdu[11] = CFM_ENDE_TLV_TYPE;
+	}
+
+	now = cfm_oam_now();
+	sent = cfm_oam_send_many(oam, frames, lens, n);
+	for (i = 0; i < (unsigned int)sent; ++i) {
+		t = &lt->traces[lt->tx_next + i];
+		t->state = CFM_LT_PENDING;
+		t->sent = now;
+	}
+	lt->tx_next += sent;
+	lt->pending += sent;
+
+	if (lt->expire_next < lt->tx_next && !lt->expire.idx)
+		cfm_oam_timer_start(oam, &lt->expire,
+				    lt->traces[lt->expire_next].sent + lt->timeout);
+
+	if (lt->tx_next < lt->trace_count)
+		cfm_oam_timer_start(oam, timer, now + CFM_LT_TICK_NS);
+}
+
+static void cfm_lt_ltr_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_lt *lt = arg;
+	const uint8_t *pdu = frame->pdu, *tlv;
+	struct cfm_lt_trace *t;
+	struct cfm_lt_hop *hop;
+	uint32_t idx;
+	unsigned int ttl;
+
+	if (frame->len < 4 + CFM_LTR_TLV_OFFSET)
+		return;
+
+	idx = cfm_pdu_get_u32(pdu + CFM_LT_TRANS_ID_OFFSET) - lt->base_id;
+	if (idx >= lt->tx_next || lt->traces[idx].state != CFM_LT_PENDING) {
+		lt->ltr_late++;
+		return;
+	}
+	t = &lt->traces[idx];
+
+	if (t->hop_count < CFM_LT_HOPS_MAX) {
+		hop = &t->hops[t->hop_count++];
+		memset(hop, 0, sizeof(*hop));
+		memcpy(hop->from.addr, frame->mac + ETH_ALEN, ETH_ALEN);
+		hop->ttl = pdu[CFM_LT_TTL_OFFSET];
+		hop->relay = pdu[CFM_LTR_RELAY_OFFSET];
+		hop->flags = cfm_pdu_flags(pdu);
+
+		tlv = cfm_lt_tlv_find(pdu, frame->len, CFM_REPLY_INGRESS_TLV_TYPE, 1 + ETH_ALEN);
+		if (tlv) {
+			hop->ingress_action = tlv[0];
+			memcpy(hop->ingress.addr, tlv + 1, ETH_ALEN);
+		}
+		tlv = cfm_lt_tlv_find(pdu, frame->len, CFM_REPLY_EGRESS_TLV_TYPE, 1 + ETH_ALEN);
+		if (tlv) {
+			hop->egress_action = tlv[0];
+			memcpy(hop->egress.addr, tlv + 1, ETH_ALEN);
+		}
+	} else {
+		t->hops_dropped++;
+	}
+
+	ttl = pdu[CFM_LT_TTL_OFFSET];
+	t->ttl_seen[ttl / 64] |= 1ULL << (ttl % 64);
+	if ((cfm_pdu_flags(pdu) & CFM_LTR_FLAG_TERMINAL_MEP) ||
+	    pdu[CFM_LTR_RELAY_OFFSET] == CFM_LTR_RELAY_HIT) {
+		if (!t->terminal || ttl > t->terminal_ttl)
+			t->terminal_ttl = ttl;
+		t->terminal = true;
+	}
+
+	/* Done once the target replied and every hop before it did too */
+	if (!t->terminal)
+		return;
+	for (ttl = t->terminal_ttl; ttl < lt->cfg->ttl; ++ttl)
+		if (!(t->ttl_seen[ttl / 64] & (1ULL << (ttl % 64))))
+			return;
+
+	cfm_lt_finish(lt, t, CFM_LT_REACHED, frame->ts ? frame->ts : cfm_oam_now());
+}
+
+static void cfm_lt_ltm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_lt *lt = arg;
+	uint8_t reply[ETH_HLEN + 64];
+	const uint8_t *pdu = frame->pdu, *egress_id;
+	struct mac_addr orig;
+	uint8_t *r, *p;
+
+	if (frame->len < CFM_LTM_TARGET_MAC_OFFSET + ETH_ALEN)
+		return;
+
+	/* A MEP only replies to LTMs looking for it */
+	if (memcmp(pdu + CFM_LTM_TARGET_MAC_OFFSET, oam->mep.mac.addr, ETH_ALEN) ||
+	    pdu[CFM_LT_TTL_OFFSET] == 0)
+		return;
+
+	memcpy(orig.addr, pdu + CFM_LTM_ORIG_MAC_OFFSET, ETH_ALEN);
+	memset(reply, 0, sizeof(reply));
+	r = cfm_oam_frame_init(oam, reply, &orig);
+	cfm_pdu_hdr_put(r, oam->mep.level, CFM_OPCODE_LTR,
+			(cfm_pdu_flags(pdu) & CFM_LT_FLAG_USE_FDB_ONLY) | CFM_LTR_FLAG_TERMINAL_MEP,
+			CFM_LTR_TLV_OFFSET);
+	memcpy(r + CFM_LT_TRANS_ID_OFFSET, pdu + CFM_LT_TRANS_ID_OFFSET, 4);
+	r[CFM_LT_TTL_OFFSET] = pdu[CFM_LT_TTL_OFFSET] - 1;
+	r[CFM_LTR_RELAY_OFFSET] = CFM_LTR_RELAY_HIT;
+
+	/* LTR Egress Identifier: the LTM Egress Identifier, then our own */
+	p = r + 4 + CFM_LTR_TLV_OFFSET;
+	p[0] = CFM_LTR_EGRESS_ID_TLV_TYPE;
+	cfm_pdu_put_u16(p + 1, 16);
+	egress_id = cfm_lt_tlv_find(pdu, frame->len, CFM_LTM_EGRESS_ID_TLV_TYPE, 8);
+	if (egress_id)
+		memcpy(p + 3, egress_id, 8);
+	memcpy(p + 13, oam->mep.mac.addr, ETH_ALEN);
+	p += 3 + 16;
+
+	/* Reply Ingress: IngOK on the MEP port */
+	p[0] = CFM_REPLY_INGRESS_TLV_TYPE;
+	cfm_pdu_put_u16(p + 1, 1 + ETH_ALEN);
+	p[3] = 1;
+	memcpy(p + 4, oam->mep.mac.addr, ETH_ALEN);
+	p += 3 + 1 + ETH_ALEN;
+
+	p[0] = CFM_ENDE_TLV_TYPE;
+	p++;
+
+	if (cfm_oam_send(oam, reply, p - r) == 0)
+		lt->ltm_answered++;
+}
+
+static void cfm_lt_learn_done(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_lt *lt = (struct cfm_lt *)oam;
+
+	cfm_oam_handler_set(oam, BR_CFM_OPCODE_CCM, NULL, NULL, NULL);
+
+	if (!lt->trace_count) {
+		oam->quit = 1;
+		return;
+	}
+
+	lt->start = now;
+	cfm_oam_timer_start(oam, &lt->tx, now);
+}
+
+/* The peer MEP MACs are not known to the bridge, take them from the CCMs */
+static void cfm_lt_ccm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_lt *lt = arg;
+	struct cfm_lt_trace *t;
+	uint16_t mepid;
+
+	if (frame->len < CFM_CCM_PDU_MEPID_OFFSET + 2)
+		return;
+
+	mepid = cfm_ccm_mepid(frame->pdu);
+	if (!(lt->peers_missing[mepid / 64] & (1ULL << (mepid % 64))))
+		return;
+
+	lt->peers_missing[mepid / 64] &= ~(1ULL << (mepid % 64));
+	t = &lt->traces[lt->trace_count++];
+	memcpy(t->target.addr, frame->mac + ETH_ALEN, ETH_ALEN);
+	t->mepid = mepid;
+
+	if (++lt->peers_learned == oam->mep.peer_count) {
+		cfm_oam_timer_stop(oam, &lt->learn);
+		cfm_lt_learn_done(oam, &lt->learn, cfm_oam_now());
+	}
+}
+
+static void cfm_lt_hops_sort(struct cfm_lt_trace *t)
+{
+	struct cfm_lt_hop hop;
+	uint32_t i, j;
+
+	/* Closest hop first, that is highest reply TTL */
+	for (i = 1; i < t->hop_count; ++i) {
+		hop = t->hops[i];
+		for (j = i; j > 0 && t->hops[j - 1].ttl < hop.ttl; --j)
+			t->hops[j] = t->hops[j - 1];
+		t->hops[j] = hop;
+	}
+}
+
+static void cfm_lt_mac_print(const char *prefix, const struct mac_addr *mac)
+{
+	printf("%s%02X-%02X-%02X-%02X-%02X-%02X", prefix, mac->addr[0], mac->addr[1],
+	       mac->addr[2], mac->addr[3], mac->addr[4], mac->addr[5]);
+}
+
+static void cfm_lt_report(struct cfm_lt *lt)
+{
+	struct cfm_lt_trace *t;
+	struct cfm_lt_hop *hop;
+	uint32_t i, j, reached = 0;
+	uint16_t mepid;
+
+	for (i = 0; i < lt->trace_count; ++i) {
+		t = &lt->traces[i];
+		cfm_lt_mac_print("Target ", &t->target);
+		if (t->mepid)
+			printf(" (MEPID %u)", t->mepid);
+		printf("\n");
+
+		switch (t->state) {
+		case CFM_LT_REACHED:
+			reached++;
+			printf("    Reached in %u hops, %.3f ms\n", lt->cfg->ttl - t->terminal_ttl,
+			       (t->done - t->sent) / 1e6);
+			break;
+		case CFM_LT_TIMEOUT:
+			printf("    Not reached\n");
+			break;
+		default:
+			printf("    Not sent\n");
+			break;
+		}
+
+		cfm_lt_hops_sort(t);
+		for (j = 0; j < t->hop_count; ++j) {
+			hop = &t->hops[j];
+			printf("    Hop %u ttl %u", lt->cfg->ttl - hop->ttl, hop->ttl);
+			cfm_lt_mac_print(" from ", &hop->from);
+			printf(" relay %s", cfm_lt_relay_str(hop->relay));
+			if (hop->flags & CFM_LTR_FLAG_FWD_YES)
+				printf(" forwarded");
+			if (hop->flags & CFM_LTR_FLAG_TERMINAL_MEP)
+				printf(" terminal");
+			if (hop->ingress_action)
+				cfm_lt_mac_print(" ingress ", &hop->ingress);
+			if (hop->egress_action)
+				cfm_lt_mac_print(" egress ", &hop->egress);
+			printf("\n");
+		}
+		if (t->hops_dropped)
+			printf("    Replies dropped %u\n", t->hops_dropped);
+	}
+
+	if (lt->cfg->peers)
+		for (mepid = 1; mepid <= CFM_MEPID_MAX; ++mepid)
+			if (lt->peers_missing[mepid / 64] & (1ULL << (mepid % 64)))
+				printf("Peer MEPID %u: no CCM received\n", mepid);
+
+	if (lt->trace_count)
+		printf("Traces %u reached %u in %.3f ms\n", lt->trace_count, reached,
+		       lt->end > lt->start ? (lt->end - lt->start) / 1e6 : 0);
+	if (lt->ltr_late)
+		printf("LTR late %llu\n", (unsigned long long)lt->ltr_late);
+	if (lt->cfg->responder)
+		printf("LTM answered %llu\n", (unsigned long long)lt->ltm_answered);
+	if (lt->oam.tx_errors)
+		printf("TX errors %llu\n", (unsigned long long)lt->oam.tx_errors);
+}
+
+int cfm_lt_run(const struct cfm_lt_config *cfg)
+{
+	const uint8_t opcodes[] = { CFM_OPCODE_LTM, CFM_OPCODE_LTR, BR_CFM_OPCODE_CCM };
+	uint64_t learn;
+	struct cfm_lt *lt;
+	uint32_t i;
+	int err = -1;
+
+	if (!cfg->dmac_count && !cfg->peers && !cfg->responder) {
+		fprintf(stderr, "No target and not a responder\n");
+		return -1;
+	}
+	if (!cfg->ttl) {
+		fprintf(stderr, "TTL must be at least 1\n");
+		return -1;
+	}
+
+	lt = calloc(1, sizeof(*lt));
+	if (!lt)
+		return -1;
+	lt->oam.tx_fd = -1;
+	lt->oam.rx.fd = -1;
+	lt->cfg = cfg;
+	lt->timeout = cfg->timeout * 1000000ULL;
+
+	if (cfm_oam_open(&lt->oam, cfg->br_ifindex, cfg->instance, opcodes,
+			 cfg->peers ? 3 : 2))
+		goto out;
+
+	lt->traces = calloc(cfg->dmac_count + (cfg->peers ? lt->oam.mep.peer_count : 0) + 1,
+			    sizeof(*lt->traces));
+	if (!lt->traces)
+		goto out;
+	for (i = 0; i < cfg->dmac_count; ++i)
+		lt->traces[lt->trace_count++].target = cfg->dmacs[i];
+
+	cfm_oam_handler_set(&lt->oam, CFM_OPCODE_LTR, cfm_lt_ltr_rx, NULL, lt);
+	if (cfg->responder)
+		cfm_oam_handler_set(&lt->oam, CFM_OPCODE_LTM, cfm_lt_ltm_rx, NULL, lt);
+	lt->tx.fn = cfm_lt_tx;
+	lt->expire.fn = cfm_lt_expire;
+	lt->learn.fn = cfm_lt_learn_done;
+	lt->base_id = (uint32_t)cfm_oam_now();
+
+	if (cfg->peers && lt->oam.mep.peer_count) {
+		memcpy(lt->peers_missing, lt->oam.mep.peers, sizeof(lt->peers_missing));
+		cfm_oam_handler_set(&lt->oam, BR_CFM_OPCODE_CCM, cfm_lt_ccm_rx, NULL, lt);
+
+		learn = cfm_ccm_interval_ns(lt->oam.mep.interval) * 7 / 2;
+		if (!learn || learn > CFM_LT_LEARN_MAX_NS)
+			learn = CFM_LT_LEARN_MAX_NS;
+		cfm_oam_timer_start(&lt->oam, &lt->learn, cfm_oam_now() + learn);
+	} else if (lt->trace_count) {
+		lt->start = cfm_oam_now();
+		cfm_oam_timer_start(&lt->oam, &lt->tx, lt->start);
+	} else if (!cfg->responder) {
+		fprintf(stderr, "No peer MEPs\n");
+		goto out;
+	}
+
+	err = cfm_oam_run(&lt->oam);
+	cfm_lt_report(lt);
+
+out:
+	cfm_oam_close(&lt->oam);
+	free(lt->traces);
+	free(lt);
+
+	return err;
+}
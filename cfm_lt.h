@@ -0,0 +1,26 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_LT_H
+#define CFM_LT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cfm_netlink.h"
+
+struct cfm_lt_config {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint8_t ttl;		/* TTL of the LTMs */
+	uint32_t timeout;	/* ms to wait for the LTRs of a trace */
+	bool fdb_only;		/* Set UseFDBonly in the LTMs */
+	bool peers;		/* Also trace to every peer MEP, learned from its CCMs */
+	bool responder;		/* Answer LTMs targeting the MEP with LTRs */
+	uint32_t dmac_count;	/* One trace per target */
+	struct mac_addr *dmacs;
+};
+
+int cfm_lt_run(const struct cfm_lt_config *cfg);
+
+#endif
@@ -1,14 +1,21 @@
 // Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
 // SPDX-License-Identifier: (GPL-2.0)
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include <getopt.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 #include <linux/types.h>
 #include <linux/if_bridge.h>
+#include <linux/net_namespace.h>
 #include <net/if.h>
 #include <errno.h>
 
@@ -16,7 +23,19 @@
 #include "list.h"
 #include "cfm_netlink.h"
 
-static struct rtnl_handle rth = { .fd = -1 };
+static struct rtnl_handle rth_local = { .fd = -1 };
+static struct rtnl_handle *rth = &rth_local;	/* Of the selected namespace */
+
+/* Named network namespaces, by the ID they have in our namespace */
+struct cfm_netns {
+	int nsid;
+	bool seen;		/* Found by the last scan */
+	char name[NAME_MAX + 1];
+	struct rtnl_handle rth;
+};
+
+static struct cfm_netns netns[CFM_NETNS_MAX];
+static int netns_count;
 
 struct request {
 	struct nlmsghdr		n;
@@ -53,7 +72,7 @@ static int cfm_nl_terminate(struct request *req, struct rtattr *afspec,
 	addattr_nest_end(&req->n, af);
 	addattr_nest_end(&req->n, afspec);
 
-	err = rtnl_talk(&rth, &req->n, NULL);
+	err = rtnl_talk(rth, &req->n, NULL);
 	if (err) {
 		printf("cfm_nl_terminate: rtnl_talk failed\n");
 		return err;
@@ -591,6 +610,370 @@ static int cfm_mep_status_get(struct nlmsghdr *n, void *data)
 	return 0;
 }
 
+struct mep_info_req {
+	struct cfm_mep_info *info;	/* 'max' entries */
+	uint32_t max;
+	uint32_t count;			/* Entries found */
+	uint32_t skipped;		/* Matching MEPs beyond 'max' */
+	bool by_port;
+	uint32_t ifindex;		/* Port if 'by_port', else bridge */
+	uint32_t instance;
+};
+
+static struct cfm_mep_info *cfm_mep_info_find(struct cfm_mep_info *info, uint32_t count,
+					      uint32_t instance)
+{
+	uint32_t m;
+
+	for (m = 0; m < count; ++m)
+		if (info[m].instance == instance)
+			return &info[m];
+
+	return NULL;
+}
+
+static int cfm_mep_info_get(struct nlmsghdr *n, void *data)
+{
+	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
+	struct rtattr *info_create[IFLA_BRIDGE_CFM_MEP_CREATE_MAX + 1];
+	struct rtattr *info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_MAX + 1];
+	struct rtattr *info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_MAX + 1];
+	struct rtattr *info_peer[IFLA_BRIDGE_CFM_CC_PEER_MEP_MAX + 1];
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct mep_info_req *req = (struct mep_info_req *)data;
+	struct cfm_mep_info *_data, *found;
+	int len = n->nlmsg_len;
+	struct rtattr *i, *list;
+	uint32_t mepid, instance, port_ifindex, first = req->count;
+	bool match;
+	int rem;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0) {
+		fprintf(stderr, "Message too short!\n");
+		return -1;
+	}
+
+	if (ifi->ifi_family != AF_BRIDGE)
+		return 0;
+
+	/* An instance is only looked up on its own bridge */
+	if (!req->by_port && (req->count || ifi->ifi_index != req->ifindex))
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_AF_SPEC])
+		return 0;
+
+	parse_rtattr_flags(aftb, IFLA_BRIDGE_MAX, RTA_DATA(tb[IFLA_AF_SPEC]), RTA_PAYLOAD(tb[IFLA_AF_SPEC]), NLA_F_NESTED);
+	if (!aftb[IFLA_BRIDGE_CFM])
+		return 0;
+
+	list = aftb[IFLA_BRIDGE_CFM];
+	rem = RTA_PAYLOAD(list);
+
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		if (i->rta_type != (IFLA_BRIDGE_CFM_MEP_CREATE_INFO | NLA_F_NESTED))
+			continue;
+
+		parse_rtattr_flags(info_create, IFLA_BRIDGE_CFM_MEP_CREATE_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+
+		if (!info_create[IFLA_BRIDGE_CFM_MEP_CREATE_INSTANCE] ||
+		    !info_create[IFLA_BRIDGE_CFM_MEP_CREATE_IFINDEX])
+			continue;
+
+		instance = rta_getattr_u32(info_create[IFLA_BRIDGE_CFM_MEP_CREATE_INSTANCE]);
+		port_ifindex = rta_getattr_u32(info_create[IFLA_BRIDGE_CFM_MEP_CREATE_IFINDEX]);
+		if (req->by_port)
+			match = port_ifindex == req->ifindex;
+		else
+			match = instance == req->instance;
+
+		if (!match)
+			continue;
+		if (req->count == req->max) {
+			req->skipped++;
+			continue;
+		}
+
+		_data = &req->info[req->count++];
+		memset(_data, 0, sizeof(*_data));
+		_data->br_ifindex = ifi->ifi_index;
+		_data->instance = instance;
+		_data->port_ifindex = port_ifindex;
+		if (info_create[IFLA_BRIDGE_CFM_MEP_CREATE_DOMAIN])
+			_data->domain = rta_getattr_u32(info_create[IFLA_BRIDGE_CFM_MEP_CREATE_DOMAIN]);
+		if (info_create[IFLA_BRIDGE_CFM_MEP_CREATE_DIRECTION])
+			_data->direction = rta_getattr_u32(info_create[IFLA_BRIDGE_CFM_MEP_CREATE_DIRECTION]);
+	}
+
+	if (req->count == first)
+		return 0;
+
+	/* The configuration of the MEPs found in this message */
+	list = aftb[IFLA_BRIDGE_CFM];
+	rem = RTA_PAYLOAD(list);
+
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		if (i->rta_type == (IFLA_BRIDGE_CFM_MEP_CONFIG_INFO | NLA_F_NESTED)) {
+			parse_rtattr_flags(info_config, IFLA_BRIDGE_CFM_MEP_CONFIG_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+			if (!info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_INSTANCE])
+				continue;
+			found = cfm_mep_info_find(&req->info[first], req->count - first,
+						  rta_getattr_u32(info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_INSTANCE]));
+			if (!found)
+				continue;
+
+			memcpy(found->mac.addr, RTA_DATA(info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_UNICAST_MAC]), sizeof(found->mac.addr));
+			found->level = rta_getattr_u32(info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_MDLEVEL]);
+			found->mepid = rta_getattr_u32(info_config[IFLA_BRIDGE_CFM_MEP_CONFIG_MEPID]);
+		} else if (i->rta_type == (IFLA_BRIDGE_CFM_CC_CONFIG_INFO | NLA_F_NESTED)) {
+			parse_rtattr_flags(info_cc, IFLA_BRIDGE_CFM_CC_CONFIG_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+			if (!info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_INSTANCE])
+				continue;
+			found = cfm_mep_info_find(&req->info[first], req->count - first,
+						  rta_getattr_u32(info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_INSTANCE]));
+			if (!found)
+				continue;
+
+			found->cc_enable = rta_getattr_u32(info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_ENABLE]);
+			found->interval = rta_getattr_u32(info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_EXP_INTERVAL]);
+			memcpy(found->maid.data, RTA_DATA(info_cc[IFLA_BRIDGE_CFM_CC_CONFIG_EXP_MAID]), sizeof(found->maid.data));
+		} else if (i->rta_type == (IFLA_BRIDGE_CFM_CC_PEER_MEP_INFO | NLA_F_NESTED)) {
+			parse_rtattr_flags(info_peer, IFLA_BRIDGE_CFM_CC_PEER_MEP_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+			if (!info_peer[IFLA_BRIDGE_CFM_CC_PEER_MEP_INSTANCE] ||
+			    !info_peer[IFLA_BRIDGE_CFM_CC_PEER_MEPID])
+				continue;
+			found = cfm_mep_info_find(&req->info[first], req->count - first,
+						  rta_getattr_u32(info_peer[IFLA_BRIDGE_CFM_CC_PEER_MEP_INSTANCE]));
+			if (!found)
+				continue;
+
+			mepid = rta_getattr_u32(info_peer[IFLA_BRIDGE_CFM_CC_PEER_MEPID]);
+			if (mepid > CFM_MEPID_MAX)
+				continue;
+			found->peers[mepid / 64] |= 1ULL << (mepid % 64);
+			found->peer_count++;
+		}
+	}
+
+	return 0;
+}
+
+struct ccm_tx_req {
+	cfm_ccm_tx_fn_t fn;
+	void *arg;
+};
+
+static int cfm_ccm_tx_get(struct nlmsghdr *n, void *data)
+{
+	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
+	struct rtattr *info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_MAX + 1];
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct ccm_tx_req *req = data;
+	int len = n->nlmsg_len;
+	struct rtattr *i, *list;
+	struct cfm_ccm_tx tx;
+	int rem;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0) {
+		fprintf(stderr, "Message too short!\n");
+		return -1;
+	}
+
+	if (ifi->ifi_family != AF_BRIDGE)
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_AF_SPEC])
+		return 0;
+
+	parse_rtattr_flags(aftb, IFLA_BRIDGE_MAX, RTA_DATA(tb[IFLA_AF_SPEC]), RTA_PAYLOAD(tb[IFLA_AF_SPEC]), NLA_F_NESTED);
+	if (!aftb[IFLA_BRIDGE_CFM])
+		return 0;
+
+	list = aftb[IFLA_BRIDGE_CFM];
+	rem = RTA_PAYLOAD(list);
+
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		if (i->rta_type != (IFLA_BRIDGE_CFM_CC_CCM_TX_INFO | NLA_F_NESTED))
+			continue;
+
+		parse_rtattr_flags(info_tx, IFLA_BRIDGE_CFM_CC_CCM_TX_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+		if (!info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_INSTANCE] ||
+		    !info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_DMAC] ||
+		    !info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PERIOD])
+			continue;
+
+		memset(&tx, 0, sizeof(tx));
+		tx.br_ifindex = ifi->ifi_index;
+		tx.instance = rta_getattr_u32(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_INSTANCE]);
+		memcpy(tx.dmac.addr, RTA_DATA(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_DMAC]), sizeof(tx.dmac.addr));
+		tx.period = rta_getattr_u32(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PERIOD]);
+		if (info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_SEQ_NO_UPDATE])
+			tx.sequence = rta_getattr_u32(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_SEQ_NO_UPDATE]);
+		if (info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV])
+			tx.iftlv = rta_getattr_u32(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV]);
+		if (info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV_VALUE])
+			tx.iftlv_value = rta_getattr_u8(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV_VALUE]);
+		if (info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV])
+			tx.porttlv = rta_getattr_u32(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV]);
+		if (info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV_VALUE])
+			tx.porttlv_value = rta_getattr_u8(info_tx[IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV_VALUE]);
+
+		req->fn(&tx, req->arg);
+	}
+
+	return 0;
+}
+
+struct mep_snapshot_req {
+	cfm_mep_snapshot_fn_t fn;
+	void *arg;
+	struct cfm_mep_snapshot *snaps;	/* MEPs of the bridge being parsed */
+	uint32_t count;
+	uint32_t size;
+	uint32_t last;
+	int err;
+};
+
+/* The attributes of one instance mostly come together, so the last MEP
+ * looked up is tried first.
+ */
+static struct cfm_mep_snapshot *mep_snapshot_get(struct mep_snapshot_req *req,
+						 uint32_t br_ifindex, uint32_t instance)
+{
+	struct cfm_mep_snapshot *snaps, *snap;
+	uint32_t i;
+
+	if (req->count && req->snaps[req->last].info.instance == instance)
+		return &req->snaps[req->last];
+
+	for (i = 0; i < req->count; ++i) {
+		if (req->snaps[i].info.instance == instance) {
+			req->last = i;
+			return &req->snaps[i];
+		}
+	}
+
+	if (req->count == req->size) {
+		snaps = realloc(req->snaps, (req->size ? 2 * req->size : 4) * sizeof(*snaps));
+		if (!snaps)
+			return NULL;
+		req->snaps = snaps;
+		req->size = req->size ? 2 * req->size : 4;
+	}
+
+	req->last = req->count++;
+	snap = &req->snaps[req->last];
+	memset(snap, 0, sizeof(*snap));
+	snap->info.br_ifindex = br_ifindex;
+	snap->info.instance = instance;
+
+	return snap;
+}
+
+static int cfm_mep_snapshot_get(struct nlmsghdr *n, void *data)
+{
+	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
+	struct rtattr *info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_MAX + 1];	/* The largest nest */
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct mep_snapshot_req *req = data;
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct cfm_mep_snapshot *snap;
+	int len = n->nlmsg_len;
+	struct rtattr *i, *list;
+	uint32_t mepid, k;
+	int rem, type;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0) {
+		fprintf(stderr, "Message too short!\n");
+		return -1;
+	}
+
+	if (ifi->ifi_family != AF_BRIDGE)
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_AF_SPEC])
+		return 0;
+
+	parse_rtattr_flags(aftb, IFLA_BRIDGE_MAX, RTA_DATA(tb[IFLA_AF_SPEC]), RTA_PAYLOAD(tb[IFLA_AF_SPEC]), NLA_F_NESTED);
+	if (!aftb[IFLA_BRIDGE_CFM])
+		return 0;
+
+	list = aftb[IFLA_BRIDGE_CFM];
+	rem = RTA_PAYLOAD(list);
+	req->count = 0;
+
+	/* The instance is attribute 1 of every nest */
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		type = i->rta_type & ~NLA_F_NESTED;
+		if (type != IFLA_BRIDGE_CFM_MEP_CREATE_INFO && type != IFLA_BRIDGE_CFM_MEP_CONFIG_INFO &&
+		    type != IFLA_BRIDGE_CFM_CC_CONFIG_INFO && type != IFLA_BRIDGE_CFM_CC_PEER_MEP_INFO &&
+		    type != IFLA_BRIDGE_CFM_MEP_STATUS_INFO && type != IFLA_BRIDGE_CFM_CC_PEER_STATUS_INFO)
+			continue;
+
+		parse_rtattr_flags(info, IFLA_BRIDGE_CFM_CC_PEER_STATUS_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
+		if (!info[1])
+			continue;
+
+		snap = mep_snapshot_get(req, ifi->ifi_index, rta_getattr_u32(info[1]));
+		if (!snap) {
+			req->err = -ENOMEM;
+			return -1;
+		}
+
+		switch (type) {
+		case IFLA_BRIDGE_CFM_MEP_CREATE_INFO:
+			snap->info.domain = rta_getattr_u32(info[IFLA_BRIDGE_CFM_MEP_CREATE_DOMAIN]);
+			snap->info.direction = rta_getattr_u32(info[IFLA_BRIDGE_CFM_MEP_CREATE_DIRECTION]);
+			snap->info.port_ifindex = rta_getattr_u32(info[IFLA_BRIDGE_CFM_MEP_CREATE_IFINDEX]);
+			break;
+		case IFLA_BRIDGE_CFM_MEP_CONFIG_INFO:
+			memcpy(snap->info.mac.addr, RTA_DATA(info[IFLA_BRIDGE_CFM_MEP_CONFIG_UNICAST_MAC]), sizeof(snap->info.mac.addr));
+			snap->info.level = rta_getattr_u32(info[IFLA_BRIDGE_CFM_MEP_CONFIG_MDLEVEL]);
+			snap->info.mepid = rta_getattr_u32(info[IFLA_BRIDGE_CFM_MEP_CONFIG_MEPID]);
+			break;
+		case IFLA_BRIDGE_CFM_CC_CONFIG_INFO:
+			snap->info.cc_enable = rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_CONFIG_ENABLE]);
+			snap->info.interval = rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_CONFIG_EXP_INTERVAL]);
+			memcpy(snap->info.maid.data, RTA_DATA(info[IFLA_BRIDGE_CFM_CC_CONFIG_EXP_MAID]), sizeof(snap->info.maid.data));
+			break;
+		case IFLA_BRIDGE_CFM_CC_PEER_MEP_INFO:
+			mepid = rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_MEPID]);
+			if (mepid > CFM_MEPID_MAX)
+				break;
+			snap->info.peers[mepid / 64] |= 1ULL << (mepid % 64);
+			snap->info.peer_count++;
+			break;
+		case IFLA_BRIDGE_CFM_CC_PEER_STATUS_INFO:
+			mepid = rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_PEER_MEPID]);
+			if (mepid > CFM_MEPID_MAX)
+				break;
+			snap->status[mepid / 64] |= 1ULL << (mepid % 64);
+			if (rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_CCM_DEFECT]))
+				snap->defects[mepid / 64] |= 1ULL << (mepid % 64);
+			if (rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_RDI]))
+				snap->rdi[mepid / 64] |= 1ULL << (mepid % 64);
+			if (rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_SEEN]))
+				snap->seen[mepid / 64] |= 1ULL << (mepid % 64);
+			if (rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_STATUS_SEQ_UNEXP_SEEN]))
+				snap->seq_unexp[mepid / 64] |= 1ULL << (mepid % 64);
+			break;
+		}
+	}
+
+	for (k = 0; k < req->count; ++k)
+		req->fn(&req->snaps[k], req->arg);
+
+	return 0;
+}
+
 static int cfm_mip_config_show(struct nlmsghdr *n, void *arg)
 {
 	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
@@ -665,7 +1048,7 @@ static int cfm_mip_config_show(struct nlmsghdr *n, void *arg)
 
 int cfm_offload_init(void)
 {
-	if (rtnl_open(&rth, 0) < 0) {
+	if (rtnl_open(&rth_local, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
 		return EXIT_FAILURE;
 	}
@@ -675,7 +1058,13 @@ int cfm_offload_init(void)
 
 void cfm_offload_uninit(void)
 {
-	rtnl_close(&rth);
+	int i;
+
+	for (i = 0; i < netns_count; ++i)
+		rtnl_close(&netns[i].rth);
+	netns_count = 0;
+	rth = &rth_local;
+	rtnl_close(&rth_local);
 }
 
 int cfm_offload_mep_create(uint32_t br_ifindex, uint32_t instance, uint32_t domain, uint32_t direction, uint32_t ifindex)
@@ -789,60 +1178,161 @@ int cfm_offload_cc_rdi(uint32_t br_ifindex, uint32_t instance, uint32_t rdi)
 	return cfm_nl_terminate(&req, afspec, af, af_sub);
 }
 
+static void cfm_nl_ccm_tx_fill(struct request *req, const struct cfm_ccm_tx *tx)
+{
+	struct rtattr *afspec, *af, *af_sub;
+	struct mac_addr dmac = tx->dmac;
+
+	cfm_nl_bridge_prepare(tx->br_ifindex, RTM_SETLINK, req, &afspec,
+			      &af, &af_sub, IFLA_BRIDGE_CFM_CC_CCM_TX);
+
+	addattr32(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_INSTANCE,
+		  tx->instance);
+	addattrmac(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_DMAC,
+		   &dmac);
+	addattr32(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_SEQ_NO_UPDATE,
+		  tx->sequence);
+	addattr32(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_PERIOD,
+		  tx->period);
+	addattr32(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV,
+		  tx->iftlv);
+	addattr8(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV_VALUE,
+		  tx->iftlv_value);
+	addattr32(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV,
+		  tx->porttlv);
+	addattr8(&req->n, sizeof(*req), IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV_VALUE,
+		  tx->porttlv_value);
+
+	addattr_nest_end(&req->n, af_sub);
+	addattr_nest_end(&req->n, af);
+	addattr_nest_end(&req->n, afspec);
+}
+
 int cfm_offload_cc_ccm_tx(uint32_t br_ifindex, uint32_t instance,
 			  struct mac_addr *dmac, uint32_t sequence, uint32_t period, uint32_t iftlv,
 			  uint8_t iftlv_value, uint32_t porttlv, uint8_t porttlv_value)
 {
-	struct rtattr *afspec, *af, *af_sub;
+	struct cfm_ccm_tx tx = {
+		.br_ifindex = br_ifindex,
+		.instance = instance,
+		.dmac = *dmac,
+		.sequence = sequence,
+		.period = period,
+		.iftlv = iftlv,
+		.iftlv_value = iftlv_value,
+		.porttlv = porttlv,
+		.porttlv_value = porttlv_value,
+	};
 	struct request req = { 0 };
+	int err;
 
-	cfm_nl_bridge_prepare(br_ifindex, RTM_SETLINK, &req, &afspec,
-			      &af, &af_sub, IFLA_BRIDGE_CFM_CC_CCM_TX);
+	cfm_nl_ccm_tx_fill(&req, &tx);
 
-	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_INSTANCE,
-		  instance);
-	addattrmac(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_DMAC,
-		   dmac);
-	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_SEQ_NO_UPDATE,
-		  sequence);
-	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_PERIOD,
-		  period);
-	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV,
-		  iftlv);
-	addattr8(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_IF_TLV_VALUE,
-		  iftlv_value);
-	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV,
-		  porttlv);
-	addattr8(&req.n, sizeof(req), IFLA_BRIDGE_CFM_CC_CCM_TX_PORT_TLV_VALUE,
-		  porttlv_value);
+	err = rtnl_talk(rth, &req.n, NULL);
+	if (err) {
+		printf("cfm_offload_cc_ccm_tx: rtnl_talk failed\n");
+		return err;
+	}
 
-	return cfm_nl_terminate(&req, afspec, af, af_sub);
+	return 0;
+}
+
+/* Send up to CFM_CCM_TX_BATCH_MAX CCM TX requests in one sendmsg() and
+ * collect the ACK of each. errors[i] is 0 or the negative errno of tx[i].
+ * Returns the number of failed requests, or -1 if the batch was not sent.
+ */
+int cfm_offload_cc_ccm_tx_batch(const struct cfm_ccm_tx *tx, unsigned int count, int *errors)
+{
+	static struct request req[CFM_CCM_TX_BATCH_MAX];
+	struct iovec iov[CFM_CCM_TX_BATCH_MAX];
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = count,
+	};
+	unsigned int i, acked = 0, failed = 0;
+	struct nlmsgerr *nlerr;
+	struct nlmsghdr *h;
+	char buf[16384];
+	uint32_t first;
+	int len;
+
+	if (count > CFM_CCM_TX_BATCH_MAX)
+		return -1;
+
+	first = rth->seq + 1;
+	for (i = 0; i < count; ++i) {
+		memset(&req[i], 0, sizeof(req[i]));
+		cfm_nl_ccm_tx_fill(&req[i], &tx[i]);
+		req[i].n.nlmsg_seq = ++rth->seq;
+		req[i].n.nlmsg_flags |= NLM_F_ACK;
+		iov[i].iov_base = &req[i].n;
+		iov[i].iov_len = req[i].n.nlmsg_len;
+		errors[i] = 1;
+	}
+
+	if (sendmsg(rth->fd, &msg, 0) < 0) {
+		for (i = 0; i < count; ++i)
+			errors[i] = -errno;
+		return -1;
+	}
+
+	while (acked < count) {
+		len = recv(rth->fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			for (i = 0; i < count; ++i)
+				if (errors[i] > 0)
+					errors[i] = -errno;
+			return count - acked + failed;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			if (h->nlmsg_type != NLMSG_ERROR || h->nlmsg_seq - first >= count ||
+			    h->nlmsg_len < NLMSG_LENGTH(sizeof(*nlerr)))
+				continue;
+
+			nlerr = NLMSG_DATA(h);
+			i = h->nlmsg_seq - first;
+			if (errors[i] <= 0)
+				continue;
+			errors[i] = nlerr->error;
+			if (nlerr->error)
+				failed++;
+			acked++;
+		}
+	}
+
+	return failed;
 }
 
 int cfm_offload_mep_config_show(uint32_t br_ifindex)
 {
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
 	}
 
-	return rtnl_dump_filter(&rth, cfm_mep_config_show, NULL);
+	return rtnl_dump_filter(rth, cfm_mep_config_show, NULL);
 }
 
 int cfm_offload_mep_status_show(uint32_t br_ifindex)
 {
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_STATUS);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_STATUS);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
 	}
 
-	return rtnl_dump_filter(&rth, cfm_mep_status_show, NULL);
+	return rtnl_dump_filter(rth, cfm_mep_status_show, NULL);
 }
 
 int cfm_offload_mep_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uint32_t *instance)
@@ -850,14 +1340,14 @@ int cfm_offload_mep_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uin
 	struct cfm_instance_get_data data;
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
 	}
 
 	data.port_ifindex = port_ifindex;
-	err = rtnl_dump_filter(&rth, cfm_mep_instance_get, &data);
+	err = rtnl_dump_filter(rth, cfm_mep_instance_get, &data);
 	*instance = data.instance;
 
 	return err;
@@ -868,14 +1358,14 @@ int cfm_offload_mep_status_get(uint32_t br_ifindex, uint32_t instance, struct cf
 	int err;
 	struct cfm_mep_status_get data;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_STATUS);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_STATUS);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
 	}
 
 	data.instance = instance;
-	err = rtnl_dump_filter(&rth, cfm_mep_status_get, &data);
+	err = rtnl_dump_filter(rth, cfm_mep_status_get, &data);
 	status->peer_mepid = data.peer_mepid;
 	status->ccm_defect = data.ccm_defect;
 
@@ -941,13 +1431,13 @@ int cfm_offload_mip_config_show(uint32_t br_ifindex)
 {
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_MIP_CONFIG);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_MIP_CONFIG);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
 	}
 
-	return rtnl_dump_filter(&rth, cfm_mip_config_show, NULL);
+	return rtnl_dump_filter(rth, cfm_mip_config_show, NULL);
 }
 
 int cfm_offload_mip_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uint32_t vlan_ifindex, uint32_t *instance)
@@ -955,7 +1445,7 @@ int cfm_offload_mip_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uin
 	struct cfm_instance_get_data data;
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_CFM_MIP_CONFIG);
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_MIP_CONFIG);
 	if (err < 0) {
 		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
 		return err;
@@ -963,8 +1453,329 @@ int cfm_offload_mip_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uin
 
 	data.port_ifindex = port_ifindex;
 	data.vlan_ifindex = vlan_ifindex;
-	err = rtnl_dump_filter(&rth, cfm_mip_instance_get, &data);
+	err = rtnl_dump_filter(rth, cfm_mip_instance_get, &data);
 	*instance = data.instance;
 
 	return err;
-}
\ No newline at end of file
+}
+
+static int cfm_offload_mep_info_dump(struct mep_info_req *req)
+{
+	int err;
+
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
+	if (err < 0) {
+		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
+		return err;
+	}
+
+	return rtnl_dump_filter(rth, cfm_mep_info_get, req);
+}
+
+/* Look up the MEP instances created on a bridge port. Returns the number
+ * found, at most 'max', or a negative error.
+ */
+int cfm_offload_mep_info_get(uint32_t port_ifindex, struct cfm_mep_info *info, uint32_t max)
+{
+	struct mep_info_req req = {
+		.info = info,
+		.max = max,
+		.by_port = true,
+		.ifindex = port_ifindex,
+	};
+	int err;
+
+	err = cfm_offload_mep_info_dump(&req);
+	if (err < 0)
+		return err;
+	if (req.skipped)
+		fprintf(stderr, "cfm_offload_mep_info_get: %u MEPs on port %u not reported\n",
+			req.skipped, port_ifindex);
+
+	return req.count;
+}
+
+int cfm_offload_mep_info_instance_get(uint32_t br_ifindex, uint32_t instance,
+				      struct cfm_mep_info *info)
+{
+	struct mep_info_req req = {
+		.info = info,
+		.max = 1,
+		.ifindex = br_ifindex,
+		.instance = instance,
+	};
+	int err;
+
+	memset(info, 0, sizeof(*info));
+	err = cfm_offload_mep_info_dump(&req);
+	if (err < 0)
+		return err;
+
+	return req.count ? 0 : -ENOENT;
+}
+
+/* Call fn for the CCM TX configuration of every MEP on every bridge */
+int cfm_offload_ccm_tx_dump(cfm_ccm_tx_fn_t fn, void *arg)
+{
+	struct ccm_tx_req req = { .fn = fn, .arg = arg };
+	int err;
+
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_CONFIG);
+	if (err < 0) {
+		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
+		return err;
+	}
+
+	return rtnl_dump_filter(rth, cfm_ccm_tx_get, &req);
+}
+
+/* Call fn for every MEP on every bridge, with its configuration if 'config'
+ * and always with the peer status, all from one dump.
+ */
+int cfm_offload_mep_snapshot(bool config, cfm_mep_snapshot_fn_t fn, void *arg)
+{
+	struct mep_snapshot_req req = { .fn = fn, .arg = arg };
+	int err;
+
+	err = rtnl_linkdump_req_filter(rth, PF_BRIDGE, RTEXT_FILTER_CFM_STATUS |
+				       (config ? RTEXT_FILTER_CFM_CONFIG : 0));
+	if (err < 0) {
+		fprintf(stderr, "Cannot rtnl_linkdump_req_filter\n");
+		return err;
+	}
+
+	err = rtnl_dump_filter(rth, cfm_mep_snapshot_get, &req);
+	free(req.snaps);
+
+	return req.err ? req.err : err;
+}
+
+/* Set the STP state of a bridge port, BR_STATE_*. The bridge must not run
+ * kernel STP.
+ */
+int cfm_offload_port_state(uint32_t port_ifindex, uint8_t state)
+{
+	struct request req = { 0 };
+	struct rtattr *protinfo;
+
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_SETLINK;
+	req.ifm.ifi_family = PF_BRIDGE;
+	req.ifm.ifi_index = port_ifindex;
+
+	protinfo = addattr_nest(&req.n, sizeof(req), IFLA_PROTINFO | NLA_F_NESTED);
+	addattr8(&req.n, sizeof(req), IFLA_BRPORT_STATE, state);
+	addattr_nest_end(&req.n, protinfo);
+
+	return rtnl_talk(rth, &req.n, NULL);
+}
+
+/* Remove the FDB entries learned on a bridge port */
+int cfm_offload_port_flush(uint32_t port_ifindex)
+{
+	struct request req = { 0 };
+	struct rtattr *protinfo;
+
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_SETLINK;
+	req.ifm.ifi_family = PF_BRIDGE;
+	req.ifm.ifi_index = port_ifindex;
+
+	protinfo = addattr_nest(&req.n, sizeof(req), IFLA_PROTINFO | NLA_F_NESTED);
+	addattr_l(&req.n, sizeof(req), IFLA_BRPORT_FLUSH, NULL, 0);
+	addattr_nest_end(&req.n, protinfo);
+
+	return rtnl_talk(rth, &req.n, NULL);
+}
+
+/* RTM_GETNSID of the namespace fd, or with RTM_NEWNSID let the kernel
+ * assign an ID. Events from a namespace without ID are not delivered.
+ */
+static int cfm_netns_id(int type, int fd)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct rtgenmsg		g;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = type,
+		.g.rtgen_family = AF_UNSPEC,
+	};
+	struct rtattr *tb[NETNSA_MAX + 1];
+	struct nlmsghdr *answer;
+	int nsid = -1;
+
+	addattr32(&req.n, sizeof(req), NETNSA_FD, fd);
+	if (type == RTM_NEWNSID) {
+		addattr32(&req.n, sizeof(req), NETNSA_NSID, -1);
+		return rtnl_talk(&rth_local, &req.n, NULL);
+	}
+
+	if (rtnl_talk(&rth_local, &req.n, &answer) < 0)
+		return -1;
+
+	parse_rtattr(tb, NETNSA_MAX, (struct rtattr *)((char *)NLMSG_DATA(answer) +
+		     NLMSG_ALIGN(sizeof(struct rtgenmsg))),
+		     answer->nlmsg_len - NLMSG_SPACE(sizeof(struct rtgenmsg)));
+	if (tb[NETNSA_NSID])
+		nsid = *(int32_t *)RTA_DATA(tb[NETNSA_NSID]);
+	free(answer);
+
+	return nsid;
+}
+
+static struct cfm_netns *cfm_netns_find(int nsid)
+{
+	int i;
+
+	for (i = 0; i < netns_count; ++i)
+		if (netns[i].nsid == nsid)
+			return &netns[i];
+
+	return NULL;
+}
+
+/* Open a netlink socket inside the namespace, it stays there */
+static int cfm_netns_open(struct cfm_netns *ns, int fd)
+{
+	int self, err;
+
+	self = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (self < 0)
+		return -1;
+
+	if (setns(fd, CLONE_NEWNET)) {
+		fprintf(stderr, "setns %s failed: %s\n", ns->name, strerror(errno));
+		close(self);
+		return -1;
+	}
+	err = rtnl_open(&ns->rth, 0);
+	if (setns(self, CLONE_NEWNET))
+		fprintf(stderr, "setns back failed: %s\n", strerror(errno));
+	close(self);
+
+	return err;
+}
+
+static void cfm_netns_add(const char *name, struct stat *self)
+{
+	struct cfm_netns *ns;
+	char path[PATH_MAX];
+	struct stat st;
+	int fd, nsid;
+
+	snprintf(path, sizeof(path), "%s/%s", CFM_NETNS_RUN_DIR, name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* Our own namespace may be named too */
+	if (fstat(fd, &st) || (st.st_dev == self->st_dev && st.st_ino == self->st_ino))
+		goto out;
+
+	nsid = cfm_netns_id(RTM_GETNSID, fd);
+	if (nsid < 0 && !cfm_netns_id(RTM_NEWNSID, fd))
+		nsid = cfm_netns_id(RTM_GETNSID, fd);
+	if (nsid < 0)
+		goto out;
+
+	ns = cfm_netns_find(nsid);
+	if (ns && !strcmp(ns->name, name)) {
+		ns->seen = true;
+		goto out;
+	}
+	if (ns) {
+		/* The ID was reused for another namespace */
+		rtnl_close(&ns->rth);
+	} else {
+		if (netns_count == CFM_NETNS_MAX)
+			goto out;
+		ns = &netns[netns_count++];
+	}
+
+	ns->nsid = nsid;
+	snprintf(ns->name, sizeof(ns->name), "%s", name);
+	if (cfm_netns_open(ns, fd)) {
+		*ns = netns[--netns_count];
+		goto out;
+	}
+	ns->seen = true;
+
+out:
+	close(fd);
+}
+
+int cfm_offload_netns_scan(void)
+{
+	struct dirent *de;
+	struct stat self;
+	DIR *dir;
+	int i;
+
+	if (stat("/proc/self/ns/net", &self))
+		return -1;
+
+	/* Handles move around below */
+	rth = &rth_local;
+	for (i = 0; i < netns_count; ++i)
+		netns[i].seen = false;
+
+	dir = opendir(CFM_NETNS_RUN_DIR);
+	if (dir) {
+		while ((de = readdir(dir)))
+			if (de->d_name[0] != '.')
+				cfm_netns_add(de->d_name, &self);
+		closedir(dir);
+	}
+
+	/* A socket would keep a deleted namespace alive */
+	for (i = 0; i < netns_count; ) {
+		if (netns[i].seen) {
+			i++;
+			continue;
+		}
+		rtnl_close(&netns[i].rth);
+		netns[i] = netns[--netns_count];
+	}
+
+	return netns_count;
+}
+
+int cfm_offload_netns_select(int nsid)
+{
+	struct cfm_netns *ns;
+
+	if (nsid < 0) {
+		rth = &rth_local;
+		return 0;
+	}
+
+	ns = cfm_netns_find(nsid);
+	if (!ns)
+		return -1;
+	rth = &ns->rth;
+
+	return 0;
+}
+
+const char *cfm_offload_netns_name(int nsid)
+{
+	struct cfm_netns *ns = cfm_netns_find(nsid);
+
+	return ns ? ns->name : NULL;
+}
+
+/* IDs of the scanned namespaces, our own not included */
+int cfm_offload_netns_list(int *nsids, int max)
+{
+	int i;
+
+	for (i = 0; i < netns_count && i < max; ++i)
+		nsids[i] = netns[i].nsid;
+
+	return i;
+}
@@ -20,6 +20,62 @@ struct cfm_mep_status {
 	bool ccm_defect;
 };
 
+#define CFM_MEPID_MAX		8191
+#define CFM_MEPID_WORDS		((CFM_MEPID_MAX + 1) / 64)
+
+/* Configuration of one MEP instance as read back from the kernel */
+struct cfm_mep_info {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t domain;
+	uint32_t direction;
+	uint32_t port_ifindex;
+	struct mac_addr mac;
+	uint32_t level;
+	uint32_t mepid;
+	uint32_t cc_enable;
+	uint32_t interval;
+	struct maid_data maid;
+	uint32_t peer_count;
+	uint64_t peers[CFM_MEPID_WORDS];	/* Bitmap of peer MEPIDs */
+};
+
+/* CCM transmission of one MEP instance. The kernel stops sending after
+ * 'period' seconds unless the configuration is given again.
+ */
+struct cfm_ccm_tx {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	struct mac_addr dmac;
+	uint32_t sequence;
+	uint32_t period;
+	uint32_t iftlv;
+	uint8_t iftlv_value;
+	uint32_t porttlv;
+	uint8_t porttlv_value;
+};
+
+#define CFM_CCM_TX_BATCH_MAX	64
+
+/* One MEP instance from a snapshot dump. Without the configuration, 'info'
+ * only holds the bridge and the instance.
+ */
+struct cfm_mep_snapshot {
+	struct cfm_mep_info info;
+	uint64_t status[CFM_MEPID_WORDS];	/* Bitmap of peers with status */
+	uint64_t defects[CFM_MEPID_WORDS];	/* Bitmap of peers in CCM defect */
+	uint64_t rdi[CFM_MEPID_WORDS];		/* Bitmap of peers sending RDI */
+	uint64_t seen[CFM_MEPID_WORDS];		/* CCM seen since the last status read */
+	uint64_t seq_unexp[CFM_MEPID_WORDS];	/* Unexpected sequence since the last read */
+};
+
+typedef void (*cfm_mep_snapshot_fn_t)(const struct cfm_mep_snapshot *snap, void *arg);
+
+#define CFM_NETNS_MAX		64
+#define CFM_NETNS_RUN_DIR	"/var/run/netns"
+
+typedef void (*cfm_ccm_tx_fn_t)(const struct cfm_ccm_tx *tx, void *arg);
+
 int cfm_offload_mep_create(uint32_t br_ifindex, uint32_t instance, uint32_t domain, uint32_t direction,
 			   uint32_t ifindex);
 int cfm_offload_mep_delete(uint32_t br_ifindex, uint32_t instance);
@@ -34,6 +90,7 @@ int cfm_offload_cc_ccm_tx(uint32_t br_ifindex, uint32_t instance,
 			  uint8_t iftlv_value, uint32_t porttlv, uint8_t porttlv_value);
 
 int cfm_offload_init(void);
+void cfm_offload_uninit(void);
 int cfm_offload_mep_config_show(uint32_t br_ifindex);
 int cfm_offload_mep_status_show(uint32_t br_ifindex);
 
@@ -47,4 +104,20 @@ int cfm_offload_mip_config_show(uint32_t br_ifindex);
 int cfm_offload_mep_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uint32_t *instance);
 int cfm_offload_mep_status_get(uint32_t br_ifindex, uint32_t instance, struct cfm_mep_status *status);
 int cfm_offload_mip_instance_get(uint32_t br_ifindex, uint32_t port_ifindex, uint32_t vlan_ifindex, uint32_t *instance);
+int cfm_offload_mep_info_get(uint32_t port_ifindex, struct cfm_mep_info *info, uint32_t max);
+int cfm_offload_mep_info_instance_get(uint32_t br_ifindex, uint32_t instance,
+				      struct cfm_mep_info *info);
+int cfm_offload_cc_ccm_tx_batch(const struct cfm_ccm_tx *tx, unsigned int count, int *errors);
+int cfm_offload_ccm_tx_dump(cfm_ccm_tx_fn_t fn, void *arg);
+int cfm_offload_mep_snapshot(bool config, cfm_mep_snapshot_fn_t fn, void *arg);
+int cfm_offload_port_state(uint32_t port_ifindex, uint8_t state);
+int cfm_offload_port_flush(uint32_t port_ifindex);
+
+/* Requests go to the selected namespace, by ID, -1 - our own. Namespaces
+ * named in CFM_NETNS_RUN_DIR are found by cfm_offload_netns_scan().
+ */
+int cfm_offload_netns_scan(void);
+int cfm_offload_netns_select(int nsid);
+const char *cfm_offload_netns_name(int nsid);
+int cfm_offload_netns_list(int *nsids, int max);
 #endif
@@ -0,0 +1,417 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "cfm_pdu.h"
+#include "cfm_oam.h"
+
+#define CFM_OAM_BLOCK_NR	16
+#define CFM_OAM_BLOCK_TIMEOUT	1
+#define CFM_OAM_POLL_MAX_MS	100
+
+static struct cfm_oam *oam_running;
+
+uint64_t cfm_oam_now(void)
+{
+	struct timespec ts;
+
+	/* Same clock as the kernel software timestamps */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cfm_oam_tx_open(struct cfm_oam *oam)
+{
+	struct sockaddr_ll sll;
+
+	/* Protocol 0 - the socket is only used for sending */
+	oam->tx_fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (oam->tx_fd < 0) {
+		fprintf(stderr, "cfm_oam_open: socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = oam->mep.port_ifindex;
+
+	if (bind(oam->tx_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		fprintf(stderr, "cfm_oam_open: bind failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int cfm_oam_open(struct cfm_oam *oam, uint32_t br_ifindex, uint32_t instance,
+		 const uint8_t *opcodes, uint8_t opcode_count)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	struct cfm_rx_config cfg;
+
+	memset(oam, 0, sizeof(*oam));
+	oam->tx_fd = -1;
+	oam->rx.fd = -1;
+
+	if (cfm_offload_mep_info_instance_get(br_ifindex, instance, &oam->mep)) {
+		fprintf(stderr, "cfm_oam_open: MEP instance %u not found\n", instance);
+		return -1;
+	}
+
+	cfm_rx_config_default(&cfg, oam->mep.port_ifindex);
+	cfg.block_nr = CFM_OAM_BLOCK_NR;
+	cfg.block_timeout = CFM_OAM_BLOCK_TIMEOUT;
+	cfg.max_level = oam->mep.level;
+	if (opcode_count > sizeof(cfg.opcodes))
+		opcode_count = sizeof(cfg.opcodes);
+	memcpy(cfg.opcodes, opcodes, opcode_count);
+	cfg.opcode_count = opcode_count;
+
+	if (cfm_rx_open(&oam->rx, &cfg))
+		goto err;
+
+	/* Stamp frames when they enter the stack instead of at the tap */
+	setsockopt(oam->rx.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+	if (cfm_oam_tx_open(oam))
+		goto err;
+
+	oam->timer_size = 64;
+	oam->timers = calloc(oam->timer_size, sizeof(*oam->timers));
+	if (!oam->timers)
+		goto err;
+
+	return 0;
+
+err:
+	cfm_oam_close(oam);
+	return -1;
+}
+
+void cfm_oam_close(struct cfm_oam *oam)
+{
+	cfm_rx_close(&oam->rx);
+	if (oam->tx_fd >= 0)
+		close(oam->tx_fd);
+	oam->tx_fd = -1;
+	free(oam->timers);
+	oam->timers = NULL;
+	oam->timer_count = 0;
+}
+
+/* Have the kernel report the transmit time of every frame sent. Only worth
+ * it for functions that use the timestamps, as each one costs a syscall.
+ */
+int cfm_oam_tx_ts_enable(struct cfm_oam *oam)
+{
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+	if (setsockopt(oam->tx_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+		fprintf(stderr, "cfm_oam: SO_TIMESTAMPING failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+void cfm_oam_handler_set(struct cfm_oam *oam, uint8_t opcode, cfm_oam_rx_t rx,
+			 cfm_oam_tx_ts_t tx_ts, void *arg)
+{
+	oam->handler[opcode].rx = rx;
+	oam->handler[opcode].tx_ts = tx_ts;
+	oam->handler[opcode].arg = arg;
+}
+
+/* Fill in the Ethernet header and return where the PDU goes */
+uint8_t *cfm_oam_frame_init(struct cfm_oam *oam, uint8_t *frame, const struct mac_addr *dmac)
+{
+	memcpy(frame, dmac->addr, ETH_ALEN);
+	memcpy(frame + ETH_ALEN, oam->mep.mac.addr, ETH_ALEN);
+	cfm_pdu_put_u16(frame + 2 * ETH_ALEN, ETH_P_CFM);
+
+	return frame + ETH_HLEN;
+}
+
+int cfm_oam_send(struct cfm_oam *oam, const uint8_t *frame, uint32_t pdu_len)
+{
+	if (send(oam->tx_fd, frame, ETH_HLEN + pdu_len, 0) < 0) {
+		oam->tx_errors++;
+		return -1;
+	}
+
+	oam->tx_frames++;
+	return 0;
+}
+
+/* Send a batch of frames in one syscall, returns the number sent */
+int cfm_oam_send_many(struct cfm_oam *oam, uint8_t *const *frames, const uint32_t *pdu_lens,
+		      unsigned int count)
+{
+	struct mmsghdr msgs[CFM_OAM_BATCH_MAX];
+	struct iovec iovs[CFM_OAM_BATCH_MAX];
+	unsigned int i;
+	int sent;
+
+	if (count > CFM_OAM_BATCH_MAX)
+		count = CFM_OAM_BATCH_MAX;
+
+	memset(msgs, 0, count * sizeof(msgs[0]));
+	for (i = 0; i < count; ++i) {
+		iovs[i].iov_base = frames[i];
+		iovs[i].iov_len = ETH_HLEN + pdu_lens[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	sent = sendmmsg(oam->tx_fd, msgs, count, 0);
+	if (sent < 0) {
+		oam->tx_errors++;
+		return 0;
+	}
+
+	oam->tx_frames += sent;
+	return sent;
+}
+
+static void cfm_oam_timer_swap(struct cfm_oam *oam, uint32_t a, uint32_t b)
+{
+	struct cfm_oam_timer *t = oam->timers[a];
+
+	oam->timers[a] = oam->timers[b];
+	oam->timers[b] = t;
+	oam->timers[a]->idx = a;
+	oam->timers[b]->idx = b;
+}
+
+static void cfm_oam_timer_up(struct cfm_oam *oam, uint32_t idx)
+{
+	while (idx > 1 && oam->timers[idx]->expires < oam->timers[idx / 2]->expires) {
+		cfm_oam_timer_swap(oam, idx, idx / 2);
+		idx /= 2;
+	}
+}
+
+static void cfm_oam_timer_down(struct cfm_oam *oam, uint32_t idx)
+{
+	uint32_t child;
+
+	while ((child = idx * 2) <= oam->timer_count) {
+		if (child < oam->timer_count &&
+		    oam->timers[child + 1]->expires < oam->timers[child]->expires)
+			child++;
+		if (oam->timers[idx]->expires <= oam->timers[child]->expires)
+			break;
+		cfm_oam_timer_swap(oam, idx, child);
+		idx = child;
+	}
+}
+
+/* A timer that cannot be added would stop its function for good, so the
+ * run ends with an error instead
+ */
+int cfm_oam_timer_start(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t expires)
+{
+	struct cfm_oam_timer **timers;
+
+	if (timer->idx) {
+		timer->expires = expires;
+		cfm_oam_timer_up(oam, timer->idx);
+		cfm_oam_timer_down(oam, timer->idx);
+		return 0;
+	}
+
+	if (oam->timer_count + 1 >= oam->timer_size) {
+		timers = realloc(oam->timers, 2 * oam->timer_size * sizeof(*timers));
+		if (!timers) {
+			fprintf(stderr, "cfm_oam_timer_start: out of memory for %u timers\n",
+				2 * oam->timer_size);
+			oam->err = -ENOMEM;
+			oam->quit = 1;
+			return -ENOMEM;
+		}
+		oam->timers = timers;
+		oam->timer_size *= 2;
+	}
+
+	timer->expires = expires;
+	timer->idx = ++oam->timer_count;
+	oam->timers[timer->idx] = timer;
+	cfm_oam_timer_up(oam, timer->idx);
+
+	return 0;
+}
+
+void cfm_oam_timer_stop(struct cfm_oam *oam, struct cfm_oam_timer *timer)
+{
+	uint32_t idx = timer->idx;
+
+	if (!idx)
+		return;
+
+	if (idx != oam->timer_count) {
+		cfm_oam_timer_swap(oam, idx, oam->timer_count);
+		oam->timer_count--;
+		cfm_oam_timer_up(oam, idx);
+		cfm_oam_timer_down(oam, idx);
+	} else {
+		oam->timer_count--;
+	}
+	timer->idx = 0;
+}
+
+static void cfm_oam_timers_run(struct cfm_oam *oam)
+{
+	struct cfm_oam_timer *timer;
+	uint64_t now = cfm_oam_now();
+
+	while (oam->timer_count && oam->timers[1]->expires <= now) {
+		timer = oam->timers[1];
+		cfm_oam_timer_stop(oam, timer);
+		timer->fn(oam, timer, now);
+	}
+}
+
+static void cfm_oam_rx_handler(const struct cfm_rx_frame *frames, unsigned int count,
+			       void *arg)
+{
+	struct cfm_oam *oam = arg;
+	struct cfm_oam_handler *h;
+	const uint8_t *pdu;
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		pdu = frames[i].pdu;
+		h = &oam->handler[cfm_pdu_opcode(pdu)];
+
+		/* Only PDUs at the MEP level addressed to the MEP or multicast */
+		if (!h->rx || cfm_pdu_level(pdu) != oam->mep.level ||
+		    (!(frames[i].mac[0] & 1) &&
+		     memcmp(frames[i].mac, oam->mep.mac.addr, ETH_ALEN)))
+			continue;
+
+		oam->rx_frames++;
+		h->rx(oam, &frames[i], h->arg);
+	}
+}
+
+/* Transmit timestamps are looped back on the error queue together with
+ * the frame they belong to.
+ */
+static void cfm_oam_tx_ts_process(struct cfm_oam *oam)
+{
+	uint8_t frame[CFM_OAM_FRAME_MAX];
+	char control[256];
+	struct scm_timestamping *tss;
+	struct cfm_oam_handler *h;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint64_t ts;
+	ssize_t len;
+
+	while (1) {
+		iov.iov_base = frame;
+		iov.iov_len = sizeof(frame);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		len = recvmsg(oam->tx_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (len < 0)
+			break;
+		if (len < ETH_HLEN + (ssize_t)sizeof(struct br_cfm_common_hdr))
+			continue;
+
+		ts = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+				ts = (uint64_t)tss->ts[0].tv_sec * 1000000000ULL + tss->ts[0].tv_nsec;
+			}
+		}
+
+		h = &oam->handler[cfm_pdu_opcode(frame + ETH_HLEN)];
+		if (ts && h->tx_ts)
+			h->tx_ts(oam, frame, len, ts, h->arg);
+	}
+}
+
+static int cfm_oam_poll_timeout(struct cfm_oam *oam)
+{
+	uint64_t now, wait;
+
+	if (!oam->timer_count)
+		return CFM_OAM_POLL_MAX_MS;
+
+	now = cfm_oam_now();
+	if (oam->timers[1]->expires <= now)
+		return 0;
+
+	wait = (oam->timers[1]->expires - now + 999999) / 1000000;
+	return wait < CFM_OAM_POLL_MAX_MS ? wait : CFM_OAM_POLL_MAX_MS;
+}
+
+static void cfm_oam_signal(int sig)
+{
+	if (oam_running)
+		oam_running->quit = 1;
+}
+
+/* Run until oam->quit is set by a timer, by a failure, or by SIGINT or SIGTERM */
+int cfm_oam_run(struct cfm_oam *oam)
+{
+	struct pollfd fds[2];
+	struct sigaction sa;
+	int n, err = 0;
+
+	/* No SA_RESTART, so a signal also ends the poll() wait */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cfm_oam_signal;
+	oam_running = oam;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fds[0].fd = oam->rx.fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = oam->tx_fd;
+	fds[1].events = 0;	/* The error queue is reported as POLLERR */
+
+	while (!oam->quit) {
+		n = poll(fds, 2, cfm_oam_poll_timeout(oam));
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "cfm_oam_run: poll failed: %s\n", strerror(errno));
+			err = -1;
+			break;
+		}
+
+		if (n > 0 && fds[1].revents)
+			cfm_oam_tx_ts_process(oam);
+		if (n > 0 && fds[0].revents)
+			cfm_rx_process(&oam->rx, cfm_oam_rx_handler, oam);
+
+		cfm_oam_timers_run(oam);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	oam_running = NULL;
+
+	return err ? err : oam->err;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_OAM_H
+#define CFM_OAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+
+#include "cfm_netlink.h"
+#include "cfm_rx.h"
+
+/* Largest frame built by the OAM functions, Ethernet header included */
+#define CFM_OAM_FRAME_MAX	1518
+
+/* Most frames sent by one cfm_oam_send_many() */
+#define CFM_OAM_BATCH_MAX	64
+
+struct cfm_oam;
+struct cfm_oam_timer;
+
+typedef void (*cfm_oam_rx_t)(struct cfm_oam *oam, const struct cfm_rx_frame *frame,
+			     void *arg);
+/* Kernel transmit timestamp of a frame sent with cfm_oam_send(). The frame
+ * starts with the Ethernet header.
+ */
+typedef void (*cfm_oam_tx_ts_t)(struct cfm_oam *oam, const uint8_t *frame, uint32_t len,
+				uint64_t ts, void *arg);
+typedef void (*cfm_oam_timer_fn_t)(struct cfm_oam *oam, struct cfm_oam_timer *timer,
+				   uint64_t now);
+
+struct cfm_oam_timer {
+	uint64_t expires;	/* ns, CLOCK_REALTIME */
+	uint32_t idx;		/* Position in the timer heap, 0 - not pending */
+	cfm_oam_timer_fn_t fn;
+};
+
+struct cfm_oam_handler {
+	cfm_oam_rx_t rx;
+	cfm_oam_tx_ts_t tx_ts;
+	void *arg;
+};
+
+/* Userspace endpoint of a MEP created in the bridge. PDUs the bridge does
+ * not handle are received on a ring socket at the MEP level and sent from
+ * the MEP MAC on the MEP port. Received frames carry kernel software
+ * timestamps, sent frames do after cfm_oam_tx_ts_enable().
+ */
+struct cfm_oam {
+	struct cfm_mep_info mep;
+	struct cfm_rx rx;
+	int tx_fd;
+
+	struct cfm_oam_handler handler[256];
+
+	/* Min-heap of pending timers, index 0 unused */
+	struct cfm_oam_timer **timers;
+	uint32_t timer_count;
+	uint32_t timer_size;
+
+	uint64_t tx_frames;
+	uint64_t tx_errors;
+	uint64_t rx_frames;
+	volatile sig_atomic_t quit;
+	int err;		/* Set with 'quit' when the run failed */
+};
+
+int cfm_oam_open(struct cfm_oam *oam, uint32_t br_ifindex, uint32_t instance,
+		 const uint8_t *opcodes, uint8_t opcode_count);
+void cfm_oam_close(struct cfm_oam *oam);
+int cfm_oam_tx_ts_enable(struct cfm_oam *oam);
+void cfm_oam_handler_set(struct cfm_oam *oam, uint8_t opcode, cfm_oam_rx_t rx,
+			 cfm_oam_tx_ts_t tx_ts, void *arg);
+uint8_t *cfm_oam_frame_init(struct cfm_oam *oam, uint8_t *frame, const struct mac_addr *dmac);
+int cfm_oam_send(struct cfm_oam *oam, const uint8_t *frame, uint32_t pdu_len);
+int cfm_oam_send_many(struct cfm_oam *oam, uint8_t *const *frames, const uint32_t *pdu_lens,
+		      unsigned int count);
+int cfm_oam_timer_start(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t expires);
+void cfm_oam_timer_stop(struct cfm_oam *oam, struct cfm_oam_timer *timer);
+int cfm_oam_run(struct cfm_oam *oam);
+uint64_t cfm_oam_now(void);
+
+#endif
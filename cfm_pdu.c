@@ -0,0 +1,225 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CFM_PDU_X86
+#endif
+
+#include "cfm_pdu.h"
+#include "cfm_rx.h"
+
+/* Bits of the first 4 octets that must match: MD level, version, opcode,
+ * CCM interval and first TLV offset. RDI and the reserved flags are free.
+ */
+static const uint8_t cfm_ccm_hdr_mask[4] = { 0xFF, 0xFF, 0x07, 0xFF };
+
+typedef void (*cfm_ccm_validate_t)(const struct cfm_ccm_expect *exp,
+				   const struct cfm_rx_frame *frames,
+				   unsigned int count, uint8_t *verdict);
+
+static const char *const verdict_str[CFM_CCM_VERDICT_MAX] = {
+	[CFM_CCM_OK] = "ok",
+	[CFM_CCM_ERR_SHORT] = "short",
+	[CFM_CCM_ERR_OPCODE] = "opcode",
+	[CFM_CCM_ERR_LEVEL] = "level",
+	[CFM_CCM_ERR_VERSION] = "version",
+	[CFM_CCM_ERR_INTERVAL] = "interval",
+	[CFM_CCM_ERR_TLV_OFFSET] = "tlv offset",
+	[CFM_CCM_ERR_MAID] = "maid",
+	[CFM_CCM_ERR_MEPID] = "mepid",
+};
+
+const char *cfm_ccm_verdict_str(enum cfm_ccm_verdict verdict)
+{
+	return verdict < CFM_CCM_VERDICT_MAX ? verdict_str[verdict] : "unknown";
+}
+
+void cfm_ccm_expect_init(struct cfm_ccm_expect *exp, uint8_t level, uint8_t interval,
+			 const uint8_t *maid)
+{
+	const uint8_t hdr[4] = {
+		(level << 5) | CFM_VERSION,
+		BR_CFM_OPCODE_CCM,
+		interval & 0x07,
+		CFM_CCM_TLV_OFFSET,
+	};
+
+	memset(exp, 0, sizeof(*exp));
+	memcpy(exp->maid, maid, CFM_MAID_LENGTH);
+	memcpy(&exp->hdr, hdr, sizeof(exp->hdr));
+}
+
+void cfm_ccm_expect_peer(struct cfm_ccm_expect *exp, uint16_t mepid)
+{
+	mepid &= 0x1FFF;
+	if (!(exp->peers[mepid / 64] & (1ULL << (mepid % 64))))
+		exp->peer_count++;
+	exp->peers[mepid / 64] |= 1ULL << (mepid % 64);
+}
+
+/* Only run for rejected frames, so it favours clarity over speed */
+static uint8_t cfm_ccm_reject_reason(const struct cfm_ccm_expect *exp, const uint8_t *pdu)
+{
+	const uint8_t *hdr = (const uint8_t *)&exp->hdr;
+
+	if (cfm_pdu_opcode(pdu) != BR_CFM_OPCODE_CCM)
+		return CFM_CCM_ERR_OPCODE;
+	if (cfm_pdu_level(pdu) != hdr[0] >> 5)
+		return CFM_CCM_ERR_LEVEL;
+	if (cfm_pdu_version(pdu) != CFM_VERSION)
+		return CFM_CCM_ERR_VERSION;
+	if (cfm_ccm_interval(pdu) != hdr[2])
+		return CFM_CCM_ERR_INTERVAL;
+	if (pdu[3] != CFM_CCM_TLV_OFFSET)
+		return CFM_CCM_ERR_TLV_OFFSET;
+	if (memcmp(cfm_ccm_maid(pdu), exp->maid, CFM_MAID_LENGTH))
+		return CFM_CCM_ERR_MAID;
+	return CFM_CCM_ERR_MEPID;
+}
+
+static inline __attribute__((always_inline))
+uint32_t cfm_ccm_hdr_ok(const struct cfm_ccm_expect *exp, const uint8_t *pdu, uint32_t mask)
+{
+	uint32_t hdr;
+
+	memcpy(&hdr, pdu, sizeof(hdr));
+	return ((hdr & mask) ^ exp->hdr) == 0;
+}
+
+static inline __attribute__((always_inline))
+uint32_t cfm_ccm_mepid_ok(const struct cfm_ccm_expect *exp, const uint8_t *pdu)
+{
+	uint16_t mepid = cfm_ccm_mepid(pdu);
+
+	return !exp->peer_count || ((exp->peers[mepid / 64] >> (mepid % 64)) & 1);
+}
+
+/* The checks of a frame are combined without branches; only the rare
+ * rejected frame takes the slow path to find out why.
+ */
+#define CFM_CCM_VALIDATE_BODY(maid_ok)						\
+	do {									\
+		uint32_t mask, ok;						\
+		const uint8_t *pdu;						\
+		unsigned int i;							\
+										\
+		memcpy(&mask, cfm_ccm_hdr_mask, sizeof(mask));			\
+		for (i = 0; i < count; ++i) {					\
+			pdu = frames[i].pdu;					\
+			if (frames[i].len < CFM_CCM_PDU_TLV_OFFSET) {		\
+				verdict[i] = CFM_CCM_ERR_SHORT;			\
+				continue;					\
+			}							\
+			ok = cfm_ccm_hdr_ok(exp, pdu, mask) &			\
+			     maid_ok(exp->maid, cfm_ccm_maid(pdu)) &		\
+			     cfm_ccm_mepid_ok(exp, pdu);			\
+			verdict[i] = ok ? CFM_CCM_OK : cfm_ccm_reject_reason(exp, pdu); \
+		}								\
+	} while (0)
+
+static inline __attribute__((always_inline))
+uint32_t cfm_ccm_maid_ok_scalar(const uint8_t *exp, const uint8_t *maid)
+{
+	uint64_t a, b, diff = 0;
+	int i;
+
+	for (i = 0; i < CFM_MAID_LENGTH; i += sizeof(a)) {
+		memcpy(&a, exp + i, sizeof(a));
+		memcpy(&b, maid + i, sizeof(b));
+		diff |= a ^ b;
+	}
+
+	return diff == 0;
+}
+
+static void cfm_ccm_validate_scalar(const struct cfm_ccm_expect *exp,
+				    const struct cfm_rx_frame *frames,
+				    unsigned int count, uint8_t *verdict)
+{
+	CFM_CCM_VALIDATE_BODY(cfm_ccm_maid_ok_scalar);
+}
+
+#ifdef CFM_PDU_X86
+static inline __attribute__((always_inline, target("sse2")))
+uint32_t cfm_ccm_maid_ok_sse2(const uint8_t *exp, const uint8_t *maid)
+{
+	__m128i eq;
+
+	eq = _mm_and_si128(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)exp),
+					  _mm_loadu_si128((const __m128i *)maid)),
+			   _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(exp + 16)),
+					  _mm_loadu_si128((const __m128i *)(maid + 16))));
+	eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(exp + 32)),
+					      _mm_loadu_si128((const __m128i *)(maid + 32))));
+
+	return _mm_movemask_epi8(eq) == 0xFFFF;
+}
+
+static __attribute__((target("sse2")))
+void cfm_ccm_validate_sse2(const struct cfm_ccm_expect *exp,
+			   const struct cfm_rx_frame *frames,
+			   unsigned int count, uint8_t *verdict)
+{
+	CFM_CCM_VALIDATE_BODY(cfm_ccm_maid_ok_sse2);
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+uint32_t cfm_ccm_maid_ok_avx2(const uint8_t *exp, const uint8_t *maid)
+{
+	__m256i eq_lo;
+	__m128i eq_hi;
+
+	eq_lo = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)exp),
+				  _mm256_loadu_si256((const __m256i *)maid));
+	eq_hi = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(exp + 32)),
+			       _mm_loadu_si128((const __m128i *)(maid + 32)));
+
+	return ((uint32_t)_mm256_movemask_epi8(eq_lo) == 0xFFFFFFFF) &
+	       (_mm_movemask_epi8(eq_hi) == 0xFFFF);
+}
+
+static __attribute__((target("avx2")))
+void cfm_ccm_validate_avx2(const struct cfm_ccm_expect *exp,
+			   const struct cfm_rx_frame *frames,
+			   unsigned int count, uint8_t *verdict)
+{
+	CFM_CCM_VALIDATE_BODY(cfm_ccm_maid_ok_avx2);
+}
+#endif
+
+static const char *validate_impl;
+static cfm_ccm_validate_t validate_fn;
+
+/* Picked once at load time, before any RX worker thread exists */
+static __attribute__((constructor)) void cfm_ccm_validate_select(void)
+{
+	validate_impl = "scalar";
+	validate_fn = cfm_ccm_validate_scalar;
+
+#ifdef CFM_PDU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		validate_impl = "avx2";
+		validate_fn = cfm_ccm_validate_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		validate_impl = "sse2";
+		validate_fn = cfm_ccm_validate_sse2;
+	}
+#endif
+}
+
+/* Validate a batch of received CCMs, writing a cfm_ccm_verdict per frame */
+void cfm_ccm_validate(const struct cfm_ccm_expect *exp, const struct cfm_rx_frame *frames,
+		      unsigned int count, uint8_t *verdict)
+{
+	validate_fn(exp, frames, count, verdict);
+}
+
+const char *cfm_ccm_validate_impl(void)
+{
+	return validate_impl;
+}
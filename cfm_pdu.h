@@ -0,0 +1,238 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_PDU_H
+#define CFM_PDU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/cfm_bridge.h>
+
+#define ETH_P_CFM			0x8902
+#define CFM_VERSION			0
+
+/* 802.1Q and Y.1731 opcodes not known to the bridge */
+#define CFM_OPCODE_LBR			2
+#define CFM_OPCODE_LBM			3
+#define CFM_OPCODE_LTR			4
+#define CFM_OPCODE_LTM			5
+#define CFM_OPCODE_1DM			45
+#define CFM_OPCODE_DMR			46
+#define CFM_OPCODE_DMM			47
+#define CFM_OPCODE_SLR			54
+#define CFM_OPCODE_SLM			55
+
+#define CFM_LBM_TLV_OFFSET		4
+#define CFM_LB_TRANS_ID_OFFSET		4
+#define CFM_DATA_TLV_TYPE		3
+
+#define CFM_LTM_TLV_OFFSET		17
+#define CFM_LTR_TLV_OFFSET		6
+#define CFM_LT_TRANS_ID_OFFSET		4
+#define CFM_LT_TTL_OFFSET		8
+#define CFM_LTM_ORIG_MAC_OFFSET		9
+#define CFM_LTM_TARGET_MAC_OFFSET	15
+#define CFM_LTR_RELAY_OFFSET		9
+#define CFM_LT_FLAG_USE_FDB_ONLY	0x80
+#define CFM_LTR_FLAG_FWD_YES		0x40
+#define CFM_LTR_FLAG_TERMINAL_MEP	0x20
+#define CFM_LTR_RELAY_HIT		1
+#define CFM_LTR_RELAY_FDB		2
+#define CFM_LTR_RELAY_MPDB		3
+#define CFM_REPLY_INGRESS_TLV_TYPE	5
+#define CFM_REPLY_EGRESS_TLV_TYPE	6
+#define CFM_LTM_EGRESS_ID_TLV_TYPE	7
+#define CFM_LTR_EGRESS_ID_TLV_TYPE	8
+
+#define CFM_DMM_TLV_OFFSET		32
+#define CFM_1DM_TLV_OFFSET		16
+#define CFM_DM_TXF_OFFSET		4
+#define CFM_DM_RXF_OFFSET		12
+#define CFM_DM_TXB_OFFSET		20
+#define CFM_DM_RXB_OFFSET		28
+
+#define CFM_SLM_TLV_OFFSET		16
+#define CFM_SLM_SRC_MEPID_OFFSET	4
+#define CFM_SLM_RSP_MEPID_OFFSET	6
+#define CFM_SLM_TEST_ID_OFFSET		8
+#define CFM_SLM_TXFCF_OFFSET		12
+#define CFM_SLM_TXFCB_OFFSET		16
+
+/* G.8032 R-APS, the request is in the upper nibble of the first byte */
+#define CFM_RAPS_VERSION		1
+#define CFM_RAPS_TLV_OFFSET		32
+#define CFM_RAPS_REQ_NR			0x0
+#define CFM_RAPS_REQ_MS			0x7
+#define CFM_RAPS_REQ_SF			0xB
+#define CFM_RAPS_REQ_FS			0xD
+#define CFM_RAPS_REQ_EVENT		0xE
+#define CFM_RAPS_STATUS_RB		0x80
+#define CFM_RAPS_STATUS_DNF		0x40
+#define CFM_RAPS_STATUS_BPR		0x20
+#define CFM_RAPS_NODE_ID_OFFSET		6
+
+/* Field accessors working directly on received frame memory. 'pdu' points
+ * to the CFM common header (struct br_cfm_common_hdr).
+ */
+static inline uint8_t cfm_pdu_level(const uint8_t *pdu)
+{
+	return ((const struct br_cfm_common_hdr *)pdu)->mdlevel_version >> 5;
+}
+
+static inline uint8_t cfm_pdu_version(const uint8_t *pdu)
+{
+	return ((const struct br_cfm_common_hdr *)pdu)->mdlevel_version & 0x1F;
+}
+
+static inline uint8_t cfm_pdu_opcode(const uint8_t *pdu)
+{
+	return ((const struct br_cfm_common_hdr *)pdu)->opcode;
+}
+
+static inline uint8_t cfm_pdu_flags(const uint8_t *pdu)
+{
+	return ((const struct br_cfm_common_hdr *)pdu)->flags;
+}
+
+static inline uint16_t cfm_pdu_get_u16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t cfm_pdu_get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void cfm_pdu_put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static inline void cfm_pdu_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Y.1731 timestamps: 32 bit seconds followed by 32 bit nanoseconds */
+static inline uint64_t cfm_pdu_get_ts(const uint8_t *p)
+{
+	return (uint64_t)cfm_pdu_get_u32(p) * 1000000000ULL + cfm_pdu_get_u32(p + 4);
+}
+
+static inline void cfm_pdu_put_ts(uint8_t *p, uint64_t ns)
+{
+	cfm_pdu_put_u32(p, ns / 1000000000ULL);
+	cfm_pdu_put_u32(p + 4, ns % 1000000000ULL);
+}
+
+static inline void cfm_pdu_hdr_put(uint8_t *pdu, uint8_t level, uint8_t opcode,
+				   uint8_t flags, uint8_t tlv_offset)
+{
+	pdu[0] = (level << 5) | CFM_VERSION;
+	pdu[1] = opcode;
+	pdu[2] = flags;
+	pdu[3] = tlv_offset;
+}
+
+static inline bool cfm_ccm_rdi(const uint8_t *pdu)
+{
+	return cfm_pdu_flags(pdu) & 0x80;
+}
+
+static inline uint8_t cfm_ccm_interval(const uint8_t *pdu)
+{
+	return cfm_pdu_flags(pdu) & 0x07;
+}
+
+static inline uint32_t cfm_ccm_seq(const uint8_t *pdu)
+{
+	return cfm_pdu_get_u32(pdu + CFM_CCM_PDU_SEQNR_OFFSET);
+}
+
+static inline uint16_t cfm_ccm_mepid(const uint8_t *pdu)
+{
+	return cfm_pdu_get_u16(pdu + CFM_CCM_PDU_MEPID_OFFSET) & 0x1FFF;
+}
+
+static inline const uint8_t *cfm_ccm_maid(const uint8_t *pdu)
+{
+	return pdu + CFM_CCM_PDU_MAID_OFFSET;
+}
+
+/* Transmission period in ns of a CCM interval code, 0 if invalid */
+static inline uint64_t cfm_ccm_interval_ns(uint8_t interval)
+{
+	static const uint64_t period[] = {
+		[BR_CFM_CCM_INTERVAL_3_3_MS] = 3333333ULL,
+		[BR_CFM_CCM_INTERVAL_10_MS] = 10000000ULL,
+		[BR_CFM_CCM_INTERVAL_100_MS] = 100000000ULL,
+		[BR_CFM_CCM_INTERVAL_1_SEC] = 1000000000ULL,
+		[BR_CFM_CCM_INTERVAL_10_SEC] = 10000000000ULL,
+		[BR_CFM_CCM_INTERVAL_1_MIN] = 60000000000ULL,
+		[BR_CFM_CCM_INTERVAL_10_MIN] = 600000000000ULL,
+	};
+
+	return interval < sizeof(period) / sizeof(period[0]) ? period[interval] : 0;
+}
+
+/* Find the Port Status and Interface Status TLV values of a CCM. Values of
+ * absent TLVs are left untouched.
+ */
+static inline void cfm_ccm_status_tlvs(const uint8_t *pdu, uint32_t len,
+				       uint8_t *port_tlv, uint8_t *if_tlv)
+{
+	uint32_t off = CFM_CCM_PDU_TLV_OFFSET;
+	uint16_t tlv_len;
+
+	while (off + 3 <= len && pdu[off] != CFM_ENDE_TLV_TYPE) {
+		tlv_len = cfm_pdu_get_u16(pdu + off + 1);
+		if (off + 3 + tlv_len > len)
+			break;
+		if (pdu[off] == CFM_PORT_STATUS_TLV_TYPE && tlv_len >= 1)
+			*port_tlv = pdu[off + 3];
+		else if (pdu[off] == CFM_IF_STATUS_TLV_TYPE && tlv_len >= 1)
+			*if_tlv = pdu[off + 3];
+		off += 3 + tlv_len;
+	}
+}
+
+/* Result of validating one received CCM against the local MEP */
+enum cfm_ccm_verdict {
+	CFM_CCM_OK,
+	CFM_CCM_ERR_SHORT,
+	CFM_CCM_ERR_OPCODE,
+	CFM_CCM_ERR_LEVEL,
+	CFM_CCM_ERR_VERSION,
+	CFM_CCM_ERR_INTERVAL,
+	CFM_CCM_ERR_TLV_OFFSET,
+	CFM_CCM_ERR_MAID,
+	CFM_CCM_ERR_MEPID,
+	CFM_CCM_VERDICT_MAX,
+};
+
+/* What a valid CCM looks like. The MAID is first so it is 32 byte aligned
+ * for the vector compares.
+ */
+struct cfm_ccm_expect {
+	uint8_t maid[CFM_MAID_LENGTH] __attribute__((aligned(32)));
+	uint32_t hdr;		/* First 4 octets of a valid CCM, network order */
+	uint32_t peer_count;	/* 0 - any MEPID is accepted */
+	uint64_t peers[8192 / 64];
+};
+
+struct cfm_rx_frame;
+
+void cfm_ccm_expect_init(struct cfm_ccm_expect *exp, uint8_t level, uint8_t interval,
+			 const uint8_t *maid);
+void cfm_ccm_expect_peer(struct cfm_ccm_expect *exp, uint16_t mepid);
+void cfm_ccm_validate(const struct cfm_ccm_expect *exp, const struct cfm_rx_frame *frames,
+		      unsigned int count, uint8_t *verdict);
+const char *cfm_ccm_validate_impl(void);
+const char *cfm_ccm_verdict_str(enum cfm_ccm_verdict verdict);
+
+#endif
@@ -0,0 +1,231 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfm_peer.h"
+
+#define CFM_PEER_SWEEP_CHUNK	64
+
+static uint32_t cfm_peer_hash(uint64_t key, uint32_t mask)
+{
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static int cfm_peer_hash_alloc(struct cfm_peer_table *t, uint32_t capacity)
+{
+	uint32_t size = 1;
+	uint32_t i, h;
+
+	/* Keep the load factor at or below 50% */
+	while (size < capacity * 2)
+		size <<= 1;
+
+	free(t->hash);
+	t->hash = malloc(size * sizeof(*t->hash));
+	if (!t->hash)
+		return -1;
+	memset(t->hash, 0xFF, size * sizeof(*t->hash));
+	t->hash_mask = size - 1;
+
+	for (i = 0; i < t->count; ++i) {
+		h = cfm_peer_hash(t->key[i], t->hash_mask);
+		while (t->hash[h] >= 0)
+			h = (h + 1) & t->hash_mask;
+		t->hash[h] = i;
+	}
+
+	return 0;
+}
+
+#define CFM_PEER_RESIZE(t, field, capacity) ({					\
+	void *p = realloc((t)->field, (capacity) * sizeof(*(t)->field));	\
+	if (p)									\
+		(t)->field = p;							\
+	p != NULL; })
+
+static int cfm_peer_resize(struct cfm_peer_table *t, uint32_t capacity)
+{
+	if (!CFM_PEER_RESIZE(t, deadline, capacity) ||
+	    !CFM_PEER_RESIZE(t, defects, capacity) ||
+	    !CFM_PEER_RESIZE(t, last_seq, capacity) ||
+	    !CFM_PEER_RESIZE(t, ccm_seen, capacity) ||
+	    !CFM_PEER_RESIZE(t, seq_unexp, capacity) ||
+	    !CFM_PEER_RESIZE(t, tlv_change, capacity) ||
+	    !CFM_PEER_RESIZE(t, port_tlv, capacity) ||
+	    !CFM_PEER_RESIZE(t, if_tlv, capacity) ||
+	    !CFM_PEER_RESIZE(t, key, capacity))
+		return -1;
+
+	t->capacity = capacity;
+
+	return cfm_peer_hash_alloc(t, capacity);
+}
+
+int cfm_peer_table_init(struct cfm_peer_table *t, uint32_t capacity)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (cfm_peer_resize(t, capacity ? capacity : 16)) {
+		cfm_peer_table_free(t);
+		return -1;
+	}
+
+	return 0;
+}
+
+void cfm_peer_table_free(struct cfm_peer_table *t)
+{
+	free(t->deadline);
+	free(t->defects);
+	free(t->last_seq);
+	free(t->ccm_seen);
+	free(t->seq_unexp);
+	free(t->tlv_change);
+	free(t->port_tlv);
+	free(t->if_tlv);
+	free(t->key);
+	free(t->hash);
+	memset(t, 0, sizeof(*t));
+}
+
+int cfm_peer_lookup(const struct cfm_peer_table *t, uint64_t key)
+{
+	uint32_t h = cfm_peer_hash(key, t->hash_mask);
+	int32_t slot;
+
+	while ((slot = t->hash[h]) >= 0) {
+		if (t->key[slot] == key)
+			return slot;
+		h = (h + 1) & t->hash_mask;
+	}
+
+	return -1;
+}
+
+/* Returns the slot of the peer, adding it with cleared state if unknown */
+int cfm_peer_add(struct cfm_peer_table *t, uint64_t key)
+{
+	uint32_t h, slot;
+	int found;
+
+	found = cfm_peer_lookup(t, key);
+	if (found >= 0)
+		return found;
+
+	if (t->count == t->capacity && cfm_peer_resize(t, t->capacity * 2))
+		return -1;
+
+	slot = t->count++;
+	t->deadline[slot] = 0;
+	t->defects[slot] = 0;
+	t->last_seq[slot] = 0;
+	t->ccm_seen[slot] = 0;
+	t->seq_unexp[slot] = 0;
+	t->tlv_change[slot] = 0;
+	t->port_tlv[slot] = 0;
+	t->if_tlv[slot] = 0;
+	t->key[slot] = key;
+
+	h = cfm_peer_hash(key, t->hash_mask);
+	while (t->hash[h] >= 0)
+		h = (h + 1) & t->hash_mask;
+	t->hash[h] = slot;
+
+	return slot;
+}
+
+static uint32_t cfm_peer_hash_find(const struct cfm_peer_table *t, uint32_t slot)
+{
+	uint32_t h = cfm_peer_hash(t->key[slot], t->hash_mask);
+
+	while (t->hash[h] != (int32_t)slot)
+		h = (h + 1) & t->hash_mask;
+
+	return h;
+}
+
+void cfm_peer_remove(struct cfm_peer_table *t, uint64_t key)
+{
+	uint32_t h, next, home, last;
+	int slot;
+
+	slot = cfm_peer_lookup(t, key);
+	if (slot < 0)
+		return;
+
+	/* Backward shift deletion keeps the probe sequences intact */
+	h = cfm_peer_hash_find(t, slot);
+	next = (h + 1) & t->hash_mask;
+	while (t->hash[next] >= 0) {
+		home = cfm_peer_hash(t->key[t->hash[next]], t->hash_mask);
+		if (((next - home) & t->hash_mask) >= ((next - h) & t->hash_mask)) {
+			t->hash[h] = t->hash[next];
+			h = next;
+		}
+		next = (next + 1) & t->hash_mask;
+	}
+	t->hash[h] = -1;
+
+	/* Move the last slot into the hole to keep the arrays dense */
+	last = --t->count;
+	if (slot != last) {
+		t->hash[cfm_peer_hash_find(t, last)] = slot;
+		t->deadline[slot] = t->deadline[last];
+		t->defects[slot] = t->defects[last];
+		t->last_seq[slot] = t->last_seq[last];
+		t->ccm_seen[slot] = t->ccm_seen[last];
+		t->seq_unexp[slot] = t->seq_unexp[last];
+		t->tlv_change[slot] = t->tlv_change[last];
+		t->port_tlv[slot] = t->port_tlv[last];
+		t->if_tlv[slot] = t->if_tlv[last];
+		t->key[slot] = t->key[last];
+	}
+}
+
+/* Evaluate loss of continuity for all peers at time 'now'. The inner loop
+ * is branch free so the compiler can vectorize it; the change callback is
+ * only run for chunks where a defect bit actually flipped. Returns the
+ * number of changed peers.
+ */
+uint32_t cfm_peer_sweep(struct cfm_peer_table *t, uint64_t now,
+			cfm_peer_change_t change, void *arg)
+{
+	uint8_t old[CFM_PEER_SWEEP_CHUNK];
+	const uint64_t *deadline = t->deadline;
+	uint8_t *defects = t->defects;
+	uint32_t base, end, i, changed = 0;
+	uint8_t diff;
+
+	for (base = 0; base < t->count; base += CFM_PEER_SWEEP_CHUNK) {
+		end = base + CFM_PEER_SWEEP_CHUNK;
+		if (end > t->count)
+			end = t->count;
+
+		memcpy(old, &defects[base], end - base);
+
+		/* An unarmed deadline of 0 wraps to the maximum and never expires */
+		diff = 0;
+		for (i = base; i < end; ++i) {
+			uint8_t loc = (deadline[i] - 1) < now;
+			uint8_t d = (defects[i] & ~CFM_PEER_DEFECT_LOC) | loc;
+
+			diff |= d ^ old[i - base];
+			defects[i] = d;
+		}
+
+		if (!diff)
+			continue;
+
+		for (i = base; i < end; ++i) {
+			if (defects[i] == old[i - base])
+				continue;
+			changed++;
+			if (change)
+				change(t, i, old[i - base], arg);
+		}
+	}
+
+	return changed;
+}
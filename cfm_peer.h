@@ -0,0 +1,68 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_PEER_H
+#define CFM_PEER_H
+
+#include <stdint.h>
+
+#define CFM_PEER_DEFECT_LOC	0x01	/* No CCM within 3.5 intervals */
+#define CFM_PEER_DEFECT_RDI	0x02	/* Last CCM carried RDI */
+
+/* Peer MEP state stored as a struct of arrays indexed by a dense slot
+ * number. The arrays touched by a defect sweep (deadline and defects) are
+ * kept apart from the per-frame state, so a sweep over all peers streams
+ * through 9 bytes per peer. Removing a peer moves the last slot into the
+ * hole, so slots 0..count-1 are always in use.
+ */
+struct cfm_peer_table {
+	uint32_t count;
+	uint32_t capacity;
+
+	/* Swept */
+	uint64_t *deadline;	/* ns, 0 - not armed */
+	uint8_t *defects;	/* CFM_PEER_DEFECT_* */
+
+	/* Per received CCM */
+	uint32_t *last_seq;
+	uint32_t *ccm_seen;
+	uint32_t *seq_unexp;
+	uint32_t *tlv_change;
+	uint8_t *port_tlv;
+	uint8_t *if_tlv;
+
+	/* Cold */
+	uint64_t *key;
+
+	/* Key to slot, open addressing with linear probing */
+	int32_t *hash;
+	uint32_t hash_mask;
+};
+
+static inline uint64_t cfm_peer_key(uint32_t instance, uint16_t mepid)
+{
+	return ((uint64_t)instance << 16) | mepid;
+}
+
+static inline uint32_t cfm_peer_key_instance(uint64_t key)
+{
+	return key >> 16;
+}
+
+static inline uint16_t cfm_peer_key_mepid(uint64_t key)
+{
+	return key & 0xFFFF;
+}
+
+typedef void (*cfm_peer_change_t)(struct cfm_peer_table *t, uint32_t slot,
+				  uint8_t old_defects, void *arg);
+
+int cfm_peer_table_init(struct cfm_peer_table *t, uint32_t capacity);
+void cfm_peer_table_free(struct cfm_peer_table *t);
+int cfm_peer_lookup(const struct cfm_peer_table *t, uint64_t key);
+int cfm_peer_add(struct cfm_peer_table *t, uint64_t key);
+void cfm_peer_remove(struct cfm_peer_table *t, uint64_t key);
+uint32_t cfm_peer_sweep(struct cfm_peer_table *t, uint64_t now,
+			cfm_peer_change_t change, void *arg);
+
+#endif
@@ -0,0 +1,605 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ev.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <net/if.h>
+
+#include "cfm_pubsub.h"
+
+/* Event fan-out to subscribers connected to a unix stream socket.
+ *
+ * Publishing only copies the event into the bounded queue of each
+ * subscriber and starts its write watcher, the sockets are written from the
+ * event loop when they are writable and never block. A subscriber that
+ * does not keep up fills its own queue, and then either loses its oldest
+ * events, which is reported by a gap event, or is disconnected.
+ *
+ * A subscriber may send option lines at any time:
+ *   format json|binary
+ *   queue <events>
+ *   policy drop|disconnect
+ *   netns <nsid>|any
+ *   bridge <bridge>|<ifindex>|any
+ *   instance <instance>|any
+ *   level <level>[-<level>]
+ *   events all|<type>[,<type>...]
+ * Several options may be given on one line. The default is JSON lines, a
+ * queue of CFM_PUBSUB_QUEUE_DEFAULT events, dropping the oldest events, and
+ * all events. The level filter does not apply to events without MD level.
+ * A bridge without netns is one in the namespace of the server.
+ *
+ * The filters of all subscribers are compiled into a hash table keyed by
+ * (namespace, bridge, instance), where FILTER_NETNS_ANY, 0 and FILTER_ANY
+ * are the wildcards. Every entry holds per event type the bitmask of the
+ * subscribers that want it, so an event is matched with six lookups and a
+ * level mask, whatever the number of subscribers, and is only queued to the
+ * subscribers it matches.
+ */
+
+#define SUB_LINE_MAX	256
+#define SUB_OUT_SIZE	4096
+
+#define FILTER_ANY	0xFFFFFFFF
+#define FILTER_NETNS_ANY	INT32_MIN
+#define FILTER_BITS	7		/* Twice the subscribers, the table never fills */
+#define FILTER_BUCKETS	(1 << FILTER_BITS)
+#define FILTER_LEVELS	9		/* MD levels 0-7 and no level */
+
+struct subscriber {
+	int fd;
+	uint64_t bit;		/* 1 << index in subs */
+	int32_t nsid;		/* Filter, FILTER_NETNS_ANY - any namespace */
+	uint32_t br_ifindex;	/* Filter, 0 - any bridge */
+	uint32_t instance;	/* Filter, FILTER_ANY - any instance */
+	uint8_t level_min;
+	uint8_t level_max;
+	uint32_t types;		/* Filter, bitmask of enum cfm_event_type */
+	ev_io read_watcher;
+	ev_io write_watcher;
+	bool binary;
+	bool disconnect;	/* Overflow policy, else drop oldest */
+	struct cfm_event *queue;
+	uint32_t size;		/* Power of 2 */
+	uint64_t head;
+	uint64_t tail;
+	uint64_t lost;		/* Dropped since the last gap event */
+	char in[SUB_LINE_MAX];
+	uint32_t in_len;
+	char out[SUB_OUT_SIZE];
+	uint32_t out_len;
+	uint32_t out_off;
+	uint64_t sent;
+	uint64_t dropped;
+	uint64_t gaps;
+};
+
+struct filter_entry {
+	bool used;
+	int32_t nsid;
+	uint64_t key;		/* br_ifindex << 32 | instance */
+	uint64_t subs[CFM_EVENT_TYPES];
+};
+
+static const char *sock_path;
+static int listen_fd = -1;
+static ev_io listen_watcher;
+static struct subscriber *subs[CFM_PUBSUB_SUBSCRIBERS_MAX];
+static uint64_t event_seq;
+static uint64_t accepted;
+static uint64_t rejected;	/* Refused, all subscriber slots taken */
+static uint64_t overflows;	/* Disconnected by the overflow policy */
+static uint64_t filtered;	/* Events no subscriber wanted */
+static struct filter_entry filters[FILTER_BUCKETS];
+static uint64_t level_subs[FILTER_LEVELS];
+
+static const char *event_names[] = {
+	[CFM_EVENT_GAP] = "gap",
+	[CFM_EVENT_PEER] = "peer",
+	[CFM_EVENT_RAPS] = "raps",
+	[CFM_EVENT_ALARM] = "alarm",
+	[CFM_EVENT_DAMPED] = "damped",
+};
+
+static struct filter_entry *filter_find(int32_t nsid, uint32_t br_ifindex, uint32_t instance,
+				       bool add)
+{
+	uint64_t key = (uint64_t)br_ifindex << 32 | instance;
+	uint32_t i = ((key ^ (uint32_t)nsid) * 0x9E3779B97F4A7C15ULL) >> (64 - FILTER_BITS);
+
+	for (;; i = (i + 1) & (FILTER_BUCKETS - 1)) {
+		if (!filters[i].used) {
+			if (!add)
+				return NULL;
+			filters[i].used = true;
+			filters[i].nsid = nsid;
+			filters[i].key = key;
+			return &filters[i];
+		}
+		if (filters[i].key == key && filters[i].nsid == nsid)
+			return &filters[i];
+	}
+}
+
+static uint64_t filter_subs(int32_t nsid, uint32_t br_ifindex, uint32_t instance, uint16_t type)
+{
+	struct filter_entry *e = filter_find(nsid, br_ifindex, instance, false);
+
+	return e ? e->subs[type] : 0;
+}
+
+static void filters_compile(void)
+{
+	struct filter_entry *e;
+	struct subscriber *sub;
+	int32_t nsid;
+	int i, t, l;
+
+	memset(filters, 0, sizeof(filters));
+	memset(level_subs, 0, sizeof(level_subs));
+
+	for (i = 0; i < CFM_PUBSUB_SUBSCRIBERS_MAX; ++i) {
+		sub = subs[i];
+		if (!sub)
+			continue;
+
+		nsid = sub->nsid;
+		if (sub->br_ifindex && nsid == FILTER_NETNS_ANY)
+			nsid = -1;
+		e = filter_find(nsid, sub->br_ifindex, sub->instance, true);
+		for (t = 0; t < CFM_EVENT_TYPES; ++t)
+			if (sub->types & (1 << t))
+				e->subs[t] |= sub->bit;
+		for (l = sub->level_min; l <= sub->level_max; ++l)
+			level_subs[l] |= sub->bit;
+		level_subs[FILTER_LEVELS - 1] |= sub->bit;
+	}
+}
+
+static void sub_close(struct subscriber *sub)
+{
+	int i;
+
+	for (i = 0; i < CFM_PUBSUB_SUBSCRIBERS_MAX; ++i)
+		if (subs[i] == sub)
+			subs[i] = NULL;
+
+	ev_io_stop(EV_DEFAULT, &sub->read_watcher);
+	ev_io_stop(EV_DEFAULT, &sub->write_watcher);
+	close(sub->fd);
+	free(sub->queue);
+	free(sub);
+
+	filters_compile();
+}
+
+static int sub_encode(struct subscriber *sub, const struct cfm_event *ev)
+{
+	char *buf = sub->out + sub->out_len;
+	size_t len = sizeof(sub->out) - sub->out_len;
+	int n;
+
+	if (sub->binary) {
+		memcpy(buf, ev, sizeof(*ev));
+		return sizeof(*ev);
+	}
+
+	n = snprintf(buf, len, "{\"seq\":%" PRIu64 ",\"ts\":%" PRIu64 ",\"type\":\"%s\"",
+		     ev->seq, ev->ts, event_names[ev->type]);
+	if (ev->type != CFM_EVENT_GAP && ev->nsid >= 0)
+		n += snprintf(buf + n, len - n, ",\"netns\":%d", ev->nsid);
+	if (ev->type != CFM_EVENT_GAP)
+		n += snprintf(buf + n, len - n, ",\"bridge\":%u,\"instance\":%u",
+			      ev->br_ifindex, ev->instance);
+
+	switch (ev->type) {
+	case CFM_EVENT_GAP:
+		n += snprintf(buf + n, len - n, ",\"lost\":%" PRIu64, ev->gap.lost);
+		break;
+	case CFM_EVENT_PEER:
+	case CFM_EVENT_DAMPED:
+		n += snprintf(buf + n, len - n, ",\"mepid\":%u,\"defect\":%u",
+			      ev->peer.mepid, ev->peer.defect);
+		break;
+	case CFM_EVENT_RAPS:
+		n += snprintf(buf + n, len - n,
+			      ",\"request\":%u,\"sub_code\":%u,\"status\":%u,"
+			      "\"node_id\":\"%02X-%02X-%02X-%02X-%02X-%02X\"",
+			      ev->raps.request, ev->raps.sub_code, ev->raps.status,
+			      ev->raps.node_id[0], ev->raps.node_id[1], ev->raps.node_id[2],
+			      ev->raps.node_id[3], ev->raps.node_id[4], ev->raps.node_id[5]);
+		break;
+	case CFM_EVENT_ALARM:
+		n += snprintf(buf + n, len - n, ",\"id\":%u,\"port\":%u,\"members\":%u,\"active\":%u",
+			      ev->alarm.id, ev->alarm.port_ifindex, ev->alarm.members,
+			      ev->alarm.active);
+		break;
+	}
+	n += snprintf(buf + n, len - n, "}\n");
+
+	return n;
+}
+
+/* Move queued events into the output buffer, while a JSON line surely fits */
+static void sub_fill(struct subscriber *sub)
+{
+	struct cfm_event gap;
+
+	while (sub->tail != sub->head && sizeof(sub->out) - sub->out_len >= SUB_LINE_MAX) {
+		if (sub->lost) {
+			/* The lost events were the oldest, just before the tail */
+			memset(&gap, 0, sizeof(gap));
+			gap.type = CFM_EVENT_GAP;
+			gap.len = sizeof(gap);
+			gap.version = CFM_EVENT_VERSION;
+			gap.seq = sub->queue[sub->tail & (sub->size - 1)].seq;
+			gap.ts = sub->queue[sub->tail & (sub->size - 1)].ts;
+			gap.gap.lost = sub->lost;
+			sub->out_len += sub_encode(sub, &gap);
+			sub->lost = 0;
+			sub->gaps++;
+			continue;
+		}
+		sub->out_len += sub_encode(sub, &sub->queue[sub->tail++ & (sub->size - 1)]);
+		sub->sent++;
+	}
+}
+
+static void sub_flush(struct subscriber *sub)
+{
+	ssize_t n;
+
+	for (;;) {
+		if (sub->out_off == sub->out_len) {
+			sub->out_off = sub->out_len = 0;
+			sub_fill(sub);
+			if (!sub->out_len) {
+				ev_io_stop(EV_DEFAULT, &sub->write_watcher);
+				return;
+			}
+		}
+
+		n = send(sub->fd, sub->out + sub->out_off, sub->out_len - sub->out_off,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ev_io_start(EV_DEFAULT, &sub->write_watcher);
+				return;
+			}
+			if (errno == EINTR)
+				continue;
+			sub_close(sub);
+			return;
+		}
+		sub->out_off += n;
+	}
+}
+
+static void sub_write(EV_P_ ev_io *w, int revents)
+{
+	sub_flush(w->data);
+}
+
+static int sub_queue_resize(struct subscriber *sub, uint32_t events)
+{
+	struct cfm_event *queue;
+	uint32_t size = 1, i;
+
+	while (size < events)
+		size <<= 1;
+
+	queue = calloc(size, sizeof(*queue));
+	if (!queue)
+		return -1;
+
+	/* Keep the newest events that fit */
+	if (sub->head - sub->tail > size) {
+		sub->lost += sub->head - sub->tail - size;
+		sub->dropped += sub->head - sub->tail - size;
+		sub->tail = sub->head - size;
+	}
+	for (i = 0; sub->tail + i != sub->head; ++i)
+		queue[i] = sub->queue[(sub->tail + i) & (sub->size - 1)];
+
+	free(sub->queue);
+	sub->queue = queue;
+	sub->size = size;
+	sub->head = i;
+	sub->tail = 0;
+
+	return 0;
+}
+
+static int sub_options(struct subscriber *sub, char *line)
+{
+	char *key, *val, *type, *save, *save_type;
+	int events, min, max, n;
+
+	for (key = strtok_r(line, " \t\r", &save); key; key = strtok_r(NULL, " \t\r", &save)) {
+		val = strtok_r(NULL, " \t\r", &save);
+		if (!val)
+			return -1;
+
+		if (!strcmp(key, "format")) {
+			if (!strcmp(val, "json"))
+				sub->binary = false;
+			else if (!strcmp(val, "binary"))
+				sub->binary = true;
+			else
+				return -1;
+		} else if (!strcmp(key, "policy")) {
+			if (!strcmp(val, "drop"))
+				sub->disconnect = false;
+			else if (!strcmp(val, "disconnect"))
+				sub->disconnect = true;
+			else
+				return -1;
+		} else if (!strcmp(key, "queue")) {
+			events = atoi(val);
+			if (events < 1 || events > CFM_PUBSUB_QUEUE_MAX)
+				return -1;
+			if (sub_queue_resize(sub, events))
+				return -1;
+		} else if (!strcmp(key, "bridge")) {
+			if (!strcmp(val, "any"))
+				sub->br_ifindex = 0;
+			else if (!(sub->br_ifindex = if_nametoindex(val)) &&
+				 !(sub->br_ifindex = strtoul(val, NULL, 10)))
+				return -1;
+		} else if (!strcmp(key, "netns")) {
+			if (!strcmp(val, "any"))
+				sub->nsid = FILTER_NETNS_ANY;
+			else
+				sub->nsid = atoi(val);
+		} else if (!strcmp(key, "instance")) {
+			if (!strcmp(val, "any"))
+				sub->instance = FILTER_ANY;
+			else
+				sub->instance = atoi(val);
+		} else if (!strcmp(key, "level")) {
+			n = sscanf(val, "%d-%d", &min, &max);
+			if (n < 1)
+				return -1;
+			if (n == 1)
+				max = 7;
+			if (min < 0 || min > max || max > 7)
+				return -1;
+			sub->level_min = min;
+			sub->level_max = max;
+		} else if (!strcmp(key, "events")) {
+			sub->types = 0;
+			for (type = strtok_r(val, ",", &save_type); type;
+			     type = strtok_r(NULL, ",", &save_type)) {
+				if (!strcmp(type, "all"))
+					sub->types |= ~(1 << CFM_EVENT_GAP);
+				else if (!strcmp(type, "peer"))
+					sub->types |= 1 << CFM_EVENT_PEER;
+				else if (!strcmp(type, "raps"))
+					sub->types |= 1 << CFM_EVENT_RAPS;
+				else if (!strcmp(type, "alarm"))
+					sub->types |= 1 << CFM_EVENT_ALARM;
+				else if (!strcmp(type, "damped"))
+					sub->types |= 1 << CFM_EVENT_DAMPED;
+				else
+					return -1;
+			}
+		} else {
+			return -1;
+		}
+	}
+
+	filters_compile();
+
+	return 0;
+}
+
+static void sub_read(EV_P_ ev_io *w, int revents)
+{
+	struct subscriber *sub = w->data;
+	char *nl;
+	ssize_t n;
+
+	n = recv(sub->fd, sub->in + sub->in_len, sizeof(sub->in) - 1 - sub->in_len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n <= 0) {
+		sub_close(sub);
+		return;
+	}
+	sub->in_len += n;
+	sub->in[sub->in_len] = '\0';
+
+	while ((nl = strchr(sub->in, '\n'))) {
+		*nl = '\0';
+		if (sub_options(sub, sub->in)) {
+			fprintf(stderr, "Subscriber %d: invalid options, disconnected\n", sub->fd);
+			sub_close(sub);
+			return;
+		}
+		sub->in_len -= nl + 1 - sub->in;
+		memmove(sub->in, nl + 1, sub->in_len + 1);
+	}
+
+	if (sub->in_len == sizeof(sub->in) - 1) {
+		fprintf(stderr, "Subscriber %d: option line too long, disconnected\n", sub->fd);
+		sub_close(sub);
+	}
+}
+
+static void listen_accept(EV_P_ ev_io *w, int revents)
+{
+	struct subscriber *sub;
+	int fd, i;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < CFM_PUBSUB_SUBSCRIBERS_MAX; ++i)
+		if (!subs[i])
+			break;
+	if (i == CFM_PUBSUB_SUBSCRIBERS_MAX) {
+		rejected++;
+		close(fd);
+		return;
+	}
+
+	sub = calloc(1, sizeof(*sub));
+	if (!sub) {
+		close(fd);
+		return;
+	}
+	sub->fd = fd;
+	sub->bit = 1ULL << i;
+	sub->nsid = FILTER_NETNS_ANY;
+	sub->instance = FILTER_ANY;
+	sub->level_max = 7;
+	sub->types = ~(1 << CFM_EVENT_GAP);
+	sub->size = CFM_PUBSUB_QUEUE_DEFAULT;
+	sub->queue = calloc(sub->size, sizeof(*sub->queue));
+	if (!sub->queue) {
+		free(sub);
+		close(fd);
+		return;
+	}
+
+	ev_io_init(&sub->read_watcher, sub_read, fd, EV_READ);
+	sub->read_watcher.data = sub;
+	ev_io_init(&sub->write_watcher, sub_write, fd, EV_WRITE);
+	sub->write_watcher.data = sub;
+	ev_io_start(EV_DEFAULT, &sub->read_watcher);
+
+	subs[i] = sub;
+	accepted++;
+	filters_compile();
+}
+
+void cfm_pubsub_publish(struct cfm_event *ev)
+{
+	struct subscriber *sub;
+	uint64_t mask;
+
+	ev->len = sizeof(*ev);
+	ev->version = CFM_EVENT_VERSION;
+	ev->seq = ++event_seq;
+
+	mask = filter_subs(ev->nsid, ev->br_ifindex, ev->instance, ev->type) |
+	       filter_subs(ev->nsid, ev->br_ifindex, FILTER_ANY, ev->type) |
+	       filter_subs(ev->nsid, 0, ev->instance, ev->type) |
+	       filter_subs(ev->nsid, 0, FILTER_ANY, ev->type) |
+	       filter_subs(FILTER_NETNS_ANY, 0, ev->instance, ev->type) |
+	       filter_subs(FILTER_NETNS_ANY, 0, FILTER_ANY, ev->type);
+	mask &= level_subs[ev->level < FILTER_LEVELS - 1 ? ev->level : FILTER_LEVELS - 1];
+	if (!mask)
+		filtered++;
+
+	for (; mask; mask &= mask - 1) {
+		sub = subs[__builtin_ctzll(mask)];
+
+		if (sub->head - sub->tail == sub->size) {
+			if (sub->disconnect) {
+				fprintf(stderr, "Subscriber %d: queue overflow, disconnected\n", sub->fd);
+				overflows++;
+				sub_close(sub);
+				continue;
+			}
+			sub->tail++;
+			sub->lost++;
+			sub->dropped++;
+		}
+		sub->queue[sub->head++ & (sub->size - 1)] = *ev;
+
+		if (!ev_is_active(&sub->write_watcher))
+			ev_io_start(EV_DEFAULT, &sub->write_watcher);
+	}
+}
+
+int cfm_pubsub_init(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listen_fd, CFM_PUBSUB_SUBSCRIBERS_MAX)) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+	sock_path = path;
+
+	ev_io_init(&listen_watcher, listen_accept, listen_fd, EV_READ);
+	ev_io_start(EV_DEFAULT, &listen_watcher);
+
+	return 0;
+}
+
+void cfm_pubsub_uninit(void)
+{
+	int i;
+
+	if (listen_fd < 0)
+		return;
+
+	for (i = 0; i < CFM_PUBSUB_SUBSCRIBERS_MAX; ++i)
+		if (subs[i])
+			sub_close(subs[i]);
+
+	ev_io_stop(EV_DEFAULT, &listen_watcher);
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(sock_path);
+}
+
+void cfm_pubsub_stats_print(FILE *fp)
+{
+	struct subscriber *sub;
+	int i;
+
+	fprintf(fp, "Subscribers on %s\n", sock_path);
+	fprintf(fp, "    Events %" PRIu64 ", filtered out %" PRIu64 ", accepted %" PRIu64 " rejected %" PRIu64
+		" overflow disconnects %" PRIu64 "\n", event_seq, filtered, accepted, rejected, overflows);
+	for (i = 0; i < CFM_PUBSUB_SUBSCRIBERS_MAX; ++i) {
+		sub = subs[i];
+		if (!sub)
+			continue;
+		fprintf(fp, "    fd %d %s %s: queued %" PRIu64 "/%u sent %" PRIu64
+			" dropped %" PRIu64 " gaps %" PRIu64 "\n", sub->fd,
+			sub->binary ? "binary" : "json", sub->disconnect ? "disconnect" : "drop",
+			sub->head - sub->tail, sub->size, sub->sent, sub->dropped, sub->gaps);
+		fprintf(fp, "        ");
+		if (sub->nsid != FILTER_NETNS_ANY)
+			fprintf(fp, "netns %d ", sub->nsid);
+		fprintf(fp, "bridge %u instance ", sub->br_ifindex);
+		if (sub->instance == FILTER_ANY)
+			fprintf(fp, "any");
+		else
+			fprintf(fp, "%u", sub->instance);
+		fprintf(fp, " level %u-%u events%s%s%s%s\n", sub->level_min, sub->level_max,
+			sub->types & (1 << CFM_EVENT_PEER) ? " peer" : "",
+			sub->types & (1 << CFM_EVENT_RAPS) ? " raps" : "",
+			sub->types & (1 << CFM_EVENT_ALARM) ? " alarm" : "",
+			sub->types & (1 << CFM_EVENT_DAMPED) ? " damped" : "");
+	}
+	fprintf(fp, "\n");
+}
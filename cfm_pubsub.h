@@ -0,0 +1,70 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_PUBSUB_H
+#define CFM_PUBSUB_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Events streamed by cfm_server to its subscribers. The binary format is
+ * this struct as is, the JSON format one object per line. Fields are only
+ * added at the end of the struct, with a new version.
+ */
+enum cfm_event_type {
+	CFM_EVENT_GAP = 0,	/* 'lost' events dropped, seq and ts are of the next one */
+	CFM_EVENT_PEER = 1,	/* Peer MEP CCM defect changed */
+	CFM_EVENT_RAPS = 2,	/* MIP received R-APS */
+	CFM_EVENT_ALARM = 3,	/* Correlated CCM defects raised or cleared */
+	CFM_EVENT_DAMPED = 4,	/* Flap damped peer MEP CCM defect changed */
+	CFM_EVENT_TYPES
+};
+
+#define CFM_EVENT_LEVEL_NONE	0xFF	/* The event has no MD level */
+
+#define CFM_EVENT_VERSION	1	/* 0 - no nsid */
+
+struct cfm_event {
+	uint16_t type;
+	uint16_t len;		/* sizeof(struct cfm_event) */
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint8_t level;		/* MD level of the MEP */
+	uint8_t version;	/* CFM_EVENT_VERSION */
+	uint8_t reserved[2];
+	uint64_t seq;		/* Per server, gaps show dropped events */
+	uint64_t ts;		/* ns, CLOCK_MONOTONIC, when the event was read */
+	union {
+		struct {
+			uint32_t mepid;
+			uint32_t defect;
+		} peer;			/* Also CFM_EVENT_DAMPED */
+		struct {
+			uint8_t request;
+			uint8_t sub_code;
+			uint8_t status;
+			uint8_t node_id[6];
+		} raps;
+		struct {
+			uint64_t lost;
+		} gap;
+		struct {
+			uint32_t id;
+			uint32_t port_ifindex;
+			uint32_t members;
+			uint32_t active;	/* Members in defect, 0 - cleared */
+		} alarm;
+	};
+	int32_t nsid;		/* Network namespace ID, -1 - the server's own */
+};
+
+#define CFM_PUBSUB_SUBSCRIBERS_MAX	64	/* At most 64, filters are bitmasks */
+#define CFM_PUBSUB_QUEUE_DEFAULT	1024
+#define CFM_PUBSUB_QUEUE_MAX		65536
+
+int cfm_pubsub_init(const char *path);
+void cfm_pubsub_uninit(void);
+void cfm_pubsub_publish(struct cfm_event *ev);
+void cfm_pubsub_stats_print(FILE *fp);
+
+#endif
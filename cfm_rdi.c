@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <inttypes.h>
+
+#include "cfm_hist.h"
+#include "cfm_rdi.h"
+
+/* Event to RDI latency of all MEPs, from reading the defect event off the
+ * netlink socket until the kernel acknowledged the new RDI.
+ */
+static struct cfm_hist rdi_latency = { .min = UINT64_MAX };
+
+/* 802.1Q 20.9.4: a MEP sends RDI while any of its peers is in defect. The
+ * RDI is only set when that changes, repeated events for the same state
+ * are counted and dropped.
+ */
+void cfm_rdi_update(struct cfm_mep_state *mep, uint64_t event_ts)
+{
+	int rdi = mep->defect_count != 0;
+	uint64_t latency;
+	int err;
+
+	if (mep->rdi == rdi) {
+		mep->rdi_debounced++;
+		return;
+	}
+
+	err = cfm_offload_netns_select(mep->nsid);
+	if (!err)
+		err = cfm_offload_cc_rdi(mep->br_ifindex, mep->instance, rdi);
+	cfm_offload_netns_select(-1);
+	if (err) {
+		/* Left unknown, so the next event tries again */
+		mep->rdi = -1;
+		mep->rdi_errors++;
+		return;
+	}
+
+	latency = cfm_state_now() - event_ts;
+	mep->rdi = rdi;
+	mep->rdi_sets++;
+	if (latency > mep->rdi_latency_max)
+		mep->rdi_latency_max = latency;
+	if (mep->interval_ns && latency > mep->interval_ns)
+		mep->rdi_late++;
+	cfm_hist_add(&rdi_latency, latency);
+}
+
+static void cfm_rdi_mep_print(struct cfm_mep_state *mep, void *arg)
+{
+	FILE *fp = arg;
+
+	if (!mep->rdi_sets && !mep->rdi_errors)
+		return;
+
+	fprintf(fp, "    ");
+	if (mep->nsid >= 0)
+		fprintf(fp, "Netns %d ", mep->nsid);
+	fprintf(fp, "Bridge %u instance %u: rdi %d defects %u sets %" PRIu64
+		" debounced %" PRIu64 " errors %" PRIu64 " late %" PRIu64 " max %.3f us\n",
+		mep->br_ifindex, mep->instance, mep->rdi, mep->defect_count, mep->rdi_sets,
+		mep->rdi_debounced, mep->rdi_errors, mep->rdi_late,
+		mep->rdi_latency_max / 1000.0);
+}
+
+void cfm_rdi_stats_print(FILE *fp)
+{
+	fprintf(fp, "Auto RDI\n");
+	cfm_hist_print(fp, "Event to RDI", &rdi_latency);
+	cfm_state_for_each(cfm_rdi_mep_print, fp);
+	fprintf(fp, "\n");
+}
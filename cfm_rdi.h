@@ -0,0 +1,15 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_RDI_H
+#define CFM_RDI_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cfm_state.h"
+
+void cfm_rdi_update(struct cfm_mep_state *mep, uint64_t event_ts);
+void cfm_rdi_stats_print(FILE *fp);
+
+#endif
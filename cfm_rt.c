@@ -0,0 +1,185 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <malloc.h>
+#include <ev.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+#include "cfm_hist.h"
+#include "cfm_state.h"
+#include "cfm_rt.h"
+
+/* Real-time setup of the event thread. It is done after the RX workers are
+ * started, so the CPU and scheduling policy apply to the event thread only.
+ *
+ * The scheduling latency is measured with a periodic timerfd watched by the
+ * event loop. The timer expires at absolute times, and each wakeup records
+ * how long after the expiry the loop got to it, which is the delay a
+ * netlink event would have seen at that moment.
+ */
+
+#define RT_PREFAULT_STACK	(512 * 1024)
+#define RT_PREFAULT_HEAP	(8 * 1024 * 1024)
+
+static struct cfm_rt_config config;
+static int probe_fd = -1;
+static ev_io probe_watcher;
+static uint64_t probe_start;	/* ns, CLOCK_MONOTONIC, first expiry */
+static uint64_t probe_expirations;
+static uint64_t probe_missed;	/* Expirations passed while the loop was away */
+static struct cfm_hist probe_latency;
+static struct rusage usage_start;
+
+static void rt_prefault_stack(void)
+{
+	volatile unsigned char stack[RT_PREFAULT_STACK];
+	size_t i, page = sysconf(_SC_PAGESIZE);
+
+	for (i = 0; i < sizeof(stack); i += page)
+		stack[i] = 0;
+}
+
+static int rt_lock(void)
+{
+	unsigned char *heap;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Keep freed memory, so later allocations reuse the prefaulted heap */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	heap = malloc(RT_PREFAULT_HEAP);
+	if (heap) {
+		memset(heap, 0, RT_PREFAULT_HEAP);
+		free(heap);
+	}
+	rt_prefault_stack();
+
+	return 0;
+}
+
+static void rt_probe(EV_P_ ev_io *w, int revents)
+{
+	uint64_t expirations, expiry, now;
+
+	if (read(probe_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	now = cfm_state_now();
+	probe_expirations += expirations;
+	probe_missed += expirations - 1;
+	expiry = probe_start + (probe_expirations - 1) * config.probe * 1000ULL;
+	cfm_hist_add(&probe_latency, now - expiry);
+}
+
+static int rt_probe_start(void)
+{
+	struct itimerspec its = { 0 };
+
+	probe_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (probe_fd < 0) {
+		fprintf(stderr, "timerfd_create failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	probe_start = cfm_state_now() + config.probe * 1000ULL;
+	its.it_value.tv_sec = probe_start / 1000000000;
+	its.it_value.tv_nsec = probe_start % 1000000000;
+	its.it_interval.tv_sec = config.probe / 1000000;
+	its.it_interval.tv_nsec = config.probe % 1000000 * 1000;
+	if (timerfd_settime(probe_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		fprintf(stderr, "timerfd_settime failed: %s\n", strerror(errno));
+		close(probe_fd);
+		probe_fd = -1;
+		return -1;
+	}
+
+	cfm_hist_init(&probe_latency);
+	ev_io_init(&probe_watcher, rt_probe, probe_fd, EV_READ);
+	ev_io_start(EV_DEFAULT, &probe_watcher);
+
+	return 0;
+}
+
+int cfm_rt_init(const struct cfm_rt_config *cfg)
+{
+	struct sched_param param = { .sched_priority = cfg->priority };
+	cpu_set_t set;
+
+	config = *cfg;
+
+	if (config.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(config.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			fprintf(stderr, "Cannot run on CPU %d: %s\n", config.cpu, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (config.lock && rt_lock())
+		return -1;
+
+	if (config.priority && sched_setscheduler(0, SCHED_FIFO, &param)) {
+		fprintf(stderr, "Cannot set SCHED_FIFO priority %d: %s\n", config.priority,
+			strerror(errno));
+		return -1;
+	}
+
+	if (config.probe && rt_probe_start())
+		return -1;
+
+	getrusage(RUSAGE_THREAD, &usage_start);
+
+	return 0;
+}
+
+void cfm_rt_uninit(void)
+{
+	if (probe_fd < 0)
+		return;
+
+	ev_io_stop(EV_DEFAULT, &probe_watcher);
+	close(probe_fd);
+	probe_fd = -1;
+}
+
+void cfm_rt_stats_print(FILE *fp)
+{
+	struct rusage usage;
+
+	if (config.cpu < 0 && !config.priority && !config.lock && !config.probe)
+		return;
+
+	getrusage(RUSAGE_THREAD, &usage);
+
+	fprintf(fp, "Event thread\n");
+	fprintf(fp, "    CPU %d, %s", sched_getcpu(),
+		sched_getscheduler(0) == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER");
+	if (config.priority)
+		fprintf(fp, " priority %d", config.priority);
+	fprintf(fp, ", memory %slocked\n", config.lock ? "" : "not ");
+	fprintf(fp, "    Page faults since start: minor %ld major %ld\n",
+		usage.ru_minflt - usage_start.ru_minflt, usage.ru_majflt - usage_start.ru_majflt);
+	fprintf(fp, "    Context switches since start: voluntary %ld involuntary %ld\n",
+		usage.ru_nvcsw - usage_start.ru_nvcsw, usage.ru_nivcsw - usage_start.ru_nivcsw);
+	if (config.probe) {
+		cfm_hist_print(fp, "Scheduling latency", &probe_latency);
+		fprintf(fp, "    Probes %" PRIu64 " every %u us, missed %" PRIu64 "\n",
+			probe_expirations, config.probe, probe_missed);
+	}
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_RT_H
+#define CFM_RT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct cfm_rt_config {
+	int cpu;		/* CPU to run the event thread on, -1 - any */
+	int priority;		/* SCHED_FIFO priority, 0 - normal scheduling */
+	bool lock;		/* Lock and prefault all memory */
+	uint32_t probe;		/* us between scheduling latency probes, 0 - off */
+};
+
+int cfm_rt_init(const struct cfm_rt_config *cfg);
+void cfm_rt_uninit(void);
+void cfm_rt_stats_print(FILE *fp);
+
+#endif
@@ -0,0 +1,369 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#include "cfm_pdu.h"
+#include "cfm_rx.h"
+
+#define CFM_RX_BLOCK_SIZE	(1 << 16)
+#define CFM_RX_BLOCK_NR		64
+#define CFM_RX_FRAME_SIZE	(1 << 11)
+#define CFM_RX_BLOCK_TIMEOUT	10
+
+static uint64_t cfm_rx_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void cfm_rx_config_default(struct cfm_rx_config *cfg, uint32_t ifindex)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->ifindex = ifindex;
+	cfg->block_size = CFM_RX_BLOCK_SIZE;
+	cfg->block_nr = CFM_RX_BLOCK_NR;
+	cfg->frame_size = CFM_RX_FRAME_SIZE;
+	cfg->block_timeout = CFM_RX_BLOCK_TIMEOUT;
+	cfg->max_level = 7;
+}
+
+#define CFM_RX_FILTER_MAX	(16 + 16)
+
+/* Build a classic BPF program accepting only CFM frames, untagged or behind
+ * one tag that the driver did not strip, at or below the maximum MD level
+ * and with one of the configured opcodes. X holds the tag length, so the
+ * same indirect loads work for both cases.
+ */
+static int cfm_rx_filter_build(const struct cfm_rx_config *cfg, struct sock_filter *prog)
+{
+	int n = 0, i, accept, drop;
+
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021Q, 3, 0);
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021AD, 2, 0);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 0);
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 4);
+
+	/* Jump targets are filled in below once the program length is known */
+	accept = 6 + 2 + (cfg->max_level < 7 ? 3 : 0) + (cfg->opcode_count ? 1 + cfg->opcode_count : 0);
+	drop = accept + 1;
+
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 12);
+	prog[n] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CFM, 0, drop - n - 1);
+	n++;
+
+	if (cfg->max_level < 7) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 14);
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 5);
+		prog[n] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, cfg->max_level, drop - n - 1, 0);
+		n++;
+	}
+
+	if (cfg->opcode_count) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 15);
+		for (i = 0; i < cfg->opcode_count; ++i) {
+			/* The last compare falls through to drop on mismatch */
+			prog[n] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cfg->opcodes[i],
+							       accept - n - 1,
+							       i == cfg->opcode_count - 1 ? drop - n - 1 : 0);
+			n++;
+		}
+	}
+
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	return n;
+}
+
+static int cfm_rx_filter_attach(int fd, const struct cfm_rx_config *cfg)
+{
+	struct sock_filter prog[CFM_RX_FILTER_MAX];
+	struct sock_fprog fprog;
+
+	fprog.len = cfm_rx_filter_build(cfg, prog);
+	fprog.filter = prog;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		fprintf(stderr, "cfm_rx_open: SO_ATTACH_FILTER failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Join the fanout group of the port. Frames are spread over the members by
+ * a hash of the source MAC rather than the MEPID, as the MAC identifies the
+ * remote MEP in every opcode while the MEPID is only carried in CCMs. The
+ * kernel takes the returned value modulo the number of members. The fanout
+ * program runs before the MAC header is pushed back on ingress, so the MAC
+ * is loaded relative to the link layer header.
+ */
+static int cfm_rx_fanout_join(int fd, uint16_t id)
+{
+	struct sock_filter prog[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_LL_OFF + 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog fprog = {
+		.len = sizeof(prog) / sizeof(prog[0]),
+		.filter = prog,
+	};
+	int arg = id | (PACKET_FANOUT_CBPF << 16);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+		fprintf(stderr, "cfm_rx_open: PACKET_FANOUT failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT_DATA, &fprog, sizeof(fprog)) < 0) {
+		fprintf(stderr, "cfm_rx_open: PACKET_FANOUT_DATA failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int cfm_rx_open(struct cfm_rx *rx, const struct cfm_rx_config *cfg)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	int one = 1;
+
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = -1;
+
+	/* Protocol 0 - nothing is queued before the ring is in place and bound */
+	rx->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (rx->fd < 0) {
+		fprintf(stderr, "cfm_rx_open: socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (setsockopt(rx->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fprintf(stderr, "cfm_rx_open: PACKET_VERSION failed: %s\n", strerror(errno));
+		goto err;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = cfg->block_size;
+	req.tp_block_nr = cfg->block_nr;
+	req.tp_frame_size = cfg->frame_size;
+	req.tp_frame_nr = (cfg->block_size / cfg->frame_size) * cfg->block_nr;
+	req.tp_retire_blk_tov = cfg->block_timeout;
+
+	if (setsockopt(rx->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		fprintf(stderr, "cfm_rx_open: PACKET_RX_RING failed: %s\n", strerror(errno));
+		goto err;
+	}
+
+	rx->block_size = cfg->block_size;
+	rx->block_nr = cfg->block_nr;
+	rx->map_len = (size_t)cfg->block_size * cfg->block_nr;
+	rx->map = mmap(NULL, rx->map_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, rx->fd, 0);
+	if (rx->map == MAP_FAILED) {
+		fprintf(stderr, "cfm_rx_open: mmap failed: %s\n", strerror(errno));
+		rx->map = NULL;
+		goto err;
+	}
+
+	if (cfm_rx_filter_attach(rx->fd, cfg))
+		goto err;
+
+	/* Frames sent from this host, including our own, are not received.
+	 * Kernels before 4.20 do not know the option, they are dropped when
+	 * the ring is walked instead.
+	 */
+	if (setsockopt(rx->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) < 0) {
+		if (errno != ENOPROTOOPT) {
+			fprintf(stderr, "cfm_rx_open: PACKET_IGNORE_OUTGOING failed: %s\n",
+				strerror(errno));
+			goto err;
+		}
+		rx->skip_outgoing = true;
+	}
+
+	/* ETH_P_ALL taps see the frame before the bridge rx_handler, which
+	 * consumes CFM frames on ports with a MEP or MIP instance. The filter
+	 * keeps everything else in the kernel.
+	 */
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = cfg->ifindex;
+
+	if (bind(rx->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		fprintf(stderr, "cfm_rx_open: bind failed: %s\n", strerror(errno));
+		goto err;
+	}
+
+	if (cfg->fanout_id && cfm_rx_fanout_join(rx->fd, cfg->fanout_id))
+		goto err;
+
+	return 0;
+
+err:
+	cfm_rx_close(rx);
+	return -1;
+}
+
+void cfm_rx_close(struct cfm_rx *rx)
+{
+	if (rx->map)
+		munmap(rx->map, rx->map_len);
+	if (rx->fd >= 0)
+		close(rx->fd);
+	rx->map = NULL;
+	rx->fd = -1;
+}
+
+static int cfm_rx_parse(const struct cfm_rx *rx, const struct tpacket3_hdr *hdr,
+			struct cfm_rx_frame *frame)
+{
+	const uint8_t *mac = (const uint8_t *)hdr + hdr->tp_mac;
+	const struct sockaddr_ll *sll;
+	uint32_t len = hdr->tp_snaplen;
+	uint32_t off = 2 * ETH_ALEN;
+	uint16_t proto;
+
+	if (rx->skip_outgoing) {
+		sll = (const struct sockaddr_ll *)((const uint8_t *)hdr +
+						   TPACKET_ALIGN(sizeof(*hdr)));
+		if (sll->sll_pkttype == PACKET_OUTGOING)
+			return -1;
+	}
+
+	if (len < ETH_HLEN + sizeof(struct br_cfm_common_hdr))
+		return -1;
+
+	frame->vlan_tci = 0;
+	if (hdr->tp_status & TP_STATUS_VLAN_VALID)
+		frame->vlan_tci = hdr->hv1.tp_vlan_tci;
+
+	/* A tag that was not stripped by the driver is still in the frame */
+	proto = cfm_pdu_get_u16(mac + off);
+	if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+		if (len < ETH_HLEN + 4 + sizeof(struct br_cfm_common_hdr))
+			return -1;
+		frame->vlan_tci = cfm_pdu_get_u16(mac + off + 2);
+		off += 4;
+		proto = cfm_pdu_get_u16(mac + off);
+	}
+
+	if (proto != ETH_P_CFM)
+		return -1;
+
+	off += 2;
+	frame->mac = mac;
+	frame->pdu = mac + off;
+	frame->len = len - off;
+	frame->ts = (uint64_t)hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+
+	return 0;
+}
+
+/* Walk all blocks the kernel has handed over, passing the CFM frames to
+ * the handler in batches. The frames point into the ring and are only
+ * valid until the handler returns.
+ */
+int cfm_rx_process(struct cfm_rx *rx, cfm_rx_handler_t handler, void *arg)
+{
+	struct cfm_rx_frame frames[CFM_RX_BATCH];
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	uint32_t i, num_pkts, status;
+	unsigned int count;
+	uint64_t start, elapsed;
+	int total = 0;
+
+	while (1) {
+		bd = (struct tpacket_block_desc *)(rx->map + (size_t)rx->block_idx * rx->block_size);
+		status = __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+		if (!(status & TP_STATUS_USER))
+			break;
+
+		start = cfm_rx_now();
+		num_pkts = bd->hdr.bh1.num_pkts;
+		hdr = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		count = 0;
+
+		for (i = 0; i < num_pkts; ++i) {
+			if (cfm_rx_parse(rx, hdr, &frames[count]) == 0 &&
+			    ++count == CFM_RX_BATCH) {
+				handler(frames, count, arg);
+				rx->stats.cfm_frames += count;
+				count = 0;
+			}
+			hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+		}
+
+		if (count) {
+			handler(frames, count, arg);
+			rx->stats.cfm_frames += count;
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		rx->block_idx = (rx->block_idx + 1) % rx->block_nr;
+
+		elapsed = cfm_rx_now() - start;
+		rx->stats.blocks++;
+		if (status & TP_STATUS_BLK_TMO)
+			rx->stats.blocks_tmo++;
+		rx->stats.frames += num_pkts;
+		rx->stats.proc_ns += elapsed;
+		if (elapsed > rx->stats.max_block_ns)
+			rx->stats.max_block_ns = elapsed;
+
+		total += num_pkts;
+	}
+
+	return total;
+}
+
+void cfm_rx_stats_get(struct cfm_rx *rx, struct cfm_rx_stats *stats)
+{
+	struct tpacket_stats_v3 kstats;
+	socklen_t len = sizeof(kstats);
+
+	/* The kernel counters are cleared on every read */
+	if (getsockopt(rx->fd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == 0) {
+		rx->stats.drops += kstats.tp_drops;
+		rx->stats.freezes += kstats.tp_freeze_q_cnt;
+	}
+
+	*stats = rx->stats;
+}
+
+void cfm_rx_stats_print(FILE *fp, const char *name, const struct cfm_rx_stats *stats)
+{
+	fprintf(fp, "RX %s\n", name);
+	fprintf(fp, "    Blocks %" PRIu64 " (timeout %" PRIu64 ")\n", stats->blocks, stats->blocks_tmo);
+	fprintf(fp, "    Frames %" PRIu64 " (cfm %" PRIu64 ")\n", stats->frames, stats->cfm_frames);
+	fprintf(fp, "    Frames/block %" PRIu64 "\n", stats->blocks ? stats->frames / stats->blocks : 0);
+	fprintf(fp, "    Ns/frame %" PRIu64 "\n", stats->frames ? stats->proc_ns / stats->frames : 0);
+	fprintf(fp, "    Max block ns %" PRIu64 "\n", stats->max_block_ns);
+	fprintf(fp, "    Drops %" PRIu64 "\n", stats->drops);
+	fprintf(fp, "    Freezes %" PRIu64 "\n", stats->freezes);
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_RX_H
+#define CFM_RX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Maximum number of frames handed to the handler in one call */
+#define CFM_RX_BATCH		64
+
+struct cfm_rx_frame {
+	const uint8_t *mac;	/* Ethernet header, points into the ring */
+	const uint8_t *pdu;	/* CFM common header, points into the ring */
+	uint32_t len;		/* Bytes from pdu to the end of the frame */
+	uint16_t vlan_tci;
+	uint64_t ts;		/* Kernel receive timestamp in ns */
+};
+
+typedef void (*cfm_rx_handler_t)(const struct cfm_rx_frame *frames,
+				 unsigned int count, void *arg);
+
+struct cfm_rx_config {
+	uint32_t ifindex;
+	uint32_t block_size;
+	uint32_t block_nr;
+	uint32_t frame_size;
+	uint32_t block_timeout;	/* ms before a partially filled block is retired */
+	uint8_t max_level;	/* Frames above this MD level are dropped in the kernel */
+	uint8_t opcode_count;	/* 0 accepts all opcodes */
+	uint8_t opcodes[16];
+	uint16_t fanout_id;	/* 0 - the socket is not part of a fanout group */
+};
+
+struct cfm_rx_stats {
+	uint64_t blocks;
+	uint64_t blocks_tmo;	/* Blocks retired by timeout instead of being full */
+	uint64_t frames;
+	uint64_t cfm_frames;
+	uint64_t proc_ns;	/* Total time spent processing blocks */
+	uint64_t max_block_ns;
+	uint64_t drops;
+	uint64_t freezes;
+};
+
+struct cfm_rx {
+	int fd;
+	uint8_t *map;
+	size_t map_len;
+	uint32_t block_size;
+	uint32_t block_nr;
+	uint32_t block_idx;
+	bool skip_outgoing;	/* PACKET_IGNORE_OUTGOING is not supported */
+	struct cfm_rx_stats stats;
+};
+
+void cfm_rx_config_default(struct cfm_rx_config *cfg, uint32_t ifindex);
+int cfm_rx_open(struct cfm_rx *rx, const struct cfm_rx_config *cfg);
+void cfm_rx_close(struct cfm_rx *rx);
+int cfm_rx_process(struct cfm_rx *rx, cfm_rx_handler_t handler, void *arg);
+void cfm_rx_stats_get(struct cfm_rx *rx, struct cfm_rx_stats *stats);
+void cfm_rx_stats_print(FILE *fp, const char *name, const struct cfm_rx_stats *stats);
+
+#endif
@@ -3,10 +3,12 @@
 
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <linux/types.h>
 #include <linux/if_bridge.h>
 #include <errno.h>
+#include <signal.h>
 
 #include "list.h"
 
@@ -20,47 +22,221 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
 
 #include "cfm_netlink.h"
+#include "cfm_soft_rx.h"
+#include "cfm_state.h"
+#include "cfm_rdi.h"
+#include "cfm_lease.h"
+#include "cfm_erps.h"
+#include "cfm_action.h"
+#include "cfm_rt.h"
+#include "cfm_shm.h"
+#include "cfm_pubsub.h"
+#include "cfm_warm.h"
+#include "cfm_ctl.h"
+#include "cfm_history.h"
+#include "cfm_journal.h"
+#include "cfm_avail.h"
+#include "cfm_corr.h"
+#include "cfm_damp.h"
 #include "libnetlink.h"
 
-volatile bool quit = false;
+static struct rtnl_handle rth;
+static ev_io netlink_watcher;
+static ev_signal stats_watcher;
+static ev_signal quit_watcher[3];
+
+static struct cfm_soft_rx_config soft_rx_cfg = { .max_level = 7, .workers = 1 };
+static const char *soft_rx_ports[CFM_SOFT_RX_MAX_PORTS];
+static int soft_rx_port_count;
+
+static bool auto_rdi;
+static bool ccm_lease;
+static struct cfm_lease_config lease_cfg = { .rescan = 1000, .window = 500 };
+static const char *erps_file;
+static const char *action_file;
+static struct cfm_rt_config rt_cfg = { .cpu = -1 };
+static bool shm;
+static const char *pubsub_path;
+static bool all_netns;
+static const char *state_file;
+static const char *ctl_path;
+static struct cfm_history_config history_cfg = { .memory = CFM_HISTORY_MEMORY };
+static const char *journal_dir;
+static uint32_t journal_flush;
+static uint32_t avail_window;
+static uint32_t corr_window;
+static struct cfm_damp_config damp_cfg;
+static bool damping;
+static ev_timer netns_watcher;
+static uint64_t netns_scanned;	/* ns, CLOCK_MONOTONIC, of the last scan */
+
+/* Namespaces are rescanned this often, and when an event comes from an
+ * unknown one, but not more than once a second.
+ */
+#define NETNS_SCAN_INTERVAL	10
+
+/* MEPs changed by one notification, handled after all its peers are seen */
+#define EVENT_MEPS_MAX	64
 
-static void handle_signal(int sig)
+char *rta_getattr_mac(const struct rtattr *rta)
 {
-    ev_break(EV_DEFAULT, EVBREAK_ALL);;
+	static char buf_ret[100];
+	unsigned char mac[6];
+
+	memcpy(&mac, RTA_DATA(rta), 6);
+	snprintf(buf_ret, sizeof(buf_ret), "%02X-%02X-%02X-%02X-%02X-%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	return buf_ret;
 }
 
-int signal_init(void)
+static void mep_event_done(struct cfm_mep_state *mep, uint64_t now)
 {
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_signal;
-    sa.sa_flags = 0;
+	mep->dirty = false;
+	if (auto_rdi)
+		cfm_rdi_update(mep, now);
+	/* Rings are configured in our own namespace */
+	if (erps_file && mep->nsid < 0)
+		cfm_erps_mep_changed(mep, now);
+	if (shm)
+		cfm_shm_mep_update(mep, now);
+}
 
-    sigaction(SIGTERM, &sa, NULL);
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGHUP, &sa, NULL);
-    sigaction(SIGUSR2, &sa, NULL);
+static void mep_changed(struct cfm_mep_state **meps, int *count, struct cfm_mep_state *mep,
+			uint64_t now)
+{
+	if (*count < EVENT_MEPS_MAX)
+		meps[(*count)++] = mep;
+	else
+		mep_event_done(mep, now);
+}
 
-    sa.sa_handler = SIG_IGN;
-    sigaction(SIGPIPE, &sa, NULL);
+static void alarm_changed(const struct cfm_corr_alarm *alarm, uint64_t now)
+{
+	if (pubsub_path) {
+		struct cfm_event ev = {
+			.type = CFM_EVENT_ALARM,
+			.br_ifindex = alarm->br_ifindex,
+			.nsid = alarm->nsid,
+			.level = alarm->level,
+			.ts = now,
+			.alarm.id = alarm->id,
+			.alarm.port_ifindex = alarm->port_ifindex,
+			.alarm.members = alarm->member_count,
+			.alarm.active = alarm->active,
+		};
+
+		cfm_pubsub_publish(&ev);
+	}
+}
 
-    return 0;
+/* With damping, actions follow the damped state */
+static void damped_changed(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	if (action_file && mep->nsid < 0)
+		cfm_action_peer(mep->br_ifindex, mep->instance, peer->mepid, peer->damp.defect, now);
+	if (pubsub_path) {
+		struct cfm_event ev = {
+			.type = CFM_EVENT_DAMPED,
+			.br_ifindex = mep->br_ifindex,
+			.nsid = mep->nsid,
+			.instance = mep->instance,
+			.level = mep->level,
+			.ts = now,
+			.peer.mepid = peer->mepid,
+			.peer.defect = peer->damp.defect,
+		};
+
+		cfm_pubsub_publish(&ev);
+	}
 }
 
-static struct rtnl_handle rth;
-static ev_io netlink_watcher;
+static void peer_changed(struct cfm_mep_state *mep, struct cfm_peer_state *peer, uint64_t now)
+{
+	if (action_file && mep->nsid < 0 && !damp_cfg.half_life)
+		cfm_action_peer(mep->br_ifindex, mep->instance, peer->mepid, peer->defect, now);
+	if (journal_dir)
+		cfm_journal_peer(mep->nsid, mep->br_ifindex, mep->instance, peer->mepid,
+				 peer->defect, peer->defect_events, now);
+	if (avail_window)
+		cfm_avail_peer(mep, peer, now);
+	if (pubsub_path) {
+		struct cfm_event ev = {
+			.type = CFM_EVENT_PEER,
+			.br_ifindex = mep->br_ifindex,
+			.nsid = mep->nsid,
+			.instance = mep->instance,
+			.level = mep->level,
+			.ts = now,
+			.peer.mepid = peer->mepid,
+			.peer.defect = peer->defect,
+		};
+
+		cfm_pubsub_publish(&ev);
+	}
+	if (corr_window)
+		cfm_corr_peer(mep, peer, now);
+	if (damping)
+		cfm_damp_peer(mep, peer, now);
+}
 
-char *rta_getattr_mac(const struct rtattr *rta)
+static void mep_loaded(struct cfm_mep_state *mep, void *arg)
 {
-	static char buf_ret[100];
-	unsigned char mac[6];
+	mep_event_done(mep, *(uint64_t *)arg);
+}
 
-	memcpy(&mac, RTA_DATA(rta), 6);
-	snprintf(buf_ret, sizeof(buf_ret), "%02X-%02X-%02X-%02X-%02X-%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+/* Start from the state file if it is still valid, else from a dump of all
+ * MEPs, so peers already in defect are known before the first event.
+ */
+static void state_load(void)
+{
+	uint64_t start = cfm_state_now(), now;
+	bool warm;
 
-	return buf_ret;
+	warm = state_file && !cfm_warm_load(state_file, peer_changed);
+	if (!warm && cfm_warm_snapshot())
+		printf("MEP snapshot failed, MEPs are learned from events\n");
+
+	now = cfm_state_now();
+	cfm_state_for_each(mep_loaded, &now);
+	printf("%s start, %u MEPs in %" PRIu64 " us\n", warm ? "Warm" : "Cold",
+	       cfm_state_mep_count(), (cfm_state_now() - start) / 1000);
+}
+
+static void peer_event(int nsid, uint32_t br_ifindex, struct rtattr **info, uint64_t now,
+		       struct cfm_mep_state **meps, int *count)
+{
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	bool dirty;
+
+	if (!info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_PEER_MEPID] ||
+	    !info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_CCM_DEFECT])
+		return;
+
+	if (nsid < 0)
+		cfm_soft_rx_peer_event(br_ifindex, rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_INSTANCE]),
+				       rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_PEER_MEPID]));
+
+	mep = cfm_state_mep_get(nsid, br_ifindex, rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_INSTANCE]));
+	if (!mep)
+		return;
+	peer = cfm_state_peer_get(mep, rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_PEER_MEPID]));
+	if (!peer)
+		return;
+
+	dirty = mep->dirty;
+	if (!cfm_state_peer_defect(mep, peer, rta_getattr_u32(info[IFLA_BRIDGE_CFM_CC_PEER_EVENT_CCM_DEFECT]), now)) {
+		if (auto_rdi)
+			mep->rdi_debounced++;
+		return;
+	}
+	peer_changed(mep, peer, now);
+	if (!dirty)
+		mep_changed(meps, count, mep, now);
 }
 
 static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
@@ -74,7 +250,11 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 	int len = n->nlmsg_len;
 	struct rtattr *i, *list;
 	int rem;
-	uint32_t instance, request, sub_code, status;
+	uint32_t instance, request, sub_code, status, br_ifindex;
+	struct cfm_mep_state *meps[EVENT_MEPS_MAX];
+	uint64_t now = cfm_state_now();
+	int mep_count = 0, m;
+	int nsid = who ? who->nsid : -1;
 
 	if (n->nlmsg_type == NLMSG_DONE)
 		return 0;
@@ -98,17 +278,30 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 		return -1;
 	}
 
-	if (!tb[IFLA_AF_SPEC])
-		return 0;
+	/* Port notifications name the bridge in IFLA_MASTER */
+	br_ifindex = tb[IFLA_MASTER] ? rta_getattr_u32(tb[IFLA_MASTER]) : (uint32_t)ifi->ifi_index;
 
-	parse_rtattr_flags(aftb, IFLA_BRIDGE_MAX, RTA_DATA(tb[IFLA_AF_SPEC]), RTA_PAYLOAD(tb[IFLA_AF_SPEC]), NLA_F_NESTED);
-	if (!aftb[IFLA_BRIDGE_CFM])
+	if (tb[IFLA_AF_SPEC])
+		parse_rtattr_flags(aftb, IFLA_BRIDGE_MAX, RTA_DATA(tb[IFLA_AF_SPEC]), RTA_PAYLOAD(tb[IFLA_AF_SPEC]), NLA_F_NESTED);
+	if (!tb[IFLA_AF_SPEC] || !aftb[IFLA_BRIDGE_CFM]) {
+		/* Anything but CFM status may be a MEP configuration change */
+		if (nsid < 0)
+			cfm_soft_rx_link_event(ifi->ifi_index, br_ifindex);
 		return 0;
+	}
+
+	if (nsid >= 0 && !cfm_offload_netns_name(nsid) &&
+	    now - netns_scanned > 1000000000ULL) {
+		netns_scanned = now;
+		cfm_offload_netns_scan();
+	}
 
 	list = aftb[IFLA_BRIDGE_CFM];
 	rem = RTA_PAYLOAD(list);
 
 	printf("EVENT CFM CC peer status:\n");
+	if (nsid >= 0)
+		printf("Netns %d %s\n", nsid, cfm_offload_netns_name(nsid) ? : "");
 	instance = 0xFFFFFFFF;
 	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
 		if (i->rta_type != (IFLA_BRIDGE_CFM_CC_PEER_EVENT_INFO | NLA_F_NESTED))
@@ -125,16 +318,27 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 		printf("    Peer-mep %u\n", rta_getattr_u32(info_peer[IFLA_BRIDGE_CFM_CC_PEER_EVENT_PEER_MEPID]));
 		printf("        CCM defect %u\n", rta_getattr_u32(info_peer[IFLA_BRIDGE_CFM_CC_PEER_EVENT_CCM_DEFECT]));
 		printf("\n");
+
+		peer_event(nsid, br_ifindex, info_peer, now, meps, &mep_count);
 	}
 
+	for (m = 0; m < mep_count; ++m)
+		mep_event_done(meps[m], now);
+
 	printf("EVENT CFM MIP RAPS info:\n");
+	if (nsid >= 0)
+		printf("Netns %d %s\n", nsid, cfm_offload_netns_name(nsid) ? : "");
 	instance = 0xFFFFFFFF;
+	rem = RTA_PAYLOAD(list);
 	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
 		if (i->rta_type != (IFLA_BRIDGE_CFM_MIP_EVENT_INFO | NLA_F_NESTED))
 			continue;
 
 		parse_rtattr_flags(info_mip, IFLA_BRIDGE_CFM_MIP_EVENT_MAX, RTA_DATA(i), RTA_PAYLOAD(i), NLA_F_NESTED);
-		if (!info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_INSTANCE])
+		if (!info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_INSTANCE] ||
+		    !info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_NODE_ID] ||
+		    !info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_REQUEST_SUBCODE] ||
+		    !info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_STATUS])
 			continue;
 
 		if (instance != rta_getattr_u32(info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_INSTANCE])) {
@@ -149,6 +353,26 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 		printf("    status %u\n", status);
 		printf("    Node-id %s\n", rta_getattr_mac(info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_NODE_ID]));
 		printf("\n");
+
+		if (erps_file && nsid < 0)
+			cfm_erps_raps_event(br_ifindex, instance, (request << 4) | sub_code, status,
+					    RTA_DATA(info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_NODE_ID]), now);
+		if (pubsub_path) {
+			struct cfm_event ev = {
+				.type = CFM_EVENT_RAPS,
+				.br_ifindex = br_ifindex,
+				.nsid = nsid,
+				.instance = instance,
+				.level = CFM_EVENT_LEVEL_NONE,
+				.ts = now,
+				.raps.request = request,
+				.raps.sub_code = sub_code,
+				.raps.status = status,
+			};
+
+			memcpy(ev.raps.node_id, RTA_DATA(info_mip[IFLA_BRIDGE_CFM_MIP_EVENT_RAPS_NODE_ID]), 6);
+			cfm_pubsub_publish(&ev);
+		}
 	}
 
 	return 0;
@@ -159,6 +383,69 @@ static void netlink_rcv(EV_P_ ev_io *w, int revents)
 	rtnl_listen(&rth, netlink_listen, stdout);
 }
 
+static void quit_signal(EV_P_ ev_signal *w, int revents)
+{
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void stats_print(EV_P_ ev_signal *w, int revents)
+{
+	cfm_soft_rx_stats_print(stdout);
+	if (auto_rdi)
+		cfm_rdi_stats_print(stdout);
+	if (ccm_lease)
+		cfm_lease_stats_print(stdout);
+	if (erps_file)
+		cfm_erps_stats_print(stdout);
+	if (action_file)
+		cfm_action_stats_print(stdout);
+	if (pubsub_path)
+		cfm_pubsub_stats_print(stdout);
+	if (history_cfg.resolution)
+		cfm_history_stats_print(stdout);
+	if (journal_dir)
+		cfm_journal_stats_print(stdout);
+	if (avail_window)
+		cfm_avail_stats_print(stdout);
+	if (corr_window)
+		cfm_corr_stats_print(stdout);
+	if (damping)
+		cfm_damp_stats_print(stdout);
+	cfm_rt_stats_print(stdout);
+	fflush(stdout);
+}
+
+/* RTMGRP_LINK carries every link change on the system, but only AF_BRIDGE
+ * RTM_NEWLINK can hold CFM events. The rest is dropped in the kernel before
+ * it wakes the event loop. Netlink headers are in host order while BPF
+ * loads are big endian, hence the htons().
+ */
+static void netlink_filter_attach(int fd)
+{
+	struct sock_filter prog[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct nlmsghdr, nlmsg_type)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_NEWLINK), 0, 2),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, NLMSG_HDRLEN + offsetof(struct ifinfomsg, ifi_family)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AF_BRIDGE, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+	};
+	struct sock_fprog fprog = {
+		.len = sizeof(prog) / sizeof(prog[0]),
+		.filter = prog,
+	};
+
+	/* Without the filter the messages are still dropped in netlink_listen() */
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+		fprintf(stderr, "netlink SO_ATTACH_FILTER failed: %s\n", strerror(errno));
+}
+
+static void netns_scan(EV_P_ ev_timer *w, int revents)
+{
+	netns_scanned = cfm_state_now();
+	cfm_offload_netns_scan();
+}
+
 static int netlink_init(void)
 {
 	int err;
@@ -167,7 +454,11 @@ static int netlink_init(void)
 	if (err)
 		return err;
 
+	if (all_netns && rtnl_listen_all_nsid(&rth))
+		return -1;
+
 	fcntl(rth.fd, F_SETFL, O_NONBLOCK);
+	netlink_filter_attach(rth.fd);
 
 	ev_io_init(&netlink_watcher, netlink_rcv, rth.fd, EV_READ);
 	ev_io_start(EV_DEFAULT, &netlink_watcher);
@@ -181,15 +472,351 @@ static void netlink_uninit(void)
 	rtnl_close(&rth);
 }
 
-int main (void)
+static void help(void)
 {
+	printf("Usage: cfm_server [options]\n");
+	printf("options:\n");
+	printf("  -h | --help                   Show this help text\n");
+	printf("  -r | --rx <port>              Receive CFM frames in software on <port>\n");
+	printf("  -t | --rx-block-timeout <ms>  Retire partially filled RX blocks after <ms>\n");
+	printf("  -l | --rx-level <level>       Drop received frames above MD <level> in the kernel\n");
+	printf("  -w | --rx-workers <count>     Spread reception over <count> threads\n");
+	printf("  -R | --auto-rdi               Set RDI while any peer MEP is in CCM defect\n");
+	printf("  -L | --ccm-lease <ms>         Keep CCM TX running, look for started MEPs every <ms>\n");
+	printf("  -W | --ccm-lease-window <ms>  Renew leases due within <ms> together (default 500)\n");
+	printf("  -E | --erps <file>            Run G.8032 ring protection for the rings in <file>\n");
+	printf("  -A | --actions <file>         Run the netlink actions in <file> on CCM defect changes\n");
+	printf("  -c | --cpu <cpu>              Run the event thread on <cpu>\n");
+	printf("  -p | --priority <prio>        Run the event thread under SCHED_FIFO at <prio>\n");
+	printf("  -m | --mlock                  Lock and prefault all memory\n");
+	printf("  -P | --latency-probe <us>     Measure the scheduling latency every <us>\n");
+	printf("  -S | --shm                    Publish the MEP status in shared memory\n");
+	printf("  -U | --subscribe <path>       Stream events to subscribers of unix socket <path>\n");
+	printf("  -N | --all-netns              Monitor the MEPs in all named network namespaces\n");
+	printf("  -F | --state-file <file>      Save the state to <file> on exit, restart from it\n");
+	printf("  -C | --control <path>         Answer queries on unix socket <path>\n");
+	printf("  -H | --history <ms>           Keep the CCM history of every peer MEP, sampled every <ms>\n");
+	printf("                                This clears the CCM seen flags shown by cfm mep-status-show\n");
+	printf("  -M | --history-memory <MB>    Memory for the history of all peers (default 64)\n");
+	printf("  -J | --journal <dir>          Write peer MEP changes, and the history, to files in <dir>\n");
+	printf("  -j | --journal-flush <ms>     Write and sync the journal every <ms> (default 1000)\n");
+	printf("  -a | --availability <s>       Count availability, changed by <s> seconds in a row (G.826: 10)\n");
+	printf("  -G | --correlate <ms>         Raise one alarm for the CCM defects on a port within <ms>\n");
+	printf("  -D | --damp <ms>              Damp flapping peer MEPs, the penalty halves every <ms>\n");
+	printf("  -O | --damp-hold <ms>         Pass on a damped clear after <ms> without defect\n");
+}
+
+int main (int argc, char *const *argv)
+{
+	int f, i, n;
+
+	static const struct option options[] =
+	{
+		{.name = "help",		.val = 'h'},
+		{.name = "rx",			.val = 'r', .has_arg = required_argument},
+		{.name = "rx-block-timeout",	.val = 't', .has_arg = required_argument},
+		{.name = "rx-level",		.val = 'l', .has_arg = required_argument},
+		{.name = "rx-workers",		.val = 'w', .has_arg = required_argument},
+		{.name = "auto-rdi",		.val = 'R'},
+		{.name = "ccm-lease",		.val = 'L', .has_arg = required_argument},
+		{.name = "ccm-lease-window",	.val = 'W', .has_arg = required_argument},
+		{.name = "erps",		.val = 'E', .has_arg = required_argument},
+		{.name = "actions",		.val = 'A', .has_arg = required_argument},
+		{.name = "cpu",			.val = 'c', .has_arg = required_argument},
+		{.name = "priority",		.val = 'p', .has_arg = required_argument},
+		{.name = "mlock",		.val = 'm'},
+		{.name = "latency-probe",	.val = 'P', .has_arg = required_argument},
+		{.name = "shm",			.val = 'S'},
+		{.name = "subscribe",		.val = 'U', .has_arg = required_argument},
+		{.name = "all-netns",		.val = 'N'},
+		{.name = "state-file",		.val = 'F', .has_arg = required_argument},
+		{.name = "control",		.val = 'C', .has_arg = required_argument},
+		{.name = "history",		.val = 'H', .has_arg = required_argument},
+		{.name = "history-memory",	.val = 'M', .has_arg = required_argument},
+		{.name = "journal",		.val = 'J', .has_arg = required_argument},
+		{.name = "journal-flush",	.val = 'j', .has_arg = required_argument},
+		{.name = "availability",	.val = 'a', .has_arg = required_argument},
+		{.name = "correlate",		.val = 'G', .has_arg = required_argument},
+		{.name = "damp",		.val = 'D', .has_arg = required_argument},
+		{.name = "damp-hold",		.val = 'O', .has_arg = required_argument},
+		{0}
+	};
+
+	while (EOF != (f = getopt_long(argc, argv, "hr:t:l:w:RL:W:E:A:c:p:mP:SU:NF:C:H:M:J:j:a:G:D:O:", options, NULL))) {
+		switch (f) {
+		case 'h':
+			help();
+			return 0;
+		case 'r':
+			if (soft_rx_port_count == CFM_SOFT_RX_MAX_PORTS) {
+				fprintf(stderr, "Too many RX ports\n");
+				return -1;
+			}
+			soft_rx_ports[soft_rx_port_count++] = optarg;
+			break;
+		case 't':
+			soft_rx_cfg.block_timeout = atoi(optarg);
+			break;
+		case 'l':
+			n = atoi(optarg);
+			if (n < 0 || n > 7) {
+				fprintf(stderr, "Level must be 0-7\n");
+				return -1;
+			}
+			soft_rx_cfg.max_level = n;
+			break;
+		case 'w':
+			soft_rx_cfg.workers = atoi(optarg);
+			break;
+		case 'R':
+			auto_rdi = true;
+			break;
+		case 'L':
+			ccm_lease = true;
+			lease_cfg.rescan = atoi(optarg);
+			break;
+		case 'W':
+			lease_cfg.window = atoi(optarg);
+			break;
+		case 'E':
+			erps_file = optarg;
+			break;
+		case 'A':
+			action_file = optarg;
+			break;
+		case 'c':
+			rt_cfg.cpu = atoi(optarg);
+			break;
+		case 'p':
+			n = atoi(optarg);
+			if (n < 1 || n > 99) {
+				fprintf(stderr, "Priority must be 1-99\n");
+				return -1;
+			}
+			rt_cfg.priority = n;
+			break;
+		case 'm':
+			rt_cfg.lock = true;
+			break;
+		case 'P':
+			rt_cfg.probe = atoi(optarg);
+			break;
+		case 'S':
+			shm = true;
+			break;
+		case 'U':
+			pubsub_path = optarg;
+			break;
+		case 'N':
+			all_netns = true;
+			break;
+		case 'F':
+			state_file = optarg;
+			break;
+		case 'C':
+			ctl_path = optarg;
+			break;
+		case 'H':
+			n = atoi(optarg);
+			if (n < 1) {
+				fprintf(stderr, "History resolution must be at least 1 ms\n");
+				return -1;
+			}
+			history_cfg.resolution = n;
+			break;
+		case 'M':
+			history_cfg.memory = atoi(optarg);
+			break;
+		case 'J':
+			journal_dir = optarg;
+			history_cfg.journal = true;
+			break;
+		case 'j':
+			journal_flush = atoi(optarg);
+			break;
+		case 'a':
+			n = atoi(optarg);
+			if (n < 1) {
+				fprintf(stderr, "Availability window must be at least 1 s\n");
+				return -1;
+			}
+			avail_window = n;
+			break;
+		case 'G':
+			n = atoi(optarg);
+			if (n < 1) {
+				fprintf(stderr, "Correlation window must be at least 1 ms\n");
+				return -1;
+			}
+			corr_window = n;
+			break;
+		case 'D':
+			n = atoi(optarg);
+			if (n < 1) {
+				fprintf(stderr, "Damping half life must be at least 1 ms\n");
+				return -1;
+			}
+			damp_cfg.half_life = n;
+			break;
+		case 'O':
+			damp_cfg.hold = atoi(optarg);
+			break;
+		default:
+			help();
+			return -1;
+		}
+	}
+
 	if (netlink_init()) {
 		printf("netlink init failed!\n");
 		return -1;
 	}
 
+	if (cfm_offload_init()) {
+		printf("offload init failed!\n");
+		return -1;
+	}
+
+	if (all_netns) {
+		netns_scan(EV_DEFAULT, &netns_watcher, 0);
+		ev_timer_init(&netns_watcher, netns_scan, NETNS_SCAN_INTERVAL, NETNS_SCAN_INTERVAL);
+		ev_timer_start(EV_DEFAULT, &netns_watcher);
+	}
+
+	if (cfm_soft_rx_init(soft_rx_ports, soft_rx_port_count, &soft_rx_cfg)) {
+		printf("RX init failed!\n");
+		return -1;
+	}
+
+	if (ccm_lease && cfm_lease_init(&lease_cfg)) {
+		printf("CCM TX lease init failed!\n");
+		return -1;
+	}
+
+	if (shm && cfm_shm_init()) {
+		printf("Status table init failed!\n");
+		return -1;
+	}
+
+	if (pubsub_path && cfm_pubsub_init(pubsub_path)) {
+		printf("Subscriber socket init failed!\n");
+		return -1;
+	}
+
+	if (action_file && cfm_action_init(action_file)) {
+		printf("Action init failed!\n");
+		return -1;
+	}
+
+	if (erps_file && cfm_erps_init(erps_file)) {
+		printf("ERPS init failed!\n");
+		return -1;
+	}
+
+	if (journal_dir && cfm_journal_init(journal_dir, journal_flush)) {
+		printf("Journal init failed!\n");
+		return -1;
+	}
+
+	if (corr_window && cfm_corr_init(corr_window, alarm_changed)) {
+		printf("Correlation init failed!\n");
+		return -1;
+	}
+
+	state_load();
+
+	if (avail_window && cfm_avail_init(avail_window)) {
+		printf("Availability init failed!\n");
+		return -1;
+	}
+
+	if (damp_cfg.half_life) {
+		if (cfm_damp_init(&damp_cfg, damped_changed)) {
+			printf("Damping init failed!\n");
+			return -1;
+		}
+		damping = true;
+	}
+
+	if (ctl_path && cfm_ctl_init(ctl_path)) {
+		printf("Control socket init failed!\n");
+		return -1;
+	}
+
+	if (history_cfg.resolution && cfm_history_init(&history_cfg)) {
+		printf("History init failed!\n");
+		return -1;
+	}
+
+	/* Last, so only the event thread is pinned and raised */
+	if (cfm_rt_init(&rt_cfg)) {
+		printf("Real-time init failed!\n");
+		return -1;
+	}
+
+	ev_signal_init(&stats_watcher, stats_print, SIGUSR1);
+	ev_signal_start(EV_DEFAULT, &stats_watcher);
+	ev_signal_init(&quit_watcher[0], quit_signal, SIGTERM);
+	ev_signal_init(&quit_watcher[1], quit_signal, SIGINT);
+	ev_signal_init(&quit_watcher[2], quit_signal, SIGHUP);
+	for (i = 0; i < 3; ++i)
+		ev_signal_start(EV_DEFAULT, &quit_watcher[i]);
+	signal(SIGPIPE, SIG_IGN);
+
 	ev_run(EV_DEFAULT, 0);
 
+	for (i = 0; i < 3; ++i)
+		ev_signal_stop(EV_DEFAULT, &quit_watcher[i]);
+	ev_signal_stop(EV_DEFAULT, &stats_watcher);
+	if (all_netns)
+		ev_timer_stop(EV_DEFAULT, &netns_watcher);
+	cfm_rt_stats_print(stdout);
+	cfm_rt_uninit();
+	cfm_soft_rx_uninit();
+	if (ccm_lease)
+		cfm_lease_uninit();
+	if (erps_file) {
+		cfm_erps_stats_print(stdout);
+		cfm_erps_uninit();
+	}
+	if (action_file) {
+		cfm_action_stats_print(stdout);
+		cfm_action_uninit();
+	}
+	if (pubsub_path) {
+		cfm_pubsub_stats_print(stdout);
+		cfm_pubsub_uninit();
+	}
+	if (history_cfg.resolution) {
+		cfm_history_stats_print(stdout);
+		cfm_history_uninit();
+	}
+	if (journal_dir) {
+		cfm_journal_stats_print(stdout);
+		cfm_journal_uninit();
+	}
+	if (avail_window) {
+		cfm_avail_stats_print(stdout);
+		cfm_avail_uninit();
+	}
+	if (corr_window) {
+		cfm_corr_stats_print(stdout);
+		cfm_corr_uninit();
+	}
+	if (damping) {
+		cfm_damp_stats_print(stdout);
+		cfm_damp_uninit();
+	}
+	if (ctl_path)
+		cfm_ctl_uninit();
+	if (shm)
+		cfm_shm_uninit();
+	if (auto_rdi)
+		cfm_rdi_stats_print(stdout);
+	if (state_file)
+		cfm_warm_save(state_file);
+	cfm_state_uninit();
+	cfm_offload_uninit();
 	netlink_uninit();
 
 	return 0;
@@ -0,0 +1,143 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <ev.h>
+
+#include "cfm_state.h"
+#include "cfm_shm.h"
+
+/* Writer side of the status table. MEPs are published when their defect
+ * or RDI state changes. Once a second the heartbeat is updated, and MEPs
+ * whose peers were added without a transition are published too.
+ */
+
+static struct cfm_shm_header *hdr;
+static ev_timer heartbeat_watcher;
+
+static struct cfm_shm_mep *shm_slot(uint32_t idx)
+{
+	return (struct cfm_shm_mep *)(hdr + 1) + idx;
+}
+
+static void shm_header_update(bool added)
+{
+	cfm_shm_write_begin(&hdr->seq);
+	hdr->heartbeat = cfm_state_now();
+	hdr->updates++;
+	cfm_shm_write_end(&hdr->seq);
+	if (added)
+		__atomic_store_n(&hdr->mep_count, hdr->mep_count + 1, __ATOMIC_RELEASE);
+}
+
+void cfm_shm_mep_update(struct cfm_mep_state *mep, uint64_t now)
+{
+	struct cfm_shm_mep *slot;
+	uint32_t i, count;
+	bool added = false;
+
+	if (!hdr)
+		return;
+
+	if (!mep->shm_slot) {
+		if (hdr->mep_count == CFM_SHM_MEPS_MAX)
+			return;
+		mep->shm_slot = hdr->mep_count + 1;
+		added = true;
+	}
+	slot = shm_slot(mep->shm_slot - 1);
+
+	cfm_shm_write_begin(&slot->seq);
+	slot->nsid = mep->nsid;
+	slot->br_ifindex = mep->br_ifindex;
+	slot->instance = mep->instance;
+	slot->port_ifindex = mep->port_ifindex;
+	slot->level = mep->level;
+	slot->rdi = mep->rdi;
+	slot->interval_ns = mep->interval_ns;
+	slot->peer_count = mep->peer_count;
+	slot->defect_count = mep->defect_count;
+	slot->updated = now;
+	count = mep->peer_count < CFM_SHM_PEERS_MAX ? mep->peer_count : CFM_SHM_PEERS_MAX;
+	for (i = 0; i < count; ++i) {
+		slot->peers[i].mepid = mep->peers[i].mepid;
+		slot->peers[i].defect = mep->peers[i].defect;
+		slot->peers[i].defect_events = mep->peers[i].defect_events;
+		slot->peers[i].last_change = mep->peers[i].last_change;
+	}
+	cfm_shm_write_end(&slot->seq);
+
+	shm_header_update(added);
+}
+
+static void shm_mep_refresh(struct cfm_mep_state *mep, void *arg)
+{
+	if (!mep->shm_slot || shm_slot(mep->shm_slot - 1)->peer_count != mep->peer_count)
+		cfm_shm_mep_update(mep, *(uint64_t *)arg);
+}
+
+static void shm_heartbeat(EV_P_ ev_timer *w, int revents)
+{
+	uint64_t now = cfm_state_now();
+
+	cfm_state_for_each(shm_mep_refresh, &now);
+	shm_header_update(false);
+}
+
+int cfm_shm_init(void)
+{
+	struct timespec ts;
+	int fd;
+
+	fd = shm_open(CFM_SHM_NAME, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "shm_open %s failed: %s\n", CFM_SHM_NAME, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, CFM_SHM_SIZE)) {
+		fprintf(stderr, "ftruncate %s failed: %s\n", CFM_SHM_NAME, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, CFM_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %s\n", CFM_SHM_NAME, strerror(errno));
+		hdr = NULL;
+		return -1;
+	}
+
+	/* Readers still mapping the table of a previous run see it emptied */
+	__atomic_store_n(&hdr->mep_count, 0, __ATOMIC_RELEASE);
+	cfm_shm_write_begin(&hdr->seq);
+	memset(hdr + 1, 0, CFM_SHM_MEPS_MAX * sizeof(struct cfm_shm_mep));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr->magic = CFM_SHM_MAGIC;
+	hdr->version = CFM_SHM_VERSION;
+	hdr->header_size = sizeof(*hdr);
+	hdr->slot_size = sizeof(struct cfm_shm_mep);
+	hdr->meps_max = CFM_SHM_MEPS_MAX;
+	hdr->peers_max = CFM_SHM_PEERS_MAX;
+	hdr->generation = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	hdr->heartbeat = cfm_state_now();
+	hdr->updates = 0;
+	cfm_shm_write_end(&hdr->seq);
+
+	ev_timer_init(&heartbeat_watcher, shm_heartbeat, 1, 1);
+	ev_timer_start(EV_DEFAULT, &heartbeat_watcher);
+
+	return 0;
+}
+
+void cfm_shm_uninit(void)
+{
+	if (!hdr)
+		return;
+
+	ev_timer_stop(EV_DEFAULT, &heartbeat_watcher);
+	munmap(hdr, CFM_SHM_SIZE);
+	hdr = NULL;
+	shm_unlink(CFM_SHM_NAME);
+}
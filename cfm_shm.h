@@ -0,0 +1,160 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_SHM_H
+#define CFM_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* MEP and peer MEP status published by cfm_server in POSIX shared memory.
+ * The layout is fixed: a header followed by meps_max slots of slot_size
+ * bytes. Slots are only ever added, in the order the MEPs are first seen.
+ *
+ * The header and every slot are guarded by a sequence lock. The writer
+ * makes seq odd, updates, and makes it even again. A reader copies the
+ * slot and retries if seq was odd or changed, so it never sees a partly
+ * written slot and never blocks the writer. Readers only need this header.
+ */
+
+#define CFM_SHM_NAME		"/cfm_status"
+#define CFM_SHM_MAGIC		0x53464d43	/* "CFMS" */
+#define CFM_SHM_VERSION		2
+#define CFM_SHM_MEPS_MAX	1024
+#define CFM_SHM_PEERS_MAX	32		/* Peers kept per MEP, by MEPID */
+#define CFM_SHM_READ_TRIES	1000
+
+struct cfm_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t header_size;
+	uint32_t slot_size;
+	uint32_t meps_max;
+	uint32_t peers_max;
+	uint32_t mep_count;
+	uint64_t generation;	/* Changes when the server restarts */
+	uint64_t heartbeat;	/* ns, CLOCK_MONOTONIC, updated every second */
+	uint64_t updates;
+};
+
+struct cfm_shm_peer {
+	uint32_t mepid;
+	uint32_t defect;
+	uint64_t defect_events;
+	uint64_t last_change;	/* ns, CLOCK_MONOTONIC */
+};
+
+struct cfm_shm_mep {
+	uint32_t seq;
+	int32_t nsid;		/* Network namespace ID, -1 - the server's own */
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t port_ifindex;
+	uint32_t level;
+	int32_t rdi;		/* -1 - not set by the server */
+	uint32_t reserved;
+	uint64_t interval_ns;
+	uint32_t peer_count;	/* All peers, only peers_max are listed */
+	uint32_t defect_count;
+	uint64_t updated;	/* ns, CLOCK_MONOTONIC */
+	struct cfm_shm_peer peers[CFM_SHM_PEERS_MAX];
+};
+
+#define CFM_SHM_SIZE	(sizeof(struct cfm_shm_header) + \
+			 CFM_SHM_MEPS_MAX * sizeof(struct cfm_shm_mep))
+
+/* Writer, in cfm_server */
+struct cfm_mep_state;
+
+int cfm_shm_init(void);
+void cfm_shm_uninit(void);
+void cfm_shm_mep_update(struct cfm_mep_state *mep, uint64_t now);
+
+static inline void cfm_shm_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void cfm_shm_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy len bytes at src, whose sequence lock is *seq, to dst */
+static inline bool cfm_shm_read(const uint32_t *seq, void *dst, const void *src, size_t len)
+{
+	uint32_t s1, s2;
+	int i;
+
+	for (i = 0; i < CFM_SHM_READ_TRIES; ++i) {
+		s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (s1 & 1)
+			continue;
+		memcpy(dst, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+		if (s1 == s2)
+			return true;
+	}
+
+	return false;
+}
+
+/* Map the table read-only, NULL if there is none or its layout differs */
+static inline const struct cfm_shm_header *cfm_shm_map(void)
+{
+	const struct cfm_shm_header *hdr;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(CFM_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < (off_t)CFM_SHM_SIZE) {
+		close(fd);
+		return NULL;
+	}
+	hdr = mmap(NULL, CFM_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	if (hdr->magic != CFM_SHM_MAGIC || hdr->version != CFM_SHM_VERSION ||
+	    hdr->header_size != sizeof(*hdr) || hdr->slot_size != sizeof(struct cfm_shm_mep)) {
+		munmap((void *)hdr, CFM_SHM_SIZE);
+		return NULL;
+	}
+
+	return hdr;
+}
+
+static inline void cfm_shm_unmap(const struct cfm_shm_header *hdr)
+{
+	munmap((void *)hdr, CFM_SHM_SIZE);
+}
+
+static inline bool cfm_shm_header_read(const struct cfm_shm_header *hdr,
+				       struct cfm_shm_header *dst)
+{
+	return cfm_shm_read(&hdr->seq, dst, hdr, sizeof(*dst));
+}
+
+static inline bool cfm_shm_mep_read(const struct cfm_shm_header *hdr, uint32_t idx,
+				    struct cfm_shm_mep *dst)
+{
+	const struct cfm_shm_mep *slot = (const struct cfm_shm_mep *)(hdr + 1) + idx;
+
+	if (idx >= __atomic_load_n(&hdr->mep_count, __ATOMIC_ACQUIRE))
+		return false;
+
+	return cfm_shm_read(&slot->seq, dst, slot, sizeof(*dst));
+}
+
+#endif
@@ -0,0 +1,471 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <linux/if_ether.h>
+
+#include "cfm_pdu.h"
+#include "cfm_oam.h"
+#include "cfm_slm.h"
+
+/* Responder state of a test not seen for this long is dropped */
+#define CFM_SLM_RSP_AGE_NS	60000000000ULL
+#define CFM_SLM_RSP_SWEEP_NS	10000000000ULL
+
+/* Time to wait for the last SLRs after the final SLM */
+#define CFM_SLM_LINGER_NS	1000000000ULL
+
+#define CFM_SLM_PDU_LEN		(4 + CFM_SLM_TLV_OFFSET + 1)
+
+/* Sessions are identified by the MEPID of the initiator and the test ID,
+ * carried in both SLM and SLR.
+ */
+static uint64_t cfm_slm_key(uint16_t mepid, uint32_t test_id)
+{
+	return ((uint64_t)mepid << 32) | test_id;
+}
+
+struct cfm_slm_entry {
+	uint64_t key;
+	uint32_t idx;
+	uint32_t used;
+};
+
+/* Key to array index, open addressing with linear probing */
+struct cfm_slm_hash {
+	struct cfm_slm_entry *e;
+	uint32_t mask;
+	uint32_t count;
+};
+
+struct cfm_slm_session {
+	struct cfm_oam_timer timer;	/* First, the timer leads to the session */
+	struct mac_addr peer;
+	uint32_t test_id;
+	uint16_t peer_mepid;	/* Learned from the SLRs */
+
+	uint32_t tx_fcl;	/* SLMs sent */
+	uint32_t rx_fcl;	/* SLRs received */
+	uint32_t tx_fcf;	/* TxFCf and TxFCb of the newest SLR */
+	uint32_t tx_fcb;
+
+	/* Counters at the start of the current window. 'win_tx_fcf' is the last
+	 * SLM accounted for, by an SLR or as lost.
+	 */
+	uint32_t win_tx_fcf;
+	uint32_t win_tx_fcb;
+	uint32_t win_rx_fcl;
+
+	uint32_t windows;
+	uint64_t frames;	/* SLMs covered by closed windows */
+	uint64_t far_lost;
+	uint64_t near_lost;
+	double far_worst;	/* Highest loss ratio of a window */
+	double near_worst;
+};
+
+struct cfm_slm_rsp {
+	uint64_t key;
+	uint32_t rx;		/* SLMs received, sent back as TxFCb */
+	uint64_t last;
+};
+
+struct cfm_slm {
+	struct cfm_oam oam;
+	const struct cfm_slm_config *cfg;
+	uint64_t interval;	/* ns */
+	uint64_t window;	/* ns */
+
+	struct cfm_slm_session *sessions;
+	uint32_t session_count;
+	struct cfm_slm_hash session_hash;
+	uint32_t done;
+
+	/* Responder state, kept dense by moving the last entry into holes */
+	struct cfm_slm_rsp *rsp;
+	uint32_t rsp_count;
+	uint32_t rsp_capacity;
+	struct cfm_slm_hash rsp_hash;
+	uint64_t slm_answered;
+
+	struct cfm_oam_timer window_timer;
+	struct cfm_oam_timer sweep_timer;
+	struct cfm_oam_timer stop;
+};
+
+static uint32_t cfm_slm_hash_idx(uint64_t key, uint32_t mask)
+{
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static int cfm_slm_hash_init(struct cfm_slm_hash *h, uint32_t capacity)
+{
+	uint32_t size = 16;
+
+	/* Keep the load factor at or below 50% */
+	while (size < capacity * 2)
+		size <<= 1;
+
+	h->e = calloc(size, sizeof(*h->e));
+	if (!h->e)
+		return -1;
+	h->mask = size - 1;
+	h->count = 0;
+
+	return 0;
+}
+
+static struct cfm_slm_entry *cfm_slm_hash_find(const struct cfm_slm_hash *h, uint64_t key)
+{
+	uint32_t i = cfm_slm_hash_idx(key, h->mask);
+
+	while (h->e[i].used) {
+		if (h->e[i].key == key)
+			return &h->e[i];
+		i = (i + 1) & h->mask;
+	}
+
+	return NULL;
+}
+
+static int cfm_slm_hash_insert(struct cfm_slm_hash *h, uint64_t key, uint32_t idx)
+{
+	struct cfm_slm_hash old = *h;
+	uint32_t i;
+
+	if (2 * (h->count + 1) > h->mask + 1) {
+		if (cfm_slm_hash_init(h, h->mask + 1)) {
+			*h = old;
+			return -1;
+		}
+		for (i = 0; i <= old.mask; ++i) {
+			if (old.e[i].used)
+				cfm_slm_hash_insert(h, old.e[i].key, old.e[i].idx);
+		}
+		free(old.e);
+	}
+
+	i = cfm_slm_hash_idx(key, h->mask);
+	while (h->e[i].used)
+		i = (i + 1) & h->mask;
+	h->e[i].key = key;
+	h->e[i].idx = idx;
+	h->e[i].used = 1;
+	h->count++;
+
+	return 0;
+}
+
+static void cfm_slm_hash_remove(struct cfm_slm_hash *h, struct cfm_slm_entry *e)
+{
+	uint32_t i = e - h->e, next, home;
+
+	/* Backward shift deletion keeps the probe sequences intact */
+	next = (i + 1) & h->mask;
+	while (h->e[next].used) {
+		home = cfm_slm_hash_idx(h->e[next].key, h->mask);
+		if (((next - home) & h->mask) >= ((next - i) & h->mask)) {
+			h->e[i] = h->e[next];
+			i = next;
+		}
+		next = (next + 1) & h->mask;
+	}
+	h->e[i].used = 0;
+	h->count--;
+}
+
+static void cfm_slm_stop(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	oam->quit = 1;
+}
+
+static void cfm_slm_tx(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_slm_session *s = (struct cfm_slm_session *)timer;
+	struct cfm_slm *slm = (struct cfm_slm *)oam;
+	uint8_t frame[ETH_HLEN + CFM_SLM_PDU_LEN];
+	uint8_t *pdu;
+
+	memset(frame, 0, sizeof(frame));
+	pdu = cfm_oam_frame_init(oam, frame, &s->peer);
+	cfm_pdu_hdr_put(pdu, oam->mep.level, CFM_OPCODE_SLM, 0, CFM_SLM_TLV_OFFSET);
+	cfm_pdu_put_u16(pdu + CFM_SLM_SRC_MEPID_OFFSET, oam->mep.mepid);
+	cfm_pdu_put_u32(pdu + CFM_SLM_TEST_ID_OFFSET, s->test_id);
+	cfm_pdu_put_u32(pdu + CFM_SLM_TXFCF_OFFSET, s->tx_fcl + 1);
+
+	/* TxFCl counts the SLMs handed to the kernel */
+	if (cfm_oam_send(oam, frame, CFM_SLM_PDU_LEN) == 0)
+		s->tx_fcl++;
+
+	if (!slm->cfg->count || s->tx_fcl < slm->cfg->count) {
+		cfm_oam_timer_start(oam, timer, timer->expires + slm->interval);
+		return;
+	}
+
+	if (++slm->done == slm->session_count)
+		cfm_oam_timer_start(oam, &slm->stop, now + CFM_SLM_LINGER_NS);
+}
+
+static void cfm_slm_slr_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_slm *slm = arg;
+	struct cfm_slm_session *s;
+	struct cfm_slm_entry *e;
+	const uint8_t *pdu = frame->pdu;
+	uint32_t tx_fcf;
+
+	if (frame->len < CFM_SLM_TXFCB_OFFSET + 4)
+		return;
+
+	e = cfm_slm_hash_find(&slm->session_hash,
+			      cfm_slm_key(cfm_pdu_get_u16(pdu + CFM_SLM_SRC_MEPID_OFFSET),
+					  cfm_pdu_get_u32(pdu + CFM_SLM_TEST_ID_OFFSET)));
+	if (!e)
+		return;
+
+	s = &slm->sessions[e->idx];
+	s->rx_fcl++;
+	s->peer_mepid = cfm_pdu_get_u16(pdu + CFM_SLM_RSP_MEPID_OFFSET);
+
+	/* A reordered SLR must not move the counters backwards */
+	tx_fcf = cfm_pdu_get_u32(pdu + CFM_SLM_TXFCF_OFFSET);
+	if ((int32_t)(tx_fcf - s->tx_fcf) > 0) {
+		s->tx_fcf = tx_fcf;
+		s->tx_fcb = cfm_pdu_get_u32(pdu + CFM_SLM_TXFCB_OFFSET);
+	}
+}
+
+static void cfm_slm_slm_rx(struct cfm_oam *oam, const struct cfm_rx_frame *frame, void *arg)
+{
+	struct cfm_slm *slm = arg;
+	uint8_t reply[ETH_HLEN + CFM_SLM_PDU_LEN];
+	struct cfm_slm_entry *e;
+	struct cfm_slm_rsp *rsp, *r;
+	struct mac_addr peer;
+	uint64_t key;
+	uint8_t *pdu;
+
+	if (frame->len < CFM_SLM_PDU_LEN)
+		return;
+
+	key = cfm_slm_key(cfm_pdu_get_u16(frame->pdu + CFM_SLM_SRC_MEPID_OFFSET),
+			  cfm_pdu_get_u32(frame->pdu + CFM_SLM_TEST_ID_OFFSET));
+	e = cfm_slm_hash_find(&slm->rsp_hash, key);
+	if (e) {
+		r = &slm->rsp[e->idx];
+	} else {
+		if (slm->rsp_count == slm->rsp_capacity) {
+			rsp = realloc(slm->rsp, 2 * slm->rsp_capacity * sizeof(*rsp));
+			if (!rsp)
+				return;
+			slm->rsp = rsp;
+			slm->rsp_capacity *= 2;
+		}
+		if (cfm_slm_hash_insert(&slm->rsp_hash, key, slm->rsp_count))
+			return;
+		r = &slm->rsp[slm->rsp_count++];
+		r->key = key;
+		r->rx = 0;
+	}
+	r->rx++;
+	r->last = frame->ts;
+
+	memcpy(peer.addr, frame->mac + ETH_ALEN, ETH_ALEN);
+	pdu = cfm_oam_frame_init(oam, reply, &peer);
+	memcpy(pdu, frame->pdu, CFM_SLM_PDU_LEN);
+	pdu[1] = CFM_OPCODE_SLR;
+	cfm_pdu_put_u16(pdu + CFM_SLM_RSP_MEPID_OFFSET, oam->mep.mepid);
+	cfm_pdu_put_u32(pdu + CFM_SLM_TXFCB_OFFSET, r->rx);
+
+	if (cfm_oam_send(oam, reply, CFM_SLM_PDU_LEN) == 0)
+		slm->slm_answered++;
+}
+
+static void cfm_slm_rsp_sweep(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_slm *slm = (struct cfm_slm *)oam;
+	struct cfm_slm_entry *e;
+	uint32_t i = 0;
+
+	while (i < slm->rsp_count) {
+		if (slm->rsp[i].last + CFM_SLM_RSP_AGE_NS > now) {
+			i++;
+			continue;
+		}
+
+		cfm_slm_hash_remove(&slm->rsp_hash, cfm_slm_hash_find(&slm->rsp_hash, slm->rsp[i].key));
+		if (i != --slm->rsp_count) {
+			slm->rsp[i] = slm->rsp[slm->rsp_count];
+			e = cfm_slm_hash_find(&slm->rsp_hash, slm->rsp[i].key);
+			e->idx = i;
+		}
+	}
+
+	cfm_oam_timer_start(oam, timer, now + CFM_SLM_RSP_SWEEP_NS);
+}
+
+static double cfm_slm_ratio(uint64_t lost, uint64_t frames)
+{
+	return frames ? 100.0 * lost / frames : 0;
+}
+
+/* Close the current window of a session. Far-end loss is what the
+ * responder did not receive of the SLMs sent, near-end loss is what we did
+ * not receive of the SLRs the responder sent. Without a new SLR in the
+ * window, the SLMs sent since the last one accounted for are all lost.
+ */
+static void cfm_slm_window_close(struct cfm_slm_session *s)
+{
+	int64_t tx, far_rx, near_rx, far, near;
+	int32_t answered;
+
+	answered = s->tx_fcf - s->win_tx_fcf;
+	if (s->rx_fcl != s->win_rx_fcl && answered > 0) {
+		tx = answered;
+		far_rx = (uint32_t)(s->tx_fcb - s->win_tx_fcb);
+		near_rx = (uint32_t)(s->rx_fcl - s->win_rx_fcl);
+		s->win_tx_fcf = s->tx_fcf;
+	} else {
+		tx = (uint32_t)(s->tx_fcl - s->win_tx_fcf);
+		far_rx = 0;
+		near_rx = 0;
+		s->win_tx_fcf = s->tx_fcl;
+	}
+	s->win_tx_fcb = s->tx_fcb;
+	s->win_rx_fcl = s->rx_fcl;
+	if (!tx)
+		return;
+
+	/* SLMs that got through while all SLRs were lost are already counted */
+	if (far_rx > tx)
+		far_rx = tx;
+	far = tx - far_rx;
+	near = far_rx > near_rx ? far_rx - near_rx : 0;
+
+	s->windows++;
+	s->frames += tx;
+	s->far_lost += far;
+	s->near_lost += near;
+	if (cfm_slm_ratio(far, tx) > s->far_worst)
+		s->far_worst = cfm_slm_ratio(far, tx);
+	if (far_rx && cfm_slm_ratio(near, far_rx) > s->near_worst)
+		s->near_worst = cfm_slm_ratio(near, far_rx);
+}
+
+static void cfm_slm_window(struct cfm_oam *oam, struct cfm_oam_timer *timer, uint64_t now)
+{
+	struct cfm_slm *slm = (struct cfm_slm *)oam;
+	uint32_t i;
+
+	for (i = 0; i < slm->session_count; ++i)
+		cfm_slm_window_close(&slm->sessions[i]);
+
+	cfm_oam_timer_start(oam, timer, timer->expires + slm->window);
+}
+
+static void cfm_slm_report(struct cfm_slm *slm)
+{
+	struct cfm_slm_session *s;
+	uint32_t i;
+
+	for (i = 0; i < slm->session_count; ++i) {
+		s = &slm->sessions[i];
+		cfm_slm_window_close(s);
+
+		printf("Test ID %u peer %02X-%02X-%02X-%02X-%02X-%02X mepid %u\n", s->test_id,
+		       s->peer.addr[0], s->peer.addr[1], s->peer.addr[2],
+		       s->peer.addr[3], s->peer.addr[4], s->peer.addr[5], s->peer_mepid);
+		printf("    Sent %u\n", s->tx_fcl);
+		printf("    Received %u\n", s->rx_fcl);
+		printf("    Windows %u\n", s->windows);
+		printf("    Far-end loss %" PRIu64 " (%.3f%%, worst window %.3f%%)\n",
+		       s->far_lost, cfm_slm_ratio(s->far_lost, s->frames), s->far_worst);
+		printf("    Near-end loss %" PRIu64 " (%.3f%%, worst window %.3f%%)\n",
+		       s->near_lost, cfm_slm_ratio(s->near_lost, s->frames - s->far_lost),
+		       s->near_worst);
+	}
+
+	if (slm->cfg->responder)
+		printf("SLM answered %" PRIu64 " (%u tests)\n", slm->slm_answered, slm->rsp_count);
+	if (slm->oam.tx_errors)
+		printf("TX errors %" PRIu64 "\n", slm->oam.tx_errors);
+}
+
+int cfm_slm_run(const struct cfm_slm_config *cfg)
+{
+	const uint8_t opcodes[] = { CFM_OPCODE_SLM, CFM_OPCODE_SLR };
+	struct cfm_slm_session *s;
+	struct cfm_slm *slm;
+	uint64_t now;
+	uint32_t i;
+	int err = -1;
+
+	if (!cfg->dmac_count && !cfg->responder) {
+		fprintf(stderr, "No destination and not a responder\n");
+		return -1;
+	}
+
+	slm = calloc(1, sizeof(*slm));
+	if (!slm)
+		return -1;
+	slm->oam.tx_fd = -1;
+	slm->oam.rx.fd = -1;
+	slm->cfg = cfg;
+	slm->interval = (uint64_t)(cfg->interval ? cfg->interval : 100) * 1000000ULL;
+	slm->window = (uint64_t)(cfg->window ? cfg->window : 1000) * 1000000ULL;
+
+	slm->rsp_capacity = 64;
+	slm->rsp = calloc(slm->rsp_capacity, sizeof(*slm->rsp));
+	slm->sessions = calloc(cfg->dmac_count ? cfg->dmac_count : 1, sizeof(*slm->sessions));
+	if (!slm->rsp || !slm->sessions ||
+	    cfm_slm_hash_init(&slm->session_hash, cfg->dmac_count) ||
+	    cfm_slm_hash_init(&slm->rsp_hash, slm->rsp_capacity))
+		goto out;
+
+	if (cfm_oam_open(&slm->oam, cfg->br_ifindex, cfg->instance, opcodes, sizeof(opcodes)))
+		goto out;
+
+	cfm_oam_handler_set(&slm->oam, CFM_OPCODE_SLR, cfm_slm_slr_rx, NULL, slm);
+	if (cfg->responder)
+		cfm_oam_handler_set(&slm->oam, CFM_OPCODE_SLM, cfm_slm_slm_rx, NULL, slm);
+
+	slm->stop.fn = cfm_slm_stop;
+	slm->window_timer.fn = cfm_slm_window;
+	slm->sweep_timer.fn = cfm_slm_rsp_sweep;
+
+	/* Spread the sessions over the interval so they don't send in bursts */
+	now = cfm_oam_now();
+	for (i = 0; i < cfg->dmac_count; ++i) {
+		s = &slm->sessions[slm->session_count];
+		s->peer = cfg->dmacs[i];
+		s->test_id = cfg->test_id + i;
+		s->timer.fn = cfm_slm_tx;
+		if (cfm_slm_hash_insert(&slm->session_hash,
+					cfm_slm_key(slm->oam.mep.mepid, s->test_id),
+					slm->session_count))
+			goto out;
+		cfm_oam_timer_start(&slm->oam, &s->timer, now + slm->interval * i / cfg->dmac_count);
+		slm->session_count++;
+	}
+
+	if (slm->session_count)
+		cfm_oam_timer_start(&slm->oam, &slm->window_timer, now + slm->window);
+	if (cfg->responder)
+		cfm_oam_timer_start(&slm->oam, &slm->sweep_timer, now + CFM_SLM_RSP_SWEEP_NS);
+
+	err = cfm_oam_run(&slm->oam);
+	cfm_slm_report(slm);
+
+out:
+	cfm_oam_close(&slm->oam);
+	free(slm->session_hash.e);
+	free(slm->rsp_hash.e);
+	free(slm->sessions);
+	free(slm->rsp);
+	free(slm);
+
+	return err;
+}
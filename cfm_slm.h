@@ -0,0 +1,26 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_SLM_H
+#define CFM_SLM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cfm_netlink.h"
+
+struct cfm_slm_config {
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t test_id;	/* Test ID of the first session, one up per session */
+	uint32_t interval;	/* ms between SLMs of a session */
+	uint32_t window;	/* ms of a loss measurement window */
+	uint32_t count;		/* SLMs per session, 0 - until interrupted */
+	bool responder;		/* Answer SLMs with SLRs */
+	uint32_t dmac_count;	/* One session per destination */
+	struct mac_addr *dmacs;
+};
+
+int cfm_slm_run(const struct cfm_slm_config *cfg);
+
+#endif
@@ -0,0 +1,666 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <net/if.h>
+#include <ev.h>
+
+#include "cfm_netlink.h"
+#include "cfm_pdu.h"
+#include "cfm_peer.h"
+#include "cfm_rx.h"
+#include "cfm_soft_rx.h"
+
+/* Upper bound of the delay between a LOC deadline and its detection */
+#define SOFT_RX_SWEEP_MS	10
+
+/* Configuration changes are read back from the kernel this long after the
+ * last notification, so a burst of changes costs one dump
+ */
+#define SOFT_RX_REFRESH_MS	100
+
+/* The MEPs configured on a port. A new set replaces the old one as a whole
+ * when the configuration changes, so a worker never sees half of it. The
+ * old set is freed once every worker has started a round in a later epoch.
+ */
+struct soft_rx_meps {
+	struct cfm_ccm_expect expect[CFM_SOFT_RX_PORT_MEPS];
+	uint32_t count;
+	uint32_t br_ifindex;
+	uint32_t instance[CFM_SOFT_RX_PORT_MEPS];
+	uint8_t level[CFM_SOFT_RX_PORT_MEPS];
+	/* Not part of the configuration */
+	uint64_t retire_epoch;
+	struct soft_rx_meps *retired_next;
+};
+
+/* Counters of one port as seen by one worker */
+struct soft_rx_counters {
+	uint64_t ccm_frames;
+	uint64_t raps_frames;
+	uint64_t seq_unexp;
+	uint64_t tlv_change;
+	uint64_t loc_events;
+	uint64_t rdi_events;
+	uint64_t peers;		/* Current number of peers */
+	uint64_t loc_peers;	/* Current number of peers in LOC */
+	uint64_t ccm_verdict[CFM_CCM_VERDICT_MAX];
+};
+
+/* The shard of a port owned by one worker. Only the worker thread touches
+ * it, so no locking is needed while frames are processed.
+ */
+struct soft_rx_port {
+	struct cfm_rx rx;
+	struct soft_rx_counters cnt;
+	struct cfm_peer_table peers;
+	struct soft_rx_meps **meps;	/* Points to NULL - learn any peer */
+};
+
+/* Copy published by the worker for the stats reader */
+struct soft_rx_pub {
+	struct cfm_rx_stats rx;
+	struct soft_rx_counters cnt;
+};
+
+struct soft_rx_worker {
+	pthread_t thread;
+	int id;
+	bool started;
+	struct soft_rx_port *ports;
+	struct soft_rx_pub *pub;
+	uint64_t epoch;		/* Last epoch the worker started a round in */
+};
+
+static struct soft_rx_worker *workers;
+static int worker_count;
+static char (*port_names)[IF_NAMESIZE];
+static uint32_t *port_ifindex;
+static struct soft_rx_meps **port_meps;
+static int port_count;
+static volatile int soft_rx_quit;
+static uint64_t soft_rx_epoch;
+static ev_timer refresh_watcher;
+static ev_timer reclaim_watcher;
+static struct soft_rx_meps *retired;	/* Replaced sets not yet freed */
+static uint64_t refreshes;
+
+static uint64_t soft_rx_now(void)
+{
+	struct timespec ts;
+
+	/* Same clock as the ring timestamps */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Peers are learned from the received CCMs. A peer is identified by the
+ * MEPID within its VLAN and MD level.
+ */
+static void soft_rx_ccm(struct soft_rx_port *port, const struct cfm_rx_frame *frame)
+{
+	struct cfm_peer_table *t = &port->peers;
+	const uint8_t *pdu = frame->pdu;
+	uint8_t port_tlv, if_tlv, rdi;
+	uint64_t period;
+	uint32_t seq;
+	int slot;
+
+	slot = cfm_peer_add(t, cfm_peer_key(((frame->vlan_tci & 0xFFF) << 3) | cfm_pdu_level(pdu),
+					    cfm_ccm_mepid(pdu)));
+	if (slot < 0)
+		return;
+
+	seq = cfm_ccm_seq(pdu);
+	if (t->ccm_seen[slot] && seq != t->last_seq[slot] + 1) {
+		t->seq_unexp[slot]++;
+		port->cnt.seq_unexp++;
+	}
+	t->last_seq[slot] = seq;
+	t->ccm_seen[slot]++;
+
+	/* LOC is raised and cleared by the sweep, only the deadline moves here */
+	period = cfm_ccm_interval_ns(cfm_ccm_interval(pdu));
+	t->deadline[slot] = period ? frame->ts + period * 7 / 2 : 0;
+
+	rdi = cfm_ccm_rdi(pdu) ? CFM_PEER_DEFECT_RDI : 0;
+	if ((t->defects[slot] & CFM_PEER_DEFECT_RDI) != rdi) {
+		t->defects[slot] ^= CFM_PEER_DEFECT_RDI;
+		port->cnt.rdi_events++;
+	}
+
+	port_tlv = t->port_tlv[slot];
+	if_tlv = t->if_tlv[slot];
+	cfm_ccm_status_tlvs(pdu, frame->len, &port_tlv, &if_tlv);
+	if (port_tlv != t->port_tlv[slot] || if_tlv != t->if_tlv[slot]) {
+		t->port_tlv[slot] = port_tlv;
+		t->if_tlv[slot] = if_tlv;
+		t->tlv_change[slot]++;
+		port->cnt.tlv_change++;
+	}
+}
+
+/* Each CCM is validated against the MEP at its MD level. MEPs sharing a
+ * level are rare, the ones after the first only see the frames the first
+ * one rejected for their MAID or MEPID.
+ */
+static void soft_rx_validate(const struct soft_rx_meps *meps, const struct cfm_rx_frame *ccm,
+			     unsigned int n, uint8_t *verdict)
+{
+	struct cfm_rx_frame group[CFM_RX_BATCH];
+	uint8_t idx[CFM_RX_BATCH], v[CFM_RX_BATCH], other;
+	uint32_t m, k, done = 0;
+	unsigned int i, g;
+
+	memset(verdict, CFM_CCM_ERR_LEVEL, n);
+	for (m = 0; m < meps->count; ++m) {
+		if (done & (1U << meps->level[m]))
+			continue;
+		done |= 1U << meps->level[m];
+
+		for (i = 0, g = 0; i < n; ++i) {
+			if (cfm_pdu_level(ccm[i].pdu) != meps->level[m])
+				continue;
+			group[g] = ccm[i];
+			idx[g++] = i;
+		}
+		if (!g)
+			continue;
+
+		cfm_ccm_validate(&meps->expect[m], group, g, v);
+		for (i = 0; i < g; ++i) {
+			for (k = m + 1; k < meps->count &&
+			     (v[i] == CFM_CCM_ERR_MAID || v[i] == CFM_CCM_ERR_MEPID); ++k) {
+				if (meps->level[k] != meps->level[m])
+					continue;
+				cfm_ccm_validate(&meps->expect[k], &group[i], 1, &other);
+				if (other == CFM_CCM_OK)
+					v[i] = other;
+			}
+			verdict[idx[i]] = v[i];
+		}
+	}
+}
+
+static void soft_rx_handler(const struct cfm_rx_frame *frames, unsigned int count,
+			    void *arg)
+{
+	struct soft_rx_port *port = arg;
+	struct cfm_rx_frame ccm[CFM_RX_BATCH];
+	uint8_t verdict[CFM_RX_BATCH];
+	const struct soft_rx_meps *meps;
+	unsigned int i, n = 0;
+	const uint8_t *pdu;
+
+	for (i = 0; i < count; ++i) {
+		pdu = frames[i].pdu;
+		if (cfm_pdu_opcode(pdu) == BR_CFM_OPCODE_RAPS)
+			port->cnt.raps_frames++;
+		else if (cfm_pdu_opcode(pdu) == BR_CFM_OPCODE_CCM)
+			ccm[n++] = frames[i];
+	}
+
+	if (!n)
+		return;
+	port->cnt.ccm_frames += n;
+
+	/* The CCMs of a batch are validated in one go against the local MEPs */
+	meps = __atomic_load_n(port->meps, __ATOMIC_ACQUIRE);
+	if (meps && meps->count == 1) {
+		cfm_ccm_validate(&meps->expect[0], ccm, n, verdict);
+	} else if (meps) {
+		soft_rx_validate(meps, ccm, n, verdict);
+	} else {
+		for (i = 0; i < n; ++i)
+			verdict[i] = ccm[i].len < CFM_CCM_PDU_TLV_OFFSET ? CFM_CCM_ERR_SHORT : CFM_CCM_OK;
+	}
+
+	for (i = 0; i < n; ++i) {
+		port->cnt.ccm_verdict[verdict[i]]++;
+		if (verdict[i] == CFM_CCM_OK)
+			soft_rx_ccm(port, &ccm[i]);
+	}
+}
+
+static void soft_rx_loc_change(struct cfm_peer_table *t, uint32_t slot,
+			       uint8_t old_defects, void *arg)
+{
+	struct soft_rx_port *port = arg;
+
+	if (t->defects[slot] & CFM_PEER_DEFECT_LOC) {
+		port->cnt.loc_events++;
+		port->cnt.loc_peers++;
+	} else {
+		port->cnt.loc_peers--;
+	}
+}
+
+/* Counters are published one 64 bit word at a time, so a reader never sees
+ * a torn value, only a mix of old and new counters.
+ */
+static void soft_rx_publish(uint64_t *dst, const uint64_t *src, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size / sizeof(uint64_t); ++i)
+		__atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+}
+
+static void soft_rx_collect(uint64_t *dst, const uint64_t *src, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size / sizeof(uint64_t); ++i)
+		dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+static void *soft_rx_worker_run(void *arg)
+{
+	struct soft_rx_worker *w = arg;
+	struct soft_rx_port *port;
+	struct cfm_rx_stats stats;
+	struct pollfd *fds;
+	uint64_t now;
+	int i, n;
+
+	fds = calloc(port_count, sizeof(*fds));
+	if (!fds)
+		return NULL;
+
+	for (i = 0; i < port_count; ++i) {
+		fds[i].fd = w->ports[i].rx.fd;
+		fds[i].events = POLLIN | POLLERR;
+	}
+
+	while (!__atomic_load_n(&soft_rx_quit, __ATOMIC_RELAXED)) {
+		/* No MEP set from an earlier epoch is held past this point */
+		__atomic_store_n(&w->epoch, __atomic_load_n(&soft_rx_epoch, __ATOMIC_ACQUIRE),
+				 __ATOMIC_RELEASE);
+
+		n = poll(fds, port_count, SOFT_RX_SWEEP_MS);
+		if (n < 0)
+			continue;
+
+		now = soft_rx_now();
+		for (i = 0; i < port_count; ++i) {
+			port = &w->ports[i];
+			if (!n || fds[i].revents)
+				cfm_rx_process(&port->rx, soft_rx_handler, port);
+
+			cfm_peer_sweep(&port->peers, now, soft_rx_loc_change, port);
+			port->cnt.peers = port->peers.count;
+
+			cfm_rx_stats_get(&port->rx, &stats);
+			soft_rx_publish((uint64_t *)&w->pub[i].rx, (uint64_t *)&stats,
+					sizeof(stats));
+			soft_rx_publish((uint64_t *)&w->pub[i].cnt, (uint64_t *)&port->cnt,
+					sizeof(port->cnt));
+		}
+	}
+
+	free(fds);
+	return NULL;
+}
+
+static int soft_rx_worker_start(struct soft_rx_worker *w)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+	int err;
+
+	err = pthread_create(&w->thread, NULL, soft_rx_worker_run, w);
+	if (err) {
+		fprintf(stderr, "RX worker %d: pthread_create failed: %s\n", w->id, strerror(err));
+		return -1;
+	}
+	w->started = true;
+
+	/* Spread the workers over the CPUs so the shards scale with cores */
+	if (worker_count > 1 && cpus > 1) {
+		CPU_ZERO(&set);
+		CPU_SET(w->id % cpus, &set);
+		pthread_setaffinity_np(w->thread, sizeof(set), &set);
+	}
+
+	return 0;
+}
+
+/* Read the MEPs on port 'p' back from the kernel, NULL if there are none */
+static int soft_rx_meps_load(int p, struct soft_rx_meps **meps)
+{
+	struct cfm_mep_info info[CFM_SOFT_RX_PORT_MEPS];
+	struct soft_rx_meps *set;
+	uint32_t mepid;
+	int count, m;
+
+	*meps = NULL;
+	count = cfm_offload_mep_info_get(port_ifindex[p], info, CFM_SOFT_RX_PORT_MEPS);
+	if (count <= 0)
+		return count;
+
+	set = aligned_alloc(__alignof__(*set), sizeof(*set));
+	if (!set)
+		return -1;
+	memset(set, 0, sizeof(*set));
+
+	set->count = count;
+	set->br_ifindex = info[0].br_ifindex;
+	for (m = 0; m < count; ++m) {
+		set->instance[m] = info[m].instance;
+		set->level[m] = info[m].level & 0x07;
+		cfm_ccm_expect_init(&set->expect[m], info[m].level, info[m].interval,
+				    info[m].maid.data);
+		for (mepid = 0; mepid <= CFM_MEPID_MAX; ++mepid) {
+			if (info[m].peers[mepid / 64] & (1ULL << (mepid % 64)))
+				cfm_ccm_expect_peer(&set->expect[m], mepid);
+		}
+	}
+	*meps = set;
+
+	return 0;
+}
+
+static void soft_rx_retired_free(uint64_t epoch)
+{
+	struct soft_rx_meps **pp = &retired, *set;
+
+	while ((set = *pp)) {
+		if (set->retire_epoch > epoch) {
+			pp = &set->retired_next;
+			continue;
+		}
+		*pp = set->retired_next;
+		free(set);
+	}
+}
+
+/* Free the replaced MEP sets no worker can still use. Every worker starts a
+ * round at least every SOFT_RX_SWEEP_MS, so this runs at that period until
+ * all are freed.
+ */
+static void soft_rx_reclaim(EV_P_ ev_timer *w, int revents)
+{
+	uint64_t epoch = UINT64_MAX, e;
+	int i;
+
+	for (i = 0; i < worker_count; ++i) {
+		if (!workers[i].started)
+			continue;
+		e = __atomic_load_n(&workers[i].epoch, __ATOMIC_ACQUIRE);
+		if (e < epoch)
+			epoch = e;
+	}
+
+	soft_rx_retired_free(epoch);
+	if (!retired)
+		ev_timer_stop(EV_A_ w);
+}
+
+static void soft_rx_refresh(EV_P_ ev_timer *w, int revents)
+{
+	struct soft_rx_meps *old, *set;
+	uint64_t epoch = 0;
+	int p;
+
+	refreshes++;
+	for (p = 0; p < port_count; ++p) {
+		if (soft_rx_meps_load(p, &set))
+			continue;
+		if (set && port_meps[p] &&
+		    !memcmp(set, port_meps[p], offsetof(struct soft_rx_meps, retire_epoch))) {
+			free(set);
+			continue;
+		}
+		old = __atomic_exchange_n(&port_meps[p], set, __ATOMIC_ACQ_REL);
+		if (!old)
+			continue;
+
+		/* Workers that start a round in this epoch no longer see 'old' */
+		if (!epoch)
+			epoch = __atomic_add_fetch(&soft_rx_epoch, 1, __ATOMIC_ACQ_REL);
+		old->retire_epoch = epoch;
+		old->retired_next = retired;
+		retired = old;
+	}
+
+	if (retired && !ev_is_active(&reclaim_watcher))
+		ev_timer_start(EV_A_ &reclaim_watcher);
+}
+
+static void soft_rx_refresh_schedule(void)
+{
+	if (!ev_is_active(&refresh_watcher))
+		ev_timer_start(EV_DEFAULT, &refresh_watcher);
+}
+
+/* A bridge notification other than CFM status, in our own namespace. It
+ * may be a MEP configuration change on one of the ports.
+ */
+void cfm_soft_rx_link_event(uint32_t ifindex, uint32_t br_ifindex)
+{
+	int p;
+
+	for (p = 0; workers && p < port_count; ++p) {
+		if (ifindex == port_ifindex[p] || !port_meps[p] ||
+		    port_meps[p]->br_ifindex == br_ifindex) {
+			soft_rx_refresh_schedule();
+			return;
+		}
+	}
+}
+
+/* A CC peer event in our own namespace. A peer or a MEP not known on a
+ * port of the bridge means the configuration changed.
+ */
+void cfm_soft_rx_peer_event(uint32_t br_ifindex, uint32_t instance, uint32_t mepid)
+{
+	const struct soft_rx_meps *meps;
+	bool known = false;
+	uint32_t m;
+	int p;
+
+	mepid &= 0x1FFF;
+	for (p = 0; workers && p < port_count; ++p) {
+		meps = port_meps[p];
+		if (!meps || meps->br_ifindex != br_ifindex)
+			continue;
+		for (m = 0; m < meps->count; ++m) {
+			if (meps->instance[m] != instance)
+				continue;
+			if (!(meps->expect[m].peers[mepid / 64] & (1ULL << (mepid % 64))))
+				soft_rx_refresh_schedule();
+			return;
+		}
+		known = true;
+	}
+
+	/* The instance may live on a port that is not ours */
+	if (known)
+		soft_rx_refresh_schedule();
+}
+
+int cfm_soft_rx_init(const char *const *ports, int count, const struct cfm_soft_rx_config *cfg)
+{
+	struct cfm_rx_config rx_cfg;
+	struct soft_rx_worker *w;
+	uint32_t ifindex;
+	int i, p;
+
+	if (count == 0)
+		return 0;
+
+	if (count > CFM_SOFT_RX_MAX_PORTS) {
+		fprintf(stderr, "Too many RX ports\n");
+		return -1;
+	}
+
+	port_count = count;
+	worker_count = cfg->workers > 0 ? cfg->workers : 1;
+
+	port_names = calloc(port_count, sizeof(*port_names));
+	workers = calloc(worker_count, sizeof(*workers));
+	port_ifindex = calloc(port_count, sizeof(*port_ifindex));
+	port_meps = calloc(port_count, sizeof(*port_meps));
+	if (!port_names || !workers || !port_ifindex || !port_meps)
+		goto err;
+
+	for (i = 0; i < worker_count; ++i) {
+		workers[i].id = i;
+		workers[i].ports = calloc(port_count, sizeof(struct soft_rx_port));
+		workers[i].pub = calloc(port_count, sizeof(struct soft_rx_pub));
+		if (!workers[i].ports || !workers[i].pub)
+			goto err;
+		for (p = 0; p < port_count; ++p) {
+			workers[i].ports[p].rx.fd = -1;
+			workers[i].ports[p].meps = &port_meps[p];
+			if (cfm_peer_table_init(&workers[i].ports[p].peers, 0))
+				goto err;
+		}
+	}
+
+	for (p = 0; p < port_count; ++p) {
+		ifindex = if_nametoindex(ports[p]);
+		if (ifindex == 0) {
+			fprintf(stderr, "Unknown port %s\n", ports[p]);
+			goto err;
+		}
+		snprintf(port_names[p], IF_NAMESIZE, "%s", ports[p]);
+		port_ifindex[p] = ifindex;
+
+		/* CCMs are validated against the MEPs on the port, if there are any */
+		if (soft_rx_meps_load(p, &port_meps[p]))
+			fprintf(stderr, "Cannot read the MEPs on port %s\n", ports[p]);
+
+		cfm_rx_config_default(&rx_cfg, ifindex);
+		if (cfg->block_timeout)
+			rx_cfg.block_timeout = cfg->block_timeout;
+
+		/* Only the opcodes handled by soft_rx_handler() reach userspace */
+		rx_cfg.max_level = cfg->max_level;
+		rx_cfg.opcodes[rx_cfg.opcode_count++] = BR_CFM_OPCODE_CCM;
+		rx_cfg.opcodes[rx_cfg.opcode_count++] = BR_CFM_OPCODE_RAPS;
+
+		/* One fanout group per port with a socket per worker */
+		if (worker_count > 1)
+			rx_cfg.fanout_id = 1 + (getpid() * CFM_SOFT_RX_MAX_PORTS + p) % 0xFFFE;
+
+		for (i = 0; i < worker_count; ++i) {
+			if (cfm_rx_open(&workers[i].ports[p].rx, &rx_cfg))
+				goto err;
+		}
+	}
+
+	for (i = 0; i < worker_count; ++i) {
+		w = &workers[i];
+		if (soft_rx_worker_start(w))
+			goto err;
+	}
+
+	ev_timer_init(&refresh_watcher, soft_rx_refresh, SOFT_RX_REFRESH_MS / 1000.0, 0);
+	ev_timer_init(&reclaim_watcher, soft_rx_reclaim, SOFT_RX_SWEEP_MS / 1000.0,
+		      SOFT_RX_SWEEP_MS / 1000.0);
+
+	return 0;
+
+err:
+	cfm_soft_rx_uninit();
+	return -1;
+}
+
+void cfm_soft_rx_uninit(void)
+{
+	int i, p;
+
+	if (!workers)
+		return;
+
+	__atomic_store_n(&soft_rx_quit, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < worker_count; ++i) {
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < worker_count; ++i) {
+		for (p = 0; workers[i].ports && p < port_count; ++p) {
+			cfm_rx_close(&workers[i].ports[p].rx);
+			cfm_peer_table_free(&workers[i].ports[p].peers);
+		}
+		free(workers[i].ports);
+		free(workers[i].pub);
+	}
+
+	ev_timer_stop(EV_DEFAULT, &refresh_watcher);
+	ev_timer_stop(EV_DEFAULT, &reclaim_watcher);
+	soft_rx_retired_free(UINT64_MAX);
+	for (p = 0; port_meps && p < port_count; ++p)
+		free(port_meps[p]);
+
+	free(workers);
+	free(port_names);
+	free(port_ifindex);
+	free(port_meps);
+	workers = NULL;
+	port_names = NULL;
+	port_ifindex = NULL;
+	port_meps = NULL;
+}
+
+void cfm_soft_rx_stats_print(FILE *fp)
+{
+	struct soft_rx_pub total;
+	uint64_t max_block_ns, max;
+	int i, p;
+
+	for (p = 0; workers && p < port_count; ++p) {
+		memset(&total, 0, sizeof(total));
+		max = 0;
+		for (i = 0; i < worker_count; ++i) {
+			soft_rx_collect((uint64_t *)&total.rx, (uint64_t *)&workers[i].pub[p].rx,
+					sizeof(total.rx));
+			soft_rx_collect((uint64_t *)&total.cnt, (uint64_t *)&workers[i].pub[p].cnt,
+					sizeof(total.cnt));
+			max_block_ns = __atomic_load_n(&workers[i].pub[p].rx.max_block_ns, __ATOMIC_RELAXED);
+			if (max_block_ns > max)
+				max = max_block_ns;
+		}
+		total.rx.max_block_ns = max;
+
+		cfm_rx_stats_print(fp, port_names[p], &total.rx);
+		fprintf(fp, "    CCM frames %" PRIu64 "\n", total.cnt.ccm_frames);
+		if (port_meps[p])
+			fprintf(fp, "    CCM validation %s, %u MEPs\n", cfm_ccm_validate_impl(),
+				port_meps[p]->count);
+		else
+			fprintf(fp, "    CCM validation off (no MEP)\n");
+		for (i = CFM_CCM_OK + 1; i < CFM_CCM_VERDICT_MAX; ++i) {
+			if (total.cnt.ccm_verdict[i])
+				fprintf(fp, "    CCM invalid %s %" PRIu64 "\n",
+					cfm_ccm_verdict_str(i), total.cnt.ccm_verdict[i]);
+		}
+		fprintf(fp, "    Seq unexp %" PRIu64 "\n", total.cnt.seq_unexp);
+		fprintf(fp, "    Tlv change %" PRIu64 "\n", total.cnt.tlv_change);
+		fprintf(fp, "    Peers %" PRIu64 " (loc %" PRIu64 ")\n", total.cnt.peers, total.cnt.loc_peers);
+		fprintf(fp, "    LOC events %" PRIu64 "\n", total.cnt.loc_events);
+		fprintf(fp, "    RDI events %" PRIu64 "\n", total.cnt.rdi_events);
+		fprintf(fp, "    RAPS frames %" PRIu64 "\n", total.cnt.raps_frames);
+		for (i = 0; worker_count > 1 && i < worker_count; ++i)
+			fprintf(fp, "    Worker %d frames %" PRIu64 "\n", i,
+				__atomic_load_n(&workers[i].pub[p].rx.frames, __ATOMIC_RELAXED));
+		fprintf(fp, "\n");
+	}
+
+	if (workers)
+		fprintf(fp, "RX MEP refreshes %" PRIu64 "\n\n", refreshes);
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_SOFT_RX_H
+#define CFM_SOFT_RX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CFM_SOFT_RX_MAX_PORTS	64
+#define CFM_SOFT_RX_PORT_MEPS	8	/* MEPs validated against per port */
+
+struct cfm_soft_rx_config {
+	uint32_t block_timeout;	/* ms, 0 - ring default */
+	uint8_t max_level;
+	int workers;
+};
+
+int cfm_soft_rx_init(const char *const *ports, int count, const struct cfm_soft_rx_config *cfg);
+void cfm_soft_rx_uninit(void);
+void cfm_soft_rx_link_event(uint32_t ifindex, uint32_t br_ifindex);
+void cfm_soft_rx_peer_event(uint32_t br_ifindex, uint32_t instance, uint32_t mepid);
+void cfm_soft_rx_stats_print(FILE *fp);
+
+#endif
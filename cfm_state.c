@@ -0,0 +1,314 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cfm_pdu.h"
+#include "cfm_state.h"
+
+/* MEPs by (namespace, bridge, instance), open addressing with linear
+ * probing. MEPs are never removed, the kernel does not notify MEP deletion.
+ */
+static struct cfm_mep_state **meps;
+static uint32_t mep_mask;
+static uint32_t mep_count;
+
+uint64_t cfm_state_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t cfm_state_hash(int nsid, uint32_t br_ifindex, uint32_t instance)
+{
+	uint64_t key = ((uint64_t)br_ifindex << 32) | instance;
+
+	key = (key ^ (uint32_t)nsid) * 0x9E3779B97F4A7C15ULL;
+	return key >> 32;
+}
+
+static int cfm_state_grow(void)
+{
+	struct cfm_mep_state **old = meps;
+	uint32_t old_size = old ? mep_mask + 1 : 0;
+	uint32_t size = old_size ? old_size * 2 : 64;
+	uint32_t i, h;
+
+	meps = calloc(size, sizeof(*meps));
+	if (!meps) {
+		meps = old;
+		return -1;
+	}
+	mep_mask = size - 1;
+
+	for (i = 0; i < old_size; ++i) {
+		if (!old[i])
+			continue;
+		h = cfm_state_hash(old[i]->nsid, old[i]->br_ifindex, old[i]->instance) & mep_mask;
+		while (meps[h])
+			h = (h + 1) & mep_mask;
+		meps[h] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+void cfm_state_mep_info_load(struct cfm_mep_state *mep)
+{
+	struct cfm_mep_info info;
+	int err;
+
+	if (cfm_offload_netns_select(mep->nsid))
+		return;
+	err = cfm_offload_mep_info_instance_get(mep->br_ifindex, mep->instance, &info);
+	cfm_offload_netns_select(-1);
+	if (err)
+		return;
+
+	mep->info_valid = true;
+	mep->port_ifindex = info.port_ifindex;
+	mep->level = info.level;
+	mep->interval_ns = cfm_ccm_interval_ns(info.interval);
+}
+
+struct cfm_mep_state *cfm_state_mep_find(int nsid, uint32_t br_ifindex, uint32_t instance)
+{
+	uint32_t h;
+
+	if (!meps)
+		return NULL;
+
+	h = cfm_state_hash(nsid, br_ifindex, instance) & mep_mask;
+	for (; meps[h]; h = (h + 1) & mep_mask)
+		if (meps[h]->br_ifindex == br_ifindex && meps[h]->instance == instance &&
+		    meps[h]->nsid == nsid)
+			return meps[h];
+
+	return NULL;
+}
+
+/* A new MEP, without its configuration */
+struct cfm_mep_state *cfm_state_mep_add(int nsid, uint32_t br_ifindex, uint32_t instance)
+{
+	struct cfm_mep_state *mep;
+	uint32_t h;
+
+	if ((!meps || 2 * (mep_count + 1) > mep_mask + 1) && cfm_state_grow())
+		return NULL;
+
+	mep = calloc(1, sizeof(*mep));
+	if (!mep)
+		return NULL;
+	mep->nsid = nsid;
+	mep->br_ifindex = br_ifindex;
+	mep->instance = instance;
+	mep->rdi = -1;
+
+	h = cfm_state_hash(nsid, br_ifindex, instance) & mep_mask;
+	while (meps[h])
+		h = (h + 1) & mep_mask;
+	meps[h] = mep;
+	mep_count++;
+
+	return mep;
+}
+
+struct cfm_mep_state *cfm_state_mep_get(int nsid, uint32_t br_ifindex, uint32_t instance)
+{
+	struct cfm_mep_state *mep;
+
+	mep = cfm_state_mep_find(nsid, br_ifindex, instance);
+	if (mep)
+		return mep;
+
+	mep = cfm_state_mep_add(nsid, br_ifindex, instance);
+	if (mep)
+		cfm_state_mep_info_load(mep);
+
+	return mep;
+}
+
+/* Take over a MEP from a snapshot dump, with its configuration if 'config'.
+ * Peers already in defect are not counted as defect events, it is not
+ * known when they went into it. Called from within the dump, so nothing
+ * else can be asked from the kernel here.
+ */
+struct cfm_mep_state *cfm_state_mep_load(int nsid, const struct cfm_mep_snapshot *snap, bool config)
+{
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	uint64_t peers, bit;
+	uint32_t w;
+
+	mep = cfm_state_mep_find(nsid, snap->info.br_ifindex, snap->info.instance);
+	if (!mep)
+		mep = cfm_state_mep_add(nsid, snap->info.br_ifindex, snap->info.instance);
+	if (!mep)
+		return NULL;
+
+	if (config) {
+		mep->info_valid = true;
+		mep->port_ifindex = snap->info.port_ifindex;
+		mep->level = snap->info.level;
+		mep->interval_ns = cfm_ccm_interval_ns(snap->info.interval);
+	}
+
+	/* By MEPID, so every peer is appended */
+	for (w = 0; w < CFM_MEPID_WORDS; ++w) {
+		peers = snap->status[w] | (config ? snap->info.peers[w] : 0);
+		while (peers) {
+			bit = __builtin_ctzll(peers);
+			peers &= peers - 1;
+
+			peer = cfm_state_peer_get(mep, w * 64 + bit);
+			if (!peer)
+				return NULL;
+			if (!peer->defect && (snap->defects[w] & (1ULL << bit))) {
+				peer->defect = true;
+				mep->defect_count++;
+				mep->dirty = true;
+			}
+		}
+	}
+
+	return mep;
+}
+
+struct state_snapshot_req {
+	cfm_state_snapshot_fn_t fn;
+	void *arg;
+	int nsid;
+};
+
+static void cfm_state_snapshot_one(const struct cfm_mep_snapshot *snap, void *arg)
+{
+	struct state_snapshot_req *req = arg;
+
+	req->fn(req->nsid, snap, req->arg);
+}
+
+/* Snapshot dump of our own namespace and every scanned one */
+int cfm_state_snapshot(bool config, cfm_state_snapshot_fn_t fn, void *arg)
+{
+	struct state_snapshot_req req = { .fn = fn, .arg = arg };
+	int nsids[CFM_NETNS_MAX + 1];
+	int i, count, err = 0;
+
+	nsids[0] = -1;
+	count = 1 + cfm_offload_netns_list(nsids + 1, CFM_NETNS_MAX);
+
+	for (i = 0; i < count && !err; ++i) {
+		req.nsid = nsids[i];
+		err = cfm_offload_netns_select(nsids[i]);
+		if (!err)
+			err = cfm_offload_mep_snapshot(config, cfm_state_snapshot_one, &req);
+		cfm_offload_netns_select(-1);
+	}
+
+	return err;
+}
+
+struct cfm_peer_state *cfm_state_peer_find(struct cfm_mep_state *mep, uint32_t mepid)
+{
+	uint32_t lo = 0, hi = mep->peer_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (mep->peers[mid].mepid == mepid)
+			return &mep->peers[mid];
+		if (mep->peers[mid].mepid < mepid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+struct cfm_peer_state *cfm_state_peer_get(struct cfm_mep_state *mep, uint32_t mepid)
+{
+	struct cfm_peer_state *peers;
+	uint32_t lo = 0, hi = mep->peer_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (mep->peers[mid].mepid == mepid)
+			return &mep->peers[mid];
+		if (mep->peers[mid].mepid < mepid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (mep->peer_count == mep->peer_size) {
+		peers = realloc(mep->peers, (mep->peer_size ? 2 * mep->peer_size : 4) *
+				sizeof(*peers));
+		if (!peers)
+			return NULL;
+		mep->peers = peers;
+		mep->peer_size = mep->peer_size ? 2 * mep->peer_size : 4;
+	}
+
+	memmove(&mep->peers[lo + 1], &mep->peers[lo],
+		(mep->peer_count - lo) * sizeof(*mep->peers));
+	memset(&mep->peers[lo], 0, sizeof(*mep->peers));
+	mep->peers[lo].mepid = mepid;
+	mep->peer_count++;
+
+	return &mep->peers[lo];
+}
+
+/* Returns true if the defect state of the peer changed */
+bool cfm_state_peer_defect(struct cfm_mep_state *mep, struct cfm_peer_state *peer,
+			   bool defect, uint64_t now)
+{
+	if (peer->defect == defect)
+		return false;
+
+	peer->defect = defect;
+	peer->last_change = now;
+	if (defect) {
+		peer->defect_events++;
+		mep->defect_count++;
+	} else {
+		mep->defect_count--;
+	}
+	mep->dirty = true;
+
+	return true;
+}
+
+void cfm_state_for_each(cfm_state_mep_fn_t fn, void *arg)
+{
+	uint32_t i;
+
+	for (i = 0; meps && i <= mep_mask; ++i)
+		if (meps[i])
+			fn(meps[i], arg);
+}
+
+uint32_t cfm_state_mep_count(void)
+{
+	return mep_count;
+}
+
+void cfm_state_uninit(void)
+{
+	uint32_t i;
+
+	for (i = 0; meps && i <= mep_mask; ++i) {
+		if (!meps[i])
+			continue;
+		free(meps[i]->peers);
+		free(meps[i]);
+	}
+	free(meps);
+	meps = NULL;
+	mep_mask = 0;
+	mep_count = 0;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_STATE_H
+#define CFM_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cfm_netlink.h"
+#include "cfm_avail.h"
+#include "cfm_damp.h"
+
+/* Kernel MEP and peer MEP state as seen by cfm_server through netlink
+ * events. MEPs are created on their first event and looked up by network
+ * namespace, bridge and instance.
+ */
+struct cfm_peer_state {
+	uint32_t mepid;
+	bool defect;
+	uint64_t defect_events;	/* Transitions into CCM defect */
+	uint64_t last_change;	/* ns, CLOCK_MONOTONIC */
+	uint32_t history_slot;	/* Sample ring + 1, 0 - not kept */
+	struct cfm_avail avail;
+	uint32_t corr_id;	/* Alarm joined last, 0 - none */
+	uint32_t corr_member;	/* Index in its members */
+	struct cfm_damp damp;
+};
+
+struct cfm_mep_state {
+	int nsid;		/* Network namespace ID, -1 - our own */
+	uint32_t br_ifindex;
+	uint32_t instance;
+
+	/* Configuration read back when the MEP was first seen */
+	bool info_valid;
+	uint32_t port_ifindex;
+	uint32_t level;
+	uint64_t interval_ns;	/* CCM interval, 0 - unknown */
+
+	/* Sorted by MEPID */
+	struct cfm_peer_state *peers;
+	uint32_t peer_count;
+	uint32_t peer_size;
+	uint32_t defect_count;	/* Peers in CCM defect */
+
+	/* Auto RDI */
+	int rdi;		/* Last RDI set, -1 - not set */
+	uint64_t rdi_sets;
+	uint64_t rdi_errors;
+	uint64_t rdi_debounced;
+	uint64_t rdi_late;	/* Set later than one CCM interval after the event */
+	uint64_t rdi_latency_max;
+
+	uint32_t shm_slot;	/* Status table slot + 1, 0 - not published */
+
+	struct cfm_avail avail;	/* Unavailable while any peer is */
+
+	bool dirty;		/* Changed by the event being handled */
+};
+
+typedef void (*cfm_state_mep_fn_t)(struct cfm_mep_state *mep, void *arg);
+typedef void (*cfm_state_snapshot_fn_t)(int nsid, const struct cfm_mep_snapshot *snap, void *arg);
+
+struct cfm_mep_state *cfm_state_mep_find(int nsid, uint32_t br_ifindex, uint32_t instance);
+struct cfm_mep_state *cfm_state_mep_add(int nsid, uint32_t br_ifindex, uint32_t instance);
+struct cfm_mep_state *cfm_state_mep_get(int nsid, uint32_t br_ifindex, uint32_t instance);
+void cfm_state_mep_info_load(struct cfm_mep_state *mep);
+struct cfm_mep_state *cfm_state_mep_load(int nsid, const struct cfm_mep_snapshot *snap, bool config);
+struct cfm_peer_state *cfm_state_peer_find(struct cfm_mep_state *mep, uint32_t mepid);
+struct cfm_peer_state *cfm_state_peer_get(struct cfm_mep_state *mep, uint32_t mepid);
+bool cfm_state_peer_defect(struct cfm_mep_state *mep, struct cfm_peer_state *peer,
+			   bool defect, uint64_t now);
+void cfm_state_for_each(cfm_state_mep_fn_t fn, void *arg);
+int cfm_state_snapshot(bool config, cfm_state_snapshot_fn_t fn, void *arg);
+uint32_t cfm_state_mep_count(void);
+void cfm_state_uninit(void);
+uint64_t cfm_state_now(void);
+
+#endif
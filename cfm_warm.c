@@ -0,0 +1,410 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cfm_warm.h"
+
+/* The state file written by cfm_server on shutdown: a header, the MEPs and
+ * then the peers of all MEPs, in MEP order and sorted by MEPID. It is only
+ * read back by the same build, on the same boot.
+ */
+#define CFM_WARM_MAGIC		0x57464d43	/* "CFMW" */
+#define CFM_WARM_VERSION	1
+#define CFM_WARM_BOOT_ID	"/proc/sys/kernel/random/boot_id"
+
+struct warm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t mep_size;
+	uint32_t peer_size;
+	uint32_t mep_count;
+	uint64_t peer_count;
+	uint64_t saved;		/* ns, CLOCK_MONOTONIC */
+	char boot_id[40];	/* CLOCK_MONOTONIC times only hold within one boot */
+};
+
+struct warm_mep {
+	int32_t nsid;
+	uint32_t br_ifindex;
+	uint32_t instance;
+	uint32_t port_ifindex;
+	uint32_t level;
+	uint32_t info_valid;
+	int32_t rdi;
+	uint32_t peer_count;
+	uint64_t interval_ns;
+	uint64_t rdi_sets;
+	uint64_t rdi_errors;
+	uint64_t rdi_debounced;
+	uint64_t rdi_late;
+	uint64_t rdi_latency_max;
+};
+
+struct warm_peer {
+	uint32_t mepid;
+	uint32_t defect;
+	uint64_t defect_events;
+	uint64_t last_change;
+};
+
+/* A peer whose defect differs between the file and the kernel */
+struct warm_change {
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	bool defect;
+};
+
+struct warm_ctx {
+	bool valid;
+	uint32_t meps;
+	struct warm_change *changes;
+	uint32_t change_count;
+	uint32_t change_size;
+};
+
+struct warm_save {
+	FILE *fp;
+	uint64_t peers;
+};
+
+static void warm_boot_id(char *id, size_t size)
+{
+	FILE *fp;
+
+	memset(id, 0, size);
+	fp = fopen(CFM_WARM_BOOT_ID, "r");
+	if (!fp)
+		return;
+	if (!fgets(id, size, fp))
+		id[0] = 0;
+	fclose(fp);
+	id[strcspn(id, "\n")] = 0;
+}
+
+static void warm_snapshot_load(int nsid, const struct cfm_mep_snapshot *snap, void *arg)
+{
+	struct warm_ctx *ctx = arg;
+	struct cfm_mep_state *mep;
+	uint32_t i;
+
+	mep = cfm_state_mep_load(nsid, snap, true);
+	if (!mep) {
+		ctx->valid = false;
+		return;
+	}
+	ctx->meps++;
+
+	/* Nothing was passed on before, damping starts from the dump */
+	for (i = 0; i < mep->peer_count; ++i)
+		mep->peers[i].damp.defect = mep->peers[i].defect;
+}
+
+/* Cold start, the state of all MEPs from one configuration and status dump */
+int cfm_warm_snapshot(void)
+{
+	struct warm_ctx ctx = { .valid = true };
+	int err;
+
+	err = cfm_state_snapshot(true, warm_snapshot_load, &ctx);
+	if (err)
+		return err;
+
+	return ctx.valid ? 0 : -ENOMEM;
+}
+
+static int warm_change_add(struct warm_ctx *ctx, struct cfm_mep_state *mep,
+			   struct cfm_peer_state *peer, bool defect)
+{
+	struct warm_change *changes;
+
+	if (ctx->change_count == ctx->change_size) {
+		changes = realloc(ctx->changes, (ctx->change_size ? 2 * ctx->change_size : 64) *
+				  sizeof(*changes));
+		if (!changes)
+			return -1;
+		ctx->changes = changes;
+		ctx->change_size = ctx->change_size ? 2 * ctx->change_size : 64;
+	}
+
+	ctx->changes[ctx->change_count].mep = mep;
+	ctx->changes[ctx->change_count].peer = peer;
+	ctx->changes[ctx->change_count].defect = defect;
+	ctx->change_count++;
+
+	return 0;
+}
+
+/* The restored MEP must still exist with exactly the same peers */
+static void warm_check(int nsid, const struct cfm_mep_snapshot *snap, void *arg)
+{
+	struct warm_ctx *ctx = arg;
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	uint32_t i, count = 0;
+	uint64_t bit;
+	bool defect;
+
+	if (!ctx->valid)
+		return;
+
+	for (i = 0; i < CFM_MEPID_WORDS; ++i)
+		count += __builtin_popcountll(snap->status[i]);
+
+	mep = cfm_state_mep_find(nsid, snap->info.br_ifindex, snap->info.instance);
+	if (!mep || mep->peer_count != count) {
+		ctx->valid = false;
+		return;
+	}
+	ctx->meps++;
+
+	for (i = 0; i < mep->peer_count; ++i) {
+		peer = &mep->peers[i];
+		bit = 1ULL << (peer->mepid % 64);
+		if (!(snap->status[peer->mepid / 64] & bit)) {
+			ctx->valid = false;
+			return;
+		}
+		defect = snap->defects[peer->mepid / 64] & bit;
+		if (defect != peer->defect && warm_change_add(ctx, mep, peer, defect)) {
+			ctx->valid = false;
+			return;
+		}
+	}
+}
+
+static int warm_restore(const struct warm_header *hdr)
+{
+	const struct warm_mep *m = (const void *)((const char *)hdr + hdr->header_size);
+	const struct warm_peer *p = (const void *)(m + hdr->mep_count);
+	uint64_t peers_left = hdr->peer_count;
+	struct cfm_mep_state *mep;
+	struct cfm_peer_state *peer;
+	uint32_t i, j;
+
+	for (i = 0; i < hdr->mep_count; ++i, ++m) {
+		if (m->peer_count > peers_left ||
+		    cfm_state_mep_find(m->nsid, m->br_ifindex, m->instance))
+			return -1;
+
+		mep = cfm_state_mep_add(m->nsid, m->br_ifindex, m->instance);
+		if (!mep)
+			return -1;
+		mep->info_valid = m->info_valid;
+		mep->port_ifindex = m->port_ifindex;
+		mep->level = m->level;
+		mep->interval_ns = m->interval_ns;
+		/* Still set in the kernel, so it is not set again */
+		mep->rdi = m->rdi;
+		mep->rdi_sets = m->rdi_sets;
+		mep->rdi_errors = m->rdi_errors;
+		mep->rdi_debounced = m->rdi_debounced;
+		mep->rdi_late = m->rdi_late;
+		mep->rdi_latency_max = m->rdi_latency_max;
+
+		if (!m->peer_count)
+			continue;
+		mep->peers = malloc(m->peer_count * sizeof(*mep->peers));
+		if (!mep->peers)
+			return -1;
+		mep->peer_size = m->peer_count;
+
+		for (j = 0; j < m->peer_count; ++j, ++p) {
+			if (p->mepid > CFM_MEPID_MAX || (j && p->mepid <= p[-1].mepid))
+				return -1;
+			peer = &mep->peers[mep->peer_count++];
+			memset(peer, 0, sizeof(*peer));
+			peer->mepid = p->mepid;
+			peer->defect = p->defect;
+			peer->defect_events = p->defect_events;
+			peer->last_change = p->last_change;
+			/* The damped state is not saved, the last raw one stands in */
+			peer->damp.defect = p->defect;
+			mep->defect_count += peer->defect;
+		}
+		peers_left -= m->peer_count;
+	}
+
+	return peers_left ? -1 : 0;
+}
+
+/* Warm restart from the state file. It is only used if the kernel still has
+ * the same MEPs and peers, the peers whose defect changed meanwhile are
+ * then passed to 'fn'. The file is removed, a crash later on must not bring
+ * back this state.
+ */
+int cfm_warm_load(const char *path, cfm_warm_peer_fn_t fn)
+{
+	struct warm_ctx ctx = { .valid = true };
+	const struct warm_header *hdr;
+	char boot_id[sizeof(hdr->boot_id)];
+	struct stat st;
+	uint64_t now;
+	uint32_t i;
+	void *map;
+	int fd, err = -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	hdr = map;
+	if (hdr->magic != CFM_WARM_MAGIC) {
+		fprintf(stderr, "%s is not a state file\n", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	warm_boot_id(boot_id, sizeof(boot_id));
+	if (hdr->version != CFM_WARM_VERSION || hdr->header_size != sizeof(*hdr) ||
+	    hdr->mep_size != sizeof(struct warm_mep) || hdr->peer_size != sizeof(struct warm_peer) ||
+	    (uint64_t)st.st_size != sizeof(*hdr) + hdr->mep_count * sizeof(struct warm_mep) +
+				    hdr->peer_count * sizeof(struct warm_peer)) {
+		fprintf(stderr, "State file %s is of another version\n", path);
+		goto out;
+	}
+	if (!boot_id[0] || strncmp(boot_id, hdr->boot_id, sizeof(boot_id))) {
+		fprintf(stderr, "State file %s is from another boot\n", path);
+		goto out;
+	}
+
+	if (warm_restore(hdr)) {
+		fprintf(stderr, "State file %s is corrupt\n", path);
+		cfm_state_uninit();
+		goto out;
+	}
+
+	/* Status only, the configuration is taken from the file */
+	if (cfm_state_snapshot(false, warm_check, &ctx) || !ctx.valid ||
+	    ctx.meps != cfm_state_mep_count()) {
+		fprintf(stderr, "State file %s is out of date\n", path);
+		cfm_state_uninit();
+		goto out;
+	}
+
+	now = cfm_state_now();
+	for (i = 0; i < ctx.change_count; ++i)
+		if (cfm_state_peer_defect(ctx.changes[i].mep, ctx.changes[i].peer,
+					  ctx.changes[i].defect, now))
+			fn(ctx.changes[i].mep, ctx.changes[i].peer, now);
+	err = 0;
+
+out:
+	free(ctx.changes);
+	munmap(map, st.st_size);
+	unlink(path);
+
+	return err;
+}
+
+static void warm_peers_count(struct cfm_mep_state *mep, void *arg)
+{
+	struct warm_save *save = arg;
+
+	save->peers += mep->peer_count;
+}
+
+static void warm_mep_save(struct cfm_mep_state *mep, void *arg)
+{
+	struct warm_save *save = arg;
+	struct warm_mep m = {
+		.nsid = mep->nsid,
+		.br_ifindex = mep->br_ifindex,
+		.instance = mep->instance,
+		.port_ifindex = mep->port_ifindex,
+		.level = mep->level,
+		.info_valid = mep->info_valid,
+		.rdi = mep->rdi,
+		.peer_count = mep->peer_count,
+		.interval_ns = mep->interval_ns,
+		.rdi_sets = mep->rdi_sets,
+		.rdi_errors = mep->rdi_errors,
+		.rdi_debounced = mep->rdi_debounced,
+		.rdi_late = mep->rdi_late,
+		.rdi_latency_max = mep->rdi_latency_max,
+	};
+
+	fwrite(&m, sizeof(m), 1, save->fp);
+}
+
+static void warm_peers_save(struct cfm_mep_state *mep, void *arg)
+{
+	struct warm_save *save = arg;
+	struct warm_peer p;
+	uint32_t i;
+
+	for (i = 0; i < mep->peer_count; ++i) {
+		memset(&p, 0, sizeof(p));
+		p.mepid = mep->peers[i].mepid;
+		p.defect = mep->peers[i].defect;
+		p.defect_events = mep->peers[i].defect_events;
+		p.last_change = mep->peers[i].last_change;
+		fwrite(&p, sizeof(p), 1, save->fp);
+	}
+}
+
+/* Written next to 'path' and renamed, so a reader sees all or nothing */
+int cfm_warm_save(const char *path)
+{
+	struct warm_save save = {};
+	struct warm_header hdr = {};
+	char tmp[PATH_MAX];
+	int err;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	save.fp = fopen(tmp, "w");
+	if (!save.fp) {
+		fprintf(stderr, "fopen %s failed: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	cfm_state_for_each(warm_peers_count, &save);
+	hdr.magic = CFM_WARM_MAGIC;
+	hdr.version = CFM_WARM_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.mep_size = sizeof(struct warm_mep);
+	hdr.peer_size = sizeof(struct warm_peer);
+	hdr.mep_count = cfm_state_mep_count();
+	hdr.peer_count = save.peers;
+	hdr.saved = cfm_state_now();
+	warm_boot_id(hdr.boot_id, sizeof(hdr.boot_id));
+
+	fwrite(&hdr, sizeof(hdr), 1, save.fp);
+	cfm_state_for_each(warm_mep_save, &save);
+	cfm_state_for_each(warm_peers_save, &save);
+
+	err = fflush(save.fp) || ferror(save.fp) || fsync(fileno(save.fp));
+	if (fclose(save.fp))
+		err = -1;
+	if (!err && rename(tmp, path))
+		err = -1;
+	if (err) {
+		fprintf(stderr, "Writing %s failed: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,19 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef CFM_WARM_H
+#define CFM_WARM_H
+
+#include <stdint.h>
+
+#include "cfm_state.h"
+
+/* Called for every peer whose defect changed while cfm_server was down */
+typedef void (*cfm_warm_peer_fn_t)(struct cfm_mep_state *mep, struct cfm_peer_state *peer,
+				   uint64_t now);
+
+int cfm_warm_snapshot(void);
+int cfm_warm_load(const char *path, cfm_warm_peer_fn_t fn);
+int cfm_warm_save(const char *path);
+
+#endif
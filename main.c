@@ -1,16 +1,25 @@
 // Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
 // SPDX-License-Identifier: (GPL-2.0)
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 #include <ev.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <net/if.h>
+#include <time.h>
 
 #include "cfm_netlink.h"
+#include "cfm_dm.h"
+#include "cfm_journal.h"
+#include "cfm_lb.h"
+#include "cfm_lt.h"
+#include "cfm_slm.h"
+#include "cfm_shm.h"
 #include "libnetlink.h"
 #include <linux/cfm_bridge.h>
 
@@ -573,6 +582,379 @@ static int cmd_mip_config_show(int argc, char *const *argv)
 	return cfm_offload_mip_config_show(br_ifindex);
 }
 
+static int cmd_dm(int argc, char *const *argv)
+{
+	struct cfm_dm_config cfg;
+	int err;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.type = CFM_DM_TYPE_DMM;
+	cfg.interval = 100;
+
+	/* Room for a session per remaining argument */
+	cfg.dmacs = calloc(argc, sizeof(*cfg.dmacs));
+	if (!cfg.dmacs)
+		return -1;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			cfg.br_ifindex = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "instance") == 0) {
+			NEXT_ARG();
+			cfg.instance = atoi(*argv);
+		} else if (strcmp(*argv, "dmac") == 0) {
+			NEXT_ARG();
+			if (strlen(*argv) != 17)	/* Must be 17 characters to be XX-XX-XX-XX-XX-XX format */
+				goto err;
+			cfg.dmacs[cfg.dmac_count++] = mac_array(*argv);
+		} else if (strcmp(*argv, "type") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "dmm") == 0)
+				cfg.type = CFM_DM_TYPE_DMM;
+			else if (strcmp(*argv, "1dm") == 0)
+				cfg.type = CFM_DM_TYPE_1DM;
+			else
+				goto err;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			cfg.interval = atoi(*argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			cfg.count = atoi(*argv);
+		} else if (strcmp(*argv, "responder") == 0) {
+			NEXT_ARG();
+			cfg.responder = atoi(*argv);
+		} else
+			goto err;
+
+		argc--; argv++;
+	}
+
+	if (cfg.br_ifindex == 0 || cfg.instance == 0 || cfg.interval == 0)
+		goto err;
+
+	err = cfm_dm_run(&cfg);
+	free(cfg.dmacs);
+	return err;
+
+err:
+	free(cfg.dmacs);
+	return -1;
+}
+
+static int cmd_lt(int argc, char *const *argv)
+{
+	struct cfm_lt_config cfg;
+	int err;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.ttl = 64;
+	cfg.timeout = 5000;
+
+	/* Room for a trace per remaining argument */
+	cfg.dmacs = calloc(argc, sizeof(*cfg.dmacs));
+	if (!cfg.dmacs)
+		return -1;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			cfg.br_ifindex = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "instance") == 0) {
+			NEXT_ARG();
+			cfg.instance = atoi(*argv);
+		} else if (strcmp(*argv, "dmac") == 0) {
+			NEXT_ARG();
+			if (strlen(*argv) != 17)	/* Must be 17 characters to be XX-XX-XX-XX-XX-XX format */
+				goto err;
+			cfg.dmacs[cfg.dmac_count++] = mac_array(*argv);
+		} else if (strcmp(*argv, "peers") == 0) {
+			NEXT_ARG();
+			cfg.peers = atoi(*argv);
+		} else if (strcmp(*argv, "ttl") == 0) {
+			NEXT_ARG();
+			cfg.ttl = atoi(*argv);
+		} else if (strcmp(*argv, "timeout") == 0) {
+			NEXT_ARG();
+			cfg.timeout = atoi(*argv);
+		} else if (strcmp(*argv, "fdb-only") == 0) {
+			NEXT_ARG();
+			cfg.fdb_only = atoi(*argv);
+		} else if (strcmp(*argv, "responder") == 0) {
+			NEXT_ARG();
+			cfg.responder = atoi(*argv);
+		} else
+			goto err;
+
+		argc--; argv++;
+	}
+
+	if (cfg.br_ifindex == 0 || cfg.instance == 0 || cfg.timeout == 0)
+		goto err;
+
+	err = cfm_lt_run(&cfg);
+	free(cfg.dmacs);
+	return err;
+
+err:
+	free(cfg.dmacs);
+	return -1;
+}
+
+static int cmd_slm(int argc, char *const *argv)
+{
+	struct cfm_slm_config cfg;
+	int err;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.interval = 100;
+	cfg.window = 1000;
+
+	/* Room for a session per remaining argument */
+	cfg.dmacs = calloc(argc, sizeof(*cfg.dmacs));
+	if (!cfg.dmacs)
+		return -1;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			cfg.br_ifindex = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "instance") == 0) {
+			NEXT_ARG();
+			cfg.instance = atoi(*argv);
+		} else if (strcmp(*argv, "dmac") == 0) {
+			NEXT_ARG();
+			if (strlen(*argv) != 17)	/* Must be 17 characters to be XX-XX-XX-XX-XX-XX format */
+				goto err;
+			cfg.dmacs[cfg.dmac_count++] = mac_array(*argv);
+		} else if (strcmp(*argv, "test-id") == 0) {
+			NEXT_ARG();
+			cfg.test_id = strtoul(*argv, NULL, 0);
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			cfg.interval = atoi(*argv);
+		} else if (strcmp(*argv, "window") == 0) {
+			NEXT_ARG();
+			cfg.window = atoi(*argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			cfg.count = atoi(*argv);
+		} else if (strcmp(*argv, "responder") == 0) {
+			NEXT_ARG();
+			cfg.responder = atoi(*argv);
+		} else
+			goto err;
+
+		argc--; argv++;
+	}
+
+	if (cfg.br_ifindex == 0 || cfg.instance == 0 || cfg.interval == 0 || cfg.window == 0)
+		goto err;
+
+	err = cfm_slm_run(&cfg);
+	free(cfg.dmacs);
+	return err;
+
+err:
+	free(cfg.dmacs);
+	return -1;
+}
+
+static int cmd_lb(int argc, char *const *argv)
+{
+	struct cfm_lb_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.rate = 1;
+	cfg.count = 5;
+	cfg.burst = 32;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			cfg.br_ifindex = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "instance") == 0) {
+			NEXT_ARG();
+			cfg.instance = atoi(*argv);
+		} else if (strcmp(*argv, "dmac") == 0) {
+			NEXT_ARG();
+			if (strlen(*argv) != 17)	/* Must be 17 characters to be XX-XX-XX-XX-XX-XX format */
+				return -1;
+			cfg.dmac = mac_array(*argv);
+			cfg.initiator = true;
+		} else if (strcmp(*argv, "rate") == 0) {
+			NEXT_ARG();
+			cfg.rate = atoi(*argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			cfg.count = atoi(*argv);
+		} else if (strcmp(*argv, "size") == 0) {
+			NEXT_ARG();
+			cfg.size = atoi(*argv);
+		} else if (strcmp(*argv, "burst") == 0) {
+			NEXT_ARG();
+			cfg.burst = atoi(*argv);
+		} else if (strcmp(*argv, "responder") == 0) {
+			NEXT_ARG();
+			cfg.responder = atoi(*argv);
+		} else
+			return -1;
+
+		argc--; argv++;
+	}
+
+	if (cfg.br_ifindex == 0 || cfg.instance == 0)
+		return -1;
+
+	return cfm_lb_run(&cfg);
+}
+
+static uint64_t journal_time_parse(const char *arg)
+{
+	struct tm tm;
+	char *end;
+
+	/* Seconds since the epoch, or local time as 2020-01-31T12:00:00 */
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+	if (end && !*end) {
+		tm.tm_isdst = -1;
+		return mktime(&tm) * 1000000ULL;
+	}
+
+	return strtoull(arg, NULL, 0) * 1000000ULL;
+}
+
+static int cmd_journal_show(int argc, char *const *argv)
+{
+	struct cfm_journal_query q = {
+		.nsid = -1,
+		.to = UINT64_MAX,
+	};
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dir") == 0) {
+			NEXT_ARG();
+			q.dir = *argv;
+		} else if (strcmp(*argv, "netns") == 0) {
+			NEXT_ARG();
+			q.nsid = atoi(*argv);
+		} else if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			/* Bridges of other namespaces are given by ifindex */
+			q.br_ifindex = if_nametoindex(*argv);
+			if (!q.br_ifindex)
+				q.br_ifindex = atoi(*argv);
+		} else if (strcmp(*argv, "instance") == 0) {
+			NEXT_ARG();
+			q.instance = atoi(*argv);
+		} else if (strcmp(*argv, "peer") == 0) {
+			NEXT_ARG();
+			q.mepid = atoi(*argv);
+		} else if (strcmp(*argv, "from") == 0) {
+			NEXT_ARG();
+			q.from = journal_time_parse(*argv);
+		} else if (strcmp(*argv, "to") == 0) {
+			NEXT_ARG();
+			q.to = journal_time_parse(*argv);
+		} else
+			return -1;
+
+		argc--; argv++;
+	}
+
+	if (!q.dir || q.br_ifindex == 0)
+		return -1;
+
+	return cfm_journal_show(&q);
+}
+
+static int cmd_server_status_show(int argc, char *const *argv)
+{
+	const struct cfm_shm_header *hdr;
+	struct cfm_shm_header head;
+	struct cfm_shm_mep mep;
+	uint32_t br_ifindex = 0, i, p, count;
+	int nsid = -1, err = 0;
+	bool all_netns = true;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			br_ifindex = if_nametoindex(*argv);
+			all_netns = false;
+		} else if (strcmp(*argv, "netns") == 0) {
+			NEXT_ARG();
+			nsid = atoi(*argv);
+			all_netns = false;
+		} else
+			return -1;
+
+		argc--; argv++;
+	}
+
+	hdr = cfm_shm_map();
+	if (!hdr) {
+		fprintf(stderr, "No status table, is cfm_server running with --shm?\n");
+		return -1;
+	}
+	if (!cfm_shm_header_read(hdr, &head)) {
+		cfm_shm_unmap(hdr);
+		return -1;
+	}
+
+	printf("CFM server status (updates %" PRIu64 "):\n", head.updates);
+	for (i = 0; i < CFM_SHM_MEPS_MAX && cfm_shm_mep_read(hdr, i, &mep); ++i) {
+		if (br_ifindex && mep.br_ifindex != br_ifindex)
+			continue;
+		if (!all_netns && mep.nsid != nsid)
+			continue;
+
+		if (mep.nsid >= 0)
+			printf("Netns %d ", mep.nsid);
+		printf("Bridge %u instance %u\n", mep.br_ifindex, mep.instance);
+		printf("    Port %u level %u RDI %d\n", mep.port_ifindex, mep.level, mep.rdi);
+		printf("    Peers %u in defect %u\n", mep.peer_count, mep.defect_count);
+		count = mep.peer_count < CFM_SHM_PEERS_MAX ? mep.peer_count : CFM_SHM_PEERS_MAX;
+		for (p = 0; p < count; ++p)
+			printf("    Peer-mep %u CCM defect %u defects %" PRIu64 "\n",
+			       mep.peers[p].mepid, mep.peers[p].defect, mep.peers[p].defect_events);
+		printf("\n");
+	}
+	if (i < __atomic_load_n(&hdr->mep_count, __ATOMIC_ACQUIRE)) {
+		fprintf(stderr, "Status of MEP %u kept changing\n", i);
+		err = -1;
+	}
+
+	cfm_shm_unmap(hdr);
+	return err;
+}
+
 struct command
 {
 	const char *name;
@@ -620,6 +1002,37 @@ static const struct command commands[] =
 	 "Configure MIP instance"},
 	{"mip-config-show", cmd_mip_config_show,
 	 "bridge <bridge>", "Show MIP instances configuration"},
+	{"dm", cmd_dm,
+	 "bridge <bridge> instance <instance> dmac <dmac> [dmac <dmac> ...] type <type>\n"
+	 "                    interval <interval> count <count> responder <responder>\n"
+	 "                    Parameter 'type' is dmm - 1dm. Parameter 'interval' is in ms (default 100).\n"
+	 "                    A 'count' of 0 runs until interrupted.",
+	 "Run Y.1731 delay measurement sessions from a MEP instance"},
+	{"lb", cmd_lb,
+	 "bridge <bridge> instance <instance> dmac <dmac> rate <rate> count <count> size <size>\n"
+	 "                    burst <burst> responder <responder>\n"
+	 "                    Parameter 'rate' is LBMs per second (default 1), 0 sends as fast as possible.\n"
+	 "                    A 'count' of 0 runs until interrupted (default 5).",
+	 "Run loopback from a MEP instance"},
+	{"lt", cmd_lt,
+	 "bridge <bridge> instance <instance> dmac <dmac> [dmac <dmac> ...] peers <peers>\n"
+	 "                    ttl <ttl> timeout <timeout> fdb-only <fdb-only> responder <responder>\n"
+	 "                    'peers 1' also traces to every peer MEP of the instance.\n"
+	 "                    Parameter 'timeout' is in ms (default 5000), 'ttl' defaults to 64.",
+	 "Run linktrace from a MEP instance"},
+	{"journal-show", cmd_journal_show,
+	 "dir <dir> [netns <nsid>] bridge <bridge> [instance <instance>] [peer <mepid>]\n"
+	 "                    [from <time>] [to <time>]\n"
+	 "                    A 'time' is seconds since the epoch or local time as 2020-01-31T12:00:00.",
+	 "Show the peer MEP history in a cfm_server --journal directory"},
+	{"server-status-show", cmd_server_status_show,
+	 "[netns <nsid>] [bridge <bridge>]", "Show the MEP status published by cfm_server --shm"},
+	{"slm", cmd_slm,
+	 "bridge <bridge> instance <instance> dmac <dmac> [dmac <dmac> ...] test-id <test-id>\n"
+	 "                    interval <interval> window <window> count <count> responder <responder>\n"
+	 "                    Sessions use consecutive test IDs. 'interval' and 'window' are in ms.\n"
+	 "                    A 'count' of 0 runs until interrupted.",
+	 "Run Y.1731 synthetic loss measurement sessions from a MEP instance"},
 };
 
 static void command_helpall(void)